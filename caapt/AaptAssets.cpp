@@ -60,10 +60,7 @@ static bool validateFileName(const char* fileName)
 // The default to use if no other ignore pattern is defined.
 const char * const gDefaultIgnoreAssets =
     "!.svn:!.git:!.ds_store:!*.scc:.*:<dir>_*:!CVS:!thumbs.db:!picasa.ini:!*~";
-// The ignore pattern that can be passed via --ignore-assets in Main.cpp
-const char * gUserIgnoreAssets = NULL;
-
-static bool isHidden(const char *root, const char *path)
+static bool isHidden(const Bundle* bundle, const char *root, const char *path)
 {
     // Patterns syntax:
     // - Delimiter is :
@@ -83,7 +80,8 @@ static bool isHidden(const char *root, const char *path)
     }
 
     const char *delim = ":";
-    const char *p = gUserIgnoreAssets;
+    // The pattern passed via --ignore-assets wins over the environment.
+    const char *p = bundle != NULL ? bundle->getIgnoreAssets() : NULL;
     if (!p || !p[0]) {
         p = getenv("ANDROID_AAPT_IGNORE");
     }
@@ -529,6 +527,36 @@ void AaptFile::clearData()
     mBufferSize = 0;
 }
 
+void AaptFile::adoptData(void* data, size_t size)
+{
+    clearData();
+    mData = data;
+    mDataSize = size;
+    mBufferSize = size;
+}
+
+const void* AaptFile::mapSourceFile(size_t* outSize) const
+{
+    if (mSourceMap == NULL) {
+        size_t size;
+        const void* map = AaptUtil::mapFile(mSourceFile.string(), &size);
+        if (map == NULL) {
+            return NULL;
+        }
+        mSourceMap = map;
+        mSourceMapSize = size;
+    }
+    *outSize = mSourceMapSize;
+    return mSourceMap;
+}
+
+void AaptFile::unmapSourceFile() const
+{
+    AaptUtil::unmapFile(mSourceMap, mSourceMapSize);
+    mSourceMap = NULL;
+    mSourceMapSize = 0;
+}
+
 String8 AaptFile::getPrintableSource() const
 {
     if (hasData()) {
@@ -701,7 +729,7 @@ ssize_t AaptDir::slurpFullTree(Bundle* bundle, const String8& srcDir,
             if (entry == NULL)
                 break;
 
-            if (isHidden(srcDir.string(), entry->d_name))
+            if (isHidden(bundle, srcDir.string(), entry->d_name))
                 continue;
 
             String8 name(entry->d_name);
@@ -1173,7 +1201,7 @@ ssize_t AaptAssets::slurpResourceTree(Bundle* bundle, const String8& srcDir)
             break;
         }
 
-        if (isHidden(srcDir.string(), entry->d_name)) {
+        if (isHidden(bundle, srcDir.string(), entry->d_name)) {
             continue;
         }
 
@@ -1302,8 +1330,12 @@ AaptAssets::slurpResourceZip(Bundle* bundle, const char* filename)
 
         size_t len = entry->getUncompressedLen();
         void* data = zip->uncompress(entry);
-        void* buf = file->editData(len);
-        memcpy(buf, data, len);
+        if (data == NULL) {
+            fprintf(stderr, "err=unable to uncompress entryName=%s\n", entryName.string());
+            count = UNKNOWN_ERROR;
+            goto bail;
+        }
+        file->adoptData(data, len);
 
 #if 0
         const int OFF = 0;
@@ -1320,8 +1352,6 @@ AaptAssets::slurpResourceZip(Bundle* bundle, const char* filename)
         }
 #endif
 
-        free(data);
-
         count++;
     }
 
@@ -1548,6 +1578,20 @@ status_t AaptAssets::buildIncludedResources(Bundle* bundle)
         return NO_ERROR;
     }
 
+    // Reuse the include set another AaptAssets already parsed, rather
+    // than opening and parsing every package again.
+    ResTable* shared = bundle->getSharedIncludedResources();
+    if (shared != NULL) {
+        status_t err = editIncludedResources().add(shared);
+        if (err != NO_ERROR) {
+            fprintf(stderr, "ERROR: unable to reuse shared included resources.\n");
+            return err;
+        }
+        mIncludedIndex = bundle->getSharedIncludedIndex();
+        mHaveIncludedAssets = true;
+        return NO_ERROR;
+    }
+
     // Add in all includes.
     const Vector<String8>& includes = bundle->getPackageIncludes();
     const size_t packageIncludeCount = includes.size();
@@ -1577,6 +1621,16 @@ status_t AaptAssets::buildIncludedResources(Bundle* bundle)
         }
     }
 
+    if (bundle->getIncludeIndexCacheDir() != NULL) {
+        Vector<String8> paths(includes);
+        if (!featureOfBase.isEmpty()) {
+            paths.add(featureOfBase);
+        }
+        // Without an index, names are looked up in the ResTable as usual.
+        mIncludedIndex = IncludedResIndex::load(paths,
+                String8(bundle->getIncludeIndexCacheDir()), bundle->getVerbose());
+    }
+
     mHaveIncludedAssets = true;
 
     return NO_ERROR;
@@ -1584,9 +1638,13 @@ status_t AaptAssets::buildIncludedResources(Bundle* bundle)
 
 status_t AaptAssets::addIncludedResources(const sp<AaptFile>& file)
 {
-    const ResTable& res = getIncludedResources();
-    // XXX dirty!
-    return const_cast<ResTable&>(res).add(file->getData(), file->getSize());
+    if (mIncludedIndex != NULL && IncludedResIndex::getPackages(file->getData(),
+            file->getSize(), &mAddedPackageIds, &mAddedPackageNames) != NO_ERROR) {
+        // These join the included packages with the same ID or name; if
+        // we can't tell which, stop using the index.
+        mIncludedIndex = NULL;
+    }
+    return editIncludedResources().add(file->getData(), file->getSize());
 }
 
 const ResTable& AaptAssets::getIncludedResources() const
@@ -1594,11 +1652,45 @@ const ResTable& AaptAssets::getIncludedResources() const
     return mIncludedAssets.getResources(false);
 }
 
+ResTable& AaptAssets::editIncludedResources()
+{
+    // AssetManager only hands its table out as const, but it is ours:
+    // nothing else holds the AssetManager.
+    return const_cast<ResTable&>(mIncludedAssets.getResources(false));
+}
+
 AssetManager& AaptAssets::getAssetManager()
 {
     return mIncludedAssets;
 }
 
+uint32_t AaptAssets::identifierForName(const char16_t* name, size_t nameLen,
+                                       const char16_t* type, size_t typeLen,
+                                       const char16_t* package, size_t packageLen,
+                                       uint32_t* outTypeSpecFlags) const
+{
+    // The index only knows plain names in an explicit package and type;
+    // "@", "^", "package:" and "type/" forms are the ResTable's to parse.
+    uint32_t packageId;
+    bool indexed = mIncludedIndex != NULL && type != NULL && package != NULL
+            && nameLen > 0 && name[0] != '@' && name[0] != '^'
+            && mIncludedIndex->hasPackage(package, packageLen, &packageId);
+    for (size_t i = 0; indexed && i < nameLen; i++) {
+        indexed = name[i] != ':' && name[i] != '/';
+    }
+    for (size_t i = 0; indexed && i < mAddedPackageIds.size(); i++) {
+        indexed = mAddedPackageIds[i] != packageId
+                && strzcmp16(package, packageLen, mAddedPackageNames[i].string(),
+                        mAddedPackageNames[i].size()) != 0;
+    }
+    if (indexed) {
+        return mIncludedIndex->identifierForName(name, nameLen, type, typeLen,
+                package, packageLen, outTypeSpecFlags);
+    }
+    return getIncludedResources().identifierForName(name, nameLen, type, typeLen,
+            package, packageLen, outTypeSpecFlags);
+}
+
 void AaptAssets::print(const String8& prefix) const
 {
     String8 innerPrefix(prefix);
@@ -19,13 +19,13 @@
 #include "AaptConfig.h"
 #include "Bundle.h"
 #include "ConfigDescription.h"
+#include "IncludedResIndex.h"
 #include "SourcePos.h"
 #include "ZipFile.h"
 
 using namespace android;
 
 extern const char * const gDefaultIgnoreAssets;
-extern const char * gUserIgnoreAssets;
 
 bool valid_symbol_name(const String8& str);
 
@@ -155,12 +155,15 @@ public:
         , mData(NULL)
         , mDataSize(0)
         , mBufferSize(0)
+        , mSourceMap(NULL)
+        , mSourceMapSize(0)
         , mCompression(ZipEntry::kCompressStored)
         {
             //printf("new AaptFile created %s\n", (const char*)sourceFile);
         }
     virtual ~AaptFile() {
         free(mData);
+        unmapSourceFile();
     }
 
     const String8& getPath() const { return mPath; }
@@ -177,6 +180,9 @@ public:
     void* padData(size_t wordSize);
     status_t writeData(const void* data, size_t size);
     void clearData();
+    // Take ownership of a malloc()ed buffer as the file's data, instead
+    // of copying it in with writeData().
+    void adoptData(void* data, size_t size);
 
     const String8& getResourceType() const { return mResourceType; }
 
@@ -186,6 +192,13 @@ public:
 
     String8 getPrintableSource() const;
 
+    // Read-only view of the source file's contents, mapped into memory
+    // rather than read.  Stays valid until unmapSourceFile() or the
+    // AaptFile goes away; returns NULL (with errno set) on failure.  The
+    // attached data, if any, is neither used nor changed.
+    const void* mapSourceFile(size_t* outSize) const;
+    void unmapSourceFile() const;
+
     // Desired compression method, as per utils/ZipEntry.h.  For example,
     // no compression is ZipEntry::kCompressStored.
     int getCompressionMethod() const { return mCompression; }
@@ -200,6 +213,8 @@ private:
     void* mData;
     size_t mDataSize;
     size_t mBufferSize;
+    mutable const void* mSourceMap;
+    mutable size_t mSourceMapSize;
     int mCompression;
 };
 
@@ -564,8 +579,20 @@ public:
     status_t buildIncludedResources(Bundle* bundle);
     status_t addIncludedResources(const sp<AaptFile>& file);
     const ResTable& getIncludedResources() const;
+    /* the included table, to extend or to share with another AaptAssets */
+    ResTable& editIncludedResources();
     AssetManager& getAssetManager();
 
+    /*
+     * getIncludedResources().identifierForName(), answered from the
+     * --include-index-cache index when it covers the package.
+     */
+    uint32_t identifierForName(const char16_t* name, size_t nameLen,
+                               const char16_t* type, size_t typeLen,
+                               const char16_t* package, size_t packageLen,
+                               uint32_t* outTypeSpecFlags = NULL) const;
+    const sp<IncludedResIndex>& getIncludedIndex() const { return mIncludedIndex; }
+
     void print(const String8& prefix) const;
 
     inline const Vector<sp<AaptDir> >& resDirs() const { return mResDirs; }
@@ -611,6 +638,10 @@ private:
 
     bool mHaveIncludedAssets;
     AssetManager mIncludedAssets;
+    sp<IncludedResIndex> mIncludedIndex;
+    // packages added by addIncludedResources(), which the index can't see
+    Vector<uint32_t> mAddedPackageIds;
+    Vector<String16> mAddedPackageNames;
 
     sp<AaptAssets> mOverlay;
     KeyedVector<String8, sp<ResourceTypeSet> >* mRes;
@@ -16,6 +16,25 @@
 
 #include "AaptUtil.h"
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef HAVE_MS_C_RUNTIME
+#include <sys/utime.h>
+#else
+#include <sys/mman.h>
+#include <utime.h>
+#endif
+
+#ifndef HAVE_MS_C_RUNTIME
+#define O_BINARY 0
+#endif
+
 using android::Vector;
 using android::String8;
 
@@ -61,4 +80,143 @@ Vector<String8> splitAndLowerCase(const String8& str, const char sep) {
     return parts;
 }
 
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+    const unsigned char* p = (const unsigned char*) data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool hashFile(const String8& path, uint64_t* outHash, off_t* outSize) {
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    uint64_t hash = kHashSeed;
+    off_t size = 0;
+    unsigned char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        hash = hashBytes(buf, n, hash);
+        size += n;
+    }
+    bool failed = ferror(fp) != 0;
+    fclose(fp);
+    if (failed) {
+        return false;
+    }
+    *outHash = hash;
+    *outSize = size;
+    return true;
+}
+
+// mmap() can't map an empty file; this stands in for one.
+static char sEmptyMap[1];
+
+const void* mapFile(const char* path, size_t* outSize) {
+    int fd = open(path, O_RDONLY | O_BINARY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        return NULL;
+    }
+
+    size_t size = (size_t) st.st_size;
+    void* map = sEmptyMap;
+    if (size > 0) {
+#ifdef HAVE_MS_C_RUNTIME
+        // no mmap(); read it in one go instead
+        map = malloc(size);
+        if (map != NULL && read(fd, map, size) != (ssize_t) size) {
+            free(map);
+            map = NULL;
+            errno = EIO;
+        }
+#else
+        map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+        }
+#endif
+    }
+    int err = errno;
+    close(fd);
+    if (map == NULL) {
+        errno = err;
+        return NULL;
+    }
+    *outSize = size;
+    return map;
+}
+
+void unmapFile(const void* data, size_t size) {
+    if (data == NULL || data == sEmptyMap) {
+        return;
+    }
+#ifdef HAVE_MS_C_RUNTIME
+    free((void*) data);
+#else
+    munmap((void*) data, size);
+#endif
+}
+
+bool parseCompressionLevel(const char* str, int* level) {
+    char* end;
+    long val = strtol(str, &end, 10);
+    if (*str == '\0' || *end != '\0' || val < 0 || val > 9) {
+        return false;
+    }
+    *level = (int) val;
+    return true;
+}
+
+void pruneCacheDir(const String8& dir, time_t maxAge, time_t interval) {
+    const time_t now = time(NULL);
+    String8 stamp(dir);
+    stamp.appendPath(".pruned");
+    struct stat st;
+    if (stat(stamp.string(), &st) == 0 && now - st.st_mtime < interval) {
+        return;
+    }
+
+    // Claim this round first, so that processes sharing the directory
+    // don't all scan it.
+    FILE* fp = fopen(stamp.string(), "wb");
+    if (fp == NULL) {
+        return;
+    }
+    fclose(fp);
+    touchCacheEntry(stamp);
+
+    DIR* d = opendir(dir.string());
+    if (d == NULL) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        String8 path(dir);
+        path.appendPath(entry->d_name);
+        if (stat(path.string(), &st) == 0 && S_ISREG(st.st_mode)
+                && now - st.st_mtime > maxAge) {
+            unlink(path.string());
+        }
+    }
+    closedir(d);
+}
+
+void touchCacheEntry(const String8& path) {
+    // Failing only means the entry may be pruned sooner.
+    utime(path.string(), NULL);
+}
+
 } // namespace AaptUtil
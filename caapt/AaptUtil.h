@@ -20,11 +20,79 @@
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
 namespace AaptUtil {
 
 android::Vector<android::String8> split(const android::String8& str, const char sep);
 android::Vector<android::String8> splitAndLowerCase(const android::String8& str, const char sep);
 
+/*
+ * Parses the argument of --compression-level: a zlib level from 0 to 9,
+ * with nothing else in the string.  Returns false if "str" isn't one.
+ */
+bool parseCompressionLevel(const char* str, int* level);
+
+/*
+ * 64-bit FNV-1a, which the caches name and key their entries by.  Pass a
+ * previous result as "hash" to carry on over more data.
+ */
+const uint64_t kHashSeed = 14695981039346656037ULL;
+uint64_t hashBytes(const void* data, size_t size, uint64_t hash = kHashSeed);
+
+/*
+ * hashBytes() over the whole file at "path", and its size.  Returns false
+ * if it can't be read.
+ */
+bool hashFile(const android::String8& path, uint64_t* outHash, off_t* outSize);
+
+/*
+ * The whole of the file at "path", read-only: mmap()ed, or read into a
+ * buffer where there's no mmap().  An empty file gives a non-NULL pointer
+ * and a size of 0.  Returns NULL, with errno set, if it can't be read.
+ * Release it with unmapFile().
+ */
+const void* mapFile(const char* path, size_t* outSize);
+void unmapFile(const void* data, size_t size);
+
+/*
+ * A source file's modification time and size, and when it was last read,
+ * so a cache can tell it hasn't changed without reading it again.
+ * st_mtime only has seconds: a file modified in the second it was read
+ * may change again without its time changing, so such a stamp is never
+ * trusted.
+ */
+struct FileStamp {
+    FileStamp() : modTime(0), size(0), checkedAt(0) { }
+    FileStamp(const struct stat& st, time_t _checkedAt)
+        : modTime(st.st_mtime), size(st.st_size), checkedAt(_checkedAt) { }
+
+    /* whether the file's content can be remembered under this stamp */
+    bool trusted() const { return modTime < checkedAt; }
+
+    /* whether a file with stat "st" is still what was read */
+    bool matches(const struct stat& st) const {
+        return trusted() && modTime == st.st_mtime && size == st.st_size;
+    }
+
+    time_t modTime;
+    off_t size;
+    time_t checkedAt;
+};
+
+/*
+ * The on-disk caches keep one file per entry in a directory of their own,
+ * and touch an entry whenever they use it.  pruneCacheDir() deletes the
+ * files in "dir" that haven't been used for "maxAge" seconds; it only
+ * scans the directory once every "interval" seconds, going by the time
+ * on a stamp file it keeps there.
+ */
+void pruneCacheDir(const android::String8& dir, time_t maxAge, time_t interval);
+void touchCacheEntry(const android::String8& path);
+
 } // namespace AaptUtil
 
 #endif // __AAPT_UTIL_H
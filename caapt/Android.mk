@@ -32,8 +32,11 @@ aaptSources := \
     ApkBuilder.cpp \
     Command.cpp \
     CrunchCache.cpp \
+    DeflateCache.cpp \
     FileFinder.cpp \
+    IncludedResIndex.cpp \
     Package.cpp \
+    StringAtoms.cpp \
     StringPool.cpp \
     XMLNode.cpp \
     ResourceFilter.cpp \
@@ -44,16 +47,35 @@ aaptSources := \
     pseudolocalize.cpp \
     SourcePos.cpp \
     WorkQueue.cpp \
+    XmlCompileCache.cpp \
     ZipEntry.cpp \
     ZipFile.cpp \
     RMerge.cpp \
+    RClassWriter.cpp \
+    RSymbolIndex.cpp \
     qsort_r_compat.c
 
 
 aaptTests := \
     tests/AaptConfig_test.cpp \
     tests/AaptGroupEntry_test.cpp \
-    tests/ResourceFilter_test.cpp
+    tests/CrunchCache_test.cpp \
+    tests/Images_test.cpp \
+    tests/IncludedResIndex_test.cpp \
+    tests/Package_test.cpp \
+    tests/RClassWriter_test.cpp \
+    tests/RMerge_test.cpp \
+    tests/RSymbolIndex_test.cpp \
+    tests/ResourceFilter_test.cpp \
+    tests/ResourceIdCache_test.cpp \
+    tests/ResourceTable_test.cpp \
+    tests/StringAtoms_test.cpp \
+    tests/StringPool_test.cpp \
+    tests/XmlCompileCache_test.cpp \
+    tests/ZipFile_test.cpp
+
+aaptPerfTests := \
+    tests/Perf_test.cpp
 
 aaptCIncludes := \
     external/libpng \
@@ -131,7 +153,28 @@ include $(CLEAR_VARS)
 LOCAL_MODULE := libaapt_tests
 
 LOCAL_SRC_FILES += $(aaptTests)
-LOCAL_C_INCLUDES += $(LOCAL_PATH)
+LOCAL_C_INCLUDES += $(LOCAL_PATH) $(aaptCIncludes)
+
+LOCAL_STATIC_LIBRARIES += \
+    libaapt \
+    $(aaptHostStaticLibs)
+
+LOCAL_LDLIBS += $(aaptHostLdLibs)
+LOCAL_CFLAGS += $(aaptCFlags)
+
+include $(BUILD_HOST_NATIVE_TEST)
+
+
+# ==========================================================
+# Build the host timings: aapt_perf_tests
+# ==========================================================
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := aapt_perf_tests
+LOCAL_MODULE_TAGS := optional
+
+LOCAL_SRC_FILES += $(aaptPerfTests)
+LOCAL_C_INCLUDES += $(LOCAL_PATH) $(aaptCIncludes)
 
 LOCAL_STATIC_LIBRARIES += \
     libaapt \
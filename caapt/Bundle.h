@@ -14,6 +14,11 @@
 #include <utils/String8.h>
 #include <utils/Vector.h>
 
+namespace android {
+class ResTable;
+}
+class IncludedResIndex;
+
 enum {
     SDK_CUPCAKE = 3,
     SDK_DONUT = 4,
@@ -40,9 +45,44 @@ typedef enum Command {
     kCommandPackage,
     kCommandCrunch,
     kCommandSingleCrunch,
-    kCommandDaemon
+    kCommandDaemon,
+    kCommandBatch
 } Command;
 
+/*
+ * zlib compression levels for --compression-level and --fast.  The
+ * default is Z_BEST_COMPRESSION, which release builds rely on.
+ */
+enum {
+    kFastCompressionLevel = 1,
+    kDefaultCompressionLevel = 9,
+};
+
+/*
+ * The package XML attributes are looked for in when their namespace's
+ * package doesn't define them, unless --attr-fallback-package says
+ * otherwise.
+ */
+static const char* const kDefaultAttrFallbackPackage = "ctrip.android.view";
+
+/*
+ * Milliseconds --png-search may spend on one image before it settles for
+ * the smallest encoding found so far.
+ */
+enum {
+    kDefaultPngSearchBudget = 2000,
+};
+
+/*
+ * When preProcessImage() may keep a PNG's original bytes instead of the
+ * re-encoded ones (--png-passthrough).
+ */
+typedef enum PngPassthrough {
+    PNG_PASSTHROUGH_NEVER = 0,  // always use the re-encoded image
+    PNG_PASSTHROUGH_LARGER,     // keep the original if re-encoding doesn't shrink it
+    PNG_PASSTHROUGH_OPTIMIZED,  // also skip decoding images whose headers say they can't shrink
+} PngPassthrough;
+
 /*
  * Pseudolocalization methods
  */
@@ -63,19 +103,26 @@ public:
           mUpdate(false), mExtending(false),
           mRequireLocalization(false), mPseudolocalize(NO_PSEUDOLOCALIZATION),
           mWantUTF16(false), mValues(false), mIncludeMetaData(false),
-          mCompressionMethod(0), mJunkPath(false), mOutputAPKFile(NULL),
+          mCompressionMethod(0), mCompressionLevel(kDefaultCompressionLevel),
+          mPngPassthrough(PNG_PASSTHROUGH_NEVER),
+          mPngSearch(false), mPngSearchBudget(kDefaultPngSearchBudget),
+          mJunkPath(false), mOutputAPKFile(NULL),
           mManifestPackageNameOverride(NULL), mInstrumentationPackageNameOverride(NULL),
           mAutoAddOverlay(false), mGenDependencies(false),
-          mCrunchedOutputDir(NULL), mProguardFile(NULL),
+          mCrunchedOutputDir(NULL), mCompressionCacheDir(NULL), mIncludeIndexCacheDir(NULL),
+          mCompiledXmlCacheDir(NULL), mIgnoreAssets(NULL),
+          mProguardFile(NULL),
           mAndroidManifestFile(NULL), mPublicOutputFile(NULL),
           mRClassDir(NULL), mResourceIntermediatesDir(NULL), mManifestMinSdkVersion(NULL),
           mMinSdkVersion(NULL), mTargetSdkVersion(NULL), mMaxSdkVersion(NULL),
           mVersionCode(NULL), mVersionName(NULL), mReplaceVersion(false), mCustomPackage(NULL),
-          mExtraPackages(NULL), mMaxResVersion(NULL), mDebugMode(false), mNonConstantId(false),
+          mExtraPackages(NULL), mMaxResVersion(NULL), mAttrFallbackPackage(kDefaultAttrFallbackPackage),
+          mDebugMode(false), mNonConstantId(false),
           mProduct(NULL), mUseCrunchCache(false), mErrorOnFailedInsert(false),
-          mErrorOnMissingConfigEntry(false), mOutputTextSymbols(NULL),
+          mErrorOnMissingConfigEntry(false), mOutputTextSymbols(NULL), mOutputRJar(NULL),
           mSingleCrunchInputFile(NULL), mSingleCrunchOutputFile(NULL),
-          mBuildSharedLibrary(false),
+          mBuildSharedLibrary(false), mJobs(1), mSharedIncludedResources(NULL),
+          mSharedIncludedIndex(NULL),
           mArgc(0), mArgv(NULL)
         {}
     ~Bundle(void) {}
@@ -115,6 +162,15 @@ public:
     void setIncludeMetaData(bool val) { mIncludeMetaData = val; }
     int getCompressionMethod(void) const { return mCompressionMethod; }
     void setCompressionMethod(int val) { mCompressionMethod = val; }
+    /* zlib level (0-9) used for both Zip entries and crunched PNGs */
+    int getCompressionLevel(void) const { return mCompressionLevel; }
+    void setCompressionLevel(int val) { mCompressionLevel = val; }
+    PngPassthrough getPngPassthrough() const { return mPngPassthrough; }
+    void setPngPassthrough(PngPassthrough val) { mPngPassthrough = val; }
+    bool getPngSearch() const { return mPngSearch; }
+    void setPngSearch(bool val) { mPngSearch = val; }
+    int getPngSearchBudget() const { return mPngSearchBudget; }
+    void setPngSearchBudget(int ms) { mPngSearchBudget = ms; }
     bool getJunkPath(void) const { return mJunkPath; }
     void setJunkPath(bool val) { mJunkPath = val; }
     const char* getOutputAPKFile() const { return mOutputAPKFile; }
@@ -147,6 +203,14 @@ public:
     void addAssetSourceDir(const char* dir) { mAssetSourceDirs.insertAt(dir,0); }
     const char* getCrunchedOutputDir() const { return mCrunchedOutputDir; }
     void setCrunchedOutputDir(const char* dir) { mCrunchedOutputDir = dir; }
+    const char* getCompressionCacheDir() const { return mCompressionCacheDir; }
+    void setCompressionCacheDir(const char* dir) { mCompressionCacheDir = dir; }
+    const char* getIncludeIndexCacheDir() const { return mIncludeIndexCacheDir; }
+    void setIncludeIndexCacheDir(const char* dir) { mIncludeIndexCacheDir = dir; }
+    const char* getCompiledXmlCacheDir() const { return mCompiledXmlCacheDir; }
+    void setCompiledXmlCacheDir(const char* dir) { mCompiledXmlCacheDir = dir; }
+    const char* getIgnoreAssets() const { return mIgnoreAssets; }
+    void setIgnoreAssets(const char* patterns) { mIgnoreAssets = patterns; }
     const char* getProguardFile() const { return mProguardFile; }
     void setProguardFile(const char* file) { mProguardFile = file; }
     const android::Vector<const char*>& getResourceSourceDirs() const { return mResourceSourceDirs; }
@@ -202,6 +266,8 @@ public:
     void setExtraPackages(const char* val) { mExtraPackages = val; }
     const char* getMaxResVersion() const { return mMaxResVersion; }
     void setMaxResVersion(const char * val) { mMaxResVersion = val; }
+    const char* getAttrFallbackPackage() const { return mAttrFallbackPackage; }
+    void setAttrFallbackPackage(const char* val) { mAttrFallbackPackage = val; }
     bool getDebugMode() const { return mDebugMode; }
     void setDebugMode(bool val) { mDebugMode = val; }
     bool getNonConstantId() const { return mNonConstantId; }
@@ -212,12 +278,26 @@ public:
     bool getUseCrunchCache() const { return mUseCrunchCache; }
     const char* getOutputTextSymbols() const { return mOutputTextSymbols; }
     void setOutputTextSymbols(const char* val) { mOutputTextSymbols = val; }
+    const char* getOutputRJar() const { return mOutputRJar; }
+    void setOutputRJar(const char* val) { mOutputRJar = val; }
     const char* getSingleCrunchInputFile() const { return mSingleCrunchInputFile; }
     void setSingleCrunchInputFile(const char* val) { mSingleCrunchInputFile = val; }
     const char* getSingleCrunchOutputFile() const { return mSingleCrunchOutputFile; }
     void setSingleCrunchOutputFile(const char* val) { mSingleCrunchOutputFile = val; }
     bool getBuildSharedLibrary() const { return mBuildSharedLibrary; }
     void setBuildSharedLibrary(bool val) { mBuildSharedLibrary = val; }
+    size_t getJobs() const { return mJobs; }
+    void setJobs(size_t val) { mJobs = val > 0 ? val : 1; }
+
+    /*
+     * Already-parsed resources of the -I packages, and their index with
+     * --include-index-cache.  When set, they are used in place of loading
+     * the includes again (see "batch").
+     */
+    android::ResTable* getSharedIncludedResources() const { return mSharedIncludedResources; }
+    void setSharedIncludedResources(android::ResTable* val) { mSharedIncludedResources = val; }
+    IncludedResIndex* getSharedIncludedIndex() const { return mSharedIncludedIndex; }
+    void setSharedIncludedIndex(IncludedResIndex* val) { mSharedIncludedIndex = val; }
     
     /*
      * Set and get the file specification.
@@ -291,6 +371,10 @@ private:
     bool        mValues;
     bool        mIncludeMetaData;
     int         mCompressionMethod;
+    int         mCompressionLevel;
+    PngPassthrough mPngPassthrough;
+    bool        mPngSearch;
+    int         mPngSearchBudget;
     bool        mJunkPath;
     const char* mOutputAPKFile;
     const char* mManifestPackageNameOverride;
@@ -298,6 +382,10 @@ private:
     bool        mAutoAddOverlay;
     bool        mGenDependencies;
     const char* mCrunchedOutputDir;
+    const char* mCompressionCacheDir;
+    const char* mIncludeIndexCacheDir;
+    const char* mCompiledXmlCacheDir;
+    const char* mIgnoreAssets;
     const char* mProguardFile;
     const char* mAndroidManifestFile;
     const char* mPublicOutputFile;
@@ -327,6 +415,7 @@ private:
     const char* mCustomPackage;
     const char* mExtraPackages;
     const char* mMaxResVersion;
+    const char* mAttrFallbackPackage;
     bool        mDebugMode;
     bool        mNonConstantId;
     const char* mProduct;
@@ -334,9 +423,13 @@ private:
     bool        mErrorOnFailedInsert;
     bool        mErrorOnMissingConfigEntry;
     const char* mOutputTextSymbols;
+    const char* mOutputRJar;
     const char* mSingleCrunchInputFile;
     const char* mSingleCrunchOutputFile;
     bool        mBuildSharedLibrary;
+    size_t      mJobs;
+    android::ResTable* mSharedIncludedResources;
+    IncludedResIndex* mSharedIncludedIndex;
     android::String8 mPlatformVersionCode;
     android::String8 mPlatformVersionName;
 
@@ -3,12 +3,14 @@
 //
 // Android Asset Packaging Tool main entry point.
 //
+#include "AaptUtil.h"
 #include "AaptXml.h"
 #include "ApkBuilder.h"
 #include "Bundle.h"
 #include "Images.h"
 #include "Main.h"
 #include "ResourceFilter.h"
+#include "ResourceIdCache.h"
 #include "ResourceTable.h"
 #include "XMLNode.h"
 
@@ -22,10 +24,22 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <time.h>
 
+#include <sys/stat.h>
+
+#ifndef HAVE_MS_C_RUNTIME
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <fstream>
 #include <iostream>
+#include <map>
 #include <string>
 #include <sstream>
+#include <vector>
 
 using namespace android;
 
@@ -2089,6 +2103,7 @@ int doAdd(Bundle* bundle)
         fprintf(stderr, "ERROR: failed opening/creating '%s' as Zip file\n", zipFileName);
         goto bail;
     }
+    zip->setCompressionLevel(bundle->getCompressionLevel());
 
     for (int i = 1; i < bundle->getFileSpecCount(); i++) {
         const char* fileName = bundle->getFileSpecEntry(i);
@@ -2370,6 +2385,12 @@ int doPackage(Bundle* bundle)
         fclose(fp);
     }
 
+    // Each writeResourceSymbols() call below adds its package's classes to
+    // the R jar, so start from an empty one.
+    if (bundle->getOutputRJar() != NULL) {
+        unlink(bundle->getOutputRJar());
+    }
+
     // Write out R.java constants
     if (!assets->havePrivateSymbols()) {
         if (bundle->getCustomPackage() == NULL) {
@@ -2459,6 +2480,21 @@ int doPackage(Bundle* bundle)
         fclose(fp);
     }
 
+    if (bundle->getVerbose()) {
+        ResourceIdCache::dump();
+#ifndef HAVE_MS_C_RUNTIME
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+            long peakKb = usage.ru_maxrss / 1024;   // bytes on Darwin
+#else
+            long peakKb = usage.ru_maxrss;
+#endif
+            printf("Peak RSS: %ld KB\n", peakKb);
+        }
+#endif
+    }
+
     retVal = 0;
 bail:
     if (SourcePos::hasErrors()) {
@@ -2510,7 +2546,193 @@ int doSingleCrunch(Bundle* bundle)
     return NO_ERROR;
 }
 
-int runInDaemonMode(Bundle* bundle) {
+/*
+ * Included packages kept loaded between the package requests served by
+ * the daemon.  They are loaded again whenever the set of includes changes
+ * or the content of one of the files does.
+ */
+class DaemonIncludes {
+public:
+    status_t prepare(Bundle* bundle);
+
+private:
+    // The content of an included file, as of when it was last hashed.
+    struct Source {
+        AaptUtil::FileStamp stamp;
+        uint64_t hash;
+    };
+
+    String8 makeKey(const Bundle* bundle);
+    bool hashSource(const String8& path, uint64_t* outHash);
+
+    String8 mKey;
+    KeyedVector<String8, Source> mSources;
+    sp<AaptAssets> mAssets;
+    SortedVector<String16> mPackages;
+    SortedVector<uint32_t> mPackageIds;
+    String8 mPlatformVersionCode;
+    String8 mPlatformVersionName;
+};
+
+/*
+ * The hash of the file at "path", only read again when its FileStamp no
+ * longer matches.
+ */
+bool DaemonIncludes::hashSource(const String8& path, uint64_t* outHash)
+{
+    struct stat st;
+    if (stat(path.string(), &st) != 0) {
+        return false;
+    }
+    ssize_t idx = mSources.indexOfKey(path);
+    if (idx >= 0 && mSources.valueAt(idx).stamp.matches(st)) {
+        *outHash = mSources.valueAt(idx).hash;
+        return true;
+    }
+
+    Source source;
+    source.stamp = AaptUtil::FileStamp(st, time(NULL));
+    off_t size;
+    if (!AaptUtil::hashFile(path, &source.hash, &size) || size != st.st_size) {
+        mSources.removeItem(path);
+        return false;
+    }
+    mSources.replaceValueFor(path, source);
+    *outHash = source.hash;
+    return true;
+}
+
+String8 DaemonIncludes::makeKey(const Bundle* bundle)
+{
+    Vector<String8> paths(bundle->getPackageIncludes());
+    if (!bundle->getFeatureOfPackage().isEmpty()) {
+        paths.add(bundle->getFeatureOfPackage());
+    }
+
+    String8 key;
+    for (size_t i = 0; i < paths.size(); i++) {
+        uint64_t hash;
+        if (!hashSource(paths[i], &hash)) {
+            // unreadable; buildIncludedResources() will say so
+            key.appendFormat("%s:-\n", paths[i].string());
+            continue;
+        }
+        key.appendFormat("%s:%08lx%08lx\n", paths[i].string(),
+                (unsigned long) (hash >> 32), (unsigned long) (hash & 0xffffffffUL));
+    }
+    if (!key.isEmpty() && bundle->getIncludeIndexCacheDir() != NULL) {
+        key.appendFormat("index:%s\n", bundle->getIncludeIndexCacheDir());
+    }
+    return key;
+}
+
+status_t DaemonIncludes::prepare(Bundle* bundle)
+{
+    String8 key(makeKey(bundle));
+    if (key.isEmpty()) {
+        ResourceIdCache::clear();
+        return NO_ERROR;
+    }
+
+    if (mAssets == NULL || key != mKey) {
+        // The includes changed, so nothing we cached can be trusted.
+        ResourceIdCache::clear();
+        mKey = String8();
+        mPackages.clear();
+        mPackageIds.clear();
+        mAssets = new AaptAssets();
+        status_t err = mAssets->buildIncludedResources(bundle);
+        if (err != NO_ERROR) {
+            mAssets = NULL;
+            return err;
+        }
+
+        const ResTable& table = mAssets->getIncludedResources();
+        for (size_t i = 0; i < table.getBasePackageCount(); i++) {
+            mPackages.add(table.getBasePackageName(i));
+            mPackageIds.add(table.getBasePackageId(i));
+        }
+
+        Bundle versions;
+        if (extractPlatformBuildVersion(mAssets->getAssetManager(), &versions) != NO_ERROR) {
+            mAssets = NULL;
+            return UNKNOWN_ERROR;
+        }
+        mPlatformVersionCode = versions.getPlatformBuildVersionCode();
+        mPlatformVersionName = versions.getPlatformBuildVersionName();
+        mKey = key;
+    } else {
+        // IDs resolved in the included packages are still valid; anything
+        // resolved in the previously built package may not be.
+        ResourceIdCache::retainPackages(mPackages, mPackageIds);
+    }
+
+    bundle->setSharedIncludedResources(&mAssets->editIncludedResources());
+    bundle->setSharedIncludedIndex(mAssets->getIncludedIndex().get());
+    if (bundle->getPlatformBuildVersionCode() == "") {
+        bundle->setPlatformBuildVersionCode(mPlatformVersionCode);
+    }
+    if (bundle->getPlatformBuildVersionName() == "") {
+        bundle->setPlatformBuildVersionName(mPlatformVersionName);
+    }
+    return NO_ERROR;
+}
+
+/*
+ * Handle a "p <argc>" daemon request.  The package arguments follow on the
+ * next argc lines, one argument per line, so they may contain spaces.
+ */
+static int runDaemonPackage(Bundle* bundle, FlagParser parseFlags,
+        DaemonIncludes* includes, int argc)
+{
+    std::vector<char*> args;
+    int result = 1;
+    for (int i = 0; i < argc; i++) {
+        std::string arg;
+        if (!std::getline(std::cin, arg)) {
+            break;
+        }
+        args.push_back(strdup(arg.c_str()));
+    }
+
+    if ((int) args.size() != argc) {
+        std::cerr << "Truncated package request" << std::endl;
+    } else {
+        Bundle request(*bundle);
+        request.setCommand(kCommandPackage);
+        char* const* argv = argc > 0 ? &args[0] : NULL;
+        int consumed = parseFlags(&request, argc, argv);
+        if (consumed < 0) {
+            std::cerr << "Invalid package arguments" << std::endl;
+        } else {
+            request.setFileSpec(argv + consumed, argc - consumed);
+            if (includes->prepare(&request) == NO_ERROR) {
+                result = doPackage(&request);
+            }
+        }
+    }
+
+    SourcePos::clearErrors();
+    for (size_t i = 0; i < args.size(); i++) {
+        free(args[i]);
+    }
+    return result;
+}
+
+/*
+ * Serve commands read from stdin, one per line, until "quit":
+ *
+ *   s <input> <output>   crunch a single PNG file
+ *   p <argc>             run "package" with the arguments on the next
+ *                        argc lines
+ *
+ * The included packages, resolved resource IDs and crunched PNGs are kept
+ * in memory between requests, so rebuilding a module is cheap.
+ */
+int runInDaemonMode(Bundle* bundle, FlagParser parseFlags) {
+    DaemonIncludes includes;
+    setKeepCrunchedImages(true);
+
     std::cout << "Ready" << std::endl;
     for (std::string line; std::getline(std::cin, line);) {
         if (line == "quit") {
@@ -2532,6 +2754,17 @@ int runInDaemonMode(Bundle* bundle) {
                 std::cout << "Error" << std::endl;
             }
             std::cout << "Done" << std::endl;
+        } else if (command[0] == 'p') {
+            int argc = atoi(parameterOne.c_str());
+            if (argc < 0) {
+                std::cerr << "Invalid argument count" << std::endl;
+                return -1;
+            }
+            std::cout << "Packaging" << std::endl;
+            if (runDaemonPackage(bundle, parseFlags, &includes, argc) != 0) {
+                std::cout << "Error" << std::endl;
+            }
+            std::cout << "Done" << std::endl;
         } else {
             // in case of invalid command, just bail out.
             std::cerr << "Unknown command" << std::endl;
@@ -2541,6 +2774,204 @@ int runInDaemonMode(Bundle* bundle) {
     return -1;
 }
 
+/*
+ * One module of a batch build: the options read from its manifest line
+ * and the bundle they were parsed into.
+ */
+struct BatchModule {
+    int line;
+    std::vector<char*> args;
+    Bundle* bundle;
+
+    BatchModule() : line(0), bundle(NULL) { }
+    ~BatchModule() {
+        delete bundle;
+        for (size_t i = 0; i < args.size(); i++) {
+            free(args[i]);
+        }
+    }
+};
+
+/*
+ * Read the batch manifest.  Every non-empty line that doesn't start with
+ * '#' is a whitespace-separated list of package options for one module,
+ * applied on top of the options given to the batch command itself.
+ */
+static status_t readBatchManifest(const Bundle* bundle, const char* manifestPath,
+        FlagParser parseFlags, std::vector<BatchModule*>* outModules)
+{
+    std::ifstream in(manifestPath);
+    if (!in) {
+        fprintf(stderr, "ERROR: unable to open batch manifest '%s'\n", manifestPath);
+        return UNKNOWN_ERROR;
+    }
+
+    int lineNo = 0;
+    for (std::string line; std::getline(in, line);) {
+        lineNo++;
+        std::stringstream ss(line);
+        std::string token;
+        if (!(ss >> token) || token[0] == '#') {
+            continue;
+        }
+
+        BatchModule* module = new BatchModule();
+        module->line = lineNo;
+        do {
+            module->args.push_back(strdup(token.c_str()));
+        } while (ss >> token);
+        outModules->push_back(module);
+
+        module->bundle = new Bundle(*bundle);
+        module->bundle->setCommand(kCommandPackage);
+
+        const int argc = module->args.size();
+        char* const* argv = &module->args[0];
+        int consumed = parseFlags(module->bundle, argc, argv);
+        if (consumed < 0) {
+            fprintf(stderr, "ERROR: %s:%d: invalid module options\n", manifestPath, lineNo);
+            return BAD_VALUE;
+        }
+        module->bundle->setFileSpec(argv + consumed, argc - consumed);
+
+        // A module that brings its own includes can't use the shared set.
+        if (module->bundle->getPackageIncludes().size() != bundle->getPackageIncludes().size()
+                || module->bundle->getFeatureOfPackage() != bundle->getFeatureOfPackage()) {
+            module->bundle->setSharedIncludedResources(NULL);
+            module->bundle->setSharedIncludedIndex(NULL);
+        }
+    }
+    return NO_ERROR;
+}
+
+/*
+ * Package several modules in one run.
+ *
+ * The included packages are opened and parsed once, up front, and every
+ * module copies the parsed tables instead of loading android.jar and the
+ * base APK again.  Modules are then built in up to --jobs child processes
+ * forked from this warm parent, so they run in parallel without sharing
+ * any of the global state a package build mutates.
+ */
+int doBatch(Bundle* bundle, FlagParser parseFlags)
+{
+    int retVal = 1;
+    status_t err;
+    std::vector<BatchModule*> modules;
+    size_t failed = 0;
+
+    if (bundle->getFileSpecCount() != 1) {
+        fprintf(stderr, "ERROR: batch needs exactly one manifest file\n");
+        return 1;
+    }
+
+    // Load the shared includes before reading the manifest, so that every
+    // module's bundle is copied with them already attached.
+    sp<AaptAssets> included = new AaptAssets();
+    if (bundle->getPackageIncludes().size() > 0 || !bundle->getFeatureOfPackage().isEmpty()) {
+        err = included->buildIncludedResources(bundle);
+        if (err != NO_ERROR) {
+            goto bail;
+        }
+        // Parse the tables now, in the parent, rather than in every module.
+        bundle->setSharedIncludedResources(&included->editIncludedResources());
+        bundle->setSharedIncludedIndex(included->getIncludedIndex().get());
+
+        if (bundle->getPlatformBuildVersionCode() == ""
+                || bundle->getPlatformBuildVersionName() == "") {
+            if (extractPlatformBuildVersion(included->getAssetManager(), bundle) != NO_ERROR) {
+                goto bail;
+            }
+        }
+    }
+
+    err = readBatchManifest(bundle, bundle->getFileSpecEntry(0), parseFlags, &modules);
+    if (err != NO_ERROR) {
+        goto bail;
+    }
+
+    if (bundle->getVerbose()) {
+        printf("Packaging %d modules from '%s'\n", (int) modules.size(),
+                bundle->getFileSpecEntry(0));
+    }
+
+#ifndef HAVE_MS_C_RUNTIME
+    {
+        const size_t maxJobs = bundle->getJobs();
+        std::map<pid_t, size_t> running;
+        size_t next = 0;
+
+        while (next < modules.size() || !running.empty()) {
+            while (next < modules.size() && running.size() < maxJobs) {
+                // Don't let the children inherit (and re-flush) buffered output.
+                fflush(stdout);
+                fflush(stderr);
+                pid_t pid = fork();
+                if (pid == 0) {
+                    int result = doPackage(modules[next]->bundle);
+                    fflush(stdout);
+                    fflush(stderr);
+                    _exit(result);
+                }
+                if (pid < 0) {
+                    fprintf(stderr, "ERROR: unable to start module on line %d: %s\n",
+                            modules[next]->line, strerror(errno));
+                    failed++;
+                } else {
+                    running[pid] = next;
+                }
+                next++;
+            }
+
+            if (running.empty()) {
+                continue;
+            }
+
+            int status;
+            pid_t pid = waitpid(-1, &status, 0);
+            if (pid < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "ERROR: waiting for modules failed: %s\n", strerror(errno));
+                failed += running.size();
+                break;
+            }
+            std::map<pid_t, size_t>::iterator it = running.find(pid);
+            if (it == running.end()) {
+                continue;
+            }
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "ERROR: packaging of module on line %d failed\n",
+                        modules[it->second]->line);
+                failed++;
+            }
+            running.erase(it);
+        }
+    }
+#else
+    for (size_t i = 0; i < modules.size(); i++) {
+        if (doPackage(modules[i]->bundle) != 0) {
+            fprintf(stderr, "ERROR: packaging of module on line %d failed\n",
+                    modules[i]->line);
+            failed++;
+        }
+    }
+#endif
+
+    if (failed == 0) {
+        retVal = 0;
+    }
+
+bail:
+    for (size_t i = 0; i < modules.size(); i++) {
+        delete modules[i];
+    }
+    bundle->setSharedIncludedResources(NULL);
+    bundle->setSharedIncludedIndex(NULL);
+    return retVal;
+}
+
 char CONSOLE_DATA[2925] = {
     32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32,
     32, 32, 32, 32, 32, 32, 32, 95, 46, 32, 32, 32, 32, 32, 32, 32, 32, 32,
@@ -8,13 +8,40 @@
 #include <utils/Vector.h>
 #include <utils/String8.h>
 
+#include "AaptUtil.h"
 #include "DirectoryWalker.h"
 #include "FileFinder.h"
 #include "CacheUpdater.h"
 #include "CrunchCache.h"
+#include "WorkQueue.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 using namespace android;
 
+const char* CrunchCache::kManifestName = ".crunch-manifest";
+
+/*
+ * Runs one CacheUpdater::processImage call on the work queue.
+ */
+class CrunchWorkUnit : public WorkQueue::WorkUnit {
+public:
+    CrunchWorkUnit(CacheUpdater* cu, const String8& source, const String8& dest)
+        : mCacheUpdater(cu), mSource(source), mDest(dest) { }
+
+    virtual bool run() {
+        mCacheUpdater->processImage(mSource, mDest);
+        return true;
+    }
+
+private:
+    CacheUpdater* mCacheUpdater;
+    String8 mSource;
+    String8 mDest;
+};
+
 CrunchCache::CrunchCache(String8 sourcePath, String8 destPath, FileFinder* ff)
     : mSourcePath(sourcePath), mDestPath(destPath), mSourceFiles(0), mDestFiles(0), mFileFinder(ff)
 {
@@ -26,53 +53,96 @@ CrunchCache::CrunchCache(String8 sourcePath, String8 destPath, FileFinder* ff)
 
     // Load files into our data members
     loadFiles();
+    loadManifest();
 }
 
-size_t CrunchCache::crunch(CacheUpdater* cu, bool forceOverwrite)
+size_t CrunchCache::crunch(CacheUpdater* cu, bool forceOverwrite, size_t numThreads)
 {
-    size_t numFilesUpdated = 0;
-
-    // Iterate through the source files and compare to cache.
-    // After processing a file, remove it from the source files and
-    // from the dest files.
-    // We're done when we're out of files in source.
-    String8 relativePath;
-    while (mSourceFiles.size() > 0) {
+    // Walk the source files in order, deciding which need crunching and
+    // marking which dest files are still wanted.  Both indexes are sorted,
+    // so this is O(n log n) and nothing is removed while we walk.
+    Vector<String8> toCrunch;
+    Vector<bool> destUsed;
+    destUsed.insertAt(false, 0, mDestFiles.size());
+    KeyedVector<String8,ContentSig> manifest;
+    const time_t startedAt = time(NULL);
+
+    for (size_t i = 0; i < mSourceFiles.size(); i++) {
         // Get the full path to the source file, then convert to a c-string
         // and offset our beginning pointer to the length of the sourcePath
         // This efficiently strips the source directory prefix from our path.
         // Also, String8 doesn't have a substring method so this is what we've
         // got to work with.
-        const char* rPathPtr = mSourceFiles.keyAt(0).string()+mSourcePath.length();
+        const char* rPathPtr = mSourceFiles.keyAt(i).string()+mSourcePath.length();
         // Strip leading slash if present
         int offset = 0;
         if (rPathPtr[0] == OS_PATH_SEPARATOR)
             offset = 1;
-        relativePath = String8(rPathPtr + offset);
+        String8 relativePath(rPathPtr + offset);
+
+        ssize_t destIdx = mDestFiles.indexOfKey(mDestPath.appendPathCopy(relativePath));
+        if (destIdx >= 0)
+            destUsed.editItemAt(destIdx) = true;
+
+        ContentSig sig;
+        bool hashed = false;
+        if (forceOverwrite || needsUpdating(relativePath, &sig, &hashed)) {
+            toCrunch.add(relativePath);
+            continue;
+        }
 
-        if (forceOverwrite || needsUpdating(relativePath)) {
-            cu->processImage(mSourcePath.appendPathCopy(relativePath),
-                             mDestPath.appendPathCopy(relativePath));
-            numFilesUpdated++;
-            // crunchFile(relativePath);
+        // Up to date.  Carry its manifest entry over, recording one if the
+        // cache predates the manifest.  A source that was hashed because
+        // it looked newer is recorded at its new mod-time, so the next run
+        // takes it on trust instead of hashing it again; its dest is never
+        // rewritten, so the dates alone would never say it's up to date.
+        ssize_t idx = mManifest.indexOfKey(relativePath);
+        if (hashed || (idx < 0 && hashFile(mSourceFiles.keyAt(i), &sig))) {
+            manifest.add(relativePath, stamp(sig, mSourceFiles.valueAt(i), startedAt));
+        } else if (idx >= 0) {
+            manifest.add(relativePath, mManifest.valueAt(idx));
         }
-        // Delete this file from the source files and (if it exists) from the
-        // dest files.
-        mSourceFiles.removeItemsAt(0);
-        mDestFiles.removeItem(mDestPath.appendPathCopy(relativePath));
     }
 
-    // Iterate through what's left of destFiles and delete leftovers
-    while (mDestFiles.size() > 0) {
-        cu->deleteFile(mDestFiles.keyAt(0));
-        mDestFiles.removeItemsAt(0);
+    if (numThreads > 1 && toCrunch.size() > 1) {
+        WorkQueue wq(numThreads, false);
+        for (size_t i = 0; i < toCrunch.size(); i++) {
+            CrunchWorkUnit* w = new CrunchWorkUnit(cu,
+                    mSourcePath.appendPathCopy(toCrunch[i]),
+                    mDestPath.appendPathCopy(toCrunch[i]));
+            if (wq.schedule(w) != NO_ERROR)
+                delete w;
+        }
+        wq.finish();
+    } else {
+        for (size_t i = 0; i < toCrunch.size(); i++) {
+            cu->processImage(mSourcePath.appendPathCopy(toCrunch[i]),
+                             mDestPath.appendPathCopy(toCrunch[i]));
+        }
+    }
+
+    for (size_t i = 0; i < toCrunch.size(); i++) {
+        String8 sourcePath = mSourcePath.appendPathCopy(toCrunch[i]);
+        ContentSig sig;
+        if (hashFile(sourcePath, &sig)) {
+            manifest.add(toCrunch[i],
+                    stamp(sig, mSourceFiles.valueFor(sourcePath), startedAt));
+        }
     }
 
+    // Delete dest files that no longer have a source
+    for (size_t i = 0; i < mDestFiles.size(); i++) {
+        if (!destUsed[i])
+            cu->deleteFile(mDestFiles.keyAt(i));
+    }
+
+    saveManifest(manifest);
+    mManifest = manifest;
+
     // Update our knowledge of the files cache
-    // both source and dest should be empty by now.
     loadFiles();
 
-    return numFilesUpdated;
+    return toCrunch.size();
 }
 
 void CrunchCache::loadFiles()
@@ -93,12 +163,99 @@ void CrunchCache::loadFiles()
     delete dw;
 }
 
-bool CrunchCache::needsUpdating(String8 relativePath) const
+bool CrunchCache::needsUpdating(String8 relativePath, ContentSig* sig, bool* hashed) const
 {
     // Retrieve modification dates for this file entry under the source and
     // cache directory trees. The vectors will return a modification date of 0
     // if the file doesn't exist.
-    time_t sourceDate = mSourceFiles.valueFor(mSourcePath.appendPathCopy(relativePath));
-    time_t destDate = mDestFiles.valueFor(mDestPath.appendPathCopy(relativePath));
-    return sourceDate > destDate;
-}
\ No newline at end of file
+    String8 sourcePath = mSourcePath.appendPathCopy(relativePath);
+    time_t sourceDate = mSourceFiles.valueFor(sourcePath);
+    ssize_t destIdx = mDestFiles.indexOfKey(mDestPath.appendPathCopy(relativePath));
+    if (destIdx < 0)
+        return true;
+    if (sourceDate <= mDestFiles.valueAt(destIdx))
+        return false;
+
+    // Newer by date; only a content change counts.
+    ssize_t idx = mManifest.indexOfKey(relativePath);
+    if (idx < 0)
+        return true;
+    const ContentSig& known = mManifest.valueAt(idx);
+    if (known.modTime != 0 && known.modTime == sourceDate)
+        return false;
+    *hashed = hashFile(sourcePath, sig);
+    return !*hashed || !(*sig == known);
+}
+
+bool CrunchCache::hashFile(const String8& path, ContentSig* sig)
+{
+    return AaptUtil::hashFile(path, &sig->hash, &sig->size);
+}
+
+CrunchCache::ContentSig CrunchCache::stamp(ContentSig sig, time_t modTime, time_t startedAt)
+{
+    // Same rule as AaptUtil::FileStamp: a mod-time in the current second
+    // can't vouch for the content.
+    sig.modTime = modTime < startedAt ? modTime : 0;
+    return sig;
+}
+
+void CrunchCache::loadManifest()
+{
+    mManifest.clear();
+    FILE* fp = fopen(mDestPath.appendPathCopy(kManifestName).string(), "r");
+    if (fp == NULL)
+        return;
+
+    // One "<hash> <size> <mod-time> <relative path>" line per source
+    char line[4096];
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        char* end;
+        ContentSig sig;
+        sig.hash = strtoull(line, &end, 16);
+        if (*end != ' ')
+            continue;
+        sig.size = (off_t) strtoll(end + 1, &end, 10);
+        if (*end != ' ')
+            continue;
+        sig.modTime = (time_t) strtoll(end + 1, &end, 10);
+        if (*end != ' ')
+            continue;
+        String8 relativePath(end + 1);
+        // drop the newline
+        size_t len = relativePath.length();
+        if (len == 0 || relativePath.string()[len - 1] != '\n')
+            continue;
+        relativePath.setTo(relativePath.string(), len - 1);
+        mManifest.add(relativePath, sig);
+    }
+    fclose(fp);
+}
+
+void CrunchCache::saveManifest(const KeyedVector<String8,ContentSig>& manifest) const
+{
+    // Write to a temp file and rename, so an interrupted run leaves the
+    // old manifest rather than half a new one.
+    String8 path = mDestPath.appendPathCopy(kManifestName);
+    String8 tempPath(path);
+    tempPath.append(".tmp");
+
+    FILE* fp = fopen(tempPath.string(), "w");
+    if (fp == NULL)
+        return;
+    for (size_t i = 0; i < manifest.size(); i++) {
+        const ContentSig& sig = manifest.valueAt(i);
+        fprintf(fp, "%016llx %lld %lld %s\n", (unsigned long long) sig.hash,
+                (long long) sig.size, (long long) sig.modTime,
+                manifest.keyAt(i).string());
+    }
+    if (fclose(fp) != 0) {
+        remove(tempPath.string());
+        return;
+    }
+#ifdef HAVE_MS_C_RUNTIME
+    // rename() won't replace an existing file here
+    remove(path.string());
+#endif
+    rename(tempPath.string(), path.string());
+}
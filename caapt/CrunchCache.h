@@ -11,6 +11,8 @@
 
 #include <utils/KeyedVector.h>
 #include <utils/String8.h>
+#include <stdint.h>
+#include <time.h>
 #include "FileFinder.h"
 #include "CacheUpdater.h"
 
@@ -25,6 +27,11 @@ using namespace android;
  *      Create an instance initialized with the root of the source tree, the
  *      root location to store the cache files, and an instance of a file finder.
  *      Then update the cache by calling crunch.
+ *
+ *  Besides modification times, the cache keeps a manifest (kManifestName in
+ *  the cache root) of the content hash of every source it crunched, so a
+ *  source that only looks newer -- a fresh checkout, say -- isn't crunched
+ *  again if its content hasn't changed.
  */
 class CrunchCache {
 public:
@@ -45,6 +52,9 @@ public:
      * we delete any leftover files in the cache that are no longer present
      * in source.
      *
+     * Files are crunched on up to numThreads threads; with more than one,
+     * the CacheUpdater's processImage must be safe to call concurrently.
+     *
      * PRECONDITIONS:
      *      No setup besides construction is needed
      * POSTCONDITIONS:
@@ -52,9 +62,36 @@ public:
      *      The function then returns the number of files changed in cache
      *      (counting deletions).
      */
-    size_t crunch(CacheUpdater* cu, bool forceOverwrite=false);
+    size_t crunch(CacheUpdater* cu, bool forceOverwrite=false, size_t numThreads=1);
+
+    // Name of the content manifest, relative to the cache root
+    static const char* kManifestName;
 
 private:
+    // Size and 64-bit FNV-1a hash of a source file's content, and the
+    // source's mod-time when it was hashed.  modTime is 0 if the source
+    // was modified within the second it was hashed in, since it could
+    // have changed again without its mod-time moving.
+    struct ContentSig {
+        ContentSig() : size(0), hash(0), modTime(0) {}
+        bool operator==(const ContentSig& o) const {
+            return size == o.size && hash == o.hash;
+        }
+        off_t size;
+        uint64_t hash;
+        time_t modTime;
+    };
+
+    /** Hashes the file at path into sig. Returns false if it can't be read. */
+    static bool hashFile(const String8& path, ContentSig* sig);
+
+    /** sig recorded at modTime, for a crunch that started at startedAt. */
+    static ContentSig stamp(ContentSig sig, time_t modTime, time_t startedAt);
+
+    /** Reads/writes the manifest of relative source path -> ContentSig. */
+    void loadManifest();
+    void saveManifest(const KeyedVector<String8,ContentSig>& manifest) const;
+
     /** loadFiles is a wrapper to the FileFinder that places matching
      * files into mSourceFiles and mDestFiles.
      *
@@ -72,8 +109,12 @@ private:
      * PRECONDITIONS:
      *      mSourceFiles and mDestFiles must be initialized and filled.
      * POSTCONDITIONS:
-     *      returns true if and only if source file's modification time
-     *      is greater than the cached file's mod-time. Otherwise returns false.
+     *      returns true if the cached file is missing, or the source file's
+     *      modification time is greater than the cached file's mod-time and
+     *      its content doesn't match the manifest. Otherwise returns false.
+     *      A source whose mod-time is the one the manifest hashed it at
+     *      isn't hashed again. If the source had to be hashed, sig holds
+     *      the result and hashed is set.
      *
      * USAGE:
      *      Should be used something like the following:
@@ -81,7 +122,7 @@ private:
      *          // Recrunch sourceFile out to destFile.
      *
      */
-    bool needsUpdating(String8 relativePath) const;
+    bool needsUpdating(String8 relativePath, ContentSig* sig, bool* hashed) const;
 
     // DATA MEMBERS ====================================================
 
@@ -95,6 +136,10 @@ private:
     DefaultKeyedVector<String8,time_t> mSourceFiles;
     DefaultKeyedVector<String8,time_t> mDestFiles;
 
+    // Content of each source as of when it was last crunched, keyed by
+    // path relative to mSourcePath
+    KeyedVector<String8,ContentSig> mManifest;
+
     // Pointer to a FileFinder to use
     FileFinder* mFileFinder;
 };
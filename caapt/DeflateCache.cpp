@@ -0,0 +1,167 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// On-disk cache of deflated Zip entry data, keyed by content.
+//
+
+#include "DeflateCache.h"
+#include "AaptUtil.h"
+
+#include <zlib.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef HAVE_MS_C_RUNTIME
+#include <direct.h>
+#endif
+
+/*
+ * Each cache file is a small header followed by the raw deflate stream.
+ * All values are little-endian.
+ */
+static const unsigned char kMagic[4] = { 'a', 'D', 'C', '1' };
+enum {
+    kHeaderLen = 16,    // magic, crc, uncompressed len, compressed len
+};
+
+// Entries nobody has read for a month are deleted, going through the
+// directory at most once a day.
+static const time_t kMaxEntryAge = 30 * 24 * 60 * 60;
+static const time_t kPruneInterval = 24 * 60 * 60;
+
+DeflateCache::DeflateCache(const String8& cacheDir)
+    : mCacheDir(cacheDir), mHits(0), mMisses(0), mTempCounter(0)
+{
+#ifdef HAVE_MS_C_RUNTIME
+    _mkdir(mCacheDir.string());
+#else
+    mkdir(mCacheDir.string(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
+#endif
+    AaptUtil::pruneCacheDir(mCacheDir, kMaxEntryAge, kPruneInterval);
+}
+
+status_t DeflateCache::deflate(const void* data, size_t size, int level,
+        ZipFile::Deflated* pDeflated)
+{
+    unsigned long crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, (const unsigned char*) data, size);
+
+    String8 path = entryPath(data, size, crc, level);
+    status_t result = NO_ERROR;
+    if (read(path, size, crc, pDeflated)) {
+        AutoMutex _l(mLock);
+        mHits++;
+    } else {
+        result = ZipFile::deflateToBuffer(NULL, data, size, level, pDeflated);
+        if (result == NO_ERROR) {
+            write(path, *pDeflated);
+        }
+        AutoMutex _l(mLock);
+        mMisses++;
+    }
+    return result;
+}
+
+size_t DeflateCache::getHits() const
+{
+    AutoMutex _l(mLock);
+    return mHits;
+}
+
+size_t DeflateCache::getMisses() const
+{
+    AutoMutex _l(mLock);
+    return mMisses;
+}
+
+/*
+ * Deflate output only depends on the input and the level, so that's the
+ * whole key.
+ */
+String8 DeflateCache::entryPath(const void* data, size_t size, unsigned long crc,
+        int level) const
+{
+    // the CRC and length go into the name too, so a collision would have
+    // to match all three
+    uint64_t hash = AaptUtil::hashBytes(data, size);
+    String8 name;
+    name.appendFormat("%08lx%08lx-%08lx-%lu-d%d.z",
+            (unsigned long) (hash >> 32), (unsigned long) (hash & 0xffffffffUL),
+            crc & 0xffffffffUL, (unsigned long) size, level);
+
+    String8 path(mCacheDir);
+    path.appendPath(name);
+    return path;
+}
+
+bool DeflateCache::read(const String8& path, size_t size, unsigned long crc,
+        ZipFile::Deflated* pDeflated) const
+{
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    bool ok = false;
+    unsigned char header[kHeaderLen];
+    if (fread(header, 1, kHeaderLen, fp) == kHeaderLen
+            && memcmp(header, kMagic, sizeof(kMagic)) == 0
+            && ZipEntry::getLongLE(header + 4) == (crc & 0xffffffffUL)
+            && ZipEntry::getLongLE(header + 8) == size) {
+        size_t compressedLen = ZipEntry::getLongLE(header + 12);
+        pDeflated->data.clear();
+        pDeflated->data.insertAt(0, 0, compressedLen);
+        if (compressedLen == 0
+                || fread(pDeflated->data.editArray(), 1, compressedLen, fp) == compressedLen) {
+            // anything trailing means the entry isn't what we wrote
+            ok = fgetc(fp) == EOF;
+        }
+    }
+    fclose(fp);
+
+    if (ok) {
+        pDeflated->crc = crc;
+        pDeflated->uncompressedLen = size;
+        AaptUtil::touchCacheEntry(path);
+    } else {
+        pDeflated->data.clear();
+    }
+    return ok;
+}
+
+/*
+ * Store an entry.  Failures only cost us the next hit, so they're ignored.
+ */
+void DeflateCache::write(const String8& path, const ZipFile::Deflated& deflated)
+{
+    size_t counter;
+    {
+        AutoMutex _l(mLock);
+        counter = mTempCounter++;
+    }
+    String8 tempPath(path);
+    tempPath.appendFormat(".%d.%lu.tmp", (int) getpid(), (unsigned long) counter);
+
+    FILE* fp = fopen(tempPath.string(), "wb");
+    if (fp == NULL) {
+        return;
+    }
+
+    unsigned char header[kHeaderLen];
+    memcpy(header, kMagic, sizeof(kMagic));
+    ZipEntry::putLongLE(header + 4, deflated.crc);
+    ZipEntry::putLongLE(header + 8, deflated.uncompressedLen);
+    ZipEntry::putLongLE(header + 12, deflated.data.size());
+
+    size_t len = deflated.data.size();
+    bool ok = fwrite(header, 1, kHeaderLen, fp) == kHeaderLen
+            && fwrite(deflated.data.array(), 1, len, fp) == len;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tempPath.string(), path.string()) != 0) {
+        unlink(tempPath.string());
+    }
+}
@@ -0,0 +1,61 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// On-disk cache of deflated Zip entry data, keyed by content.
+//
+
+#ifndef __DEFLATE_CACHE_H
+#define __DEFLATE_CACHE_H
+
+#include <utils/Errors.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+
+#include "ZipFile.h"
+
+using namespace android;
+
+/*
+ * Most files going into an .apk are byte-identical to the ones in the
+ * previous build, so deflating them again is wasted work.  This cache
+ * keeps the deflate stream and CRC of everything it compresses in a
+ * directory, one file per (content, compression level), and hands them
+ * back on later runs for ZipFile::addDeflated() to splice in.
+ *
+ * Entries are written to a temp file and renamed into place, so several
+ * threads or aapt processes can share one directory.  A damaged or
+ * mismatching entry is treated as a miss.  Reading an entry touches it,
+ * and files nobody has read for a month are pruned; that includes the
+ * PNG crunch markers kept in the same directory.
+ */
+class DeflateCache {
+public:
+    DeflateCache(const String8& cacheDir);
+
+    /*
+     * Fill "pDeflated" with the deflated form of "data" at the given zlib
+     * level.  Runs zlib only on a miss.
+     */
+    status_t deflate(const void* data, size_t size, int level,
+        ZipFile::Deflated* pDeflated);
+
+    /* counters for verbose output */
+    size_t getHits() const;
+    size_t getMisses() const;
+
+private:
+    String8 entryPath(const void* data, size_t size, unsigned long crc,
+        int level) const;
+    bool read(const String8& path, size_t size, unsigned long crc,
+        ZipFile::Deflated* pDeflated) const;
+    void write(const String8& path, const ZipFile::Deflated& deflated);
+
+    String8 mCacheDir;
+
+    mutable Mutex mLock;
+    size_t mHits;
+    size_t mMisses;
+    size_t mTempCounter;
+};
+
+#endif // __DEFLATE_CACHE_H
@@ -7,13 +7,27 @@
 #define PNG_INTERNAL
 
 #include "Images.h"
+#include "AaptUtil.h"
 
 #include <androidfw/ResourceTypes.h>
 #include <utils/ByteOrder.h>
+#include <utils/Timers.h>
 
 #include <png.h>
 #include <zlib.h>
 
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_MS_C_RUNTIME
+#include <direct.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define NOISY(x) //x
 
 static void
@@ -894,6 +908,116 @@ static void dump_image(int w, int h, png_bytepp rows, int color_type)
 #define MAX(a,b) ((a)>(b)?(a):(b))
 #define ABS(a)   ((a)<0?-(a):(a))
 
+void scanRgbaRowScalar(const unsigned char* row, int width,
+                       int* maxGrayDeviation, bool* isOpaque)
+{
+    int maxDev = *maxGrayDeviation;
+    bool opaque = *isOpaque;
+    for (int i = 0; i < width; i++) {
+        int rr = *row++;
+        int gg = *row++;
+        int bb = *row++;
+        int aa = *row++;
+
+        maxDev = MAX(ABS(rr - gg), maxDev);
+        maxDev = MAX(ABS(gg - bb), maxDev);
+        maxDev = MAX(ABS(bb - rr), maxDev);
+        if (aa != 0xff) {
+            opaque = false;
+        }
+    }
+    *maxGrayDeviation = maxDev;
+    *isOpaque = opaque;
+}
+
+#if defined(__SSE2__)
+static inline __m128i absdiff_epu8(__m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+}
+
+// Four pixels at a time.  Each 32-bit lane holds one pixel as r, g, b, a
+// from the low byte up; shifting the lane right by 8 and 16 bits lines g
+// and b up under r, so |r-g|, |g-b| and |b-r| are three byte-wise
+// differences.  Alpha is AND-ed together and checked once at the end.
+void scanRgbaRow(const unsigned char* row, int width,
+                 int* maxGrayDeviation, bool* isOpaque)
+{
+    const __m128i lowTwoBytes = _mm_set1_epi32(0x0000ffff);
+    const __m128i lowByte = _mm_set1_epi32(0x000000ff);
+    __m128i dev = _mm_setzero_si128();
+    __m128i alpha = _mm_set1_epi32(-1);
+
+    int i = 0;
+    for (; i + 4 <= width; i += 4) {
+        __m128i px = _mm_loadu_si128((const __m128i*) (row + i * 4));
+        __m128i rg_gb = absdiff_epu8(px, _mm_srli_epi32(px, 8));
+        __m128i rb = absdiff_epu8(px, _mm_srli_epi32(px, 16));
+        dev = _mm_max_epu8(dev, _mm_and_si128(rg_gb, lowTwoBytes));
+        dev = _mm_max_epu8(dev, _mm_and_si128(rb, lowByte));
+        alpha = _mm_and_si128(alpha, px);
+    }
+
+    unsigned char devBytes[16];
+    unsigned char alphaBytes[16];
+    _mm_storeu_si128((__m128i*) devBytes, dev);
+    _mm_storeu_si128((__m128i*) alphaBytes, alpha);
+
+    int maxDev = *maxGrayDeviation;
+    for (int k = 0; k < 16; k++) {
+        maxDev = MAX(devBytes[k], maxDev);
+    }
+    *maxGrayDeviation = maxDev;
+    if ((alphaBytes[3] & alphaBytes[7] & alphaBytes[11] & alphaBytes[15]) != 0xff) {
+        *isOpaque = false;
+    }
+
+    scanRgbaRowScalar(row + i * 4, width - i, maxGrayDeviation, isOpaque);
+}
+#else
+void scanRgbaRow(const unsigned char* row, int width,
+                 int* maxGrayDeviation, bool* isOpaque)
+{
+    scanRgbaRowScalar(row, width, maxGrayDeviation, isOpaque);
+}
+#endif
+
+/*
+ * Maps RGBA colors to their index in the order they were first seen, which
+ * is the order the palette gets written in.  Open addressing over a table
+ * with at least 4x as many slots as the 256 colors it can ever hold.
+ */
+struct PaletteIndex {
+    enum { kSlots = 1024 };
+
+    uint32_t colors[256];
+    int num_colors;
+    int16_t slots[kSlots];
+
+    PaletteIndex() : num_colors(0) {
+        memset(slots, 0xff, sizeof(slots));
+    }
+
+    // Index of "col", or num_colors if it hasn't been seen.  *slot is where
+    // it belongs in the latter case.
+    int find(uint32_t col, int* slot) const {
+        int s = (int) ((col * 2654435761U) >> 22);
+        while (slots[s] >= 0) {
+            if (colors[slots[s]] == col) {
+                return slots[s];
+            }
+            s = (s + 1) & (kSlots - 1);
+        }
+        *slot = s;
+        return num_colors;
+    }
+
+    void add(uint32_t col, int slot) {
+        slots[slot] = (int16_t) num_colors;
+        colors[num_colors++] = col;
+    }
+};
+
 static void analyze_image(const char *imageName, image_info &imageInfo, int grayscaleTolerance,
                           png_colorp rgbPalette, png_bytep alphaPalette,
                           int *paletteEntries, bool *hasTransparency, int *colorType,
@@ -901,9 +1025,10 @@ static void analyze_image(const char *imageName, image_info &imageInfo, int gray
 {
     int w = imageInfo.width;
     int h = imageInfo.height;
-    int i, j, rr, gg, bb, aa, idx;
-    uint32_t colors[256], col;
-    int num_colors = 0;
+    int i, j, rr, gg, bb, aa;
+    uint32_t col;
+    PaletteIndex palette;
+    const uint32_t* colors = palette.colors;
     int maxGrayDeviation = 0;
 
     bool isOpaque = true;
@@ -920,67 +1045,57 @@ static void analyze_image(const char *imageName, image_info &imageInfo, int gray
 
     for (j = 0; j < h; j++) {
         png_bytep row = imageInfo.rows[j];
-        png_bytep out = outRows[j];
-        for (i = 0; i < w; i++) {
-            rr = *row++;
-            gg = *row++;
-            bb = *row++;
-            aa = *row++;
-
-            int odev = maxGrayDeviation;
-            maxGrayDeviation = MAX(ABS(rr - gg), maxGrayDeviation);
-            maxGrayDeviation = MAX(ABS(gg - bb), maxGrayDeviation);
-            maxGrayDeviation = MAX(ABS(bb - rr), maxGrayDeviation);
-            if (maxGrayDeviation > odev) {
-                NOISY(printf("New max dev. = %d at pixel (%d, %d) = (%d %d %d %d)\n",
-                             maxGrayDeviation, i, j, rr, gg, bb, aa));
-            }
 
-            // Check if image is really grayscale
-            if (isGrayscale) {
-                if (rr != gg || rr != bb) {
-                     NOISY(printf("Found a non-gray pixel at %d, %d = (%d %d %d %d)\n",
-                                  i, j, rr, gg, bb, aa));
-                    isGrayscale = false;
-                }
-            }
-
-            // Check if image is really opaque
-            if (isOpaque) {
-                if (aa != 0xff) {
-                    NOISY(printf("Found a non-opaque pixel at %d, %d = (%d %d %d %d)\n",
-                                 i, j, rr, gg, bb, aa));
-                    isOpaque = false;
-                }
-            }
+        // R == G == B for every pixel exactly when the largest deviation is 0
+        scanRgbaRow(row, w, &maxGrayDeviation, &isOpaque);
 
-            // Check if image is really <= 256 colors
-            if (isPalette) {
+        // Check if image is really <= 256 colors
+        if (isPalette) {
+            png_bytep out = outRows[j];
+            uint32_t lastCol = 0;
+            int lastIdx = -1;
+            for (i = 0; i < w; i++) {
+                rr = *row++;
+                gg = *row++;
+                bb = *row++;
+                aa = *row++;
                 col = (uint32_t) ((rr << 24) | (gg << 16) | (bb << 8) | aa);
-                bool match = false;
-                for (idx = 0; idx < num_colors; idx++) {
-                    if (colors[idx] == col) {
-                        match = true;
-                        break;
-                    }
+
+                // runs of one color are common, skip the lookup for them
+                if (lastIdx >= 0 && col == lastCol) {
+                    *out++ = lastIdx;
+                    continue;
                 }
 
+                int slot;
+                int idx = palette.find(col, &slot);
+
                 // Write the palette index for the pixel to outRows optimistically
                 // We might overwrite it later if we decide to encode as gray or
                 // gray + alpha
                 *out++ = idx;
-                if (!match) {
-                    if (num_colors == 256) {
+                if (idx == palette.num_colors) {
+                    if (palette.num_colors == 256) {
                         NOISY(printf("Found 257th color at %d, %d\n", i, j));
                         isPalette = false;
-                    } else {
-                        colors[num_colors++] = col;
+                        break;
                     }
+                    palette.add(col, slot);
                 }
+                lastCol = col;
+                lastIdx = idx;
             }
         }
+
+        // Nothing the remaining rows hold can change the outcome
+        if (!isPalette && !isOpaque && maxGrayDeviation == 0xff) {
+            break;
+        }
     }
 
+    isGrayscale = (maxGrayDeviation == 0);
+    int num_colors = palette.num_colors;
+
     *paletteEntries = 0;
     *hasTransparency = !isOpaque;
     int bpp = isOpaque ? 3 : 4;
@@ -1064,20 +1179,42 @@ static void analyze_image(const char *imageName, image_info &imageInfo, int gray
 }
 
 
-static void write_png(const char* imageName,
-                      png_structp write_ptr, png_infop write_info,
-                      image_info& imageInfo, int grayscaleTolerance)
+// What analyze_image() decided for an image, plus the 9-patch chunks.
+// Computed once per image and only read while encoding, so one plan can
+// be encoded several ways at once.
+struct png_plan
 {
-    bool optimize = true;
-    png_uint_32 width, height;
-    int color_type;
-    int bit_depth, interlace_type, compression_type;
-    int i;
+    png_plan() : outRows(NULL), height(0), chunkCount(0) {
+        memset(unknowns, 0, sizeof(unknowns));
+    }
+
+    int colorType;
+    png_color rgbPalette[256];
+    png_byte alphaPalette[256];
+    bool hasTransparency;
+    int paletteEntries;
+    png_bytepp outRows;
+    int height;
 
     png_unknown_chunk unknowns[3];
-    unknowns[0].data = NULL;
-    unknowns[1].data = NULL;
-    unknowns[2].data = NULL;
+    int chunkCount;
+};
+
+// Filters and zlib settings for one encoding of a png_plan.  -1 leaves the
+// choice to write_png's usual rules or libpng's defaults.
+struct png_encoding
+{
+    int filters;
+    int strategy;
+    int memLevel;
+};
+
+static const png_encoding kDefaultPngEncoding = { -1, -1, -1 };
+
+static void plan_png(const char* imageName, image_info& imageInfo, int grayscaleTolerance,
+                     png_plan* plan)
+{
+    int i;
 
     png_bytepp outRows = (png_bytepp) malloc((int) imageInfo.height * sizeof(png_bytep));
     if (outRows == (png_bytepp) 0) {
@@ -1091,19 +1228,16 @@ static void write_png(const char* imageName,
             exit(1);
         }
     }
-
-    png_set_compression_level(write_ptr, Z_BEST_COMPRESSION);
+    plan->outRows = outRows;
+    plan->height = (int) imageInfo.height;
 
     NOISY(printf("Writing image %s: w = %d, h = %d\n", imageName,
           (int) imageInfo.width, (int) imageInfo.height));
 
-    png_color rgbPalette[256];
-    png_byte alphaPalette[256];
-    bool hasTransparency;
-    int paletteEntries;
+    analyze_image(imageName, imageInfo, grayscaleTolerance, plan->rgbPalette, plan->alphaPalette,
+                  &plan->paletteEntries, &plan->hasTransparency, &plan->colorType, outRows);
 
-    analyze_image(imageName, imageInfo, grayscaleTolerance, rgbPalette, alphaPalette,
-                  &paletteEntries, &hasTransparency, &color_type, outRows);
+    int color_type = plan->colorType;
 
     // If the image is a 9-patch, we need to preserve it as a ARGB file to make
     // sure the pixels will not be pre-dithered/clamped until we decide they are
@@ -1111,12 +1245,13 @@ static void write_png(const char* imageName,
             color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_PALETTE)) {
         color_type = PNG_COLOR_TYPE_RGB_ALPHA;
     }
+    plan->colorType = color_type;
 
     switch (color_type) {
     case PNG_COLOR_TYPE_PALETTE:
         NOISY(printf("Image %s has %d colors%s, using PNG_COLOR_TYPE_PALETTE\n",
-                     imageName, paletteEntries,
-                     hasTransparency ? " (with alpha)" : ""));
+                     imageName, plan->paletteEntries,
+                     plan->hasTransparency ? " (with alpha)" : ""));
         break;
     case PNG_COLOR_TYPE_GRAY:
         NOISY(printf("Image %s is opaque gray, using PNG_COLOR_TYPE_GRAY\n", imageName));
@@ -1132,31 +1267,13 @@ static void write_png(const char* imageName,
         break;
     }
 
-    png_set_IHDR(write_ptr, write_info, imageInfo.width, imageInfo.height,
-                 8, color_type, PNG_INTERLACE_NONE,
-                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-    if (color_type == PNG_COLOR_TYPE_PALETTE) {
-        png_set_PLTE(write_ptr, write_info, rgbPalette, paletteEntries);
-        if (hasTransparency) {
-            png_set_tRNS(write_ptr, write_info, alphaPalette, paletteEntries, (png_color_16p) 0);
-        }
-       png_set_filter(write_ptr, 0, PNG_NO_FILTERS);
-    } else {
-       png_set_filter(write_ptr, 0, PNG_ALL_FILTERS);
-    }
-
     if (imageInfo.is9Patch) {
+        png_unknown_chunk* unknowns = plan->unknowns;
         int chunk_count = 2 + (imageInfo.haveLayoutBounds ? 1 : 0);
         int p_index = imageInfo.haveLayoutBounds ? 2 : 1;
         int b_index = 1;
         int o_index = 0;
 
-        // Chunks ordered thusly because older platforms depend on the base 9 patch data being last
-        png_byte *chunk_names = imageInfo.haveLayoutBounds
-                ? (png_byte*)"npOl\0npLb\0npTc\0"
-                : (png_byte*)"npOl\0npTc";
-
         // base 9 patch data
         NOISY(printf("Adding 9-patch info...\n"));
         strcpy((char*)unknowns[p_index].name, "npTc");
@@ -1188,9 +1305,63 @@ static void write_png(const char* imageName,
         for (int i = 0; i < chunk_count; i++) {
             unknowns[i].location = PNG_HAVE_PLTE;
         }
+        plan->chunkCount = chunk_count;
+    }
+}
+
+static void free_png_plan(png_plan* plan)
+{
+    for (int i = 0; i < plan->height; i++) {
+        free(plan->outRows[i]);
+    }
+    free(plan->outRows);
+    free(plan->unknowns[0].data);
+    free(plan->unknowns[1].data);
+    free(plan->unknowns[2].data);
+}
+
+static void encode_png(const char* imageName,
+                       png_structp write_ptr, png_infop write_info,
+                       image_info& imageInfo, const png_plan& plan,
+                       int compressionLevel, const png_encoding& encoding)
+{
+    png_uint_32 width, height;
+    int color_type = plan.colorType;
+    int bit_depth, interlace_type, compression_type;
+
+    png_set_compression_level(write_ptr, compressionLevel);
+    if (encoding.strategy >= 0) {
+        png_set_compression_strategy(write_ptr, encoding.strategy);
+    }
+    if (encoding.memLevel >= 0) {
+        png_set_compression_mem_level(write_ptr, encoding.memLevel);
+    }
+
+    png_set_IHDR(write_ptr, write_info, imageInfo.width, imageInfo.height,
+                 8, color_type, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    int filters = PNG_ALL_FILTERS;
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_PLTE(write_ptr, write_info, (png_colorp) plan.rgbPalette, plan.paletteEntries);
+        if (plan.hasTransparency) {
+            png_set_tRNS(write_ptr, write_info, (png_bytep) plan.alphaPalette,
+                         plan.paletteEntries, (png_color_16p) 0);
+        }
+        filters = PNG_NO_FILTERS;
+    }
+    png_set_filter(write_ptr, 0, encoding.filters >= 0 ? encoding.filters : filters);
+
+    if (imageInfo.is9Patch) {
+        // Chunks ordered thusly because older platforms depend on the base 9 patch data being last
+        png_byte *chunk_names = imageInfo.haveLayoutBounds
+                ? (png_byte*)"npOl\0npLb\0npTc\0"
+                : (png_byte*)"npOl\0npTc";
+
         png_set_keep_unknown_chunks(write_ptr, PNG_HANDLE_CHUNK_ALWAYS,
-                                    chunk_names, chunk_count);
-        png_set_unknown_chunks(write_ptr, write_info, unknowns, chunk_count);
+                                    chunk_names, plan.chunkCount);
+        png_set_unknown_chunks(write_ptr, write_info, (png_unknown_chunkp) plan.unknowns,
+                               plan.chunkCount);
 #if PNG_LIBPNG_VER < 10600
         /* Deal with unknown chunk location bug in 1.5.x and earlier */
         png_set_unknown_chunk_location(write_ptr, write_info, 0, PNG_HAVE_PLTE);
@@ -1210,7 +1381,7 @@ static void write_png(const char* imageName,
         }
         rows = imageInfo.rows;
     } else {
-        rows = outRows;
+        rows = plan.outRows;
     }
     png_write_image(write_ptr, rows);
 
@@ -1219,14 +1390,6 @@ static void write_png(const char* imageName,
 
     png_write_end(write_ptr, write_info);
 
-    for (i = 0; i < (int) imageInfo.height; i++) {
-        free(outRows[i]);
-    }
-    free(outRows);
-    free(unknowns[0].data);
-    free(unknowns[1].data);
-    free(unknowns[2].data);
-
     png_get_IHDR(write_ptr, write_info, &width, &height,
        &bit_depth, &color_type, &interlace_type,
        &compression_type, NULL);
@@ -1236,6 +1399,423 @@ static void write_png(const char* imageName,
                  compression_type));
 }
 
+static void write_png(const char* imageName,
+                      png_structp write_ptr, png_infop write_info,
+                      image_info& imageInfo, int grayscaleTolerance,
+                      int compressionLevel)
+{
+    png_plan plan;
+    plan_png(imageName, imageInfo, grayscaleTolerance, &plan);
+    encode_png(imageName, write_ptr, write_info, imageInfo, plan, compressionLevel,
+               kDefaultPngEncoding);
+    free_png_plan(&plan);
+}
+
+// --png-search: encodings to try for every image.  The first is what
+// write_png() uses, so a search never comes out larger than a normal
+// build.
+static const png_encoding kPngSearchEncodings[] = {
+    { -1,               -1,                 -1 },
+    { PNG_FILTER_NONE,  Z_DEFAULT_STRATEGY, 9 },
+    { PNG_FILTER_NONE,  Z_RLE,              9 },
+    { PNG_ALL_FILTERS,  Z_DEFAULT_STRATEGY, 9 },
+    { PNG_ALL_FILTERS,  Z_FILTERED,         9 },
+    { PNG_ALL_FILTERS,  Z_RLE,              9 },
+    { PNG_FILTER_SUB,   Z_FILTERED,         9 },
+    { PNG_FILTER_UP,    Z_FILTERED,         9 },
+    { PNG_FILTER_PAETH, Z_FILTERED,         9 },
+};
+
+// State shared by the encodings of one image.
+struct png_search
+{
+    const char* imageName;
+    image_info* imageInfo;
+    const png_plan* plan;
+    int compressionLevel;
+    nsecs_t deadline;
+
+    size_t bestSize;
+    int best;
+    int finished;
+    Vector<png_byte> bestData;
+};
+
+// Where one encoding is written.
+struct png_search_output
+{
+    png_search* search;
+    bool mustFinish;
+    Vector<png_byte> data;
+};
+
+static void png_search_error(png_structp png_ptr, png_const_charp msg)
+{
+    longjmp(png_jmpbuf(png_ptr), 1);
+}
+
+static void png_search_warning(png_structp png_ptr, png_const_charp msg)
+{
+}
+
+// Buffers the output and gives up on an encoding as soon as it can't win:
+// it's already larger than the best finished one, or the image ran out
+// of time (only the default encoding is exempt, so there's always one).
+static void png_write_search_output(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    png_search_output* out = (png_search_output*) png_get_io_ptr(png_ptr);
+    out->data.appendArray(data, length);
+    if (out->data.size() >= out->search->bestSize) {
+        png_error(png_ptr, "Larger than best");
+    }
+    if (!out->mustFinish && systemTime(SYSTEM_TIME_MONOTONIC) > out->search->deadline) {
+        png_error(png_ptr, "Out of time");
+    }
+}
+
+// Writes encoding "index" of the search's image, keeping it if it is the
+// smallest so far.
+static void search_png_encoding(png_search* search, int index)
+{
+    png_search_output out;
+    out.search = search;
+    out.mustFinish = index == 0;
+    if (!out.mustFinish && systemTime(SYSTEM_TIME_MONOTONIC) > search->deadline) {
+        return;
+    }
+
+    png_structp write_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL,
+            png_search_error, png_search_warning);
+    if (!write_ptr) {
+        return;
+    }
+    png_infop write_info = png_create_info_struct(write_ptr);
+    if (!write_info) {
+        png_destroy_write_struct(&write_ptr, NULL);
+        return;
+    }
+    if (setjmp(png_jmpbuf(write_ptr))) {
+        png_destroy_write_struct(&write_ptr, &write_info);
+        return;
+    }
+
+    png_set_write_fn(write_ptr, (void*) &out, png_write_search_output,
+                     png_flush_aapt_file);
+    encode_png(search->imageName, write_ptr, write_info, *search->imageInfo,
+               *search->plan, search->compressionLevel, kPngSearchEncodings[index]);
+    png_destroy_write_struct(&write_ptr, &write_info);
+
+    search->finished++;
+    if (out.data.size() < search->bestSize) {
+        search->bestData = out.data;
+        search->bestSize = out.data.size();
+        search->best = index;
+    }
+}
+
+/*
+ * Encode the image with each of kPngSearchEncodings and keep the smallest.
+ * The encodings run one after another: images are already crunched on
+ * --jobs threads, so a pool per image would only oversubscribe them.
+ * Encodings still running "budgetMs" after the search started are dropped.
+ */
+static bool search_png(const char* imageName, image_info& imageInfo,
+                       int grayscaleTolerance, int compressionLevel,
+                       int budgetMs, bool verbose, Vector<png_byte>* out)
+{
+    const int count = sizeof(kPngSearchEncodings) / sizeof(kPngSearchEncodings[0]);
+
+    png_plan plan;
+    plan_png(imageName, imageInfo, grayscaleTolerance, &plan);
+
+    png_search search;
+    search.imageName = imageName;
+    search.imageInfo = &imageInfo;
+    search.plan = &plan;
+    search.compressionLevel = compressionLevel;
+    search.deadline = systemTime(SYSTEM_TIME_MONOTONIC) + milliseconds_to_nanoseconds(budgetMs);
+    search.bestSize = (size_t) -1;
+    search.best = -1;
+    search.finished = 0;
+
+    for (int i = 0; i < count; i++) {
+        search_png_encoding(&search, i);
+    }
+    free_png_plan(&plan);
+
+    if (search.best < 0) {
+        return false;
+    }
+    if (verbose) {
+        printf("    (searched %d of %d encodings for %s: #%d is smallest, %d bytes)\n",
+               search.finished, count, imageName, search.best, (int) search.bestSize);
+    }
+    *out = search.bestData;
+    return true;
+}
+
+// The content of a source PNG, as preProcessImage() last saw it.
+struct PngSourceSig {
+    AaptUtil::FileStamp stamp;  // checkedAt is when the content was hashed
+    uint64_t hash;
+};
+
+// Crunched images remembered between packaging runs of one process,
+// keyed by source path.  An entry is only reused while the source's
+// content and the crunch settings are unchanged; the content is only
+// hashed again when its FileStamp no longer matches.  A NULL "data"
+// means the original bytes were kept.
+struct CrunchedImage {
+    PngSourceSig source;
+    int grayscaleTolerance;
+    int compressionLevel;
+    PngPassthrough passthrough;
+    int searchBudget;       // 0 without --png-search
+    sp<AaptFile> data;
+};
+
+static int pngSearchBudget(const Bundle* bundle)
+{
+    return bundle->getPngSearch() ? bundle->getPngSearchBudget() : 0;
+}
+
+static Mutex gCrunchedImagesLock;
+static bool gKeepCrunchedImages = false;
+static KeyedVector<String8, CrunchedImage> gCrunchedImages;
+
+void setKeepCrunchedImages(bool keep)
+{
+    Mutex::Autolock _l(gCrunchedImagesLock);
+    gKeepCrunchedImages = keep;
+    if (!keep) {
+        gCrunchedImages.clear();
+    }
+}
+
+/*
+ * Fill "outSig" for the source of "file" and reuse its remembered crunched
+ * image if there is one for this content and these settings.  Returns
+ * false when the image has to be crunched, or if "outSig" couldn't be
+ * filled, in which case "outSig->stamp.checkedAt" is 0.
+ */
+static bool findCrunchedImage(const sp<AaptFile>& file, const struct stat& st,
+                              const Bundle* bundle, PngPassthrough passthrough,
+                              PngSourceSig* outSig)
+{
+    CrunchedImage image;
+    bool found;
+    {
+        Mutex::Autolock _l(gCrunchedImagesLock);
+        ssize_t idx = gCrunchedImages.indexOfKey(file->getSourceFile());
+        found = idx >= 0;
+        if (found) {
+            image = gCrunchedImages.valueAt(idx);
+        }
+    }
+
+    if (found && image.source.stamp.matches(st)) {
+        *outSig = image.source;
+    } else {
+        outSig->stamp = AaptUtil::FileStamp(st, time(NULL));
+        if (!AaptUtil::hashFile(file->getSourceFile(), &outSig->hash, &outSig->stamp.size)) {
+            outSig->stamp.checkedAt = 0;
+            return false;
+        }
+    }
+
+    if (!found || image.source.hash != outSig->hash
+            || image.source.stamp.size != outSig->stamp.size
+            || image.grayscaleTolerance != bundle->getGrayscaleTolerance()
+            || image.compressionLevel != bundle->getCompressionLevel()
+            || image.passthrough != passthrough
+            || image.searchBudget != pngSearchBudget(bundle)) {
+        return false;
+    }
+    if (image.data != NULL
+            && file->writeData(image.data->getData(), image.data->getSize()) != NO_ERROR) {
+        return false;
+    }
+    if (outSig->stamp.checkedAt != image.source.stamp.checkedAt) {
+        // same content, so later builds needn't hash it again
+        Mutex::Autolock _l(gCrunchedImagesLock);
+        image.source = *outSig;
+        gCrunchedImages.replaceValueFor(file->getSourceFile(), image);
+    }
+    return true;
+}
+
+static void rememberCrunchedImage(const sp<AaptFile>& file, const PngSourceSig& sig,
+                                  const Bundle* bundle, PngPassthrough passthrough)
+{
+    if (sig.stamp.checkedAt == 0) {
+        return;
+    }
+
+    CrunchedImage image;
+    image.source = sig;
+    image.grayscaleTolerance = bundle->getGrayscaleTolerance();
+    image.compressionLevel = bundle->getCompressionLevel();
+    image.passthrough = passthrough;
+    image.searchBudget = pngSearchBudget(bundle);
+    if (file->hasData()) {
+        image.data = new AaptFile(file->getSourceFile(), file->getGroupEntry(),
+                                  file->getResourceType());
+        if (image.data->writeData(file->getData(), file->getSize()) != NO_ERROR) {
+            return;
+        }
+    }
+
+    Mutex::Autolock _l(gCrunchedImagesLock);
+    gCrunchedImages.replaceValueFor(file->getSourceFile(), image);
+}
+
+// Passing a PNG through means leaving the AaptFile without data, so the
+// source file is packaged as it is.
+
+static bool isGrayPaletteEntry(const unsigned char* rgb)
+{
+    return rgb[0] == rgb[1] && rgb[1] == rgb[2];
+}
+
+/*
+ * Walk the chunks of a PNG without decoding it and decide whether it is
+ * already stored the way write_png() would store it: a non-interlaced,
+ * opaque gray or palette image of at most 8 bits per pixel, with nothing
+ * but the chunks aapt writes itself.  The pixel data isn't looked at, so
+ * this trusts whoever wrote the file to have compressed it well; use
+ * --png-passthrough larger if that doesn't hold.
+ */
+static bool isAlreadyOptimalPng(const char* fileName)
+{
+    static const unsigned char kSignature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+
+    FILE* fp = fopen(fileName, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    bool optimal = false;
+    bool sawHeader = false;
+    bool hasTransparency = false;
+    bool grayPalette = false;
+    int bitDepth = 0;
+    int colorType = -1;
+
+    unsigned char buf[8];
+    if (fread(buf, 1, sizeof(buf), fp) != sizeof(buf) || memcmp(buf, kSignature, 8) != 0) {
+        fclose(fp);
+        return false;
+    }
+
+    while (fread(buf, 1, 8, fp) == 8) {
+        uint32_t length = ((uint32_t) buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+        const unsigned char* type = buf + 4;
+
+        if (memcmp(type, "IHDR", 4) == 0) {
+            unsigned char ihdr[13];
+            if (length != 13 || fread(ihdr, 1, 13, fp) != 13) {
+                break;
+            }
+            bitDepth = ihdr[8];
+            colorType = ihdr[9];
+            sawHeader = ihdr[12] == 0;  // not interlaced
+            length = 0;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            unsigned char rgb[3];
+            grayPalette = true;
+            for (uint32_t i = 0; i + 3 <= length; i += 3) {
+                if (fread(rgb, 1, 3, fp) != 3) {
+                    break;
+                }
+                grayPalette = grayPalette && isGrayPaletteEntry(rgb);
+            }
+            length %= 3;
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            hasTransparency = true;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            optimal = true;
+            break;
+        } else if (memcmp(type, "IDAT", 4) != 0) {
+            // ancillary or unknown chunks would be dropped by crunching
+            break;
+        }
+
+        // skip the rest of the chunk and its CRC
+        if (fseek(fp, (long) length + 4, SEEK_CUR) != 0) {
+            break;
+        }
+    }
+    fclose(fp);
+
+    if (!optimal || !sawHeader || bitDepth > 8) {
+        return false;
+    }
+    if (colorType == PNG_COLOR_TYPE_GRAY) {
+        return !hasTransparency;
+    }
+    if (colorType == PNG_COLOR_TYPE_PALETTE) {
+        // an opaque, all-gray palette would be written as plain gray
+        return !(grayPalette && !hasTransparency && bitDepth == 8);
+    }
+    return false;
+}
+
+/*
+ * Marker files in the --compression-cache directory record what crunching
+ * did to a source with these crunch settings.  A "keep" marker named by a
+ * hash of the content says the source didn't get any smaller.  So that an
+ * untouched source needn't be read to find it, a second marker named by
+ * the source's path, size and modification time says "keep" or "crunch".
+ */
+static String8 passthroughMarkerPath(const Bundle* bundle, uint64_t hash,
+                                     off_t size, const char* stamp, const char* kind)
+{
+    String8 name;
+    name.appendFormat("%08lx%08lx-%lu%s-g%d-l%d",
+            (unsigned long) (hash >> 32), (unsigned long) (hash & 0xffffffffUL),
+            (unsigned long) size,
+            stamp, bundle->getGrayscaleTolerance(), bundle->getCompressionLevel());
+    if (bundle->getPngSearch()) {
+        name.appendFormat("-s%d", bundle->getPngSearchBudget());
+    }
+    name.appendFormat(".png-%s", kind);
+    String8 path(bundle->getCompressionCacheDir());
+    path.appendPath(name);
+    return path;
+}
+
+static String8 sourceMarkerPath(const Bundle* bundle, const String8& sourceFile,
+                                const struct stat& st, const char* kind)
+{
+    uint64_t hash = AaptUtil::hashBytes(sourceFile.string(), sourceFile.length());
+    String8 stamp;
+    stamp.appendFormat("-t%ld", (long) st.st_mtime);
+    return passthroughMarkerPath(bundle, hash, st.st_size, stamp.string(), kind);
+}
+
+static void writePassthroughMarker(const Bundle* bundle, const String8& markerPath)
+{
+#ifdef HAVE_MS_C_RUNTIME
+    _mkdir(bundle->getCompressionCacheDir());
+#else
+    mkdir(bundle->getCompressionCacheDir(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
+#endif
+    FILE* fp = fopen(markerPath.string(), "wb");
+    if (fp != NULL) {
+        fclose(fp);
+    }
+}
+
+/* does the marker exist?  Touches it, so the cache's pruning keeps it */
+static bool findPassthroughMarker(const String8& markerPath)
+{
+    if (access(markerPath.string(), F_OK) != 0) {
+        return false;
+    }
+    AaptUtil::touchCacheEntry(markerPath);
+    return true;
+}
+
 status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
                          const sp<AaptFile>& file, String8* outNewLeafName)
 {
@@ -1252,6 +1832,78 @@ status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
 
     String8 printableName(file->getPrintableSource());
 
+    const size_t nameLen = file->getPath().length();
+    const bool is9Patch = nameLen > 6 && strcmp(file->getPath().string() + nameLen - 6, ".9.png") == 0;
+
+    // 9-patches always go through do_9patch(), which strips their border
+    const PngPassthrough passthrough =
+            is9Patch ? PNG_PASSTHROUGH_NEVER : bundle->getPngPassthrough();
+
+    const time_t startedAt = time(NULL);
+    struct stat st;
+    const bool haveStat = stat(file->getSourceFile().string(), &st) == 0;
+    PngSourceSig sig;
+    const bool remember = gKeepCrunchedImages && haveStat;
+    if (remember && findCrunchedImage(file, st, bundle, passthrough, &sig)) {
+        if (bundle->getVerbose()) {
+            printf("Reusing crunched image: %s\n", printableName.string());
+        }
+        return NO_ERROR;
+    }
+
+    if (passthrough == PNG_PASSTHROUGH_OPTIMIZED
+            && isAlreadyOptimalPng(file->getSourceFile().string())) {
+        if (bundle->getVerbose()) {
+            printf("Keeping already optimized image: %s\n", printableName.string());
+        }
+        if (remember) {
+            rememberCrunchedImage(file, sig, bundle, passthrough);
+        }
+        return NO_ERROR;
+    }
+
+    const bool useMarkers = passthrough != PNG_PASSTHROUGH_NEVER
+            && bundle->getCompressionCacheDir() != NULL && haveStat;
+    // only a trusted stamp can name the source
+    const bool stampable = useMarkers && AaptUtil::FileStamp(st, startedAt).trusted();
+    bool knownToShrink = false;
+    bool hashed = false;
+    uint64_t contentHash = 0;
+    off_t contentSize = 0;
+    if (useMarkers) {
+        bool keep = findPassthroughMarker(
+                sourceMarkerPath(bundle, file->getSourceFile(), st, "keep"));
+        if (!keep) {
+            knownToShrink = findPassthroughMarker(
+                    sourceMarkerPath(bundle, file->getSourceFile(), st, "crunch"));
+        }
+        if (!keep && !knownToShrink) {
+            if (sig.stamp.checkedAt != 0) {
+                contentHash = sig.hash;
+                contentSize = sig.stamp.size;
+                hashed = true;
+            } else {
+                hashed = AaptUtil::hashFile(file->getSourceFile(), &contentHash, &contentSize);
+            }
+            keep = hashed && findPassthroughMarker(
+                    passthroughMarkerPath(bundle, contentHash, contentSize, "", "keep"));
+            if (keep && stampable) {
+                writePassthroughMarker(bundle,
+                        sourceMarkerPath(bundle, file->getSourceFile(), st, "keep"));
+            }
+        }
+        if (keep) {
+            if (bundle->getVerbose()) {
+                printf("Keeping original image: %s (crunching didn't shrink it before)\n",
+                       printableName.string());
+            }
+            if (remember) {
+                rememberCrunchedImage(file, sig, bundle, passthrough);
+            }
+            return NO_ERROR;
+        }
+    }
+
     if (bundle->getVerbose()) {
         printf("Processing image: %s\n", printableName.string());
     }
@@ -1264,11 +1916,10 @@ status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
 
     png_structp write_ptr = NULL;
     png_infop write_info = NULL;
+    Vector<png_byte> searched;
 
     status_t error = UNKNOWN_ERROR;
 
-    const size_t nameLen = file->getPath().length();
-
     fp = fopen(file->getSourceFile().string(), "rb");
     if (fp == NULL) {
         fprintf(stderr, "%s: ERROR: Unable to open PNG file\n", printableName.string());
@@ -1294,42 +1945,80 @@ status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
 
     read_png(printableName.string(), read_ptr, read_info, &imageInfo);
 
-    if (nameLen > 6) {
-        const char* name = file->getPath().string();
-        if (name[nameLen-5] == '9' && name[nameLen-6] == '.') {
-            if (do_9patch(printableName.string(), &imageInfo) != NO_ERROR) {
-                goto bail;
-            }
+    if (is9Patch) {
+        if (do_9patch(printableName.string(), &imageInfo) != NO_ERROR) {
+            goto bail;
         }
     }
 
-    write_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, (png_error_ptr)NULL,
-                                        (png_error_ptr)NULL);
-    if (!write_ptr)
-    {
-        goto bail;
-    }
+    if (bundle->getPngSearch()) {
+        if (!search_png(printableName.string(), imageInfo, bundle->getGrayscaleTolerance(),
+                        bundle->getCompressionLevel(), bundle->getPngSearchBudget(),
+                        bundle->getVerbose(), &searched)
+                || file->writeData(searched.array(), searched.size()) != NO_ERROR) {
+            goto bail;
+        }
+    } else {
+        write_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, 0, (png_error_ptr)NULL,
+                                            (png_error_ptr)NULL);
+        if (!write_ptr)
+        {
+            goto bail;
+        }
 
-    write_info = png_create_info_struct(write_ptr);
-    if (!write_info)
-    {
-        goto bail;
-    }
+        write_info = png_create_info_struct(write_ptr);
+        if (!write_info)
+        {
+            goto bail;
+        }
 
-    png_set_write_fn(write_ptr, (void*)file.get(),
-                     png_write_aapt_file, png_flush_aapt_file);
+        png_set_write_fn(write_ptr, (void*)file.get(),
+                         png_write_aapt_file, png_flush_aapt_file);
 
-    if (setjmp(png_jmpbuf(write_ptr)))
-    {
-        goto bail;
-    }
+        if (setjmp(png_jmpbuf(write_ptr)))
+        {
+            goto bail;
+        }
 
-    write_png(printableName.string(), write_ptr, write_info, imageInfo,
-              bundle->getGrayscaleTolerance());
+        write_png(printableName.string(), write_ptr, write_info, imageInfo,
+                  bundle->getGrayscaleTolerance(), bundle->getCompressionLevel());
+    }
 
     error = NO_ERROR;
 
-    if (bundle->getVerbose()) {
+    if (passthrough != PNG_PASSTHROUGH_NEVER) {
+        fseek(fp, 0, SEEK_END);
+        size_t oldSize = (size_t)ftell(fp);
+        if (file->getSize() >= oldSize) {
+            if (bundle->getVerbose()) {
+                printf("    (keeping original image %s: crunched to %d bytes, source is %d)\n",
+                       printableName.string(), (int) file->getSize(), (int) oldSize);
+            }
+            file->clearData();
+        }
+    }
+    if (useMarkers && !file->hasData()) {
+        if (!hashed) {
+            hashed = AaptUtil::hashFile(file->getSourceFile(), &contentHash, &contentSize);
+        }
+        if (hashed) {
+            writePassthroughMarker(bundle,
+                    passthroughMarkerPath(bundle, contentHash, contentSize, "", "keep"));
+        }
+        if (stampable) {
+            writePassthroughMarker(bundle,
+                    sourceMarkerPath(bundle, file->getSourceFile(), st, "keep"));
+        }
+    } else if (stampable && !knownToShrink) {
+        writePassthroughMarker(bundle,
+                sourceMarkerPath(bundle, file->getSourceFile(), st, "crunch"));
+    }
+
+    if (remember) {
+        rememberCrunchedImage(file, sig, bundle, passthrough);
+    }
+
+    if (bundle->getVerbose() && file->hasData()) {
         fseek(fp, 0, SEEK_END);
         size_t oldSize = (size_t)ftell(fp);
         size_t newSize = file->getSize();
@@ -1425,6 +2114,26 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
         }
     }
 
+    if (bundle->getPngSearch()) {
+        Vector<png_byte> searched;
+        if (!search_png(dest.string(), imageInfo, bundle->getGrayscaleTolerance(),
+                        bundle->getCompressionLevel(), bundle->getPngSearchBudget(),
+                        bundle->getVerbose(), &searched)) {
+            return error;
+        }
+        fp = fopen(dest.string(), "wb");
+        if (!fp) {
+            fprintf(stderr, "%s ERROR: Unable to open PNG file\n", dest.string());
+            return error;
+        }
+        size_t written = fwrite(searched.array(), 1, searched.size(), fp);
+        if (fclose(fp) != 0 || written != searched.size()) {
+            fprintf(stderr, "%s ERROR: Unable to write PNG file\n", dest.string());
+            return error;
+        }
+        return NO_ERROR;
+    }
+
     // Call libpng to create a structure to hold the processed image data
     // that can be written to disk
     write_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
@@ -1461,7 +2170,7 @@ status_t preProcessImageToCache(const Bundle* bundle, const String8& source, con
 
     // Actually write out to the new png
     write_png(dest.string(), write_ptr, write_info, imageInfo,
-              bundle->getGrayscaleTolerance());
+              bundle->getGrayscaleTolerance(), bundle->getCompressionLevel());
 
     if (bundle->getVerbose()) {
         // Find the size of our new file
@@ -18,9 +18,26 @@ using android::String8;
 status_t preProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
                          const sp<AaptFile>& file, String8* outNewLeafName);
 
+/*
+ * When set, crunched PNGs are kept in memory and reused by later calls to
+ * preProcessImage() for the same, unchanged source file (daemon mode).
+ */
+void setKeepCrunchedImages(bool keep);
+
 status_t preProcessImageToCache(const Bundle* bundle, const String8& source, const String8& dest);
 
 status_t postProcessImage(const Bundle* bundle, const sp<AaptAssets>& assets,
                           ResourceTable* table, const sp<AaptFile>& file);
 
+/*
+ * Fold "width" RGBA8888 pixels into the running largest |r-g|, |g-b|,
+ * |b-r| and all-opaque flag used to pick a PNG color type.  scanRgbaRow()
+ * uses SSE2 where the host compiler targets it; scanRgbaRowScalar() is the
+ * one-pixel-at-a-time reference.  Exposed for tests.
+ */
+void scanRgbaRow(const unsigned char* row, int width,
+                 int* maxGrayDeviation, bool* isOpaque);
+void scanRgbaRowScalar(const unsigned char* row, int width,
+                       int* maxGrayDeviation, bool* isOpaque);
+
 #endif
@@ -0,0 +1,825 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Cached, mmap()able name -> ID index of the -I packages' resources.
+//
+
+#include "IncludedResIndex.h"
+#include "AaptUtil.h"
+#include "ZipFile.h"
+
+#include <androidfw/ResourceTypes.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_MS_C_RUNTIME
+#include <direct.h>
+#endif
+
+#include <algorithm>
+#include <vector>
+
+static const unsigned char kMagic[4] = { 'R', 'I', 'D', 'X' };
+enum {
+    kVersion        = 1,
+    kHeaderSize     = 40,   // magic, version, 4 x (offset, count)
+    kPackageSize    = 12,
+    kSlotSize       = 16,
+
+    kKeysPerBucket  = 4,
+    kMaxSeed        = 1 << 20,
+};
+
+static const uint32_t kNoKey = 0xffffffff;
+
+static inline uint32_t readU4(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static inline uint16_t readU2(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static void writeU4(std::vector<unsigned char>* out, uint32_t val)
+{
+    out->push_back((unsigned char) val);
+    out->push_back((unsigned char) (val >> 8));
+    out->push_back((unsigned char) (val >> 16));
+    out->push_back((unsigned char) (val >> 24));
+}
+
+/*
+ * 64-bit FNV-1a over the UTF-16 units of "package:type/name", fed in
+ * pieces so a lookup needn't build the key.
+ */
+static inline unsigned long long hashChars(unsigned long long hash,
+        const char16_t* s, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint16_t) s[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static unsigned long long hashKey(const char16_t* package, size_t packageLen,
+        const char16_t* type, size_t typeLen, const char16_t* name, size_t nameLen)
+{
+    static const char16_t colon = ':';
+    static const char16_t slash = '/';
+    unsigned long long hash = hashChars(AaptUtil::kHashSeed, package, packageLen);
+    hash = hashChars(hash, &colon, 1);
+    hash = hashChars(hash, type, typeLen);
+    hash = hashChars(hash, &slash, 1);
+    return hashChars(hash, name, nameLen);
+}
+
+static inline uint32_t bucketFor(unsigned long long hash, uint32_t bucketCount)
+{
+    return (uint32_t) ((hash >> 32) % bucketCount);
+}
+
+/* where a key lands with its bucket's seed; a 64-bit finalizer mix */
+static inline uint32_t slotFor(unsigned long long hash, uint32_t seed, uint32_t slotCount)
+{
+    unsigned long long z = hash ^ (seed * 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    return (uint32_t) (z % slotCount);
+}
+
+namespace {
+
+struct Key {
+    uint32_t offset;    // into Keys::chars
+    uint32_t len;
+    unsigned long long hash;
+    uint32_t resId;
+    uint32_t specFlags;
+};
+
+struct PackageName {
+    uint32_t offset;
+    uint32_t len;
+    uint32_t id;
+};
+
+struct Keys {
+    std::vector<uint16_t> chars;
+    std::vector<Key> keys;
+    std::vector<PackageName> packages;
+
+    uint32_t append(const char16_t* s, size_t len) {
+        uint32_t offset = chars.size();
+        chars.insert(chars.end(), s, s + len);
+        return offset;
+    }
+};
+
+} // namespace
+
+/*
+ * Collect the names, and with "outKeys" every entry, of one package
+ * chunk.  A type's name is in the type string pool and an entry's in
+ * the key string pool; the spec flags come from the type's spec chunk.
+ */
+static status_t parsePackage(const unsigned char* data, size_t size,
+        Vector<uint32_t>* outIds, Vector<String16>* outNames, Keys* outKeys)
+{
+    const ResTable_package* pkg = (const ResTable_package*) data;
+    const size_t headerSize = dtohs(pkg->header.headerSize);
+    const size_t minHeaderSize = (const unsigned char*) (&pkg->lastPublicKey + 1) - data;
+    if (size < minHeaderSize || headerSize < minHeaderSize || headerSize > size) {
+        return BAD_VALUE;
+    }
+
+    // shared libraries only get their ID when loaded
+    const uint32_t id = dtohl(pkg->id);
+    if (id == 0 || id > 0xff) {
+        return BAD_VALUE;
+    }
+    // types of a feature split are numbered after its base's
+    uint32_t typeIdOffset = 0;
+    if (headerSize >= minHeaderSize + sizeof(uint32_t)) {
+        typeIdOffset = readU4(data + minHeaderSize);
+    }
+
+    char16_t name[sizeof(pkg->name) / sizeof(pkg->name[0])];
+    size_t nameLen = 0;
+    while (nameLen < sizeof(pkg->name) / sizeof(pkg->name[0]) && pkg->name[nameLen] != 0) {
+        name[nameLen] = dtohs(pkg->name[nameLen]);
+        nameLen++;
+    }
+    if (outIds != NULL) {
+        outIds->add(id);
+    }
+    if (outNames != NULL) {
+        outNames->add(String16(name, nameLen));
+    }
+    if (outKeys == NULL) {
+        return NO_ERROR;
+    }
+
+    ResStringPool typeStrings;
+    ResStringPool keyStrings;
+    const size_t typeStringsStart = dtohl(pkg->typeStrings);
+    const size_t keyStringsStart = dtohl(pkg->keyStrings);
+    if (typeStringsStart >= size || keyStringsStart >= size
+            || typeStrings.setTo(data + typeStringsStart, size - typeStringsStart) != NO_ERROR
+            || keyStrings.setTo(data + keyStringsStart, size - keyStringsStart) != NO_ERROR) {
+        return BAD_VALUE;
+    }
+
+    std::vector<std::vector<uint32_t> > specFlags(256);
+    std::vector<std::vector<uint32_t> > keyIndexes(256);
+    size_t pos = headerSize;
+    while (pos + sizeof(ResChunk_header) <= size) {
+        const ResChunk_header* chunk = (const ResChunk_header*) (data + pos);
+        const size_t chunkSize = dtohl(chunk->size);
+        const size_t chunkHeaderSize = dtohs(chunk->headerSize);
+        if (chunkSize < sizeof(ResChunk_header) || chunkSize > size - pos
+                || chunkHeaderSize > chunkSize) {
+            return BAD_VALUE;
+        }
+
+        if (dtohs(chunk->type) == RES_TABLE_TYPE_SPEC_TYPE) {
+            const ResTable_typeSpec* spec = (const ResTable_typeSpec*) chunk;
+            if (chunkHeaderSize < sizeof(ResTable_typeSpec) || spec->id == 0) {
+                return BAD_VALUE;
+            }
+            const size_t count = dtohl(spec->entryCount);
+            if (count > (chunkSize - chunkHeaderSize) / sizeof(uint32_t)) {
+                return BAD_VALUE;
+            }
+            const uint32_t* flags = (const uint32_t*) (data + pos + chunkHeaderSize);
+            std::vector<uint32_t>& out = specFlags[spec->id];
+            out.resize(count);
+            for (size_t ei = 0; ei < count; ei++) {
+                out[ei] = dtohl(flags[ei]);
+            }
+        } else if (dtohs(chunk->type) == RES_TABLE_TYPE_TYPE) {
+            // configurations have grown over time, so don't insist on ours
+            const ResTable_type* type = (const ResTable_type*) chunk;
+            const size_t minTypeSize = (const unsigned char*) &type->config
+                    - (const unsigned char*) type;
+            if (chunkHeaderSize < minTypeSize || type->id == 0) {
+                return BAD_VALUE;
+            }
+            const size_t count = dtohl(type->entryCount);
+            const size_t entriesStart = dtohl(type->entriesStart);
+            if (count > (chunkSize - chunkHeaderSize) / sizeof(uint32_t)
+                    || entriesStart > chunkSize) {
+                return BAD_VALUE;
+            }
+            const uint32_t* offsets = (const uint32_t*) (data + pos + chunkHeaderSize);
+            std::vector<uint32_t>& out = keyIndexes[type->id];
+            if (out.size() < count) {
+                out.resize(count, kNoKey);
+            }
+            for (size_t ei = 0; ei < count; ei++) {
+                const uint32_t offset = dtohl(offsets[ei]);
+                if (out[ei] != kNoKey || offset == ResTable_type::NO_ENTRY) {
+                    continue;
+                }
+                if (offset > chunkSize - entriesStart
+                        || sizeof(ResTable_entry) > chunkSize - entriesStart - offset) {
+                    return BAD_VALUE;
+                }
+                const ResTable_entry* entry = (const ResTable_entry*)
+                        (data + pos + entriesStart + offset);
+                out[ei] = dtohl(entry->key.index);
+            }
+        }
+        pos += chunkSize;
+    }
+
+    PackageName packageName;
+    packageName.offset = outKeys->append(name, nameLen);
+    packageName.len = nameLen;
+    packageName.id = id;
+    outKeys->packages.push_back(packageName);
+
+    for (uint32_t typeId = 1; typeId < keyIndexes.size(); typeId++) {
+        const std::vector<uint32_t>& keys = keyIndexes[typeId];
+        if (keys.empty() || typeId - 1 < typeIdOffset) {
+            continue;
+        }
+        size_t typeLen;
+        const char16_t* typeName = typeStrings.stringAt(typeId - 1 - typeIdOffset, &typeLen);
+        if (typeName == NULL) {
+            continue;
+        }
+
+        for (size_t ei = 0; ei < keys.size() && ei <= 0xffff; ei++) {
+            size_t entryLen;
+            const char16_t* entryName = keys[ei] == kNoKey
+                    ? NULL : keyStrings.stringAt(keys[ei], &entryLen);
+            if (entryName == NULL) {
+                continue;
+            }
+
+            static const char16_t colon = ':';
+            static const char16_t slash = '/';
+            Key key;
+            key.offset = outKeys->append(name, nameLen);
+            outKeys->append(&colon, 1);
+            outKeys->append(typeName, typeLen);
+            outKeys->append(&slash, 1);
+            outKeys->append(entryName, entryLen);
+            key.len = outKeys->chars.size() - key.offset;
+            key.hash = hashKey(name, nameLen, typeName, typeLen, entryName, entryLen);
+            key.resId = (id << 24) | (typeId << 16) | ei;
+            key.specFlags = ei < specFlags[typeId].size() ? specFlags[typeId][ei] : 0;
+            outKeys->keys.push_back(key);
+        }
+    }
+    return NO_ERROR;
+}
+
+static status_t parseTable(const void* arsc, size_t size,
+        Vector<uint32_t>* outIds, Vector<String16>* outNames, Keys* outKeys)
+{
+    const unsigned char* data = (const unsigned char*) arsc;
+    if (size < sizeof(ResTable_header)) {
+        return BAD_VALUE;
+    }
+    const ResTable_header* header = (const ResTable_header*) data;
+    const size_t headerSize = dtohs(header->header.headerSize);
+    const size_t tableSize = dtohl(header->header.size);
+    if (dtohs(header->header.type) != RES_TABLE_TYPE
+            || headerSize < sizeof(ResTable_header) || headerSize > tableSize
+            || tableSize > size) {
+        return BAD_VALUE;
+    }
+
+    size_t pos = headerSize;
+    while (pos + sizeof(ResChunk_header) <= tableSize) {
+        const ResChunk_header* chunk = (const ResChunk_header*) (data + pos);
+        const size_t chunkSize = dtohl(chunk->size);
+        if (chunkSize < sizeof(ResChunk_header) || chunkSize > tableSize - pos) {
+            return BAD_VALUE;
+        }
+        if (dtohs(chunk->type) == RES_TABLE_PACKAGE_TYPE) {
+            status_t err = parsePackage(data + pos, chunkSize, outIds, outNames, outKeys);
+            if (err != NO_ERROR) {
+                return err;
+            }
+        }
+        pos += chunkSize;
+    }
+    return NO_ERROR;
+}
+
+static bool lessByHash(const Key& a, const Key& b)
+{
+    return a.hash < b.hash;
+}
+
+static bool sameKey(const Keys& keys, const Key& a, const Key& b)
+{
+    return a.len == b.len && std::equal(keys.chars.begin() + a.offset,
+            keys.chars.begin() + a.offset + a.len, keys.chars.begin() + b.offset);
+}
+
+/*
+ * Read all of a file, or of resources.arsc inside a package, into a
+ * malloc()ed buffer.
+ */
+static status_t readTable(const String8& path, bool isPackage, void** outData,
+        size_t* outSize)
+{
+    if (isPackage) {
+        ZipFile zip;
+        if (zip.open(path.string(), ZipFile::kOpenReadOnly) != NO_ERROR) {
+            return UNKNOWN_ERROR;
+        }
+        ZipEntry* entry = zip.getEntryByName("resources.arsc");
+        if (entry == NULL) {
+            return NAME_NOT_FOUND;
+        }
+        *outData = zip.uncompress(entry);
+        *outSize = entry->getUncompressedLen();
+        return *outData != NULL ? NO_ERROR : UNKNOWN_ERROR;
+    }
+
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return UNKNOWN_ERROR;
+    }
+    struct stat st;
+    void* data = NULL;
+    size_t size = 0;
+    if (fstat(fileno(fp), &st) == 0) {
+        size = (size_t) st.st_size;
+        data = malloc(size > 0 ? size : 1);
+        if (data != NULL && fread(data, 1, size, fp) != size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+    if (data == NULL) {
+        return UNKNOWN_ERROR;
+    }
+    *outData = data;
+    *outSize = size;
+    return NO_ERROR;
+}
+
+/*
+ * AaptUtil::hashFile() of "path", the cache key with the size, remembered
+ * in "cacheDir" together with the path and its FileStamp and reused while
+ * that matches, so an unchanged android.jar isn't read again on every run.
+ */
+static status_t sourceHash(const String8& cacheDir, const String8& path,
+        uint64_t* outHash, off_t* outSize)
+{
+    struct stat st;
+    if (stat(path.string(), &st) != 0) {
+        return UNKNOWN_ERROR;
+    }
+
+    uint64_t pathHash = AaptUtil::hashBytes(path.string(), path.length());
+    String8 name;
+    name.appendFormat("%08lx%08lx.src",
+            (unsigned long) (pathHash >> 32), (unsigned long) (pathHash & 0xffffffffUL));
+    String8 memoPath(cacheDir);
+    memoPath.appendPath(name);
+
+    FILE* fp = fopen(memoPath.string(), "r");
+    if (fp != NULL) {
+        long long modTime;
+        unsigned long size;
+        unsigned long long hash;
+        // room for the path, its newline and one more to catch a longer one
+        std::vector<char> stored(path.length() + 3);
+        bool hit = fscanf(fp, "%lld %lu %llx\n", &modTime, &size, &hash) == 3
+                && fgets(&stored[0], stored.size(), fp) != NULL
+                && modTime == (long long) st.st_mtime
+                && size == (unsigned long) st.st_size;
+        fclose(fp);
+        if (hit) {
+            stored[strcspn(&stored[0], "\n")] = 0;
+            hit = path == &stored[0];
+        }
+        if (hit) {
+            *outHash = hash;
+            *outSize = size;
+            return NO_ERROR;
+        }
+    }
+
+    const AaptUtil::FileStamp stamp(st, time(NULL));
+    if (!AaptUtil::hashFile(path, outHash, outSize)) {
+        return UNKNOWN_ERROR;
+    }
+    if (!stamp.trusted() || *outSize != st.st_size) {
+        return NO_ERROR;
+    }
+
+    // failures only cost the next run a hash
+    String8 tempPath(memoPath);
+    tempPath.appendFormat(".%d.tmp", (int) getpid());
+    fp = fopen(tempPath.string(), "w");
+    if (fp == NULL) {
+        return NO_ERROR;
+    }
+    fprintf(fp, "%lld %lu %llx\n%s\n", (long long) st.st_mtime, (unsigned long) *outSize,
+            (unsigned long long) *outHash, path.string());
+    if (fclose(fp) != 0 || rename(tempPath.string(), memoPath.string()) != 0) {
+        unlink(tempPath.string());
+    }
+    return NO_ERROR;
+}
+
+struct IncludedResIndex::Table {
+    const unsigned char* data;
+    size_t size;
+
+    const unsigned char* packages;
+    uint32_t packageCount;
+    const unsigned char* seeds;
+    uint32_t bucketCount;
+    const unsigned char* slots;
+    uint32_t slotCount;
+    const unsigned char* chars;
+    uint32_t charCount;
+
+    bool equals(uint32_t offset, uint32_t len, const char16_t* s, size_t sLen) const {
+        if (len != sLen || (uint64_t) offset + len > charCount) {
+            return false;
+        }
+        for (size_t i = 0; i < sLen; i++) {
+            if (readU2(chars + (offset + i) * 2) != (uint16_t) s[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* true if the key at "offset" is "package:type/name" */
+    bool matches(uint32_t offset, uint32_t len,
+            const char16_t* package, size_t packageLen,
+            const char16_t* type, size_t typeLen,
+            const char16_t* name, size_t nameLen) const {
+        static const char16_t colon = ':';
+        static const char16_t slash = '/';
+        return len == packageLen + typeLen + nameLen + 2
+                && equals(offset, packageLen, package, packageLen)
+                && equals(offset + packageLen, 1, &colon, 1)
+                && equals(offset + packageLen + 1, typeLen, type, typeLen)
+                && equals(offset + packageLen + 1 + typeLen, 1, &slash, 1)
+                && equals(offset + packageLen + 2 + typeLen, nameLen, name, nameLen);
+    }
+};
+
+IncludedResIndex::IncludedResIndex()
+{
+}
+
+IncludedResIndex::~IncludedResIndex()
+{
+    for (size_t i = 0; i < mTables.size(); i++) {
+        Table* t = mTables[i];
+        AaptUtil::unmapFile(t->data, t->size);
+        delete t;
+    }
+}
+
+sp<IncludedResIndex> IncludedResIndex::load(const Vector<String8>& paths,
+        const String8& cacheDir, bool verbose)
+{
+#ifdef HAVE_MS_C_RUNTIME
+    _mkdir(cacheDir.string());
+#else
+    mkdir(cacheDir.string(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
+#endif
+
+    sp<IncludedResIndex> index = new IncludedResIndex();
+    for (size_t i = 0; i < paths.size(); i++) {
+        // like AssetManager::addAssetPath(): a directory holds a
+        // resources.arsc, anything else is a package
+        struct stat st;
+        if (stat(paths[i].string(), &st) != 0) {
+            return NULL;
+        }
+        const bool isPackage = !S_ISDIR(st.st_mode);
+        String8 source(paths[i]);
+        if (!isPackage) {
+            source.appendPath("resources.arsc");
+        }
+
+        uint64_t hash;
+        off_t size;
+        if (sourceHash(cacheDir, source, &hash, &size) != NO_ERROR) {
+            return NULL;
+        }
+        String8 name;
+        name.appendFormat("%08lx%08lx-%lu.rid",
+                (unsigned long) (hash >> 32), (unsigned long) (hash & 0xffffffffUL),
+                (unsigned long) size);
+        String8 indexPath(cacheDir);
+        indexPath.appendPath(name);
+        if (index->add(indexPath.string()) == NO_ERROR) {
+            continue;
+        }
+
+        void* arsc = NULL;
+        size_t arscSize = 0;
+        status_t err = readTable(source, isPackage, &arsc, &arscSize);
+        if (err == NO_ERROR) {
+            err = write(indexPath.string(), arsc, arscSize);
+            free(arsc);
+        }
+        if (err == NO_ERROR) {
+            err = index->add(indexPath.string());
+        }
+        if (err != NO_ERROR) {
+            if (verbose) {
+                printf("Unable to index resources of %s; using the resource table\n",
+                        paths[i].string());
+            }
+            return NULL;
+        }
+        if (verbose) {
+            printf("Indexed resources of %s in %s\n", paths[i].string(), indexPath.string());
+        }
+    }
+
+    // ResTable groups packages by ID under the first one's name, which
+    // a per-file index can't reproduce
+    for (size_t a = 0; a < index->mTables.size(); a++) {
+        const Table* ta = index->mTables[a];
+        for (size_t b = a; b < index->mTables.size(); b++) {
+            const Table* tb = index->mTables[b];
+            for (uint32_t pa = 0; pa < ta->packageCount; pa++) {
+                const unsigned char* ea = ta->packages + pa * kPackageSize;
+                for (uint32_t pb = (a == b ? pa + 1 : 0); pb < tb->packageCount; pb++) {
+                    const unsigned char* eb = tb->packages + pb * kPackageSize;
+                    if (readU4(ea + 8) == readU4(eb + 8)) {
+                        if (verbose) {
+                            printf("Included packages share ID 0x%02x; using the resource table\n",
+                                    readU4(ea + 8));
+                        }
+                        return NULL;
+                    }
+                }
+            }
+        }
+    }
+    return index;
+}
+
+status_t IncludedResIndex::write(const char* path, const void* arsc, size_t size)
+{
+    Keys keys;
+    status_t err = parseTable(arsc, size, NULL, NULL, &keys);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    // Drop repeats, as when two packages share a name; the first wins,
+    // as it does in ResTable.  Keys that only share a hash would need a
+    // second probe, so those tables aren't indexed.
+    std::stable_sort(keys.keys.begin(), keys.keys.end(), lessByHash);
+    std::vector<Key> unique;
+    unique.reserve(keys.keys.size());
+    for (size_t i = 0; i < keys.keys.size(); i++) {
+        if (!unique.empty() && unique.back().hash == keys.keys[i].hash) {
+            if (!sameKey(keys, unique.back(), keys.keys[i])) {
+                fprintf(stderr, "ERROR: Hash collision indexing resources\n");
+                return UNKNOWN_ERROR;
+            }
+            continue;
+        }
+        unique.push_back(keys.keys[i]);
+    }
+
+    // Place the biggest buckets first, each with the first seed that
+    // puts all of its keys in free slots.
+    const uint32_t n = unique.size();
+    const uint32_t bucketCount = n / kKeysPerBucket + 1;
+    const uint32_t slotCount = n + n / 8 + 1;
+    std::vector<std::vector<uint32_t> > buckets(bucketCount);
+    for (uint32_t i = 0; i < n; i++) {
+        buckets[bucketFor(unique[i].hash, bucketCount)].push_back(i);
+    }
+    std::vector<std::pair<size_t, uint32_t> > order;
+    order.reserve(bucketCount);
+    for (uint32_t b = 0; b < bucketCount; b++) {
+        if (!buckets[b].empty()) {
+            order.push_back(std::make_pair(buckets[b].size(), b));
+        }
+    }
+    std::sort(order.rbegin(), order.rend());
+
+    std::vector<uint32_t> seeds(bucketCount, 0);
+    std::vector<uint32_t> slotKey(slotCount, kNoKey);
+    std::vector<uint32_t> placed;
+    for (size_t o = 0; o < order.size(); o++) {
+        const std::vector<uint32_t>& bucket = buckets[order[o].second];
+        uint32_t seed = 0;
+        for (; seed < kMaxSeed; seed++) {
+            placed.clear();
+            for (size_t k = 0; k < bucket.size(); k++) {
+                const uint32_t slot = slotFor(unique[bucket[k]].hash, seed, slotCount);
+                if (slotKey[slot] != kNoKey
+                        || std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+                    break;
+                }
+                placed.push_back(slot);
+            }
+            if (placed.size() == bucket.size()) {
+                break;
+            }
+        }
+        if (seed == kMaxSeed) {
+            fprintf(stderr, "ERROR: Unable to build resource index hash\n");
+            return UNKNOWN_ERROR;
+        }
+        seeds[order[o].second] = seed;
+        for (size_t k = 0; k < bucket.size(); k++) {
+            slotKey[placed[k]] = bucket[k];
+        }
+    }
+
+    std::vector<unsigned char> body;
+    const size_t packagesStart = kHeaderSize;
+    for (size_t p = 0; p < keys.packages.size(); p++) {
+        writeU4(&body, keys.packages[p].offset);
+        writeU4(&body, keys.packages[p].len);
+        writeU4(&body, keys.packages[p].id);
+    }
+    const size_t seedsStart = kHeaderSize + body.size();
+    for (uint32_t b = 0; b < bucketCount; b++) {
+        writeU4(&body, seeds[b]);
+    }
+    const size_t slotsStart = kHeaderSize + body.size();
+    for (uint32_t s = 0; s < slotCount; s++) {
+        if (slotKey[s] == kNoKey) {
+            for (int i = 0; i < 4; i++) {
+                writeU4(&body, 0);
+            }
+            continue;
+        }
+        const Key& key = unique[slotKey[s]];
+        writeU4(&body, key.offset);
+        writeU4(&body, key.len);
+        writeU4(&body, key.resId);
+        writeU4(&body, key.specFlags);
+    }
+    const size_t charsStart = kHeaderSize + body.size();
+    for (size_t c = 0; c < keys.chars.size(); c++) {
+        body.push_back((unsigned char) keys.chars[c]);
+        body.push_back((unsigned char) (keys.chars[c] >> 8));
+    }
+
+    std::vector<unsigned char> header(kMagic, kMagic + sizeof(kMagic));
+    writeU4(&header, kVersion);
+    writeU4(&header, packagesStart);
+    writeU4(&header, keys.packages.size());
+    writeU4(&header, seedsStart);
+    writeU4(&header, bucketCount);
+    writeU4(&header, slotsStart);
+    writeU4(&header, slotCount);
+    writeU4(&header, charsStart);
+    writeU4(&header, keys.chars.size());
+
+    // several aapt processes may share the cache, so write a temp file
+    // and rename it; a reader never maps half an index
+    String8 tmpPath(path);
+    tmpPath.appendFormat(".%d.tmp", (int) getpid());
+    FILE* fp = fopen(tmpPath.string(), "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open resource index %s: %s\n",
+                tmpPath.string(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    bool ok = fwrite(&header[0], 1, header.size(), fp) == header.size()
+            && fwrite(&body[0], 1, body.size(), fp) == body.size();
+    ok = fclose(fp) == 0 && ok;
+#ifdef HAVE_MS_C_RUNTIME
+    // rename() won't replace an existing file here
+    unlink(path);
+#endif
+    if (!ok || rename(tmpPath.string(), path) != 0) {
+        fprintf(stderr, "ERROR: Unable to write resource index %s\n", path);
+        unlink(tmpPath.string());
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+status_t IncludedResIndex::getPackages(const void* arsc, size_t size,
+        Vector<uint32_t>* outIds, Vector<String16>* outNames)
+{
+    return parseTable(arsc, size, outIds, outNames, NULL);
+}
+
+status_t IncludedResIndex::add(const char* path)
+{
+    size_t size;
+    const void* data = AaptUtil::mapFile(path, &size);
+    if (data == NULL) {
+        return errno == ENOENT ? NAME_NOT_FOUND : UNKNOWN_ERROR;
+    }
+    if (size < kHeaderSize) {
+        AaptUtil::unmapFile(data, size);
+        return BAD_VALUE;
+    }
+
+    Table* t = new Table();
+    t->data = (const unsigned char*) data;
+    t->size = size;
+
+    // each table has to lie inside the file; keys are checked on use
+    const unsigned char* h = t->data;
+    const uint32_t tables[4][2] = {
+        { readU4(h + 8),  readU4(h + 12) },
+        { readU4(h + 16), readU4(h + 20) },
+        { readU4(h + 24), readU4(h + 28) },
+        { readU4(h + 32), readU4(h + 36) },
+    };
+    const size_t entrySizes[4] = { kPackageSize, 4, kSlotSize, 2 };
+    bool ok = memcmp(h, kMagic, sizeof(kMagic)) == 0 && readU4(h + 4) == kVersion
+            && tables[1][1] > 0 && tables[2][1] > 0;
+    for (int i = 0; ok && i < 4; i++) {
+        const uint64_t end = tables[i][0] + (uint64_t) tables[i][1] * entrySizes[i];
+        ok = tables[i][0] >= kHeaderSize && end <= size;
+    }
+    if (!ok) {
+        AaptUtil::unmapFile(data, size);
+        delete t;
+        return BAD_VALUE;
+    }
+
+    t->packages = t->data + tables[0][0];
+    t->packageCount = tables[0][1];
+    t->seeds = t->data + tables[1][0];
+    t->bucketCount = tables[1][1];
+    t->slots = t->data + tables[2][0];
+    t->slotCount = tables[2][1];
+    t->chars = t->data + tables[3][0];
+    t->charCount = tables[3][1];
+    mTables.add(t);
+    return NO_ERROR;
+}
+
+bool IncludedResIndex::hasPackage(const char16_t* package, size_t packageLen,
+        uint32_t* outId) const
+{
+    for (size_t i = 0; i < mTables.size(); i++) {
+        const Table* t = mTables[i];
+        for (uint32_t p = 0; p < t->packageCount; p++) {
+            const unsigned char* entry = t->packages + p * kPackageSize;
+            if (t->equals(readU4(entry), readU4(entry + 4), package, packageLen)) {
+                if (outId != NULL) {
+                    *outId = readU4(entry + 8);
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+uint32_t IncludedResIndex::identifierForName(const char16_t* name, size_t nameLen,
+        const char16_t* type, size_t typeLen,
+        const char16_t* package, size_t packageLen,
+        uint32_t* outTypeSpecFlags) const
+{
+    static const char16_t attr[] = { 'a', 't', 't', 'r' };
+    static const char16_t attrPrivate[] = { '^', 'a', 't', 't', 'r', '-',
+            'p', 'r', 'i', 'v', 'a', 't', 'e' };
+    const unsigned long long hash = hashKey(package, packageLen, type, typeLen, name, nameLen);
+    for (size_t i = 0; i < mTables.size(); i++) {
+        const Table* t = mTables[i];
+        const uint32_t seed = readU4(t->seeds + bucketFor(hash, t->bucketCount) * 4);
+        const unsigned char* slot = t->slots + slotFor(hash, seed, t->slotCount) * kSlotSize;
+        if (t->matches(readU4(slot), readU4(slot + 4), package, packageLen,
+                type, typeLen, name, nameLen)) {
+            if (outTypeSpecFlags != NULL) {
+                *outTypeSpecFlags = readU4(slot + 12);
+            }
+            return readU4(slot + 8);
+        }
+    }
+
+    // like ResTable, an attr that isn't there may be a private one
+    if (typeLen == sizeof(attr) / sizeof(attr[0])
+            && memcmp(type, attr, sizeof(attr)) == 0) {
+        return identifierForName(name, nameLen, attrPrivate,
+                sizeof(attrPrivate) / sizeof(attrPrivate[0]), package, packageLen,
+                outTypeSpecFlags);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Cached, mmap()able name -> ID index of the -I packages' resources.
+//
+
+#ifndef __INCLUDED_RES_INDEX_H
+#define __INCLUDED_RES_INDEX_H
+
+#include <utils/Errors.h>
+#include <utils/RefBase.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+using namespace android;
+
+/*
+ * Every reference to an android: or base-package resource is resolved
+ * with ResTable::identifierForName(), which walks the package's type and
+ * key string pools.  With --include-index-cache, each -I input gets an
+ * index of all its (package, type, name) -> (resID, specFlags) pairs,
+ * built once and stored under the hash of the input's content; later
+ * runs map it and answer those lookups with one hash probe.  The hash
+ * itself is remembered by path, size and modification time, so an
+ * unchanged input isn't read at all.
+ *
+ * The index is a perfect hash (hash and displace): a key's
+ * 64-bit hash picks a bucket, the bucket's seed picks the slot, and the
+ * slot holds the key itself to reject names that aren't there.
+ *
+ * Layout (all integers little-endian uint32):
+ *
+ *   header    magic "RIDX", version, then (offset, count) of the package
+ *             table, bucket seeds, slots and key characters
+ *   packages  { name, nameLen, id } of each package in the table
+ *   seeds     one per bucket
+ *   slots     { key, keyLen, resID, specFlags }; keyLen 0 if unused
+ *   chars     UTF-16 keys, "package:type/name"
+ */
+class IncludedResIndex : public RefBase {
+public:
+    IncludedResIndex();
+    virtual ~IncludedResIndex();
+
+    /*
+     * Map the index of each of "paths" (as given to -I), building and
+     * storing those "cacheDir" doesn't have yet.  Returns NULL if any of
+     * them can't be indexed, in which case everything should go to the
+     * ResTable.
+     */
+    static sp<IncludedResIndex> load(const Vector<String8>& paths,
+            const String8& cacheDir, bool verbose);
+
+    /* write the index of a flattened resource table (resources.arsc) */
+    static status_t write(const char* path, const void* arsc, size_t size);
+
+    /* append the IDs and names of the packages in a flattened resource table */
+    static status_t getPackages(const void* arsc, size_t size,
+            Vector<uint32_t>* outIds, Vector<String16>* outNames);
+
+    /* map one index file; lookups search them in the order added */
+    status_t add(const char* path);
+
+    /* true if one of the indexed tables has a package by this name */
+    bool hasPackage(const char16_t* package, size_t packageLen,
+            uint32_t* outId = NULL) const;
+
+    /*
+     * Same result as ResTable::identifierForName() with an explicit
+     * package and type, for a package hasPackage() knows: the ID, or 0
+     * if there's no such resource.
+     */
+    uint32_t identifierForName(const char16_t* name, size_t nameLen,
+            const char16_t* type, size_t typeLen,
+            const char16_t* package, size_t packageLen,
+            uint32_t* outTypeSpecFlags = NULL) const;
+
+private:
+    struct Table;
+
+    Vector<Table*> mTables;
+};
+
+#endif // __INCLUDED_RES_INDEX_H
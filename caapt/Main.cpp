@@ -5,6 +5,7 @@
 //
 #include "Main.h"
 #include "Bundle.h"
+#include "AaptUtil.h"
 
 #include <utils/Log.h>
 #include <utils/threads.h>
@@ -14,10 +15,12 @@
 #include <stdlib.h>
 #include <getopt.h>
 #include <assert.h>
+#include <unistd.h>
 
 using namespace android;
 
 static const char* gProgName = "aapt";
+static const char* gProgPath = gProgName;
 
 /*
  * When running under Cygwin on Windows, this will convert slash-based
@@ -73,7 +76,7 @@ void usage(void)
         "        [--split CONFIGS [--split CONFIGS]] \\\n"
         "        [--feature-of package [--feature-after package]] \\\n"
         "        [raw-files-dir [raw-files-dir] ...] \\\n"
-        "        [--output-text-symbols DIR]\n"
+        "        [--output-text-symbols DIR] [--output-r-jar FILE]\n"
         "        [--apk-module moduleName]\n"
         "\n"
         "   Package the android resources.  It will read assets and resources that are\n"
@@ -94,6 +97,13 @@ void usage(void)
     fprintf(stderr,
         " %s s[ingleCrunch] [-v] -i input-file -o outputfile\n"
         "   Do PNG preprocessing on a single file.\n\n", gProgName);
+    fprintf(stderr,
+        " %s b[atch] [package options shared by all modules] manifest-file\n"
+        "   Package several modules in one run.  Each non-empty line of the\n"
+        "   manifest holds the package options of one module (for example\n"
+        "   -S, -M, -F, -J, --apk-module and --public-R-path); lines starting\n"
+        "   with '#' are ignored.  Included packages (-I) are loaded once and\n"
+        "   shared by every module, and modules are built in parallel.\n\n", gProgName);
     fprintf(stderr,
         " %s v[ersion]\n"
         "   Print program version.\n\n", gProgName);
@@ -132,6 +142,10 @@ void usage(void)
         "       compress any files at all.\n"
         "   --apk-module\n"
         "       hotel,flight,train,myctrip,train,schedule\n"
+        "   --attr-fallback-package\n"
+        "       Package in which to look up an XML attribute that the package of its\n"
+        "       namespace doesn't define.  Defaults to ctrip.android.view; an empty\n"
+        "       name turns the fallback off.\n"
         "   --debug-mode\n"
         "       inserts android:debuggable=\"true\" in to the application node of the\n"
         "       manifest, making the application debuggable even on production devices.\n"
@@ -209,9 +223,45 @@ void usage(void)
         "       Insertion typically fails if the manifest already defines the attribute.\n"
         "   --error-on-missing-config-entry\n"
         "       Forces aapt to return an error if it fails to find an entry for a configuration.\n"
+        "   --jobs\n"
+        "       Number of threads (and, for batch, modules) to run in parallel.\n"
+        "       Defaults to the number of online CPUs.\n"
+        "   --compression-level\n"
+        "       zlib level (0-9) for compressed .apk entries and crunched PNGs.\n"
+        "       Defaults to 9, the smallest output.\n"
+        "   --fast\n"
+        "       Trade output size for packaging speed, for debug and CI builds.\n"
+        "       Same as --compression-level 1.\n"
+        "   --compression-cache\n"
+        "       Directory in which to keep deflated .apk entries, keyed by content and\n"
+        "       compression level, so unchanged files aren't compressed again.\n"
+        "       Also remembers PNGs that crunching can't make smaller.\n"
+        "   --include-index-cache\n"
+        "       Directory in which to keep an index of the resource names of each -I\n"
+        "       package, keyed by its content, so they are looked up without searching\n"
+        "       its resource table.\n"
+        "   --compiled-xml-cache\n"
+        "       Directory in which to keep each compiled XML resource file, keyed by its\n"
+        "       content, with the resource lookups it made.  An unchanged file whose\n"
+        "       lookups still give the same results isn't parsed or flattened again.\n"
+        "   --png-passthrough\n"
+        "       When to package a PNG's original bytes instead of crunching it:\n"
+        "       'never' (default), 'larger' (when the crunched image isn't smaller),\n"
+        "       or 'optimized' (also skip palette and gray PNGs that are already\n"
+        "       stored the way aapt would write them).\n"
+        "   --png-search\n"
+        "       Encode each crunched PNG with several filter and zlib settings and\n"
+        "       keep the smallest.  Slower; meant for release builds.\n"
+        "   --png-search-budget\n"
+        "       Milliseconds --png-search may spend per image.  Defaults to 2000.\n"
         "   --output-text-symbols\n"
         "       Generates a text file containing the resource symbols of the R class in the\n"
-        "       specified folder.\n"
+        "       specified folder.  Without --public-R-path, also writes R.idx, a binary\n"
+        "       index of the same class that --public-R-path accepts in place of R.java.\n"
+        "   --output-r-jar\n"
+        "       Writes the R classes straight into the specified jar as compiled .class\n"
+        "       files, instead of (or as well as, with -J) generating R.java.  Honors\n"
+        "       --non-constant-id and --public-R-path.\n"
         "   --ignore-assets\n"
         "       Assets to be ignored. Default pattern is:\n"
         "       %s\n",
@@ -219,79 +269,16 @@ void usage(void)
 }
 
 /*
- * Dispatch the command.
- */
-int handleCommand(Bundle* bundle)
-{
-    //printf("--- command %d (verbose=%d force=%d):\n",
-    //    bundle->getCommand(), bundle->getVerbose(), bundle->getForce());
-    //for (int i = 0; i < bundle->getFileSpecCount(); i++)
-    //    printf("  %d: '%s'\n", i, bundle->getFileSpecEntry(i));
-
-    switch (bundle->getCommand()) {
-    case kCommandVersion:      return doVersion(bundle);
-    case kCommandList:         return doList(bundle);
-    case kCommandDump:         return doDump(bundle);
-    case kCommandAdd:          return doAdd(bundle);
-    case kCommandRemove:       return doRemove(bundle);
-    case kCommandPackage:      return doPackage(bundle);
-    case kCommandCrunch:       return doCrunch(bundle);
-    case kCommandSingleCrunch: return doSingleCrunch(bundle);
-    case kCommandDaemon:       return runInDaemonMode(bundle);
-    default:
-        fprintf(stderr, "%s: requested command not yet supported\n", gProgName);
-        return 1;
-    }
-}
-
-/*
- * Parse args.
+ * Pull out flags.  We support "-fv" and "-f -v".
+ *
+ * Returns the number of arguments consumed, or -1 if the flags were
+ * malformed and usage should be printed.
  */
-int main(int argc, char* const argv[])
+static int parseFlags(Bundle* bundle, int argc, char* const argv[])
 {
-    char *prog = argv[0];
-    Bundle bundle;
-    bool wantUsage = false;
-    int result = 1;    // pessimistically assume an error.
+    const int origArgc = argc;
     int tolerance = 0;
 
-    /* default to compression */
-    bundle.setCompressionMethod(ZipEntry::kCompressDeflated);
-
-    if (argc < 2) {
-        wantUsage = true;
-        goto bail;
-    }
-
-    if (argv[1][0] == 'v')
-        bundle.setCommand(kCommandVersion);
-    else if (argv[1][0] == 'd')
-        bundle.setCommand(kCommandDump);
-    else if (argv[1][0] == 'l')
-        bundle.setCommand(kCommandList);
-    else if (argv[1][0] == 'a')
-        bundle.setCommand(kCommandAdd);
-    else if (argv[1][0] == 'r')
-        bundle.setCommand(kCommandRemove);
-    else if (argv[1][0] == 'p')
-        bundle.setCommand(kCommandPackage);
-    else if (argv[1][0] == 'c')
-        bundle.setCommand(kCommandCrunch);
-    else if (argv[1][0] == 's')
-        bundle.setCommand(kCommandSingleCrunch);
-    else if (argv[1][0] == 'm')
-        bundle.setCommand(kCommandDaemon);
-    else {
-        fprintf(stderr, "ERROR: Unknown command '%s'\n", argv[1]);
-        wantUsage = true;
-        goto bail;
-    }
-    argc -= 2;
-    argv += 2;
-
-    /*
-     * Pull out flags.  We support "-fv" and "-f -v".
-     */
     while (argc && argv[0][0] == '-') {
         /* flag(s) found */
         const char* cp = argv[0] +1;
@@ -299,415 +286,481 @@ int main(int argc, char* const argv[])
         while (*cp != '\0') {
             switch (*cp) {
             case 'v':
-                bundle.setVerbose(true);
+                bundle->setVerbose(true);
                 break;
             case 'a':
-                bundle.setAndroidList(true);
+                bundle->setAndroidList(true);
                 break;
             case 'c':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-c' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
-                bundle.addConfigurations(argv[0]);
+                bundle->addConfigurations(argv[0]);
                 break;
             case 'f':
-                bundle.setForce(true);
+                bundle->setForce(true);
                 break;
             case 'g':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-g' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 tolerance = atoi(argv[0]);
-                bundle.setGrayscaleTolerance(tolerance);
-                printf("%s: Images with deviation <= %d will be forced to grayscale.\n", prog, tolerance);
+                bundle->setGrayscaleTolerance(tolerance);
+                printf("%s: Images with deviation <= %d will be forced to grayscale.\n", gProgPath, tolerance);
                 break;
             case 'k':
-                bundle.setJunkPath(true);
+                bundle->setJunkPath(true);
                 break;
             case 'm':
-                bundle.setMakePackageDirs(true);
+                bundle->setMakePackageDirs(true);
                 break;
 #if 0
             case 'p':
-                bundle.setPseudolocalize(true);
+                bundle->setPseudolocalize(true);
                 break;
 #endif
             case 'u':
-                bundle.setUpdate(true);
+                bundle->setUpdate(true);
                 break;
             case 'x':
-                bundle.setExtending(true);
+                bundle->setExtending(true);
                 break;
             case 'z':
-                bundle.setRequireLocalization(true);
+                bundle->setRequireLocalization(true);
                 break;
             case 'j':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-j' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.addJarFile(argv[0]);
+                bundle->addJarFile(argv[0]);
                 break;
             case 'A':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-A' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.addAssetSourceDir(argv[0]);
+                bundle->addAssetSourceDir(argv[0]);
                 break;
             case 'G':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-G' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.setProguardFile(argv[0]);
+                bundle->setProguardFile(argv[0]);
                 break;
             case 'I':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-I' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.addPackageInclude(argv[0]);
+                bundle->addPackageInclude(argv[0]);
                 break;
             case 'F':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-F' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.setOutputAPKFile(argv[0]);
+                bundle->setOutputAPKFile(argv[0]);
                 break;
             case 'J':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-J' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.setRClassDir(argv[0]);
+                bundle->setRClassDir(argv[0]);
                 break;
             case 'M':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-M' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.setAndroidManifestFile(argv[0]);
+                bundle->setAndroidManifestFile(argv[0]);
                 break;
             case 'P':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-P' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.setPublicOutputFile(argv[0]);
+                bundle->setPublicOutputFile(argv[0]);
                 break;
             case 'S':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-S' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.addResourceSourceDir(argv[0]);
+                bundle->addResourceSourceDir(argv[0]);
                 break;
             case 'C':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-C' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.setCrunchedOutputDir(argv[0]);
+                bundle->setCrunchedOutputDir(argv[0]);
                 break;
             case 'i':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-i' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.setSingleCrunchInputFile(argv[0]);
+                bundle->setSingleCrunchInputFile(argv[0]);
                 break;
             case 'o':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-o' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 convertPath(argv[0]);
-                bundle.setSingleCrunchOutputFile(argv[0]);
+                bundle->setSingleCrunchOutputFile(argv[0]);
                 break;
             case '0':
                 argc--;
                 argv++;
                 if (!argc) {
                     fprintf(stderr, "ERROR: No argument supplied for '-e' option\n");
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 if (argv[0][0] != 0) {
-                    bundle.addNoCompressExtension(argv[0]);
+                    bundle->addNoCompressExtension(argv[0]);
                 } else {
-                    bundle.setCompressionMethod(ZipEntry::kCompressStored);
+                    bundle->setCompressionMethod(ZipEntry::kCompressStored);
                 }
                 break;
             case '-':
                 if (strcmp(cp, "-debug-mode") == 0) {
-                    bundle.setDebugMode(true);
+                    bundle->setDebugMode(true);
                 } else if (strcmp(cp, "-min-sdk-version") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--min-sdk-version' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setMinSdkVersion(argv[0]);
+                    bundle->setMinSdkVersion(argv[0]);
                 } else if (strcmp(cp, "-target-sdk-version") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--target-sdk-version' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setTargetSdkVersion(argv[0]);
+                    bundle->setTargetSdkVersion(argv[0]);
                 } else if (strcmp(cp, "-max-sdk-version") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--max-sdk-version' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setMaxSdkVersion(argv[0]);
+                    bundle->setMaxSdkVersion(argv[0]);
                 } else if (strcmp(cp, "-max-res-version") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--max-res-version' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setMaxResVersion(argv[0]);
+                    bundle->setMaxResVersion(argv[0]);
                 } else if (strcmp(cp, "-version-code") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--version-code' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setVersionCode(argv[0]);
+                    bundle->setVersionCode(argv[0]);
                 } else if (strcmp(cp, "-version-name") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--version-name' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setVersionName(argv[0]);
+                    bundle->setVersionName(argv[0]);
                 } else if (strcmp(cp, "-replace-version") == 0) {
-                    bundle.setReplaceVersion(true);
+                    bundle->setReplaceVersion(true);
                 } else if (strcmp(cp, "-values") == 0) {
-                    bundle.setValues(true);
+                    bundle->setValues(true);
                 } else if (strcmp(cp, "-include-meta-data") == 0) {
-                    bundle.setIncludeMetaData(true);
+                    bundle->setIncludeMetaData(true);
                 } else if (strcmp(cp, "-custom-package") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--custom-package' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setCustomPackage(argv[0]);
+                    bundle->setCustomPackage(argv[0]);
                 } else if (strcmp(cp, "-extra-packages") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--extra-packages' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setExtraPackages(argv[0]);
+                    bundle->setExtraPackages(argv[0]);
                 } else if (strcmp(cp, "-generate-dependencies") == 0) {
-                    bundle.setGenDependencies(true);
+                    bundle->setGenDependencies(true);
                 } else if (strcmp(cp, "-utf16") == 0) {
-                    bundle.setWantUTF16(true);
+                    bundle->setWantUTF16(true);
                 } else if (strcmp(cp, "-preferred-density") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--preferred-density' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setPreferredDensity(argv[0]);
+                    bundle->setPreferredDensity(argv[0]);
                 } else if (strcmp(cp, "-split") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--split' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.addSplitConfigurations(argv[0]);
+                    bundle->addSplitConfigurations(argv[0]);
                 }
                 else if(strcmp(cp, "-apk-module") == 0){
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--apk-module' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setApkModule(argv[0]);
+                    bundle->setApkModule(argv[0]);
+                }
+                else if (strcmp(cp, "-attr-fallback-package") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--attr-fallback-package' option\n");
+                        return -1;
+                    }
+                    bundle->setAttrFallbackPackage(argv[0]);
                 }
                 else if(strcmp(cp, "-public-R-path") == 0){
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--public-R-path' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setPublicRPath(argv[0]);
+                    bundle->setPublicRPath(argv[0]);
                 }
                 else if (strcmp(cp, "-feature-of") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--feature-of' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setFeatureOfPackage(argv[0]);
+                    bundle->setFeatureOfPackage(argv[0]);
                 } else if (strcmp(cp, "-feature-after") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--feature-after' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setFeatureAfterPackage(argv[0]);
+                    bundle->setFeatureAfterPackage(argv[0]);
                 } else if (strcmp(cp, "-rename-manifest-package") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--rename-manifest-package' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setManifestPackageNameOverride(argv[0]);
+                    bundle->setManifestPackageNameOverride(argv[0]);
                 } else if (strcmp(cp, "-rename-instrumentation-target-package") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--rename-instrumentation-target-package' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setInstrumentationPackageNameOverride(argv[0]);
+                    bundle->setInstrumentationPackageNameOverride(argv[0]);
                 } else if (strcmp(cp, "-auto-add-overlay") == 0) {
-                    bundle.setAutoAddOverlay(true);
+                    bundle->setAutoAddOverlay(true);
                 } else if (strcmp(cp, "-error-on-failed-insert") == 0) {
-                    bundle.setErrorOnFailedInsert(true);
+                    bundle->setErrorOnFailedInsert(true);
                 } else if (strcmp(cp, "-error-on-missing-config-entry") == 0) {
-                    bundle.setErrorOnMissingConfigEntry(true);
+                    bundle->setErrorOnMissingConfigEntry(true);
                 } else if (strcmp(cp, "-output-text-symbols") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '-output-text-symbols' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
+                    }
+                    bundle->setOutputTextSymbols(argv[0]);
+                } else if (strcmp(cp, "-output-r-jar") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--output-r-jar' option\n");
+                        return -1;
                     }
-                    bundle.setOutputTextSymbols(argv[0]);
+                    bundle->setOutputRJar(argv[0]);
                 } else if (strcmp(cp, "-product") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--product' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    bundle.setProduct(argv[0]);
+                    bundle->setProduct(argv[0]);
                 } else if (strcmp(cp, "-non-constant-id") == 0) {
-                    bundle.setNonConstantId(true);
+                    bundle->setNonConstantId(true);
                 } else if (strcmp(cp, "-shared-lib") == 0) {
-                    bundle.setNonConstantId(true);
-                    bundle.setBuildSharedLibrary(true);
+                    bundle->setNonConstantId(true);
+                    bundle->setBuildSharedLibrary(true);
+                } else if (strcmp(cp, "-jobs") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--jobs' option\n");
+                        return -1;
+                    }
+                    if (atoi(argv[0]) < 1) {
+                        fprintf(stderr, "ERROR: '--jobs' needs a positive number\n");
+                        return -1;
+                    }
+                    bundle->setJobs(atoi(argv[0]));
+                } else if (strcmp(cp, "-compression-level") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--compression-level' option\n");
+                        return -1;
+                    }
+                    int level;
+                    if (!AaptUtil::parseCompressionLevel(argv[0], &level)) {
+                        fprintf(stderr, "ERROR: '--compression-level' needs a number from 0 to 9\n");
+                        return -1;
+                    }
+                    bundle->setCompressionLevel(level);
+                } else if (strcmp(cp, "-fast") == 0) {
+                    bundle->setCompressionLevel(kFastCompressionLevel);
+                } else if (strcmp(cp, "-compression-cache") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--compression-cache' option\n");
+                        return -1;
+                    }
+                    convertPath(argv[0]);
+                    bundle->setCompressionCacheDir(argv[0]);
+                } else if (strcmp(cp, "-include-index-cache") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--include-index-cache' option\n");
+                        return -1;
+                    }
+                    convertPath(argv[0]);
+                    bundle->setIncludeIndexCacheDir(argv[0]);
+                } else if (strcmp(cp, "-compiled-xml-cache") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--compiled-xml-cache' option\n");
+                        return -1;
+                    }
+                    convertPath(argv[0]);
+                    bundle->setCompiledXmlCacheDir(argv[0]);
+                } else if (strcmp(cp, "-png-passthrough") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--png-passthrough' option\n");
+                        return -1;
+                    }
+                    if (strcmp(argv[0], "never") == 0) {
+                        bundle->setPngPassthrough(PNG_PASSTHROUGH_NEVER);
+                    } else if (strcmp(argv[0], "larger") == 0) {
+                        bundle->setPngPassthrough(PNG_PASSTHROUGH_LARGER);
+                    } else if (strcmp(argv[0], "optimized") == 0) {
+                        bundle->setPngPassthrough(PNG_PASSTHROUGH_OPTIMIZED);
+                    } else {
+                        fprintf(stderr, "ERROR: '--png-passthrough' needs one of never, larger or optimized\n");
+                        return -1;
+                    }
+                } else if (strcmp(cp, "-png-search") == 0) {
+                    bundle->setPngSearch(true);
+                } else if (strcmp(cp, "-png-search-budget") == 0) {
+                    argc--;
+                    argv++;
+                    if (!argc) {
+                        fprintf(stderr, "ERROR: No argument supplied for '--png-search-budget' option\n");
+                        return -1;
+                    }
+                    if (atoi(argv[0]) < 1) {
+                        fprintf(stderr, "ERROR: '--png-search-budget' needs a positive number\n");
+                        return -1;
+                    }
+                    bundle->setPngSearchBudget(atoi(argv[0]));
                 } else if (strcmp(cp, "-no-crunch") == 0) {
-                    bundle.setUseCrunchCache(true);
+                    bundle->setUseCrunchCache(true);
                 } else if (strcmp(cp, "-ignore-assets") == 0) {
                     argc--;
                     argv++;
                     if (!argc) {
                         fprintf(stderr, "ERROR: No argument supplied for '--ignore-assets' option\n");
-                        wantUsage = true;
-                        goto bail;
+                        return -1;
                     }
-                    gUserIgnoreAssets = argv[0];
+                    bundle->setIgnoreAssets(argv[0]);
                 } else if (strcmp(cp, "-pseudo-localize") == 0) {
-                    bundle.setPseudolocalize(PSEUDO_ACCENTED | PSEUDO_BIDI);
+                    bundle->setPseudolocalize(PSEUDO_ACCENTED | PSEUDO_BIDI);
                 } else {
                     fprintf(stderr, "ERROR: Unknown option '-%s'\n", cp);
-                    wantUsage = true;
-                    goto bail;
+                    return -1;
                 }
                 cp += strlen(cp) - 1;
                 break;
             default:
                 fprintf(stderr, "ERROR: Unknown flag '-%c'\n", *cp);
-                wantUsage = true;
-                goto bail;
+                return -1;
             }
 
             cp++;
@@ -716,6 +769,100 @@ int main(int argc, char* const argv[])
         argv++;
     }
 
+    return origArgc - argc;
+}
+
+/*
+ * Dispatch the command.
+ */
+int handleCommand(Bundle* bundle)
+{
+    //printf("--- command %d (verbose=%d force=%d):\n",
+    //    bundle->getCommand(), bundle->getVerbose(), bundle->getForce());
+    //for (int i = 0; i < bundle->getFileSpecCount(); i++)
+    //    printf("  %d: '%s'\n", i, bundle->getFileSpecEntry(i));
+
+    switch (bundle->getCommand()) {
+    case kCommandVersion:      return doVersion(bundle);
+    case kCommandList:         return doList(bundle);
+    case kCommandDump:         return doDump(bundle);
+    case kCommandAdd:          return doAdd(bundle);
+    case kCommandRemove:       return doRemove(bundle);
+    case kCommandPackage:      return doPackage(bundle);
+    case kCommandCrunch:       return doCrunch(bundle);
+    case kCommandSingleCrunch: return doSingleCrunch(bundle);
+    case kCommandDaemon:       return runInDaemonMode(bundle, parseFlags);
+    case kCommandBatch:        return doBatch(bundle, parseFlags);
+    default:
+        fprintf(stderr, "%s: requested command not yet supported\n", gProgName);
+        return 1;
+    }
+}
+
+/*
+ * Parse args.
+ */
+int main(int argc, char* const argv[])
+{
+    Bundle bundle;
+    bool wantUsage = false;
+    int result = 1;    // pessimistically assume an error.
+    int consumed;
+
+    gProgPath = argv[0];
+
+    /* default to compression */
+    bundle.setCompressionMethod(ZipEntry::kCompressDeflated);
+
+#ifdef _SC_NPROCESSORS_ONLN
+    /* default to one job per online CPU */
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > 0) {
+        bundle.setJobs(cpus);
+    }
+#endif
+
+    if (argc < 2) {
+        wantUsage = true;
+        goto bail;
+    }
+
+    if (argv[1][0] == 'v')
+        bundle.setCommand(kCommandVersion);
+    else if (argv[1][0] == 'd')
+        bundle.setCommand(kCommandDump);
+    else if (argv[1][0] == 'l')
+        bundle.setCommand(kCommandList);
+    else if (argv[1][0] == 'a')
+        bundle.setCommand(kCommandAdd);
+    else if (argv[1][0] == 'r')
+        bundle.setCommand(kCommandRemove);
+    else if (argv[1][0] == 'p')
+        bundle.setCommand(kCommandPackage);
+    else if (argv[1][0] == 'c')
+        bundle.setCommand(kCommandCrunch);
+    else if (argv[1][0] == 's')
+        bundle.setCommand(kCommandSingleCrunch);
+    else if (argv[1][0] == 'm')
+        bundle.setCommand(kCommandDaemon);
+    else if (argv[1][0] == 'b')
+        bundle.setCommand(kCommandBatch);
+    else {
+        fprintf(stderr, "ERROR: Unknown command '%s'\n", argv[1]);
+        wantUsage = true;
+        goto bail;
+    }
+    argc -= 2;
+    argv += 2;
+
+    consumed = parseFlags(&bundle, argc, argv);
+    if (consumed < 0) {
+        wantUsage = true;
+        goto bail;
+    }
+    argc -= consumed;
+    argv += consumed;
+
     /*
      * We're past the flags.  The rest all goes straight in.
      */
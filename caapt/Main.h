@@ -36,7 +36,15 @@ extern int doRemove(Bundle* bundle);
 extern int doPackage(Bundle* bundle);
 extern int doCrunch(Bundle* bundle);
 extern int doSingleCrunch(Bundle* bundle);
-extern int runInDaemonMode(Bundle* bundle);
+
+/*
+ * Parses command-line flags into a bundle.  Returns the number of
+ * arguments consumed, or -1 if they were malformed.
+ */
+typedef int (*FlagParser)(Bundle* bundle, int argc, char* const argv[]);
+
+extern int runInDaemonMode(Bundle* bundle, FlagParser parseFlags);
+extern int doBatch(Bundle* bundle, FlagParser parseFlags);
 
 extern int calcPercent(long uncompressedLen, long compressedLen);
 
@@ -46,6 +54,8 @@ extern android::status_t writeAPK(Bundle* bundle,
 
 extern android::status_t updatePreProcessedCache(Bundle* bundle);
 
+extern ssize_t extractPlatformBuildVersion(android::AssetManager& assets, Bundle* bundle);
+
 extern android::status_t buildResources(Bundle* bundle,
     const sp<AaptAssets>& assets, sp<ApkBuilder>& builder);
 
@@ -8,6 +8,8 @@
 #include "OutputSet.h"
 #include "ResourceTable.h"
 #include "ResourceFilter.h"
+#include "DeflateCache.h"
+#include "WorkQueue.h"
 
 #include <androidfw/misc.h>
 
@@ -38,8 +40,11 @@ static const char* kNoCompressExt[] = {
 
 /* fwd decls, so I can write this downward */
 ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& outputSet);
-bool processFile(Bundle* bundle, ZipFile* zip, String8 storageName, const sp<const AaptFile>& file);
+bool processFile(Bundle* bundle, ZipFile* zip, String8 storageName, const sp<const AaptFile>& file,
+                 const ZipFile::Deflated* deflated = NULL);
 bool okayToCompress(Bundle* bundle, const String8& pathName);
+bool isExcluded(const String8& storageName);
+bool willDeflate(Bundle* bundle, const String8& storageName, const sp<const AaptFile>& file);
 ssize_t processJarFiles(Bundle* bundle, ZipFile* zip);
 
 /*
@@ -98,6 +103,7 @@ status_t writeAPK(Bundle* bundle, const String8& outputFile, const sp<OutputSet>
 
     status_t status;
     zip = new ZipFile;
+    zip->setCompressionLevel(bundle->getCompressionLevel());
     status = zip->open(outputFile.string(), ZipFile::kOpenReadWrite | ZipFile::kOpenCreate);
     if (status != NO_ERROR) {
         fprintf(stderr, "ERROR: unable to open '%s' as Zip file for writing\n",
@@ -215,9 +221,91 @@ bail:
     return result;
 }
 
+/*
+ * One asset on its way into the archive.  If it's going to be deflated,
+ * a DeflateWorkUnit fills in "deflated" and sets "done" under the lock
+ * owned by processAssets().
+ */
+struct PendingAsset {
+    PendingAsset(const String8& storagePath, const sp<const AaptFile>& file)
+        : storagePath(storagePath), file(file), scheduled(false), done(false),
+          result(NO_ERROR) {}
+
+    String8 storagePath;
+    sp<const AaptFile> file;
+    ZipFile::Deflated deflated;
+    bool scheduled;
+    bool done;
+    status_t result;
+};
+
+class DeflateWorkUnit : public WorkQueue::WorkUnit {
+public:
+    DeflateWorkUnit(PendingAsset* asset, int level, DeflateCache* cache,
+            Mutex* lock, Condition* doneCondition) :
+            mAsset(asset), mLevel(level), mCache(cache), mLock(lock),
+            mDoneCondition(doneCondition) {
+    }
+
+    virtual bool run() {
+        const sp<const AaptFile>& file = mAsset->file;
+        status_t result;
+
+        // Files without data are deflated straight from a mapping of the
+        // source rather than read into a buffer first.
+        const void* data = file->getData();
+        size_t size = file->getSize();
+        if (!file->hasData()) {
+            data = file->mapSourceFile(&size);
+        }
+
+        if (data == NULL) {
+            result = UNKNOWN_ERROR;
+        } else if (mCache != NULL) {
+            result = mCache->deflate(data, size, mLevel, &mAsset->deflated);
+        } else {
+            result = ZipFile::deflateToBuffer(file->getSourceFile().string(), data, size,
+                    mLevel, &mAsset->deflated);
+        }
+        if (!file->hasData()) {
+            file->unmapSourceFile();
+        }
+
+        AutoMutex _l(*mLock);
+        mAsset->result = result;
+        mAsset->done = true;
+        mDoneCondition->broadcast();
+        return true;
+    }
+
+private:
+    PendingAsset* mAsset;
+    int mLevel;
+    DeflateCache* mCache;
+    Mutex* mLock;
+    Condition* mDoneCondition;
+};
+
+/*
+ * Add every asset in "outputSet" to the archive.
+ *
+ * Deflating is the expensive part, so with more than one job the assets
+ * are compressed into memory on a work queue while this thread appends
+ * the finished ones to the archive, always in set order so the output is
+ * the same as a serial run.  Workers run at most a few entries ahead of
+ * the writer to bound the memory held in buffers.
+ *
+ * With --compression-cache, the work units take deflated data from the
+ * cache when the content was seen before, so mostly unchanged builds
+ * become close to a plain copy.
+ *
+ * Update mode stays serial and uncached, because processFile() may
+ * decide not to replace an entry at all.
+ */
 ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& outputSet)
 {
     ssize_t count = 0;
+    Vector<PendingAsset*> assets;
     const std::set<OutputEntry>& entries = outputSet->getEntries();
     std::set<OutputEntry>::const_iterator iter = entries.begin();
     for (; iter != entries.end(); iter++) {
@@ -227,11 +315,75 @@ ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& o
         } else {
             String8 storagePath(entry.getPath());
             storagePath.convertToResPath();
-            if (!processFile(bundle, zip, storagePath, entry.getFile())) {
-                return UNKNOWN_ERROR;
+            assets.add(new PendingAsset(storagePath, entry.getFile()));
+        }
+    }
+
+    const size_t numThreads = bundle->getJobs();
+    const size_t window = numThreads * 4;
+    DeflateCache* cache = NULL;
+    if (bundle->getCompressionCacheDir() != NULL && !bundle->getUpdate()) {
+        cache = new DeflateCache(String8(bundle->getCompressionCacheDir()));
+    }
+    const bool pipelined = !bundle->getUpdate() && (numThreads > 1 || cache != NULL);
+    Mutex lock;
+    Condition doneCondition;
+    WorkQueue wq(numThreads, false);
+    size_t next = 0;
+
+    for (size_t i = 0; i < assets.size(); i++) {
+        PendingAsset* asset = assets[i];
+
+        if (pipelined) {
+            for (; next < assets.size() && next < i + window; next++) {
+                PendingAsset* ahead = assets[next];
+                if (!willDeflate(bundle, ahead->storagePath, ahead->file)) {
+                    continue;
+                }
+                DeflateWorkUnit* w = new DeflateWorkUnit(ahead, zip->getCompressionLevel(),
+                        cache, &lock, &doneCondition);
+                if (wq.schedule(w, 0) == NO_ERROR) {
+                    ahead->scheduled = true;
+                } else {
+                    delete w;
+                }
             }
-            count++;
         }
+
+        const ZipFile::Deflated* deflated = NULL;
+        if (asset->scheduled) {
+            AutoMutex _l(lock);
+            while (!asset->done) {
+                doneCondition.wait(lock);
+            }
+            // on failure, let processFile() compress it the usual way
+            if (asset->result == NO_ERROR) {
+                deflated = &asset->deflated;
+            }
+        }
+
+        if (!processFile(bundle, zip, asset->storagePath, asset->file, deflated)) {
+            count = UNKNOWN_ERROR;
+            break;
+        }
+        count++;
+
+        // release the buffer now rather than at the end
+        asset->deflated.data.clear();
+    }
+
+    wq.cancel();
+    wq.finish();
+    for (size_t i = 0; i < assets.size(); i++) {
+        delete assets[i];
+    }
+    if (cache != NULL) {
+        if (bundle->getVerbose()) {
+            printf("Compression cache: %d hit%s, %d miss%s\n",
+                    (int) cache->getHits(), cache->getHits() == 1 ? "" : "s",
+                    (int) cache->getMisses(), cache->getMisses() == 1 ? "" : "es");
+        }
+        delete cache;
     }
     return count;
 }
@@ -243,7 +395,8 @@ ssize_t processAssets(Bundle* bundle, ZipFile* zip, const sp<const OutputSet>& o
  * delete the existing entry before adding the new one.
  */
 bool processFile(Bundle* bundle, ZipFile* zip,
-                 String8 storageName, const sp<const AaptFile>& file)
+                 String8 storageName, const sp<const AaptFile>& file,
+                 const ZipFile::Deflated* deflated)
 {
     const bool hasData = file->hasData();
 
@@ -264,11 +417,7 @@ bool processFile(Bundle* bundle, ZipFile* zip,
      * should clean this up, but I'm in here getting rid of Path Name, and I
      * don't want to make other potentially breaking changes --joeo
      */
-    int fileNameLen = storageName.length();
-    int excludeExtensionLen = strlen(kExcludeExtension);
-    if (fileNameLen > excludeExtensionLen
-            && (0 == strcmp(storageName.string() + (fileNameLen - excludeExtensionLen),
-                            kExcludeExtension))) {
+    if (isExcluded(storageName)) {
         fprintf(stderr, "warning: '%s' not added to Zip\n", storageName.string());
         return true;
     }
@@ -328,8 +477,17 @@ bool processFile(Bundle* bundle, ZipFile* zip,
         if (!okayToCompress(bundle, storageName)) {
             compressionMethod = ZipEntry::kCompressStored;
         }
-        result = zip->add(file->getSourceFile().string(), storageName.string(), compressionMethod,
-                            &entry);
+        if (deflated != NULL && compressionMethod == ZipEntry::kCompressDeflated) {
+            result = zip->addDeflated(file->getSourceFile().string(), storageName.string(),
+                                      *deflated, &entry);
+        } else {
+            result = zip->add(file->getSourceFile().string(), storageName.string(),
+                              compressionMethod, &entry);
+        }
+    } else if (deflated != NULL
+            && file->getCompressionMethod() == ZipEntry::kCompressDeflated) {
+        result = zip->addDeflated(file->getData(), file->getSize(), storageName.string(),
+                                  *deflated, &entry);
     } else {
         result = zip->add(file->getData(), file->getSize(), storageName.string(),
                            file->getCompressionMethod(), &entry);
@@ -400,6 +558,41 @@ bool endsWith(const char* haystack, const char* needle)
     return strcasecmp(haystack+(a-b), needle) == 0;
 }
 
+/*
+ * Whether processFile() leaves this file out of the archive: its name ends
+ * in ".EXCLUDE", matched case-sensitively, and isn't only the extension.
+ */
+bool isExcluded(const String8& storageName)
+{
+    size_t fileNameLen = storageName.length();
+    size_t excludeExtensionLen = strlen(kExcludeExtension);
+    return fileNameLen > excludeExtensionLen
+            && 0 == strcmp(storageName.string() + (fileNameLen - excludeExtensionLen),
+                           kExcludeExtension);
+}
+
+/*
+ * Determine whether processFile() will deflate this file, so the work can
+ * be done ahead of time.  Must agree with the choices made there.
+ */
+bool willDeflate(Bundle* bundle, const String8& storageName, const sp<const AaptFile>& file)
+{
+    if (isExcluded(storageName)
+            || strcasecmp(storageName.getPathExtension().string(), ".gz") == 0) {
+        return false;
+    }
+    if (file->hasData()) {
+        return file->getCompressionMethod() == ZipEntry::kCompressDeflated;
+    }
+    return bundle->getCompressionMethod() == ZipEntry::kCompressDeflated
+            && okayToCompress(bundle, storageName);
+}
+
+/*
+ * Copy the .class entries of a jar into the archive.  The compressed
+ * bytes are copied straight across; nothing is inflated or recompressed.
+ * As before, a name that's already in the archive is left alone.
+ */
 ssize_t processJarFile(ZipFile* jar, ZipFile* out)
 {
     status_t err;
@@ -408,17 +601,13 @@ ssize_t processJarFile(ZipFile* jar, ZipFile* out)
     for (size_t i=0; i<N; i++) {
         ZipEntry* entry = jar->getEntryByIndex(i);
         const char* storageName = entry->getFileName();
-        if (endsWith(storageName, ".class")) {
-            int compressionMethod = entry->getCompressionMethod();
-            size_t size = entry->getUncompressedLen();
-            const void* data = jar->uncompress(entry);
-            if (data == NULL) {
-                fprintf(stderr, "ERROR: unable to uncompress entry '%s'\n",
-                    storageName);
+        if (endsWith(storageName, ".class") && out->getEntryByName(storageName) == NULL) {
+            err = out->add(jar, entry, 0, NULL);
+            if (err != NO_ERROR) {
+                fprintf(stderr, "ERROR: unable to copy entry '%s' (%d)\n",
+                    storageName, err);
                 return -1;
             }
-            out->add(data, size, storageName, compressionMethod, NULL);
-            free((void*)data);
         }
         count++;
     }
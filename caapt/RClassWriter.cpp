@@ -0,0 +1,563 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Writes R classes as Java class files, straight into a jar.
+//
+
+#include "RClassWriter.h"
+#include "ZipFile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <set>
+
+/*
+ * Class file constants, from chapters 4 and 6 of the JVM specification.
+ * Version 50 (Java 6) is the newest that doesn't need StackMapTable
+ * frames; the code here is straight-line anyway.
+ */
+static const uint32_t kMagic = 0xcafebabe;
+
+enum {
+    kMajorVersion           = 50,
+
+    kConstantUtf8           = 1,
+    kConstantInteger        = 3,
+    kConstantClass          = 7,
+    kConstantString         = 8,
+    kConstantFieldref       = 9,
+    kConstantMethodref      = 10,
+    kConstantNameAndType    = 12,
+
+    kAccPublic              = 0x0001,
+    kAccPrivate             = 0x0002,
+    kAccStatic              = 0x0008,
+    kAccFinal               = 0x0010,
+    kAccSuper               = 0x0020,
+    kAccSynthetic           = 0x1000,
+
+    kOpIconst0              = 0x03,
+    kOpBipush               = 0x10,
+    kOpSipush               = 0x11,
+    kOpLdc                  = 0x12,
+    kOpLdcW                 = 0x13,
+    kOpIastore              = 0x4f,
+    kOpDup                  = 0x59,
+    kOpReturn               = 0xb1,
+    kOpGetstatic            = 0xb2,
+    kOpPutstatic            = 0xb3,
+    kOpInvokespecial        = 0xb7,
+    kOpInvokestatic         = 0xb8,
+    kOpNewarray             = 0xbc,
+    kOpAload0               = 0x2a,
+
+    kArrayTypeInt           = 10,
+};
+
+/*
+ * A method's code must be under 64KiB.  Static initialisers that would
+ * be longer are split into helper methods that <clinit> calls in turn;
+ * the margin leaves room for the longest single step plus the return.
+ * (Before version 53, final static fields may be set from any method of
+ * their class, so the helpers can assign styleable arrays.)
+ */
+static const size_t kMaxInitCode = 65535 - 64;
+
+typedef std::vector<unsigned char> ByteVector;
+
+static void writeU1(ByteVector* out, unsigned int val)
+{
+    out->push_back((unsigned char) val);
+}
+
+static void writeU2(ByteVector* out, unsigned int val)
+{
+    out->push_back((unsigned char) (val >> 8));
+    out->push_back((unsigned char) val);
+}
+
+static void writeU4(ByteVector* out, uint32_t val)
+{
+    out->push_back((unsigned char) (val >> 24));
+    out->push_back((unsigned char) (val >> 16));
+    out->push_back((unsigned char) (val >> 8));
+    out->push_back((unsigned char) val);
+}
+
+static void writeBytes(ByteVector* out, const ByteVector& bytes)
+{
+    out->insert(out->end(), bytes.begin(), bytes.end());
+}
+
+/*
+ * Class files store strings in "modified UTF-8": NUL is written as two
+ * bytes, and characters outside the BMP as a surrogate pair of
+ * three-byte sequences rather than one four-byte sequence.
+ */
+static std::string toModifiedUtf8(const std::string& str)
+{
+    std::string out;
+    out.reserve(str.size());
+    const size_t N = str.size();
+    size_t i = 0;
+    while (i < N) {
+        const unsigned char ch = str[i];
+        if (ch == 0) {
+            out += '\xc0';
+            out += '\x80';
+            i++;
+        } else if ((ch & 0xf8) == 0xf0 && i + 4 <= N) {
+            uint32_t cp = ((ch & 0x07) << 18)
+                    | ((str[i+1] & 0x3f) << 12)
+                    | ((str[i+2] & 0x3f) << 6)
+                    | (str[i+3] & 0x3f);
+            cp -= 0x10000;
+            const uint32_t units[2] = { 0xd800 + (cp >> 10), 0xdc00 + (cp & 0x3ff) };
+            for (int u = 0; u < 2; u++) {
+                out += (char) (0xe0 | (units[u] >> 12));
+                out += (char) (0x80 | ((units[u] >> 6) & 0x3f));
+                out += (char) (0x80 | (units[u] & 0x3f));
+            }
+            i += 4;
+        } else {
+            out += (char) ch;
+            i++;
+        }
+    }
+    return out;
+}
+
+/*
+ * The constant pool, with each constant stored once.  Indices start at
+ * 1; a class can't have more than 65535 of them, and a string constant
+ * can't be longer than 65535 bytes, which is flagged as an overflow.
+ */
+class ConstantPool {
+public:
+    ConstantPool() : mCount(1), mOverflow(false) { }
+
+    unsigned int utf8(const std::string& str) {
+        const std::string encoded(toModifiedUtf8(str));
+        if (encoded.size() > 0xffff) {
+            mOverflow = true;
+        }
+        ByteVector entry;
+        writeU1(&entry, kConstantUtf8);
+        writeU2(&entry, encoded.size());
+        entry.insert(entry.end(), encoded.begin(), encoded.end());
+        return add(entry);
+    }
+
+    unsigned int integer(int32_t val) {
+        ByteVector entry;
+        writeU1(&entry, kConstantInteger);
+        writeU4(&entry, (uint32_t) val);
+        return add(entry);
+    }
+
+    unsigned int string(const std::string& str) {
+        return ref(kConstantString, utf8(str));
+    }
+
+    unsigned int classRef(const std::string& binaryName) {
+        return ref(kConstantClass, utf8(binaryName));
+    }
+
+    unsigned int fieldRef(const std::string& owner, const std::string& name,
+            const std::string& descriptor) {
+        return ref(kConstantFieldref, classRef(owner), nameAndType(name, descriptor));
+    }
+
+    unsigned int methodRef(const std::string& owner, const std::string& name,
+            const std::string& descriptor) {
+        return ref(kConstantMethodref, classRef(owner), nameAndType(name, descriptor));
+    }
+
+    bool overflowed() const { return mOverflow; }
+
+    void write(ByteVector* out) const {
+        writeU2(out, mCount);
+        writeBytes(out, mBytes);
+    }
+
+private:
+    unsigned int nameAndType(const std::string& name, const std::string& descriptor) {
+        return ref(kConstantNameAndType, utf8(name), utf8(descriptor));
+    }
+
+    unsigned int ref(int tag, unsigned int index) {
+        ByteVector entry;
+        writeU1(&entry, tag);
+        writeU2(&entry, index);
+        return add(entry);
+    }
+
+    unsigned int ref(int tag, unsigned int index1, unsigned int index2) {
+        ByteVector entry;
+        writeU1(&entry, tag);
+        writeU2(&entry, index1);
+        writeU2(&entry, index2);
+        return add(entry);
+    }
+
+    unsigned int add(const ByteVector& entry) {
+        const std::string key(entry.begin(), entry.end());
+        std::map<std::string, unsigned int>::const_iterator it = mIndex.find(key);
+        if (it != mIndex.end()) {
+            return it->second;
+        }
+        if (mCount >= 0xffff) {
+            mOverflow = true;
+            return 0;
+        }
+        const unsigned int index = mCount++;
+        mIndex[key] = index;
+        writeBytes(&mBytes, entry);
+        return index;
+    }
+
+    std::map<std::string, unsigned int> mIndex;
+    ByteVector mBytes;
+    unsigned int mCount;
+    bool mOverflow;
+};
+
+/* push an int constant with the shortest instruction that holds it */
+static void pushInt(ConstantPool* pool, ByteVector* code, int32_t val)
+{
+    if (val >= -1 && val <= 5) {
+        writeU1(code, kOpIconst0 + val);
+    } else if (val >= -128 && val <= 127) {
+        writeU1(code, kOpBipush);
+        writeU1(code, (unsigned int) val & 0xff);
+    } else if (val >= -32768 && val <= 32767) {
+        writeU1(code, kOpSipush);
+        writeU2(code, (unsigned int) val & 0xffff);
+    } else {
+        const unsigned int index = pool->integer(val);
+        if (index <= 0xff) {
+            writeU1(code, kOpLdc);
+            writeU1(code, index);
+        } else {
+            writeU1(code, kOpLdcW);
+            writeU2(code, index);
+        }
+    }
+}
+
+/*
+ * The body of <clinit>, cut into pieces of at most kMaxInitCode bytes.
+ */
+class InitCode {
+public:
+    /* the piece to append the next "size" bytes to */
+    ByteVector* room(size_t size) {
+        if (mBodies.empty() || mBodies.back().size() + size > kMaxInitCode) {
+            mBodies.push_back(ByteVector());
+        }
+        return &mBodies.back();
+    }
+
+    /* true if room(size) would start a new piece */
+    bool full(size_t size) const {
+        return !mBodies.empty() && mBodies.back().size() + size > kMaxInitCode;
+    }
+
+    const std::vector<ByteVector>& bodies() const { return mBodies; }
+
+private:
+    std::vector<ByteVector> mBodies;
+};
+
+static void writeFieldOp(ByteVector* code, int op, unsigned int fieldRef)
+{
+    writeU1(code, op);
+    writeU2(code, fieldRef);
+}
+
+/*
+ * Assign an int[] field: build the array on the stack with dup/iastore,
+ * as javac does, then store it.  An array too long for one piece is
+ * stored part-filled and fetched back at the start of the next one.
+ */
+static void writeArrayInit(ConstantPool* pool, InitCode* init, unsigned int fieldRef,
+        const std::vector<int32_t>& values)
+{
+    ByteVector* code = init->room(3 + 2 + 3);
+    pushInt(pool, code, values.size());
+    writeU1(code, kOpNewarray);
+    writeU1(code, kArrayTypeInt);
+
+    // dup, index, value, iastore
+    const size_t kElementCode = 1 + 3 + 3 + 1;
+    for (size_t i = 0; i < values.size(); i++) {
+        if (init->full(kElementCode + 3)) {
+            writeFieldOp(code, kOpPutstatic, fieldRef);
+            code = init->room(3 + kElementCode + 3);
+            writeFieldOp(code, kOpGetstatic, fieldRef);
+        }
+        writeU1(code, kOpDup);
+        pushInt(pool, code, (int32_t) i);
+        pushInt(pool, code, values[i]);
+        writeU1(code, kOpIastore);
+    }
+    writeFieldOp(code, kOpPutstatic, fieldRef);
+}
+
+static void writeCodeAttribute(ConstantPool* pool, ByteVector* out,
+        unsigned int maxStack, unsigned int maxLocals, const ByteVector& code)
+{
+    writeU2(out, pool->utf8("Code"));
+    writeU4(out, 2 + 2 + 4 + code.size() + 2 + 2);
+    writeU2(out, maxStack);
+    writeU2(out, maxLocals);
+    writeU4(out, code.size());
+    writeBytes(out, code);
+    writeU2(out, 0);    // exception_table_length
+    writeU2(out, 0);    // attributes_count
+}
+
+static void writeMethod(ConstantPool* pool, ByteVector* out, unsigned int access,
+        const char* name, unsigned int maxStack, unsigned int maxLocals,
+        const ByteVector& code)
+{
+    writeU2(out, access);
+    writeU2(out, pool->utf8(name));
+    writeU2(out, pool->utf8("()V"));
+    writeU2(out, 1);    // attributes_count
+    writeCodeAttribute(pool, out, maxStack, maxLocals, code);
+}
+
+static const char* descriptorFor(RFieldSpec::Kind kind)
+{
+    switch (kind) {
+        case RFieldSpec::kIntArray:
+            return "[I";
+        case RFieldSpec::kString:
+            return "Ljava/lang/String;";
+        default:
+            return "I";
+    }
+}
+
+/*
+ * Compile one class.  "outerName" is the binary name of the enclosing
+ * class, or empty for a top-level one.  Inner classes are compiled
+ * after their outer class.
+ */
+static status_t compileClass(const std::string& binaryName, const std::string& outerName,
+        const RClassSpec& cls, std::vector<RClassWriter::ClassFile>* outFiles)
+{
+    ConstantPool pool;
+    ByteVector body;
+
+    writeU2(&body, kAccPublic | kAccFinal | kAccSuper);
+    writeU2(&body, pool.classRef(binaryName));
+    writeU2(&body, pool.classRef("java/lang/Object"));
+    writeU2(&body, 0);  // interfaces_count
+
+    // fields; constants carry their value, the rest go into <clinit>
+    InitCode init;
+    std::set<std::string> names;
+    if (cls.fields.size() > 0xffff) {
+        fprintf(stderr, "ERROR: Class %s has %d fields, more than a class file can hold\n",
+                binaryName.c_str(), (int) cls.fields.size());
+        return UNKNOWN_ERROR;
+    }
+    writeU2(&body, cls.fields.size());
+    for (size_t i = 0; i < cls.fields.size(); i++) {
+        const RFieldSpec& field = cls.fields[i];
+        if (!names.insert(field.name).second) {
+            fprintf(stderr, "ERROR: Duplicate field %s in class %s\n",
+                    field.name.c_str(), binaryName.c_str());
+            return UNKNOWN_ERROR;
+        }
+        const char* descriptor = descriptorFor(field.kind);
+        const bool constant = field.isFinal && field.kind != RFieldSpec::kIntArray;
+
+        writeU2(&body, kAccPublic | kAccStatic | (field.isFinal ? kAccFinal : 0));
+        writeU2(&body, pool.utf8(field.name));
+        writeU2(&body, pool.utf8(descriptor));
+        if (constant) {
+            writeU2(&body, 1);  // attributes_count
+            writeU2(&body, pool.utf8("ConstantValue"));
+            writeU4(&body, 2);
+            writeU2(&body, field.kind == RFieldSpec::kString
+                    ? pool.string(field.stringValue) : pool.integer(field.value));
+            continue;
+        }
+        writeU2(&body, 0);  // attributes_count
+
+        const unsigned int fieldRef = pool.fieldRef(binaryName, field.name, descriptor);
+        if (field.kind == RFieldSpec::kIntArray) {
+            writeArrayInit(&pool, &init, fieldRef, field.values);
+        } else if (field.kind == RFieldSpec::kString) {
+            ByteVector* code = init.room(3 + 3);
+            const unsigned int index = pool.string(field.stringValue);
+            writeU1(code, kOpLdcW);
+            writeU2(code, index);
+            writeFieldOp(code, kOpPutstatic, fieldRef);
+        } else {
+            ByteVector* code = init.room(3 + 3);
+            pushInt(&pool, code, field.value);
+            writeFieldOp(code, kOpPutstatic, fieldRef);
+        }
+    }
+
+    // methods: the default constructor, then <clinit> and its helpers
+    const std::vector<ByteVector>& bodies = init.bodies();
+    const size_t numHelpers = bodies.size() > 1 ? bodies.size() : 0;
+    const size_t numMethods = 1 + (bodies.empty() ? 0 : 1) + numHelpers;
+    if (numMethods > 0xffff) {
+        fprintf(stderr, "ERROR: Class %s needs %d methods to initialize its fields,"
+                " more than a class file can hold\n", binaryName.c_str(), (int) numMethods);
+        return UNKNOWN_ERROR;
+    }
+    writeU2(&body, numMethods);
+
+    ByteVector ctor;
+    writeU1(&ctor, kOpAload0);
+    writeU1(&ctor, kOpInvokespecial);
+    writeU2(&ctor, pool.methodRef("java/lang/Object", "<init>", "()V"));
+    writeU1(&ctor, kOpReturn);
+    writeMethod(&pool, &body, kAccPublic, "<init>", 1, 1, ctor);
+
+    if (bodies.size() == 1) {
+        ByteVector code(bodies[0]);
+        writeU1(&code, kOpReturn);
+        writeMethod(&pool, &body, kAccStatic, "<clinit>", 4, 0, code);
+    } else if (numHelpers > 0) {
+        ByteVector clinit;
+        for (size_t i = 0; i < numHelpers; i++) {
+            char name[32];
+            snprintf(name, sizeof(name), "clinit$%d", (int) i);
+            writeU1(&clinit, kOpInvokestatic);
+            writeU2(&clinit, pool.methodRef(binaryName, name, "()V"));
+
+            ByteVector code(bodies[i]);
+            writeU1(&code, kOpReturn);
+            writeMethod(&pool, &body, kAccPrivate | kAccStatic | kAccSynthetic,
+                    name, 4, 0, code);
+        }
+        writeU1(&clinit, kOpReturn);
+        writeMethod(&pool, &body, kAccStatic, "<clinit>", 0, 0, clinit);
+    }
+
+    // InnerClasses: this class if it is nested, and its own inner classes
+    const size_t numInner = cls.inner.size() + (outerName.empty() ? 0 : 1);
+    if (numInner > 0xffff) {
+        fprintf(stderr, "ERROR: Class %s has %d inner classes, more than a class file can"
+                " hold\n", binaryName.c_str(), (int) cls.inner.size());
+        return UNKNOWN_ERROR;
+    }
+    if (numInner > 0) {
+        ByteVector attr;
+        writeU2(&attr, numInner);
+        const unsigned int innerAccess = kAccPublic | kAccStatic | kAccFinal;
+        if (!outerName.empty()) {
+            writeU2(&attr, pool.classRef(binaryName));
+            writeU2(&attr, pool.classRef(outerName));
+            writeU2(&attr, pool.utf8(cls.name));
+            writeU2(&attr, innerAccess);
+        }
+        for (size_t i = 0; i < cls.inner.size(); i++) {
+            writeU2(&attr, pool.classRef(binaryName + "$" + cls.inner[i].name));
+            writeU2(&attr, pool.classRef(binaryName));
+            writeU2(&attr, pool.utf8(cls.inner[i].name));
+            writeU2(&attr, innerAccess);
+        }
+        writeU2(&body, 1);  // attributes_count
+        writeU2(&body, pool.utf8("InnerClasses"));
+        writeU4(&body, attr.size());
+        writeBytes(&body, attr);
+    } else {
+        writeU2(&body, 0);  // attributes_count
+    }
+
+    if (pool.overflowed()) {
+        fprintf(stderr, "ERROR: Class %s has too many or too long constants for a class file\n",
+                binaryName.c_str());
+        return UNKNOWN_ERROR;
+    }
+
+    RClassWriter::ClassFile file;
+    file.entryName = binaryName + ".class";
+    writeU4(&file.data, kMagic);
+    writeU2(&file.data, 0);     // minor_version
+    writeU2(&file.data, kMajorVersion);
+    pool.write(&file.data);
+    writeBytes(&file.data, body);
+    outFiles->push_back(file);
+
+    for (size_t i = 0; i < cls.inner.size(); i++) {
+        status_t err = compileClass(binaryName + "$" + cls.inner[i].name, binaryName,
+                cls.inner[i], outFiles);
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+    return NO_ERROR;
+}
+
+RClassSpec* RClassSpec::findInner(const std::string& name)
+{
+    for (size_t i = 0; i < inner.size(); i++) {
+        if (inner[i].name == name) {
+            return &inner[i];
+        }
+    }
+    return NULL;
+}
+
+status_t RClassWriter::compile(const std::string& package, const RClassSpec& cls,
+        std::vector<ClassFile>* outFiles)
+{
+    std::string binaryName(package);
+    for (size_t i = 0; i < binaryName.size(); i++) {
+        if (binaryName[i] == '.') {
+            binaryName[i] = '/';
+        }
+    }
+    if (!binaryName.empty()) {
+        binaryName += '/';
+    }
+    binaryName += cls.name;
+    return compileClass(binaryName, std::string(), cls, outFiles);
+}
+
+status_t RClassWriter::writeJar(const char* jarPath, const std::string& package,
+        const RClassSpec& cls)
+{
+    std::vector<ClassFile> files;
+    status_t err = compile(package, cls, &files);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    ZipFile zip;
+    err = zip.open(jarPath, ZipFile::kOpenReadWrite | ZipFile::kOpenCreate);
+    if (err != NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to open R jar %s\n", jarPath);
+        return err;
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+        const char* name = files[i].entryName.c_str();
+        ZipEntry* pEntry = zip.getEntryByName(name);
+        if (pEntry != NULL) {
+            zip.remove(pEntry);
+        }
+        err = zip.add(&files[i].data[0], files[i].data.size(), name,
+                ZipEntry::kCompressDeflated, NULL);
+        if (err != NO_ERROR) {
+            fprintf(stderr, "ERROR: Unable to add %s to R jar %s\n", name, jarPath);
+            return err;
+        }
+    }
+    err = zip.flush();
+    if (err != NO_ERROR) {
+        fprintf(stderr, "ERROR: Unable to write R jar %s\n", jarPath);
+    }
+    return err;
+}
@@ -0,0 +1,86 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Writes R classes as Java class files, straight into a jar.
+//
+
+#ifndef __R_CLASS_WRITER_H
+#define __R_CLASS_WRITER_H
+
+#include <utils/Errors.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+using namespace android;
+
+/*
+ * A static field of an R class.  "final" ints and Strings become
+ * compile-time constants; everything else (int[] arrays, and ints built
+ * with --non-constant-id) is assigned in <clinit>.
+ */
+struct RFieldSpec {
+    enum Kind {
+        kInt,
+        kIntArray,
+        kString,
+    };
+
+    RFieldSpec() : kind(kInt), isFinal(true), value(0) { }
+
+    std::string name;
+    Kind kind;
+    bool isFinal;
+    int32_t value;                  // kInt
+    std::vector<int32_t> values;    // kIntArray
+    std::string stringValue;        // kString, UTF-8
+};
+
+/*
+ * R, or one of its public static final inner classes (attr, id, ...).
+ * Fields and inner classes keep the order they will have in the class
+ * file, which is the order R.java would list them in.
+ */
+struct RClassSpec {
+    std::string name;
+    std::vector<RFieldSpec> fields;
+    std::vector<RClassSpec> inner;
+
+    /* the inner class called "name", or NULL */
+    RClassSpec* findInner(const std::string& name);
+};
+
+/*
+ * Compiling a generated R.java with javac is a large part of a module's
+ * build, for what is nothing but a table of constants.  RClassWriter
+ * emits the bytecode javac would have produced instead: one class file
+ * for the top-level class and one per inner class, with int[] fields
+ * (and non-constant ints) filled in by <clinit>.
+ */
+class RClassWriter {
+public:
+    struct ClassFile {
+        std::string entryName;          // e.g. "com/foo/R$attr.class"
+        std::vector<unsigned char> data;
+    };
+
+    /*
+     * Serialize "cls", a top-level class in the Java package "package",
+     * and all of its inner classes.
+     */
+    static status_t compile(const std::string& package, const RClassSpec& cls,
+        std::vector<ClassFile>* outFiles);
+
+    /*
+     * Compile "cls" and store the class files in the jar at "jarPath",
+     * which is created if it doesn't exist.  Entries already in the jar
+     * with the same names are replaced; anything else is kept, so the R
+     * classes of several packages can go into one jar.
+     */
+    static status_t writeJar(const char* jarPath, const std::string& package,
+        const RClassSpec& cls);
+};
+
+#endif // __R_CLASS_WRITER_H
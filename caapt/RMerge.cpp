@@ -7,232 +7,615 @@
 //
 
 #include "RMerge.h"
+#include "RSymbolIndex.h"
+
+#include <utils/Timers.h>
 
 #include <stdio.h>
-#include <sys/stat.h>
-#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
 #define k_flag_template "public static final class %s {"
-#define k_package_flag "package "
-#define k_start_class_flag "public static final class "
 #define k_end_class_flag "}"
 
-unsigned long get_file_size(const char *path) {
-    if (path == NULL) {
-        return 0;
+/**
+ * R.java 中的一个内部类 (attr, drawable, id, ...)，body 是 "{" 和匹配的 "}"
+ * 之间的原文，存成在 RFile::text 里的偏移，不复制
+ */
+struct RClass {
+    std::string name;
+    size_t body_start;
+    size_t body_len;
+};
+
+/**
+ * 解析后的 R.java: package 语句 + 按出现顺序排列的内部类，以及 name -> 下标的索引
+ */
+struct RFile {
+    std::string text;
+    std::string package_line;
+    std::vector<RClass> classes;
+    std::map<std::string, size_t> index;
+
+    size_t memory_bytes() const {
+        size_t bytes = text.capacity() + package_line.capacity()
+                + classes.capacity() * sizeof(RClass);
+        for (size_t i = 0; i < classes.size(); i++) {
+            bytes += classes[i].name.capacity();
+        }
+        // map 节点大致大小
+        bytes += index.size() * (sizeof(std::string) + sizeof(size_t) + 4 * sizeof(void*));
+        return bytes;
     }
-    
-    unsigned long filesize = -1;
-    struct stat statbuff;
-    if(stat(path, &statbuff) < 0){
-        return filesize;
-    }else{
-        filesize = statbuff.st_size;
+};
+
+static bool read_file(const char *path, std::string *out) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+
+    out->clear();
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        out->append(buf, n);
     }
-    return filesize;
+    bool ok = !ferror(fp);
+    fclose(fp);
+    return ok;
 }
 
-char *copy_start_flag_with_tag(const char *tag) {
-    if (tag == NULL) {
-        return NULL;
-    }
-    
-    const char *flag_template = k_flag_template;
-    long flag_len = strlen(flag_template) + strlen(tag) + 4;
-    char *start_flag  = (char *)malloc(flag_len);
-    memset(start_flag, '\0', flag_len);
-    sprintf(start_flag, flag_template, tag);
-    return start_flag;
+/**
+ * 去掉块注释 (公共R文件里的 javadoc)，一次扫描
+ */
+static void strip_block_comments(std::string *text) {
+    const std::string &in = *text;
+    std::string out;
+    out.reserve(in.size());
+
+    size_t i = 0;
+    const size_t len = in.size();
+    while (i < len) {
+        if (in[i] == '/' && i + 1 < len && in[i+1] == '*') {
+            size_t end = in.find("*/", i + 2);
+            i = (end == std::string::npos) ? len : end + 2;
+        } else {
+            out += in[i++];
+        }
+    }
+    text->swap(out);
 }
 
-char *copy_java_with_flag(const char *in_str, const char *start_anim_flag, const char *end_anim_flag) {
-    if (in_str == NULL || start_anim_flag == NULL || end_anim_flag == NULL) {
-        return NULL;
-    }
-    
-    char *find_str  = strstr(in_str, start_anim_flag);
-    char *out_str = NULL;
-    
-    
-    if (find_str != NULL) {
-        long out_len = strlen(in_str)*sizeof(in_str) + 10;
-        out_str = (char *)malloc(out_len);
-        memset(out_str, '\0', out_len);
-        find_str += strlen(start_anim_flag);
-        
-        int k = 0;
-        char ch = '\0';
-        int find_tag_times = 1;
-        while ((ch=*(find_str++))) {
-            
-            if ( ch == '{') {
-                find_tag_times++;
-            }
-            else if (ch == '}') {
-                find_tag_times--;
-            }
-            
-            if (find_tag_times <= 0 && ch == '}') {
-                break;
-            }
-            else {
-                out_str[k++] = ch;
-            }
-        }
-    }
-    return out_str;
+static bool is_ident_char(char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+            || (ch >= '0' && ch <= '9') || ch == '_' || ch == '$';
 }
 
-void c_free(void *pointer) {
-    if (pointer != NULL) {
-        free(pointer);
+/**
+ * 在类声明头 (例如 "public static final class drawable ") 里找 class 后面的名字
+ */
+static std::string class_name_from_header(const std::string &text, size_t start, size_t end) {
+    size_t i = start;
+    while (i < end) {
+        while (i < end && !is_ident_char(text[i])) {
+            i++;
+        }
+        size_t word = i;
+        while (i < end && is_ident_char(text[i])) {
+            i++;
+        }
+        if (i - word == 5 && text.compare(word, 5, "class") == 0) {
+            while (i < end && !is_ident_char(text[i])) {
+                i++;
+            }
+            size_t name = i;
+            while (i < end && is_ident_char(text[i])) {
+                i++;
+            }
+            return text.substr(name, i - name);
+        }
+    }
+    return std::string();
+}
+
+/**
+ * 一次扫描 R.java，跳过注释和字符串常量，记录 package 语句和 R 下每个内部类的 body
+ */
+static void parse_r_file(RFile *file) {
+    const std::string &text = file->text;
+    const size_t len = text.size();
+    int depth = 0;
+    size_t header_start = 0;
+    size_t body_start = 0;
+    std::string class_name;
+
+    size_t i = 0;
+    while (i < len) {
+        char ch = text[i];
+
+        if (ch == '/' && i + 1 < len && text[i+1] == '*') {
+            size_t end = text.find("*/", i + 2);
+            i = (end == std::string::npos) ? len : end + 2;
+            continue;
+        }
+        if (ch == '/' && i + 1 < len && text[i+1] == '/') {
+            size_t end = text.find('\n', i + 2);
+            i = (end == std::string::npos) ? len : end;
+            continue;
+        }
+        if (ch == '"' || ch == '\'') {
+            for (i++; i < len && text[i] != ch; i++) {
+                if (text[i] == '\\') {
+                    i++;
+                }
+            }
+            i++;
+            continue;
+        }
+
+        if (depth == 0 && file->package_line.empty() && ch == 'p'
+                && text.compare(i, 8, "package ") == 0
+                && (i == 0 || !is_ident_char(text[i-1]))) {
+            size_t end = text.find('\n', i);
+            if (end == std::string::npos) {
+                end = len;
+            }
+            file->package_line = text.substr(i, end - i);
+            i = end;
+            continue;
+        }
+
+        if (ch == '{') {
+            if (depth == 1) {
+                class_name = class_name_from_header(text, header_start, i);
+                body_start = i + 1;
+            }
+            depth++;
+        } else if (ch == '}') {
+            depth--;
+            if (depth == 1 && !class_name.empty()) {
+                if (file->index.find(class_name) == file->index.end()) {
+                    RClass cls;
+                    cls.name = class_name;
+                    cls.body_start = body_start;
+                    cls.body_len = i - body_start;
+                    file->index[class_name] = file->classes.size();
+                    file->classes.push_back(cls);
+                }
+                class_name.clear();
+            }
+        }
+
+        if (depth <= 1 && (ch == '{' || ch == '}' || ch == ';')) {
+            header_start = i + 1;
+        }
+        i++;
+    }
+}
+
+static void append_class(std::string *out, const std::string &name,
+                          const char *first_body, size_t first_len,
+                          const char *second_body, size_t second_len) {
+    std::string start_flag(k_flag_template);
+    start_flag.replace(start_flag.find("%s"), 2, name);
+
+    *out += "\n";
+    *out += start_flag;
+    if (first_body != NULL) {
+        out->append(first_body, first_len);
+    }
+    if (second_body != NULL) {
+        out->append(second_body, second_len);
+    }
+    *out += "    ";
+    *out += k_end_class_flag;
+}
+
+/**
+ * 把索引文件中一个类的字段写成 R.java 的 body，格式和 aapt 生成的一样
+ */
+static void index_class_body(const RSymbolIndex &index, size_t cls, std::string *out) {
+    out->clear();
+    *out += "\n";
+    char buf[32];
+    const size_t N = index.getFieldCount(cls);
+    for (size_t i = 0; i < N; i++) {
+        RSymbolIndex::Field field;
+        if (!index.getField(cls, i, &field)) {
+            continue;
+        }
+        *out += field.isFinal ? "        public static final " : "        public static ";
+        if (field.kind == RFieldSpec::kIntArray) {
+            *out += "int[] ";
+            out->append(field.name, field.nameLen);
+            *out += " = {\n            ";
+            for (size_t v = 0; v < field.count; v++) {
+                snprintf(buf, sizeof(buf), v == 0 ? "0x%08x" : ", 0x%08x",
+                         (uint32_t) index.getArrayValue(field, v));
+                *out += buf;
+            }
+            *out += "\n        };\n";
+        } else if (field.kind == RFieldSpec::kString) {
+            *out += "String ";
+            out->append(field.name, field.nameLen);
+            *out += "=\"";
+            out->append(field.string, field.count);
+            *out += "\";\n";
+        } else {
+            *out += "int ";
+            out->append(field.name, field.nameLen);
+            snprintf(buf, sizeof(buf), "=0x%08x;\n", (uint32_t) field.value);
+            *out += buf;
+        }
     }
 }
 
 int merge_r_file(const char* public_r_file_path, const char* project_r_file_path) {
+    return merge_r_file_with_stats(public_r_file_path, project_r_file_path, NULL);
+}
+
+int merge_r_file_with_stats(const char* public_r_file_path, const char* project_r_file_path,
+                            RMergeStats* stats) {
     if (public_r_file_path == NULL || project_r_file_path == NULL) {
         printf("***********Error, in param in null, return -1;\n");
         return -1;
     }
-    
-    FILE *public_r_fp = fopen(public_r_file_path, "r");
-    FILE *project_r_fp = fopen(project_r_file_path, "r");
-    
-    if (public_r_fp == NULL || project_r_fp == NULL) {
+
+    RMergeStats local_stats;
+    if (stats == NULL) {
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    // 公共R可以是 R.java，也可以是编译公共工程时生成的二进制索引 (见 RSymbolIndex.h)
+    RSymbolIndex public_index;
+    const bool use_index = RSymbolIndex::isIndexFile(public_r_file_path);
+    RFile public_r;
+    RFile project_r;
+    if (use_index) {
+        if (public_index.open(public_r_file_path) != 0
+                || !read_file(project_r_file_path, &project_r.text)) {
+            printf("***********Error, read R index or R.java failed, return -2;\n");
+            return -2;
+        }
+    } else if (!read_file(public_r_file_path, &public_r.text)
+            || !read_file(project_r_file_path, &project_r.text)) {
         printf("***********Error, read R.java failed, return -2;\n");
         return -2;
     }
-    
-    unsigned long public_r_file_size = get_file_size(public_r_file_path);
-    unsigned long project_r_file_size = get_file_size(project_r_file_path);
-    
-    unsigned long public_r_malloc_len = (unsigned long)(public_r_file_size + 1);
-    unsigned long project_r_malloc_len = (unsigned long)(project_r_file_size + 1);
-    unsigned long output_r_malloc_len = (unsigned long)(public_r_file_size + project_r_file_size+2);
-    
-    char *public_r_str = (char *)malloc(public_r_malloc_len);
-    char *public_r_formated_str = (char *)malloc(public_r_malloc_len);
-    char *project_r_str = (char *)malloc(project_r_malloc_len);
-    char *output_r_str = (char *)malloc(output_r_malloc_len);
-    
-    memset(public_r_str, '\0', public_r_malloc_len);
-    memset(public_r_formated_str, '\0', public_r_malloc_len);
-    memset(project_r_str, '\0', project_r_malloc_len);
-    memset(output_r_str, '\0', output_r_malloc_len);
-    
-    size_t public_r_read_len = fread(public_r_str, 1 , public_r_file_size, public_r_fp);
-    size_t project_r_read_len = fread(project_r_str, 1, project_r_file_size, project_r_fp);
-    
-    if (public_r_read_len == public_r_file_size && project_r_read_len == project_r_file_size) {
-        printf("***********[%s]、[%s],文件读取成功\n", public_r_file_path, project_r_file_path);
-        
-        char *find_package = strstr(project_r_str, k_package_flag);
-        if (find_package != NULL) {
-            char package_path[128] = {0};
-            
-            char pch = '\0';
-            int m = 0;
-            while ((pch = (*find_package++)) != '\n') {
-                package_path[m++] = pch;
-            }
-            printf("***********package name==%s\n", package_path);
-            
-            strcpy(output_r_str, package_path);
-        }
-        
-        strcat(output_r_str, "\npublic final class R {\n");
-        
-        int is_flag = 0;
-        int j = 0;
-        int i = 0;
-        for (; i < public_r_read_len; i++) {
-            if (i >= 0 && i <= public_r_read_len-4) {
-                if (public_r_str[i]== '/' && public_r_str[i+1] == '*' ) { //&& r_str[i+2] == '*'
-                    is_flag = 1;
-                }
-                else if (public_r_str[i-2] == '*' && public_r_str[i-1] == '/') {
-                    is_flag = 0;
-                }
-                
-                if (is_flag != 1) {
-                    public_r_formated_str[j++] = public_r_str[i];
-                }
+    stats->public_bytes = public_r.text.size();
+    stats->project_bytes = project_r.text.size();
+
+    nsecs_t read_done = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    if (!use_index) {
+        // 公共R只用来取字段，去掉javadoc注释；子工程R原样保留
+        strip_block_comments(&public_r.text);
+        parse_r_file(&public_r);
+    } else {
+        // 索引不用解析，直接按类生成 body
+        std::string body;
+        for (size_t i = 0; i < public_index.getClassCount(); i++) {
+            size_t len;
+            const char *name = public_index.getClassName(i, &len);
+            if (name == NULL) {
+                continue;
+            }
+            index_class_body(public_index, i, &body);
+            RClass cls;
+            cls.name.assign(name, len);
+            cls.body_start = public_r.text.size();
+            cls.body_len = body.size();
+            public_r.text += body;
+            if (public_r.index.find(cls.name) == public_r.index.end()) {
+                public_r.index[cls.name] = public_r.classes.size();
+                public_r.classes.push_back(cls);
             }
         }
-        
-        public_r_formated_str[j++] = '\0';
-        printf("***********Public R文件格式化完成!\n");
-        const char *end_anim_flag = k_end_class_flag;
-        
-        const char *s_tag =  k_start_class_flag;
-        char *find_str = strstr(public_r_formated_str,s_tag);
-        
-        while (find_str) {
-            find_str+= strlen(s_tag);
-            char tag_d[64]= {0};
-            int k = 0;
-            char ch = '\0';
-            while ((ch=*(find_str++)) != ' ') {
-                tag_d[k++] = ch;
-            }
-            
-            if (ch == ' ') {
-                printf("***********开始Merge tag:%s\n", tag_d);
-                char *start_flag = copy_start_flag_with_tag(tag_d);
-                char *array = copy_java_with_flag(public_r_formated_str, start_flag, end_anim_flag);
-                char *array2 = copy_java_with_flag(project_r_str, start_flag, end_anim_flag);
-                find_str = strstr(find_str,s_tag);
-                strcat(output_r_str, "\n");
-                strcat(output_r_str, start_flag);
-                
-                if (array != NULL) {
-                    strcat(output_r_str, array);
-                }
-                if (array2 != NULL) {
-                    strcat(output_r_str, array2);
-                }
-                strcat(output_r_str, "    ");
-                strcat(output_r_str, end_anim_flag);
-                
-                c_free(start_flag);
-                c_free(array);
-                c_free(array2);
-            }
-        }
-        
-        strcat(output_r_str, "\n}");
-    }
-    else {
-        printf("***********R.java file读取长度有错误, return -3;\n");
-        return -3;
-    }
-    
-    
-    fclose(project_r_fp);
-    fclose(public_r_fp);
-    
-    //    printf("ret_str===%s\n", output_r_str);
-    
-//    project_r_file_path = "tmp_R_d.java";
+        stats->public_bytes = public_r.text.size();
+    }
+    parse_r_file(&project_r);
+
+    nsecs_t parse_done = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    std::string output;
+    output.reserve(public_r.text.size() + project_r.text.size() + 64);
+    output += project_r.package_line;
+    output += "\npublic final class R {\n";
+
+    // 公共R中的类按原顺序输出，并接上子工程同名类的字段
+    for (size_t i = 0; i < public_r.classes.size(); i++) {
+        const RClass &cls = public_r.classes[i];
+        std::map<std::string, size_t>::const_iterator it = project_r.index.find(cls.name);
+        const RClass *project_cls =
+                it != project_r.index.end() ? &project_r.classes[it->second] : NULL;
+        append_class(&output, cls.name,
+                     public_r.text.data() + cls.body_start, cls.body_len,
+                     project_cls != NULL ? project_r.text.data() + project_cls->body_start : NULL,
+                     project_cls != NULL ? project_cls->body_len : 0);
+        stats->classes++;
+    }
+    // 只在子工程中出现的类 (比如公共工程没有的 styleable)
+    for (size_t i = 0; i < project_r.classes.size(); i++) {
+        const RClass &cls = project_r.classes[i];
+        if (public_r.index.find(cls.name) == public_r.index.end()) {
+            append_class(&output, cls.name, NULL, 0,
+                         project_r.text.data() + cls.body_start, cls.body_len);
+            stats->classes++;
+        }
+    }
+    output += "\n}";
+
+    stats->peak_bytes = public_r.memory_bytes() + project_r.memory_bytes() + output.capacity();
+
+    int result = 1;
     FILE *out_project_fp = fopen(project_r_file_path, "w");
     if (out_project_fp != NULL) {
-        size_t write_ret = fwrite(output_r_str, strlen(output_r_str), 1, out_project_fp);
-        fclose(out_project_fp);
-        
+        size_t write_ret = fwrite(output.data(), output.size(), 1, out_project_fp);
+        // fclose 会把缓冲区写出去，它失败同样说明文件没写完整
+        if (fclose(out_project_fp) != 0) {
+            write_ret = 0;
+        }
+
         if (write_ret == 1) {
             printf("***********写R文件成功成功!Path=[%s]\n", project_r_file_path);
         } else {
-            printf("***********写文件失败, write_ret==%ld\n", write_ret);
+            printf("***********写文件失败, write_ret==%ld, return -5;\n", (long) write_ret);
+            result = -5;
+        }
+    } else {
+        printf("***********Error, open [%s] for writing failed\n", project_r_file_path);
+        result = -4;
+    }
+    stats->output_bytes = output.size();
+
+    nsecs_t write_done = systemTime(SYSTEM_TIME_MONOTONIC);
+    stats->read_ms = (read_done - start) / 1000000.0;
+    stats->parse_ms = (parse_done - read_done) / 1000000.0;
+    stats->write_ms = (write_done - parse_done) / 1000000.0;
+
+    return result;
+}
+
+/**
+ * 解析一条字段声明 (不含结尾的 ";")，例如
+ *   public static final int app_name=0x7f050000
+ *   public static final int[] Widget = { 0x7f010000, 0x7f010001 }
+ * 注解跳过；int, int[], String 以外的类型返回 false
+ */
+static bool parse_field_decl(const std::string &stmt, RFieldSpec *field) {
+    size_t eq = stmt.find('=');
+    if (eq == std::string::npos) {
+        return false;
+    }
+
+    std::vector<std::string> words;
+    bool is_array = false;
+    size_t i = 0;
+    while (i < eq) {
+        char ch = stmt[i];
+        if (ch == '@') {
+            // 注解，连同参数一起跳过
+            for (i++; i < eq && (is_ident_char(stmt[i]) || stmt[i] == '.'); i++) {
+            }
+            while (i < eq && (stmt[i] == ' ' || stmt[i] == '\t' || stmt[i] == '\r' || stmt[i] == '\n')) {
+                i++;
+            }
+            if (i < eq && stmt[i] == '(') {
+                size_t end = stmt.find(')', i);
+                i = (end == std::string::npos || end > eq) ? eq : end + 1;
+            }
+        } else if (is_ident_char(ch)) {
+            size_t word = i;
+            while (i < eq && is_ident_char(stmt[i])) {
+                i++;
+            }
+            words.push_back(stmt.substr(word, i - word));
+        } else {
+            if (ch == '[') {
+                is_array = true;
+            }
+            i++;
         }
     }
-    
-    c_free(public_r_str);
-    c_free(public_r_formated_str);
-    c_free(project_r_str);
-    c_free(output_r_str);
-    
+    if (words.size() < 2) {
+        return false;
+    }
+
+    const std::string &type = words[words.size() - 2];
+    field->name = words[words.size() - 1];
+    field->isFinal = false;
+    for (size_t w = 0; w + 2 < words.size(); w++) {
+        if (words[w] == "final") {
+            field->isFinal = true;
+        }
+    }
+
+    const char *init = stmt.c_str() + eq + 1;
+    if (type == "int" && !is_array) {
+        field->kind = RFieldSpec::kInt;
+        field->value = (int32_t) strtoll(init, NULL, 0);
+    } else if (type == "int") {
+        field->kind = RFieldSpec::kIntArray;
+        field->values.clear();
+        const char *p = strchr(init, '{');
+        if (p == NULL) {
+            return false;
+        }
+        for (p++; *p != 0 && *p != '}'; ) {
+            char *end;
+            long long value = strtoll(p, &end, 0);
+            if (end == p) {
+                // 空白和逗号
+                p++;
+                continue;
+            }
+            field->values.push_back((int32_t) value);
+            p = end;
+        }
+    } else if (type == "String") {
+        field->kind = RFieldSpec::kString;
+        field->stringValue.clear();
+        const char *p = strchr(init, '"');
+        if (p == NULL) {
+            return false;
+        }
+        for (p++; *p != 0 && *p != '"'; p++) {
+            if (*p == '\\' && p[1] != 0) {
+                p++;
+            }
+            field->stringValue += *p;
+        }
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * 按顺序解析内部类 body 里的字段声明；方法和静态代码块整个跳过
+ */
+static void parse_class_fields(const std::string &text, size_t start, size_t len,
+                               RClassSpec *cls) {
+    const size_t end = start + len;
+    size_t stmt_start = start;
+    bool has_init = false;
+    int depth = 0;
+
+    size_t i = start;
+    while (i < end) {
+        char ch = text[i];
+
+        if (ch == '/' && i + 1 < end && text[i+1] == '*') {
+            size_t close = text.find("*/", i + 2);
+            i = (close == std::string::npos || close >= end) ? end : close + 2;
+            if (depth == 0 && !has_init) {
+                stmt_start = i;
+            }
+            continue;
+        }
+        if (ch == '/' && i + 1 < end && text[i+1] == '/') {
+            size_t close = text.find('\n', i + 2);
+            i = (close == std::string::npos || close >= end) ? end : close;
+            if (depth == 0 && !has_init) {
+                stmt_start = i;
+            }
+            continue;
+        }
+        if (ch == '"' || ch == '\'') {
+            for (i++; i < end && text[i] != ch; i++) {
+                if (text[i] == '\\') {
+                    i++;
+                }
+            }
+            i++;
+            continue;
+        }
+
+        if (ch == '=' && depth == 0) {
+            has_init = true;
+        } else if (ch == '{') {
+            depth++;
+        } else if (ch == '}') {
+            depth--;
+            if (depth == 0 && !has_init) {
+                // 方法或者静态代码块结束
+                stmt_start = i + 1;
+            }
+        } else if (ch == ';' && depth == 0) {
+            RFieldSpec field;
+            if (parse_field_decl(text.substr(stmt_start, i - stmt_start), &field)) {
+                cls->fields.push_back(field);
+            }
+            stmt_start = i + 1;
+            has_init = false;
+        }
+        i++;
+    }
+}
+
+int read_r_file_classes(const char* public_r_file_path, RClassSpec* out) {
+    if (public_r_file_path == NULL || out == NULL) {
+        printf("***********Error, in param in null, return -1;\n");
+        return -1;
+    }
+
+    if (RSymbolIndex::isIndexFile(public_r_file_path)) {
+        RSymbolIndex index;
+        if (index.open(public_r_file_path) != 0) {
+            printf("***********Error, read R index failed, return -2;\n");
+            return -2;
+        }
+        index.toClassSpec(out);
+        return 1;
+    }
+
+    RFile public_r;
+    if (!read_file(public_r_file_path, &public_r.text)) {
+        printf("***********Error, read R.java failed, return -2;\n");
+        return -2;
+    }
+    strip_block_comments(&public_r.text);
+    parse_r_file(&public_r);
+
+    out->name = "R";
+    out->fields.clear();
+    out->inner.clear();
+    out->inner.resize(public_r.classes.size());
+    for (size_t i = 0; i < public_r.classes.size(); i++) {
+        const RClass &cls = public_r.classes[i];
+        out->inner[i].name = cls.name;
+        parse_class_fields(public_r.text, cls.body_start, cls.body_len, &out->inner[i]);
+    }
     return 1;
 }
 
+size_t merge_r_classes(const RClassSpec& public_r, RClassSpec* project_r) {
+    std::vector<RClassSpec> merged;
+    merged.reserve(public_r.inner.size() + project_r->inner.size());
+
+    // 公共R中的类按原顺序输出，并接上子工程同名类的字段
+    std::set<std::string> public_classes;
+    for (size_t i = 0; i < public_r.inner.size(); i++) {
+        const RClassSpec &public_cls = public_r.inner[i];
+        public_classes.insert(public_cls.name);
+        merged.push_back(public_cls);
+        RClassSpec &cls = merged.back();
+
+        const RClassSpec *project_cls = project_r->findInner(public_cls.name);
+        if (project_cls == NULL) {
+            continue;
+        }
+        // R.java 合并后同名字段会编译失败，class 文件里也不能重复，保留公共R的
+        std::set<std::string> names;
+        for (size_t f = 0; f < cls.fields.size(); f++) {
+            names.insert(cls.fields[f].name);
+        }
+        for (size_t f = 0; f < project_cls->fields.size(); f++) {
+            const RFieldSpec &field = project_cls->fields[f];
+            if (names.insert(field.name).second) {
+                cls.fields.push_back(field);
+            } else {
+                printf("***********Warning, %s.%s is in both R files, keep the public one\n",
+                       cls.name.c_str(), field.name.c_str());
+            }
+        }
+    }
+    // 只在子工程中出现的类 (比如公共工程没有的 styleable)
+    for (size_t i = 0; i < project_r->inner.size(); i++) {
+        if (public_classes.find(project_r->inner[i].name) == public_classes.end()) {
+            merged.push_back(project_r->inner[i]);
+        }
+    }
+
+    project_r->inner.swap(merged);
+    return project_r->inner.size();
+}
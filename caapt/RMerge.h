@@ -11,12 +11,49 @@
 
 #include <stdio.h>
 
+#include "RClassWriter.h"
+
+/**
+ * merge_r_file_with_stats 的统计信息
+ */
+struct RMergeStats {
+    double read_ms;            // 读取两个R文件
+    double parse_ms;           // 解析成 class -> fields 索引
+    double write_ms;           // 写出合并后的R文件
+    size_t public_bytes;       // 公共工程R文件大小
+    size_t project_bytes;      // 子工程R文件大小
+    size_t output_bytes;       // 合并后R文件大小
+    size_t peak_bytes;         // 合并过程中同时持有的最大内存(文件内容+索引+输出)
+    size_t classes;            // 输出的内部类个数
+};
+
 /**
  * Merge 子工程R文件和公共工程R文件，merge之后，会自动修改子工程R文件
  * @param project_r_file_path 子工程R文件路径
- * @param public_r_file_path  公共工程R文件路径
- * @return 成功返回1
+ * @param public_r_file_path  公共工程R文件路径，也可以是公共工程生成的 R.idx 索引 (见 RSymbolIndex.h)
+ * @return 成功返回1；参数为空返回-1，读取失败返回-2，打不开输出文件返回-4，写入失败返回-5
  */
 int merge_r_file(const char* public_r_file_path, const char* project_r_file_path);
 
+/**
+ * 同 merge_r_file，另外把耗时和内存统计写入 stats (可以为NULL)
+ */
+int merge_r_file_with_stats(const char* public_r_file_path, const char* project_r_file_path,
+                            RMergeStats* stats);
+
+/**
+ * 解析公共工程R文件中各个内部类的字段 (int, int[], String)，用于 --output-r-jar
+ * @param public_r_file_path 公共工程R文件路径，或者 R.idx 索引
+ * @param out                解析结果，内部类按R文件中的顺序排列
+ * @return 成功返回1
+ */
+int read_r_file_classes(const char* public_r_file_path, RClassSpec* out);
+
+/**
+ * 和 merge_r_file 相同的合并规则，作用在已经解析好的类上：公共R中的类按原顺序在前，
+ * 并接上子工程同名类的字段；只在子工程中出现的类放在最后。结果写回 project_r
+ * @return 合并后的内部类个数
+ */
+size_t merge_r_classes(const RClassSpec& public_r, RClassSpec* project_r);
+
 #endif /* defined(__RMerge__RMerge__) */
@@ -0,0 +1,397 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Binary, mmap()able index of the symbols in an R class.
+//
+
+#include "RSymbolIndex.h"
+#include "AaptUtil.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static const unsigned char kMagic[4] = { 'R', 'S', 'Y', 'M' };
+enum {
+    kVersion        = 1,
+    kHeaderSize     = 40,   // magic, version, 4 x (offset, count)
+    kClassSize      = 16,
+    kFieldSize      = 20,
+
+    kKindMask       = 0xff,
+    kFlagFinal      = 0x100,
+};
+
+static inline uint32_t readU4(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void writeU4(std::vector<unsigned char>* out, uint32_t val)
+{
+    out->push_back((unsigned char) val);
+    out->push_back((unsigned char) (val >> 8));
+    out->push_back((unsigned char) (val >> 16));
+    out->push_back((unsigned char) (val >> 24));
+}
+
+static bool lessByName(const RFieldSpec* a, const RFieldSpec* b)
+{
+    return a->name < b->name;
+}
+
+/* memcmp() order, a shorter name sorting before its extensions */
+static int compareNames(const char* a, size_t aLen, const char* b, size_t bLen)
+{
+    int cmp = memcmp(a, b, aLen < bLen ? aLen : bLen);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return aLen < bLen ? -1 : (aLen > bLen ? 1 : 0);
+}
+
+RSymbolIndex::RSymbolIndex()
+    : mData(NULL), mSize(0),
+      mClassCount(0), mClasses(NULL), mFieldCount(0), mFields(NULL),
+      mValueCount(0), mValues(NULL), mStringsSize(0), mStrings(NULL)
+{
+}
+
+RSymbolIndex::~RSymbolIndex()
+{
+    close();
+}
+
+void RSymbolIndex::close()
+{
+    AaptUtil::unmapFile(mData, mSize);
+    mData = NULL;
+    mSize = 0;
+    mClassCount = mFieldCount = mValueCount = mStringsSize = 0;
+}
+
+bool RSymbolIndex::isIndexFile(const char* path)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        return false;
+    }
+    unsigned char magic[sizeof(kMagic)];
+    bool match = fread(magic, 1, sizeof(magic), fp) == sizeof(magic)
+            && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+    fclose(fp);
+    return match;
+}
+
+status_t RSymbolIndex::write(const char* path, const RClassSpec& r)
+{
+    std::vector<unsigned char> classes;
+    std::vector<unsigned char> fields;
+    std::vector<unsigned char> values;
+    std::string strings;
+
+    size_t numFields = 0;
+    size_t numValues = 0;
+    for (size_t c = 0; c < r.inner.size(); c++) {
+        const RClassSpec& cls = r.inner[c];
+
+        writeU4(&classes, strings.size());
+        writeU4(&classes, cls.name.size());
+        writeU4(&classes, numFields);
+        writeU4(&classes, cls.fields.size());
+        strings.append(cls.name);
+        strings += '\0';
+
+        std::vector<const RFieldSpec*> sorted;
+        sorted.reserve(cls.fields.size());
+        for (size_t f = 0; f < cls.fields.size(); f++) {
+            sorted.push_back(&cls.fields[f]);
+        }
+        std::sort(sorted.begin(), sorted.end(), lessByName);
+
+        for (size_t f = 0; f < sorted.size(); f++) {
+            const RFieldSpec& field = *sorted[f];
+            writeU4(&fields, strings.size());
+            writeU4(&fields, field.name.size());
+            writeU4(&fields, field.kind | (field.isFinal ? kFlagFinal : 0));
+            strings.append(field.name);
+            strings += '\0';
+
+            switch (field.kind) {
+                case RFieldSpec::kIntArray:
+                    writeU4(&fields, numValues);
+                    writeU4(&fields, field.values.size());
+                    for (size_t v = 0; v < field.values.size(); v++) {
+                        writeU4(&values, (uint32_t) field.values[v]);
+                    }
+                    numValues += field.values.size();
+                    break;
+                case RFieldSpec::kString:
+                    writeU4(&fields, strings.size());
+                    writeU4(&fields, field.stringValue.size());
+                    strings.append(field.stringValue);
+                    strings += '\0';
+                    break;
+                default:
+                    writeU4(&fields, (uint32_t) field.value);
+                    writeU4(&fields, 0);
+                    break;
+            }
+        }
+        numFields += cls.fields.size();
+    }
+
+    std::vector<unsigned char> header(kMagic, kMagic + sizeof(kMagic));
+    size_t offset = kHeaderSize;
+    writeU4(&header, kVersion);
+    writeU4(&header, offset);
+    writeU4(&header, r.inner.size());
+    offset += classes.size();
+    writeU4(&header, offset);
+    writeU4(&header, numFields);
+    offset += fields.size();
+    writeU4(&header, offset);
+    writeU4(&header, numValues);
+    offset += values.size();
+    writeU4(&header, offset);
+    writeU4(&header, strings.size());
+
+    // write a temp file and rename it, so a reader never maps half an index
+    std::string tmpPath(path);
+    tmpPath += ".tmp";
+    FILE* fp = fopen(tmpPath.c_str(), "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "ERROR: Unable to open symbol index %s: %s\n",
+                tmpPath.c_str(), strerror(errno));
+        return UNKNOWN_ERROR;
+    }
+    bool ok = fwrite(&header[0], 1, header.size(), fp) == header.size();
+    if (ok && !classes.empty()) {
+        ok = fwrite(&classes[0], 1, classes.size(), fp) == classes.size();
+    }
+    if (ok && !fields.empty()) {
+        ok = fwrite(&fields[0], 1, fields.size(), fp) == fields.size();
+    }
+    if (ok && !values.empty()) {
+        ok = fwrite(&values[0], 1, values.size(), fp) == values.size();
+    }
+    if (ok && !strings.empty()) {
+        ok = fwrite(strings.data(), 1, strings.size(), fp) == strings.size();
+    }
+    ok = fclose(fp) == 0 && ok;
+#ifdef HAVE_MS_C_RUNTIME
+    // rename() won't replace an existing file here
+    unlink(path);
+#endif
+    if (!ok || rename(tmpPath.c_str(), path) != 0) {
+        fprintf(stderr, "ERROR: Unable to write symbol index %s\n", path);
+        unlink(tmpPath.c_str());
+        return UNKNOWN_ERROR;
+    }
+    return NO_ERROR;
+}
+
+status_t RSymbolIndex::open(const char* path)
+{
+    close();
+
+    size_t size;
+    const void* data = AaptUtil::mapFile(path, &size);
+    if (data == NULL) {
+        return UNKNOWN_ERROR;
+    }
+    mData = (const unsigned char*) data;
+    mSize = size;
+    if (size < kHeaderSize) {
+        close();
+        return BAD_VALUE;
+    }
+
+    const unsigned char* h = mData;
+    if (memcmp(h, kMagic, sizeof(kMagic)) != 0 || readU4(h + 4) != kVersion) {
+        close();
+        return BAD_VALUE;
+    }
+
+    // each table has to lie inside the file; entries are checked on use
+    const uint32_t tables[4][2] = {
+        { readU4(h + 8),  readU4(h + 12) },
+        { readU4(h + 16), readU4(h + 20) },
+        { readU4(h + 24), readU4(h + 28) },
+        { readU4(h + 32), readU4(h + 36) },
+    };
+    const size_t entrySizes[4] = { kClassSize, kFieldSize, 4, 1 };
+    for (int t = 0; t < 4; t++) {
+        const uint64_t end = tables[t][0] + (uint64_t) tables[t][1] * entrySizes[t];
+        if (tables[t][0] < kHeaderSize || end > size) {
+            close();
+            return BAD_VALUE;
+        }
+    }
+
+    mClasses = mData + tables[0][0];
+    mClassCount = tables[0][1];
+    mFields = mData + tables[1][0];
+    mFieldCount = tables[1][1];
+    mValues = mData + tables[2][0];
+    mValueCount = tables[2][1];
+    mStrings = (const char*) mData + tables[3][0];
+    mStringsSize = tables[3][1];
+    return NO_ERROR;
+}
+
+const unsigned char* RSymbolIndex::classEntry(size_t cls) const
+{
+    return cls < mClassCount ? mClasses + cls * kClassSize : NULL;
+}
+
+const char* RSymbolIndex::stringAt(uint32_t offset, uint32_t len) const
+{
+    if ((uint64_t) offset + len >= mStringsSize) {
+        return NULL;
+    }
+    return mStrings + offset;
+}
+
+const char* RSymbolIndex::getClassName(size_t cls, size_t* outLen) const
+{
+    const unsigned char* entry = classEntry(cls);
+    if (entry == NULL) {
+        return NULL;
+    }
+    *outLen = readU4(entry + 4);
+    return stringAt(readU4(entry), *outLen);
+}
+
+ssize_t RSymbolIndex::indexOfClass(const char* name) const
+{
+    const size_t len = strlen(name);
+    for (size_t c = 0; c < mClassCount; c++) {
+        size_t clsLen;
+        const char* clsName = getClassName(c, &clsLen);
+        if (clsName != NULL && clsLen == len && memcmp(clsName, name, len) == 0) {
+            return c;
+        }
+    }
+    return -1;
+}
+
+size_t RSymbolIndex::getFieldCount(size_t cls) const
+{
+    const unsigned char* entry = classEntry(cls);
+    if (entry == NULL) {
+        return 0;
+    }
+    const uint32_t first = readU4(entry + 8);
+    const uint32_t count = readU4(entry + 12);
+    if ((uint64_t) first + count > mFieldCount) {
+        return 0;
+    }
+    return count;
+}
+
+bool RSymbolIndex::getField(size_t cls, size_t i, Field* outField) const
+{
+    if (i >= getFieldCount(cls)) {
+        return false;
+    }
+    const unsigned char* entry = mFields + (readU4(classEntry(cls) + 8) + i) * kFieldSize;
+
+    const uint32_t kindFlags = readU4(entry + 8);
+    outField->nameLen = readU4(entry + 4);
+    outField->name = stringAt(readU4(entry), outField->nameLen);
+    outField->kind = (RFieldSpec::Kind) (kindFlags & kKindMask);
+    outField->isFinal = (kindFlags & kFlagFinal) != 0;
+    outField->value = (int32_t) readU4(entry + 12);
+    outField->count = readU4(entry + 16);
+    outField->string = NULL;
+    if (outField->name == NULL) {
+        return false;
+    }
+
+    switch (outField->kind) {
+        case RFieldSpec::kIntArray:
+            return (uint64_t) (uint32_t) outField->value + outField->count <= mValueCount;
+        case RFieldSpec::kString:
+            outField->string = stringAt(outField->value, outField->count);
+            return outField->string != NULL;
+        case RFieldSpec::kInt:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int32_t RSymbolIndex::getArrayValue(const Field& field, size_t i) const
+{
+    return (int32_t) readU4(mValues + ((uint32_t) field.value + i) * 4);
+}
+
+bool RSymbolIndex::findField(size_t cls, const char* name, size_t nameLen,
+        Field* outField) const
+{
+    size_t lo = 0;
+    size_t hi = getFieldCount(cls);
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (!getField(cls, mid, outField)) {
+            return false;
+        }
+        const int cmp = compareNames(outField->name, outField->nameLen, name, nameLen);
+        if (cmp == 0) {
+            return true;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+void RSymbolIndex::toClassSpec(RClassSpec* out) const
+{
+    out->name = "R";
+    out->fields.clear();
+    out->inner.clear();
+    out->inner.resize(mClassCount);
+    for (size_t c = 0; c < mClassCount; c++) {
+        RClassSpec& cls = out->inner[c];
+        size_t len;
+        const char* name = getClassName(c, &len);
+        if (name != NULL) {
+            cls.name.assign(name, len);
+        }
+
+        const size_t N = getFieldCount(c);
+        cls.fields.reserve(N);
+        for (size_t i = 0; i < N; i++) {
+            Field field;
+            if (!getField(c, i, &field)) {
+                continue;
+            }
+            RFieldSpec spec;
+            spec.name.assign(field.name, field.nameLen);
+            spec.kind = field.kind;
+            spec.isFinal = field.isFinal;
+            if (field.kind == RFieldSpec::kIntArray) {
+                spec.values.reserve(field.count);
+                for (size_t v = 0; v < field.count; v++) {
+                    spec.values.push_back(getArrayValue(field, v));
+                }
+            } else if (field.kind == RFieldSpec::kString) {
+                spec.stringValue.assign(field.string, field.count);
+            } else {
+                spec.value = field.value;
+            }
+            cls.fields.push_back(spec);
+        }
+    }
+}
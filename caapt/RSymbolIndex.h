@@ -0,0 +1,100 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Binary, mmap()able index of the symbols in an R class.
+//
+
+#ifndef __R_SYMBOL_INDEX_H
+#define __R_SYMBOL_INDEX_H
+
+#include <utils/Errors.h>
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "RClassWriter.h"
+
+using namespace android;
+
+/*
+ * Every module build hands the base project's R.java to --public-R-path,
+ * and scanning several megabytes of Java source each time costs more
+ * than the merge itself.  When the base is built with
+ * --output-text-symbols, an index of the same symbols is written next to
+ * R.txt; --public-R-path accepts it in place of R.java.
+ *
+ * The file is mapped, not parsed: opening it only checks the header,
+ * and a symbol is found by binary search in its class's table.
+ *
+ * Layout (all integers little-endian uint32):
+ *
+ *   header   magic "RSYM", version, then (offset, count) of the class
+ *            table, field table, int[] values and string data
+ *   classes  { name, nameLen, firstField, fieldCount } in R.java order
+ *   fields   { name, nameLen, kind | flags, value, count }, each class's
+ *            run sorted by name.  "value" is the int, or the index of
+ *            the first array element, or the offset of the string.
+ *   values   int32 array elements
+ *   strings  names and string values, each followed by a NUL
+ */
+class RSymbolIndex {
+public:
+    struct Field {
+        const char* name;
+        size_t nameLen;
+        RFieldSpec::Kind kind;
+        bool isFinal;
+        int32_t value;          // kInt
+        size_t count;           // kIntArray: number of values; kString: length
+        const char* string;     // kString
+    };
+
+    RSymbolIndex();
+    ~RSymbolIndex();
+
+    /* true if the file at "path" starts with the index magic */
+    static bool isIndexFile(const char* path);
+
+    /* write the inner classes of "r" as an index file */
+    static status_t write(const char* path, const RClassSpec& r);
+
+    status_t open(const char* path);
+
+    size_t getClassCount() const { return mClassCount; }
+    const char* getClassName(size_t cls, size_t* outLen) const;
+    ssize_t indexOfClass(const char* name) const;
+
+    size_t getFieldCount(size_t cls) const;
+    /* the i'th field of a class, in name order */
+    bool getField(size_t cls, size_t i, Field* outField) const;
+    /* element "i" of an int[] field */
+    int32_t getArrayValue(const Field& field, size_t i) const;
+
+    /* binary search a class's table for "name" */
+    bool findField(size_t cls, const char* name, size_t nameLen, Field* outField) const;
+
+    /* expand the whole index into an R class spec */
+    void toClassSpec(RClassSpec* out) const;
+
+private:
+    RSymbolIndex(const RSymbolIndex&);
+    RSymbolIndex& operator=(const RSymbolIndex&);
+
+    const unsigned char* classEntry(size_t cls) const;
+    const char* stringAt(uint32_t offset, uint32_t len) const;
+    void close();
+
+    const unsigned char* mData;
+    size_t mSize;
+
+    size_t mClassCount;
+    const unsigned char* mClasses;
+    size_t mFieldCount;
+    const unsigned char* mFields;
+    size_t mValueCount;
+    const unsigned char* mValues;
+    size_t mStringsSize;
+    const char* mStrings;
+};
+
+#endif // __R_SYMBOL_INDEX_H
@@ -16,6 +16,10 @@
 #include "WorkQueue.h"
 #include "XMLNode.h"
 #include "RMerge.h"
+#include "RClassWriter.h"
+#include "RSymbolIndex.h"
+
+#include <sys/stat.h>
 
 #if HAVE_PRINTF_ZD
 #  define ZD "%zd"
@@ -27,9 +31,6 @@
 
 #define NOISY(x) // x
 
-// Number of threads to use for preprocessing images.
-static const size_t MAX_THREADS = 4;
-
 // ==========================================================================
 // ==========================================================================
 // ==========================================================================
@@ -325,7 +326,17 @@ class PreProcessImageWorkUnit : public WorkQueue::WorkUnit {
 public:
     PreProcessImageWorkUnit(const Bundle* bundle, const sp<AaptAssets>& assets,
             const sp<AaptFile>& file, volatile bool* hasErrors) :
-            mBundle(bundle), mAssets(assets), mFile(file), mHasErrors(hasErrors) {
+            mBundle(bundle), mAssets(assets), mFile(file), mHasErrors(hasErrors),
+            mSourceSize(0) {
+        struct stat st;
+        if (stat(file->getSourceFile().string(), &st) == 0) {
+            mSourceSize = st.st_size;
+        }
+    }
+
+    // Bigger images take longer to crunch, so start them first.
+    virtual size_t weight() const {
+        return mSourceSize;
     }
 
     virtual bool run() {
@@ -341,6 +352,7 @@ private:
     sp<AaptAssets> mAssets;
     sp<AaptFile> mFile;
     volatile bool* mHasErrors;
+    size_t mSourceSize;
 };
 
 static status_t preProcessImages(const Bundle* bundle, const sp<AaptAssets>& assets,
@@ -349,12 +361,13 @@ static status_t preProcessImages(const Bundle* bundle, const sp<AaptAssets>& ass
     volatile bool hasErrors = false;
     ssize_t res = NO_ERROR;
     if (bundle->getUseCrunchCache() == false) {
-        WorkQueue wq(MAX_THREADS, false);
+        WorkQueue wq(bundle->getJobs(), false, WorkQueue::SCHEDULE_HEAVIEST_FIRST);
         ResourceDirIterator it(set, String8(type));
         while ((res=it.next()) == NO_ERROR) {
             PreProcessImageWorkUnit* w = new PreProcessImageWorkUnit(
                     bundle, assets, it.getFile(), &hasErrors);
-            status_t status = wq.schedule(w);
+            // No backlog limit: queue every image so the largest go first.
+            status_t status = wq.schedule(w, 0);
             if (status) {
                 fprintf(stderr, "preProcessImages failed: schedule() returned %d\n", status);
                 hasErrors = true;
@@ -560,6 +573,43 @@ static void checkForIds(const String8& path, ResXMLParser& parser)
     }
 }
 
+/*
+ * Compile the XML files of one resource type with compileXmlFiles(), in
+ * iteration order.  "checkIds" runs checkForIds() on each, as for layouts
+ * and menus.
+ */
+static status_t compileXmlResources(const Bundle* bundle, const sp<AaptAssets>& assets,
+                                    ResourceTable* table, const sp<ResourceTypeSet>& set,
+                                    const char* resType, int xmlFlags, bool checkIds)
+{
+    Vector<String16> names;
+    Vector<sp<AaptFile> > files;
+    Vector<String8> sources;
+    ResourceDirIterator it(set, String8(resType));
+    ssize_t res;
+    while ((res=it.next()) == NO_ERROR) {
+        names.add(String16(it.getBaseName()));
+        files.add(it.getFile());
+        // before compiling, while it still names the source file
+        sources.add(it.getFile()->getPrintableSource());
+    }
+
+    Vector<status_t> results;
+    bool hasErrors = compileXmlFiles(bundle, assets, names, files, table, xmlFlags,
+            &results) != NO_ERROR;
+    if (checkIds) {
+        for (size_t i = 0; i < files.size(); i++) {
+            if (results[i] == NO_ERROR) {
+                ResXMLTree block;
+                block.setTo(files[i]->getData(), files[i]->getSize(), true);
+                checkForIds(sources[i], block);
+            }
+        }
+    }
+
+    return (hasErrors || res < NO_ERROR) ? UNKNOWN_ERROR : NO_ERROR;
+}
+
 static bool applyFileOverlay(Bundle *bundle,
                              const sp<AaptAssets>& assets,
                              sp<ResourceTypeSet> *baseSet,
@@ -985,7 +1035,7 @@ static ssize_t extractPlatformBuildVersion(ResXMLTree& tree, Bundle* bundle) {
     return UNKNOWN_ERROR;
 }
 
-static ssize_t extractPlatformBuildVersion(AssetManager& assets, Bundle* bundle) {
+ssize_t extractPlatformBuildVersion(AssetManager& assets, Bundle* bundle) {
     int32_t cookie = getPlatformAssetCookie(assets);
     if (cookie == 0) {
         // No platform was loaded.
@@ -1033,7 +1083,7 @@ status_t updatePreProcessedCache(Bundle* bundle)
     CrunchCache cc(source,dest,ff);
 
     CacheUpdater* cu = new SystemCacheUpdater(bundle);
-    size_t numFiles = cc.crunch(cu);
+    size_t numFiles = cc.crunch(cu, false, bundle->getJobs());
 
     if (bundle->getVerbose())
         fprintf(stdout, "Crunched %d PNG files to update cache\n", (int)numFiles);
@@ -1328,7 +1378,11 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
         }
     }
 
-    // compile resources
+    // compile resources: every values file of the assets and their
+    // overlays, in that order, as one batch
+    Vector<sp<AaptFile> > valuesFiles;
+    Vector<ResTable_config> valuesParams;
+    Vector<bool> valuesOverwrite;
     current = assets;
     while(current.get()) {
         KeyedVector<String8, sp<ResourceTypeSet> > *resources = 
@@ -1339,18 +1393,24 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
             ResourceDirIterator it(resources->valueAt(index), String8("values"));
             ssize_t res;
             while ((res=it.next()) == NO_ERROR) {
-                sp<AaptFile> file = it.getFile();
-                res = compileResourceFile(bundle, assets, file, it.getParams(), 
-                                          (current!=assets), &table);
-                if (res != NO_ERROR) {
-                    fprintf(stderr,"error ResourceDirIterator\n");
-                    hasErrors = true;
-                }
+                valuesFiles.add(it.getFile());
+                valuesParams.add(it.getParams());
+                valuesOverwrite.add(current != assets);
             }
         }
         current = current->getOverlay();
     }
 
+    Vector<status_t> valuesResults;
+    compileResourceFiles(bundle, assets, valuesFiles, valuesParams, valuesOverwrite,
+            &table, &valuesResults);
+    for (size_t i = 0; i < valuesResults.size(); i++) {
+        if (valuesResults[i] != NO_ERROR) {
+            fprintf(stderr,"error ResourceDirIterator\n");
+            hasErrors = true;
+        }
+    }
+
     if (colors != NULL) {
         err = makeFileResources(bundle, assets, &table, colors, "color");
         if (err != NO_ERROR) {
@@ -1382,114 +1442,58 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
     // --------------------------------------------------------------
 
     if (layouts != NULL) {
-        ResourceDirIterator it(layouts, String8("layout"));
-        while ((err=it.next()) == NO_ERROR) {
-            String8 src = it.getFile()->getPrintableSource();
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err == NO_ERROR) {
-                ResXMLTree block;
-                block.setTo(it.getFile()->getData(), it.getFile()->getSize(), true);
-                checkForIds(src, block);
-            } else {
-                fprintf(stderr,"error layouts\n");
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
+        if (compileXmlResources(bundle, assets, &table, layouts, "layout", xmlFlags, true)
+                != NO_ERROR) {
             fprintf(stderr,"error layouts\n");
             hasErrors = true;
         }
-        err = NO_ERROR;
     }
 
     if (anims != NULL) {
-        ResourceDirIterator it(anims, String8("anim"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
+        if (compileXmlResources(bundle, assets, &table, anims, "anim", xmlFlags, false)
+                != NO_ERROR) {
             hasErrors = true;
         }
-        err = NO_ERROR;
     }
 
     if (animators != NULL) {
-        ResourceDirIterator it(animators, String8("animator"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
+        if (compileXmlResources(bundle, assets, &table, animators, "animator", xmlFlags, false)
+                != NO_ERROR) {
             hasErrors = true;
         }
-        err = NO_ERROR;
     }
 
     if (interpolators != NULL) {
-        ResourceDirIterator it(interpolators, String8("interpolator"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
+        if (compileXmlResources(bundle, assets, &table, interpolators, "interpolator", xmlFlags, false)
+                != NO_ERROR) {
             hasErrors = true;
         }
-        err = NO_ERROR;
     }
 
     if (transitions != NULL) {
-        ResourceDirIterator it(transitions, String8("transition"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
+        if (compileXmlResources(bundle, assets, &table, transitions, "transition", xmlFlags, false)
+                != NO_ERROR) {
             hasErrors = true;
         }
-        err = NO_ERROR;
     }
 
     if (xmls != NULL) {
-        ResourceDirIterator it(xmls, String8("xml"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
+        if (compileXmlResources(bundle, assets, &table, xmls, "xml", xmlFlags, false)
+                != NO_ERROR) {
             hasErrors = true;
         }
-        err = NO_ERROR;
     }
 
     if (drawables != NULL) {
+        // The images were crunched by preProcessImages(); what's left is
+        // the XML, compiled as postProcessImage() would.
+        Vector<String16> names;
+        Vector<sp<AaptFile> > files;
         ResourceDirIterator it(drawables, String8("drawable"));
         while ((err=it.next()) == NO_ERROR) {
-            err = postProcessImage(bundle, assets, &table, it.getFile());
-            if (err != NO_ERROR) {
-                hasErrors = true;
+            if (it.getFile()->getPath().getPathExtension() == ".xml") {
+                names.add(String16(it.getBaseName()));
+                files.add(it.getFile());
             }
         }
 
@@ -1497,59 +1501,55 @@ status_t buildResources(Bundle* bundle, const sp<AaptAssets>& assets, sp<ApkBuil
             hasErrors = true;
         }
         err = NO_ERROR;
-    }
 
-    if (colors != NULL) {
-        ResourceDirIterator it(colors, String8("color"));
-        while ((err=it.next()) == NO_ERROR) {
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err != NO_ERROR) {
-                hasErrors = true;
-            }
+        Vector<status_t> results;
+        if (compileXmlFiles(bundle, assets, names, files, &table,
+                XML_COMPILE_STANDARD_RESOURCE, &results) != NO_ERROR) {
+            hasErrors = true;
         }
+    }
 
-        if (err < NO_ERROR) {
+    if (colors != NULL) {
+        if (compileXmlResources(bundle, assets, &table, colors, "color", xmlFlags, false)
+                != NO_ERROR) {
             hasErrors = true;
         }
-        err = NO_ERROR;
     }
 
     if (menus != NULL) {
-        ResourceDirIterator it(menus, String8("menu"));
-        while ((err=it.next()) == NO_ERROR) {
-            String8 src = it.getFile()->getPrintableSource();
-            err = compileXmlFile(bundle, assets, String16(it.getBaseName()),
-                    it.getFile(), &table, xmlFlags);
-            if (err == NO_ERROR) {
-                ResXMLTree block;
-                block.setTo(it.getFile()->getData(), it.getFile()->getSize(), true);
-                checkForIds(src, block);
-            } else {
-                hasErrors = true;
-            }
-        }
-
-        if (err < NO_ERROR) {
+        if (compileXmlResources(bundle, assets, &table, menus, "menu", xmlFlags, true)
+                != NO_ERROR) {
             hasErrors = true;
         }
-        err = NO_ERROR;
     }
 
     // Now compile any generated resources.
+    // Compiling them can queue more, so take what's there a batch at a time.
     std::queue<CompileResourceWorkItem>& workQueue = table.getWorkQueue();
     while (!workQueue.empty()) {
-        CompileResourceWorkItem& workItem = workQueue.front();
-        err = compileXmlFile(bundle, assets, workItem.resourceName, workItem.file, &table, xmlFlags);
-        if (err == NO_ERROR) {
-            assets->addResource(workItem.resPath.getPathLeaf(),
-                    workItem.resPath,
-                    workItem.file,
-                    workItem.file->getResourceType());
-        } else {
-            hasErrors = true;
+        Vector<CompileResourceWorkItem> items;
+        Vector<String16> names;
+        Vector<sp<AaptFile> > files;
+        while (!workQueue.empty()) {
+            items.add(workQueue.front());
+            names.add(workQueue.front().resourceName);
+            files.add(workQueue.front().file);
+            workQueue.pop();
+        }
+
+        Vector<status_t> results;
+        compileXmlFiles(bundle, assets, names, files, &table, xmlFlags, &results);
+        for (size_t i = 0; i < items.size(); i++) {
+            const CompileResourceWorkItem& workItem = items[i];
+            if (results[i] == NO_ERROR) {
+                assets->addResource(workItem.resPath.getPathLeaf(),
+                        workItem.resPath,
+                        workItem.file,
+                        workItem.file->getResourceType());
+            } else {
+                hasErrors = true;
+            }
         }
-        workQueue.pop();
     }
 
     if (table.validateLocalizations()) {
@@ -2128,7 +2128,7 @@ static status_t writeLayoutClasses(
             if (code == 0) {
                 String16 name16(sym.name);
                 uint32_t typeSpecFlags;
-                code = assets->getIncludedResources().identifierForName(
+                code = assets->identifierForName(
                     name16.string(), name16.size(),
                     attr16.string(), attr16.size(),
                     package16.string(), package16.size(), &typeSpecFlags);
@@ -2263,7 +2263,7 @@ static status_t writeLayoutClasses(
 
                 uint32_t typeSpecFlags = 0;
                 String16 name16(sym.name);
-                assets->getIncludedResources().identifierForName(
+                assets->identifierForName(
                     name16.string(), name16.size(),
                     attr16.string(), attr16.size(),
                     package16.string(), package16.size(), &typeSpecFlags);
@@ -2358,7 +2358,7 @@ static status_t writeTextLayoutClasses(
             if (code == 0) {
                 String16 name16(sym.name);
                 uint32_t typeSpecFlags;
-                code = assets->getIncludedResources().identifierForName(
+                code = assets->identifierForName(
                     name16.string(), name16.size(),
                     attr16.string(), attr16.size(),
                     package16.string(), package16.size(), &typeSpecFlags);
@@ -2405,7 +2405,7 @@ static status_t writeTextLayoutClasses(
 
                 uint32_t typeSpecFlags = 0;
                 String16 name16(sym.name);
-                assets->getIncludedResources().identifierForName(
+                assets->identifierForName(
                     name16.string(), name16.size(),
                     attr16.string(), attr16.size(),
                     package16.string(), package16.size(), &typeSpecFlags);
@@ -2595,12 +2595,207 @@ static status_t writeTextSymbolClass(
     return NO_ERROR;
 }
 
+/*
+ * The R.jar counterpart of writeLayoutClasses(): for each
+ * <declare-styleable>, the int[] of its attribute IDs and the index of
+ * each attribute in that array.
+ */
+static status_t buildLayoutClassSpec(const sp<AaptAssets>& assets,
+    const sp<AaptSymbols>& symbols, bool includePrivate, bool nonConstantId,
+    RClassSpec* cls)
+{
+    cls->name = "styleable";
+
+    String16 attr16("attr");
+    String16 package16(assets->getPackage());
+
+    bool hasErrors = false;
+
+    size_t i;
+    size_t N = symbols->getNestedSymbols().size();
+    for (i=0; i<N; i++) {
+        sp<AaptSymbols> nsymbols = symbols->getNestedSymbols().valueAt(i);
+        String8 realClassName(symbols->getNestedSymbols().keyAt(i));
+        String8 nclassName(flattenSymbol(realClassName));
+
+        SortedVector<uint32_t> idents;
+        Vector<uint32_t> origOrder;
+        Vector<bool> publicFlags;
+
+        size_t a;
+        size_t NA = nsymbols->getSymbols().size();
+        for (a=0; a<NA; a++) {
+            const AaptSymbolEntry& sym(nsymbols->getSymbols().valueAt(a));
+            int32_t code = sym.typeCode == AaptSymbolEntry::TYPE_INT32
+                    ? sym.int32Val : 0;
+            bool isPublic = true;
+            if (code == 0) {
+                String16 name16(sym.name);
+                uint32_t typeSpecFlags;
+                code = assets->identifierForName(
+                    name16.string(), name16.size(),
+                    attr16.string(), attr16.size(),
+                    package16.string(), package16.size(), &typeSpecFlags);
+                if (code == 0) {
+                    fprintf(stderr, "ERROR: In <declare-styleable> %s, unable to find attribute %s\n",
+                            nclassName.string(), sym.name.string());
+                    hasErrors = true;
+                }
+                isPublic = (typeSpecFlags&ResTable_typeSpec::SPEC_PUBLIC) != 0;
+            }
+            idents.add(code);
+            origOrder.add(code);
+            publicFlags.add(isPublic);
+        }
+
+        NA = idents.size();
+
+        RFieldSpec array;
+        array.name = nclassName.string();
+        array.kind = RFieldSpec::kIntArray;
+        array.values.reserve(NA);
+        for (a=0; a<NA; a++) {
+            array.values.push_back(idents[a]);
+        }
+        cls->fields.push_back(array);
+
+        for (a=0; a<NA; a++) {
+            ssize_t pos = idents.indexOf(origOrder.itemAt(a));
+            if (pos >= 0) {
+                const AaptSymbolEntry& sym = nsymbols->getSymbols().valueAt(a);
+                if (!publicFlags.itemAt(a) && !includePrivate) {
+                    continue;
+                }
+                String8 name8(sym.name);
+                RFieldSpec field;
+                field.name = nclassName.string();
+                field.name += '_';
+                field.name += flattenSymbol(name8).string();
+                field.isFinal = !nonConstantId;
+                field.value = (int32_t)pos;
+                cls->fields.push_back(field);
+            }
+        }
+    }
+
+    return hasErrors ? UNKNOWN_ERROR : NO_ERROR;
+}
+
+/*
+ * The R.jar counterpart of writeSymbolClass(): the same fields and inner
+ * classes, in the same order, without the javadoc.
+ */
+static status_t buildSymbolClassSpec(const sp<AaptAssets>& assets, bool includePrivate,
+    const sp<AaptSymbols>& symbols, const String8& className, bool nonConstantId,
+    RClassSpec* cls)
+{
+    cls->name = className.string();
+
+    size_t i;
+    status_t err = NO_ERROR;
+
+    size_t N = symbols->getSymbols().size();
+    for (i=0; i<N; i++) {
+        const AaptSymbolEntry& sym = symbols->getSymbols().valueAt(i);
+        if (sym.typeCode != AaptSymbolEntry::TYPE_INT32) {
+            continue;
+        }
+        if (!assets->isJavaSymbol(sym, includePrivate)) {
+            continue;
+        }
+        String8 name8(sym.name);
+        RFieldSpec field;
+        field.name = flattenSymbol(name8).string();
+        field.isFinal = !nonConstantId;
+        field.value = sym.int32Val;
+        cls->fields.push_back(field);
+    }
+
+    for (i=0; i<N; i++) {
+        const AaptSymbolEntry& sym = symbols->getSymbols().valueAt(i);
+        if (sym.typeCode != AaptSymbolEntry::TYPE_STRING) {
+            continue;
+        }
+        if (!assets->isJavaSymbol(sym, includePrivate)) {
+            continue;
+        }
+        String8 name8(sym.name);
+        RFieldSpec field;
+        field.name = flattenSymbol(name8).string();
+        field.kind = RFieldSpec::kString;
+        field.stringValue = sym.stringVal.string();
+        cls->fields.push_back(field);
+    }
+
+    sp<AaptSymbols> styleableSymbols;
+
+    N = symbols->getNestedSymbols().size();
+    for (i=0; i<N; i++) {
+        sp<AaptSymbols> nsymbols = symbols->getNestedSymbols().valueAt(i);
+        String8 nclassName(symbols->getNestedSymbols().keyAt(i));
+        if (nclassName == "styleable") {
+            styleableSymbols = nsymbols;
+        } else {
+            cls->inner.push_back(RClassSpec());
+            err = buildSymbolClassSpec(assets, includePrivate, nsymbols, nclassName,
+                    nonConstantId, &cls->inner.back());
+        }
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+
+    if (styleableSymbols != NULL) {
+        cls->inner.push_back(RClassSpec());
+        err = buildLayoutClassSpec(assets, styleableSymbols, includePrivate, nonConstantId,
+                &cls->inner.back());
+        if (err != NO_ERROR) {
+            return err;
+        }
+    }
+
+    return NO_ERROR;
+}
+
+/*
+ * The fields of a top-level symbol class, as they end up in R.java: with
+ * the --public-R-path classes merged in if it is R.
+ */
+static status_t buildMergedClassSpec(Bundle* bundle, const sp<AaptAssets>& assets,
+    bool includePrivate, const sp<AaptSymbols>& symbols, const String8& className,
+    RClassSpec* cls)
+{
+    status_t err = buildSymbolClassSpec(assets, includePrivate, symbols, className,
+            bundle->getNonConstantId(), cls);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    const char *public_r_file_path = bundle->getPublicRPath();
+    if (public_r_file_path != NULL && className == "R") {
+        RClassSpec publicR;
+        if (read_r_file_classes(public_r_file_path, &publicR) != 1) {
+            fprintf(stderr, "ERROR: Unable to read public R file %s\n", public_r_file_path);
+            return UNKNOWN_ERROR;
+        }
+        size_t classes = merge_r_classes(publicR, cls);
+        if (bundle->getVerbose()) {
+            printf("R class merge: %zu classes, public=[%s]\n", classes, public_r_file_path);
+        }
+    }
+    return NO_ERROR;
+}
+
 status_t writeResourceSymbols(Bundle* bundle, const sp<AaptAssets>& assets,
     const String8& package, bool includePrivate, bool emitCallback)
 {
-    if (!bundle->getRClassDir()) {
+    if (!bundle->getRClassDir() && !bundle->getOutputRJar()) {
         return NO_ERROR;
     }
+    if (bundle->getOutputRJar() != NULL && emitCallback) {
+        fprintf(stderr, "ERROR: --output-r-jar can't be used with --shared-lib\n");
+        return UNKNOWN_ERROR;
+    }
 
     const char* textSymbolsDest = bundle->getOutputTextSymbols();
 
@@ -2610,57 +2805,86 @@ status_t writeResourceSymbols(Bundle* bundle, const sp<AaptAssets>& assets,
     for (size_t i=0; i<N; i++) {
         sp<AaptSymbols> symbols = assets->getSymbols().valueAt(i);
         String8 className(assets->getSymbols().keyAt(i));
-        String8 dest(bundle->getRClassDir());
-
-        if (bundle->getMakePackageDirs()) {
-            String8 pkg(package);
-            const char* last = pkg.string();
-            const char* s = last-1;
-            do {
-                s++;
-                if (s > last && (*s == '.' || *s == 0)) {
-                    String8 part(last, s-last);
-                    dest.appendPath(part);
+        if (bundle->getRClassDir() != NULL) {
+            String8 dest(bundle->getRClassDir());
+
+            if (bundle->getMakePackageDirs()) {
+                String8 pkg(package);
+                const char* last = pkg.string();
+                const char* s = last-1;
+                do {
+                    s++;
+                    if (s > last && (*s == '.' || *s == 0)) {
+                        String8 part(last, s-last);
+                        dest.appendPath(part);
 #ifdef HAVE_MS_C_RUNTIME
-                    _mkdir(dest.string());
+                        _mkdir(dest.string());
 #else
-                    mkdir(dest.string(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
+                        mkdir(dest.string(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
 #endif
-                    last = s+1;
-                }
-            } while (*s);
-        }
-        dest.appendPath(className);
-        dest.append(".java");
-        FILE* fp = fopen(dest.string(), "w+");
-        if (fp == NULL) {
-            fprintf(stderr, "ERROR: Unable to open class file %s: %s\n",
-                    dest.string(), strerror(errno));
-            return UNKNOWN_ERROR;
+                        last = s+1;
+                    }
+                } while (*s);
+            }
+            dest.appendPath(className);
+            dest.append(".java");
+            FILE* fp = fopen(dest.string(), "w+");
+            if (fp == NULL) {
+                fprintf(stderr, "ERROR: Unable to open class file %s: %s\n",
+                        dest.string(), strerror(errno));
+                return UNKNOWN_ERROR;
+            }
+            if (bundle->getVerbose()) {
+                printf("  Writing symbols for class %s.\n", className.string());
+            }
+            long dest_len = strlen(dest.string())+1;
+            dest_r_path = (char *)malloc(dest_len);
+            memset(dest_r_path, '\0', dest_len);
+            strcpy(dest_r_path, dest.string());
+
+            fprintf(fp,
+                "/* AUTO-GENERATED FILE.  DO NOT MODIFY.\n"
+                " *\n"
+                " * This class was automatically generated by the\n"
+                " * aapt tool from the resource data it found.  It\n"
+                " * should not be modified by hand.\n"
+                " */\n"
+                "\n"
+                "package %s;\n\n", package.string());
+
+            status_t err = writeSymbolClass(fp, assets, includePrivate, symbols,
+                    className, 0, bundle->getNonConstantId(), emitCallback);
+            fclose(fp);
+            if (err != NO_ERROR) {
+                return err;
+            }
         }
-        if (bundle->getVerbose()) {
-            printf("  Writing symbols for class %s.\n", className.string());
+
+        // R.jar and the symbol index next to R.txt hold the same fields.
+        // The index is for modules to pass to --public-R-path, so a module
+        // build, which would have to parse its own public R again to
+        // write one, only does so when R.jar needs the classes anyway.
+        RClassSpec cls;
+        const bool writeIndex = textSymbolsDest != NULL && R == className
+                && (bundle->getPublicRPath() == NULL || bundle->getOutputRJar() != NULL);
+        if (bundle->getOutputRJar() != NULL || writeIndex) {
+            status_t err = buildMergedClassSpec(bundle, assets, includePrivate, symbols,
+                    className, &cls);
+            if (err != NO_ERROR) {
+                return err;
+            }
         }
-        long dest_len = strlen(dest.string())+1;
-        dest_r_path = (char *)malloc(dest_len);
-        memset(dest_r_path, '\0', dest_len);
-        strcpy(dest_r_path, dest.string());
 
-        fprintf(fp,
-            "/* AUTO-GENERATED FILE.  DO NOT MODIFY.\n"
-            " *\n"
-            " * This class was automatically generated by the\n"
-            " * aapt tool from the resource data it found.  It\n"
-            " * should not be modified by hand.\n"
-            " */\n"
-            "\n"
-            "package %s;\n\n", package.string());
-
-        status_t err = writeSymbolClass(fp, assets, includePrivate, symbols,
-                className, 0, bundle->getNonConstantId(), emitCallback);
-        fclose(fp);
-        if (err != NO_ERROR) {
-            return err;
+        if (bundle->getOutputRJar() != NULL) {
+            if (bundle->getVerbose()) {
+                printf("  Writing class %s into %s.\n", className.string(),
+                        bundle->getOutputRJar());
+            }
+            status_t err = RClassWriter::writeJar(bundle->getOutputRJar(), package.string(),
+                    cls);
+            if (err != NO_ERROR) {
+                return err;
+            }
         }
 
         if (textSymbolsDest != NULL && R == className) {
@@ -2684,24 +2908,50 @@ status_t writeResourceSymbols(Bundle* bundle, const sp<AaptAssets>& assets,
             if (err != NO_ERROR) {
                 return err;
             }
+
+            if (writeIndex) {
+                String8 indexDest(textSymbolsDest);
+                indexDest.appendPath(className);
+                indexDest.append(".idx");
+                if (bundle->getVerbose()) {
+                    printf("  Writing symbol index for class %s.\n", className.string());
+                }
+                err = RSymbolIndex::write(indexDest.string(), cls);
+                if (err != NO_ERROR) {
+                    return err;
+                }
+            }
         }
 
         // If we were asked to generate a dependency file, we'll go ahead and add this R.java
         // as a target in the dependency file right next to it.
-        if (bundle->getGenDependencies() && R == className) {
+        if (bundle->getGenDependencies() && bundle->getRClassDir() && R == className) {
             // Add this R.java to the dependency file
             String8 dependencyFile(bundle->getRClassDir());
             dependencyFile.appendPath("R.java.d");
             FILE *fp = fopen(dependencyFile.string(), "a");
-            fprintf(fp,"%s \\\n", dest.string());
+            fprintf(fp,"%s \\\n", dest_r_path);
             fclose(fp);
         }
     }
     
     const char *public_r_file_path = bundle->getPublicRPath();
-    if (public_r_file_path != NULL ) {
+    if (public_r_file_path != NULL && dest_r_path != NULL) {
         printf("***********Start merge R.java. public=[%s], project=[%s]\n", public_r_file_path, dest_r_path);
-        merge_r_file(public_r_file_path, dest_r_path);
+        RMergeStats stats;
+        if (merge_r_file_with_stats(public_r_file_path, dest_r_path, &stats) != 1) {
+            fprintf(stderr, "ERROR: merging %s into %s failed\n",
+                    public_r_file_path, dest_r_path);
+            free(dest_r_path);
+            return UNKNOWN_ERROR;
+        }
+        if (bundle->getVerbose()) {
+            printf("R.java merge: %zu classes, %zu + %zu -> %zu bytes, peak %zu bytes; "
+                    "read %.2f ms, parse %.2f ms, write %.2f ms\n",
+                    stats.classes, stats.public_bytes, stats.project_bytes,
+                    stats.output_bytes, stats.peak_bytes,
+                    stats.read_ms, stats.parse_ms, stats.write_ms);
+        }
     }
     if (dest_r_path != NULL) {
         free(dest_r_path);
@@ -7,78 +7,123 @@
 
 #include <utils/String16.h>
 #include <utils/Log.h>
+#include <utils/RWLock.h>
+#include <utils/Vector.h>
+#include <cutils/atomic.h>
 #include "ResourceIdCache.h"
-#include <map>
-using namespace std;
+#include "StringAtoms.h"
 
+namespace android {
 
-static size_t mHits = 0;
-static size_t mMisses = 0;
-static size_t mCollisions = 0;
-
-static const size_t MAX_CACHE_ENTRIES = 2048;
-static const android::String16 TRUE16("1");
-static const android::String16 FALSE16("0");
+static volatile int32_t mHits = 0;
+static volatile int32_t mMisses = 0;
+static size_t mLongestProbe = 0;
 
 struct CacheEntry {
-    // concatenation of the relevant strings into a single instance
-    android::String16 hashedName;
+    uint32_t hashcode;
+    bool onlyPublic;
+    atom_t package;
+    atom_t type;
+    atom_t name;
     uint32_t id;
-
-    CacheEntry() {}
-    CacheEntry(const android::String16& name, uint32_t resId) : hashedName(name), id(resId) { }
 };
 
-static map< uint32_t, CacheEntry > mIdMap;
-
-
-// djb2; reasonable choice for strings when collisions aren't particularly important
-static inline uint32_t hashround(uint32_t hash, int c) {
-    return ((hash << 5) + hash) + c;    /* hash * 33 + c */
+// Lookups only take the read lock, so any number of threads can resolve
+// IDs at once; store() and the maintenance calls take the write lock.
+static RWLock mLock;
+
+// Entries in insertion order, and an open-addressing table of indices
+// into them (-1 for an empty slot).  The table size is a power of two
+// and kept under 3/4 full.
+static Vector<CacheEntry> mEntries;
+static Vector<int32_t> mSlots;
+
+// The names are atoms, so the key hashes and compares as four integers.
+// Atoms are small and sequential; the final shifts fold the high bits of
+// the product back into the low ones the table is indexed by.
+static inline uint32_t hashKey(atom_t package, atom_t type, atom_t name, bool onlyPublic) {
+    uint32_t hash = 2166136261u;
+    hash = (hash ^ name) * 16777619u;
+    hash = (hash ^ type) * 16777619u;
+    hash = (hash ^ package) * 16777619u;
+    hash = (hash ^ (onlyPublic ? 1 : 0)) * 16777619u;
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+    return hash;
 }
 
-static uint32_t hash(const android::String16& hashableString) {
-    uint32_t hash = 5381;
-    const char16_t* str = hashableString.string();
-    while (int c = *str++) hash = hashround(hash, c);
-    return hash;
+static inline bool matches(const CacheEntry& entry, atom_t package, atom_t type,
+        atom_t name, bool onlyPublic) {
+    return entry.name == name && entry.type == type && entry.package == package
+            && entry.onlyPublic == onlyPublic;
 }
 
-namespace android {
+// Caller holds the write lock.
+static void insertSlot(int32_t idx) {
+    size_t mask = mSlots.size() - 1;
+    size_t slot = mEntries[idx].hashcode & mask;
+    size_t probe = 1;
+    while (mSlots[slot] >= 0) {
+        slot = (slot + 1) & mask;
+        probe++;
+    }
+    mSlots.editItemAt(slot) = idx;
+    if (probe > mLongestProbe) {
+        mLongestProbe = probe;
+    }
+}
 
-static inline String16 makeHashableName(const android::String16& package,
-        const android::String16& type,
-        const android::String16& name,
-        bool onlyPublic) {
-    String16 hashable = String16(name);
-    hashable += type;
-    hashable += package;
-    hashable += (onlyPublic ? TRUE16 : FALSE16);
-    return hashable;
+// Caller holds the write lock.
+static void rebuildSlots(size_t minEntries) {
+    size_t numSlots = 64;
+    while (numSlots * 3 < minEntries * 4) {
+        numSlots <<= 1;
+    }
+    mSlots.clear();
+    mSlots.insertAt(-1, 0, numSlots);
+    mLongestProbe = 0;
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        insertSlot(i);
+    }
 }
 
 uint32_t ResourceIdCache::lookup(const android::String16& package,
         const android::String16& type,
         const android::String16& name,
         bool onlyPublic) {
-    const String16 hashedName = makeHashableName(package, type, name, onlyPublic);
-    const uint32_t hashcode = hash(hashedName);
-    map<uint32_t, CacheEntry>::iterator item = mIdMap.find(hashcode);
-    if (item == mIdMap.end()) {
-        // cache miss
-        mMisses++;
+    // Names that were never interned can't have been stored.
+    atom_t nameAtom = StringAtoms::find(name);
+    atom_t typeAtom = nameAtom != 0 ? StringAtoms::find(type) : 0;
+    atom_t packageAtom = typeAtom != 0 ? StringAtoms::find(package) : 0;
+    if (packageAtom == 0) {
+        android_atomic_inc(&mMisses);
         return 0;
     }
+    return lookup(packageAtom, typeAtom, nameAtom, onlyPublic);
+}
 
-    // legit match?
-    if (hashedName == (*item).second.hashedName) {
-        mHits++;
-        return (*item).second.id;
+uint32_t ResourceIdCache::lookup(atom_t package, atom_t type, atom_t name,
+        bool onlyPublic) {
+    const uint32_t hashcode = hashKey(package, type, name, onlyPublic);
+
+    RWLock::AutoRLock _l(mLock);
+    size_t numSlots = mSlots.size();
+    if (numSlots > 0) {
+        size_t mask = numSlots - 1;
+        size_t slot = hashcode & mask;
+        int32_t idx;
+        while ((idx = mSlots[slot]) >= 0) {
+            const CacheEntry& entry = mEntries[idx];
+            if (matches(entry, package, type, name, onlyPublic)) {
+                android_atomic_inc(&mHits);
+                return entry.id;
+            }
+            slot = (slot + 1) & mask;
+        }
     }
 
-    // collision
-    mCollisions++;
-    mIdMap.erase(hashcode);
+    android_atomic_inc(&mMisses);
     return 0;
 }
 
@@ -88,20 +133,79 @@ uint32_t ResourceIdCache::store(const android::String16& package,
         const android::String16& name,
         bool onlyPublic,
         uint32_t resId) {
-    if (mIdMap.size() < MAX_CACHE_ENTRIES) {
-        const String16 hashedName = makeHashableName(package, type, name, onlyPublic);
-        const uint32_t hashcode = hash(hashedName);
-        mIdMap[hashcode] = CacheEntry(hashedName, resId);
+    return store(StringAtoms::intern(package), StringAtoms::intern(type),
+            StringAtoms::intern(name), onlyPublic, resId);
+}
+
+uint32_t ResourceIdCache::store(atom_t package, atom_t type, atom_t name,
+        bool onlyPublic, uint32_t resId) {
+    const uint32_t hashcode = hashKey(package, type, name, onlyPublic);
+
+    RWLock::AutoWLock _l(mLock);
+    if (mSlots.size() > 0) {
+        size_t mask = mSlots.size() - 1;
+        size_t slot = hashcode & mask;
+        int32_t idx;
+        while ((idx = mSlots[slot]) >= 0) {
+            CacheEntry& entry = mEntries.editItemAt(idx);
+            if (matches(entry, package, type, name, onlyPublic)) {
+                entry.id = resId;
+                return resId;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    CacheEntry entry;
+    entry.hashcode = hashcode;
+    entry.onlyPublic = onlyPublic;
+    entry.package = package;
+    entry.type = type;
+    entry.name = name;
+    entry.id = resId;
+    ssize_t idx = mEntries.add(entry);
+
+    if ((mEntries.size()) * 4 > mSlots.size() * 3) {
+        rebuildSlots(mEntries.size() * 2);
+    } else {
+        insertSlot(idx);
     }
     return resId;
 }
 
+void ResourceIdCache::retainPackages(const SortedVector<String16>& packages,
+        const SortedVector<uint32_t>& packageIds) {
+    RWLock::AutoWLock _l(mLock);
+    SortedVector<atom_t> packageAtoms;
+    for (size_t i = 0; i < packages.size(); i++) {
+        packageAtoms.add(StringAtoms::intern(packages[i]));
+    }
+    Vector<CacheEntry> kept;
+    for (size_t i = 0; i < mEntries.size(); i++) {
+        if (packageAtoms.indexOf(mEntries[i].package) >= 0
+                && packageIds.indexOf(mEntries[i].id >> 24) >= 0) {
+            kept.add(mEntries[i]);
+        }
+    }
+    mEntries = kept;
+    rebuildSlots(mEntries.size());
+}
+
+void ResourceIdCache::clear() {
+    RWLock::AutoWLock _l(mLock);
+    mEntries.clear();
+    mSlots.clear();
+    mLongestProbe = 0;
+}
+
 void ResourceIdCache::dump() {
+    RWLock::AutoRLock _l(mLock);
     printf("ResourceIdCache dump:\n");
-    printf("Size: %zd\n", mIdMap.size());
-    printf("Hits:   %zd\n", mHits);
-    printf("Misses: %zd\n", mMisses);
-    printf("(Collisions: %zd)\n", mCollisions);
+    printf("Size: %zd\n", mEntries.size());
+    printf("Slots: %zd\n", mSlots.size());
+    printf("Hits:   %d\n", (int) mHits);
+    printf("Misses: %d\n", (int) mMisses);
+    printf("(Longest probe: %zd)\n", mLongestProbe);
 }
 
 }
@@ -7,9 +7,18 @@
 #define RESOURCE_ID_CACHE_H
 
 #include <utils/String16.h>
+#include <utils/SortedVector.h>
+
+#include "StringAtoms.h"
 
 namespace android {
 
+/*
+ * Process-wide cache of resolved resource IDs, keyed by (package, type,
+ * name, onlyPublic).  The names are kept as StringAtoms.  Safe for
+ * concurrent lookup() and store().  Nothing is evicted: an ID stays
+ * cached until clear() or retainPackages() drops it.
+ */
 class ResourceIdCache {
 public:
     static uint32_t lookup(const String16& package,
@@ -23,6 +32,25 @@ public:
             bool onlyPublic,
             uint32_t resId);
 
+    /* the same, for names that are already interned */
+    static uint32_t lookup(atom_t package, atom_t type, atom_t name,
+            bool onlyPublic);
+
+    static uint32_t store(atom_t package, atom_t type, atom_t name,
+            bool onlyPublic, uint32_t resId);
+
+    /*
+     * Drops every cached ID except those in one of the given packages,
+     * named "packages" and numbered "packageIds".  Used between requests
+     * in daemon mode, where the included packages stay loaded but the
+     * package being built may have changed -- even when it has the name
+     * of an included one, as a feature split does.
+     */
+    static void retainPackages(const SortedVector<String16>& packages,
+            const SortedVector<uint32_t>& packageIds);
+
+    static void clear(void);
+
     static void dump(void);
 };
 
@@ -9,11 +9,16 @@
 #include "XMLNode.h"
 #include "ResourceFilter.h"
 #include "ResourceIdCache.h"
+#include "StringAtoms.h"
+#include "WorkQueue.h"
+#include "XmlCompileCache.h"
 
 #include <androidfw/ResourceTypes.h>
 #include <utils/ByteOrder.h>
 #include <utils/TypeHelpers.h>
 #include <stdarg.h>
+#include <algorithm>
+#include <sys/stat.h>
 
 #define NOISY(x) //x
 
@@ -48,13 +53,11 @@ status_t compileXmlFile(const Bundle* bundle,
     return compileXmlFile(bundle, assets, resourceName, root, outTarget, table, options);
 }
 
-status_t compileXmlFile(const Bundle* bundle,
-                        const sp<AaptAssets>& assets,
-                        const String16& resourceName,
-                        const sp<XMLNode>& root,
-                        const sp<AaptFile>& target,
-                        ResourceTable* table,
-                        int options)
+// compileXmlFile() is three steps.  prepareXmlTree() and flattenXmlTree()
+// only touch the one file, so compileXmlFiles() runs them in parallel;
+// resolveXmlTree() reads and adds to the table and has to run in order.
+
+static void prepareXmlTree(const sp<XMLNode>& root, int options)
 {
     if ((options&XML_COMPILE_STRIP_WHITESPACE) != 0) {
         root->removeWhitespace(true, NULL);
@@ -65,8 +68,66 @@ status_t compileXmlFile(const Bundle* bundle,
     if ((options&XML_COMPILE_UTF8) != 0) {
         root->setUTF8(true);
     }
+}
 
+// The attributes of every element under "node", in the order
+// assignResourceIds() and parseValues() visit them.
+static void recordXmlAttrs(const sp<XMLNode>& node, Vector<XmlCompileCache::Attr>* outAttrs)
+{
+    const Vector<XMLNode::attribute_entry>& attrs = node->getAttributes();
+    for (size_t i = 0; i < attrs.size(); i++) {
+        XmlCompileCache::Attr attr;
+        attr.ns = attrs[i].ns;
+        attr.name = attrs[i].name;
+        attr.rawValue = attrs[i].string;
+        attr.line = node->getStartLineNumber();
+        attr.nameResId = 0;
+        attr.dataType = Res_value::TYPE_NULL;
+        attr.data = 0;
+        outAttrs->add(attr);
+    }
+    const Vector<sp<XMLNode> >& children = node->getChildren();
+    for (size_t i = 0; i < children.size(); i++) {
+        recordXmlAttrs(children[i], outAttrs);
+    }
+}
+
+// Fill in what recordXmlAttrs() found with what they resolved to.
+static void recordXmlValues(const sp<XMLNode>& node, Vector<XmlCompileCache::Attr>* outAttrs,
+                            size_t* pos)
+{
+    const Vector<XMLNode::attribute_entry>& attrs = node->getAttributes();
+    for (size_t i = 0; i < attrs.size(); i++) {
+        XmlCompileCache::Attr& attr = outAttrs->editItemAt((*pos)++);
+        attr.nameResId = attrs[i].nameResId;
+        attr.dataType = attrs[i].value.dataType;
+        attr.data = attrs[i].value.data;
+    }
+    const Vector<sp<XMLNode> >& children = node->getChildren();
+    for (size_t i = 0; i < children.size(); i++) {
+        recordXmlValues(children[i], outAttrs, pos);
+    }
+}
+
+/*
+ * "outAttrs", if not NULL, gets every lookup made in the table, for
+ * XmlCompileCache.
+ */
+static status_t resolveXmlTree(const Bundle* bundle,
+                               const sp<AaptAssets>& assets,
+                               const String16& resourceName,
+                               const sp<XMLNode>& root,
+                               const sp<AaptFile>& target,
+                               ResourceTable* table,
+                               int options,
+                               Vector<XmlCompileCache::Attr>* outAttrs = NULL)
+{
     bool hasErrors = false;
+
+    if (outAttrs != NULL) {
+        outAttrs->clear();
+        recordXmlAttrs(root, outAttrs);
+    }
     
     if ((options&XML_COMPILE_ASSIGN_ATTRIBUTE_IDS) != 0) {
         status_t err = root->assignResourceIds(assets, table);
@@ -86,14 +147,25 @@ status_t compileXmlFile(const Bundle* bundle,
         return UNKNOWN_ERROR;
     }
 
+    if (outAttrs != NULL) {
+        size_t pos = 0;
+        recordXmlValues(root, outAttrs, &pos);
+    }
+
     if (table->modifyForCompat(bundle, resourceName, target, root) != NO_ERROR) {
         fprintf(stderr,"modifyForCompat\n");
         return UNKNOWN_ERROR;
     }
-    
+    return NO_ERROR;
+}
+
+static status_t flattenXmlTree(const sp<XMLNode>& root,
+                               const sp<AaptFile>& target,
+                               int options)
+{
     NOISY(printf("Input XML Resource:\n"));
     NOISY(root->print());
-    err = root->flatten(target,
+    status_t err = root->flatten(target,
             (options&XML_COMPILE_STRIP_COMMENTS) != 0,
             (options&XML_COMPILE_STRIP_RAW_VALUES) != 0);
     if (err != NO_ERROR) {
@@ -111,6 +183,317 @@ status_t compileXmlFile(const Bundle* bundle,
     return err;
 }
 
+status_t compileXmlFile(const Bundle* bundle,
+                        const sp<AaptAssets>& assets,
+                        const String16& resourceName,
+                        const sp<XMLNode>& root,
+                        const sp<AaptFile>& target,
+                        ResourceTable* table,
+                        int options)
+{
+    prepareXmlTree(root, options);
+
+    status_t err = resolveXmlTree(bundle, assets, resourceName, root, target, table, options);
+    if (err != NO_ERROR) {
+        return err;
+    }
+
+    return flattenXmlTree(root, target, options);
+}
+
+/*
+ * Redo, in order, the table lookups a cached compile of "filename" made,
+ * so @+id references create their IDs and errors come out as they would
+ * have.  NO_ERROR if every lookup gave the same answer, and the stored
+ * output can be used as is; NOT_ENOUGH_DATA if one didn't and the file
+ * has to be compiled again; UNKNOWN_ERROR if a value no longer parses
+ * (already reported).
+ */
+static status_t replayXmlTree(const sp<AaptAssets>& assets,
+                              const String8& filename,
+                              const Vector<XmlCompileCache::Attr>& attrs,
+                              ResourceTable* table,
+                              int options)
+{
+    bool hasErrors = false;
+    const String16 defPackage(assets->getPackage());
+
+    for (size_t i = 0; i < attrs.size(); i++) {
+        const XmlCompileCache::Attr& attr = attrs[i];
+        uint32_t nameResId = 0;
+        if ((options&XML_COMPILE_ASSIGN_ATTRIBUTE_IDS) != 0 && attr.ns.size() > 0) {
+            nameResId = XMLNode::resolveAttrId(assets, table, attr.ns, attr.name);
+        }
+        if (nameResId != attr.nameResId) {
+            return NOT_ENOUGH_DATA;
+        }
+
+        Res_value value;
+        String16 str;
+        AccessorCookie ac(SourcePos(filename, attr.line), String8(attr.name),
+                String8(attr.rawValue));
+        table->setCurrentXmlPos(SourcePos(filename, attr.line));
+        if (!assets->getIncludedResources()
+                .stringToValue(&value, &str,
+                              attr.rawValue.string(), attr.rawValue.size(), true, true,
+                              nameResId, NULL, &defPackage, table, &ac)) {
+            hasErrors = true;
+            continue;
+        }
+        if (value.dataType != attr.dataType
+                || (value.dataType != Res_value::TYPE_STRING && value.data != attr.data)) {
+            return NOT_ENOUGH_DATA;
+        }
+    }
+
+    return hasErrors ? UNKNOWN_ERROR : NO_ERROR;
+}
+
+// One file of a compileXmlFiles() batch.
+struct XmlCompileJob {
+    sp<AaptFile> target;
+    sp<XMLNode> root;
+    status_t result;
+    int options;
+
+    // With a cache: the source's key, and either what's stored under it
+    // ("cached") or what this compile recorded for it ("store").
+    XmlCompileCache* cache;
+    uint64_t key;
+    size_t sourceSize;
+    bool cached;
+    bool store;
+    XmlCompileCache::Entry entry;
+};
+
+class ParseXmlWorkUnit : public WorkQueue::WorkUnit {
+public:
+    ParseXmlWorkUnit(XmlCompileJob* job) : mJob(job), mSourceSize(0) {
+        struct stat st;
+        if (stat(job->target->getSourceFile().string(), &st) == 0) {
+            mSourceSize = st.st_size;
+        }
+    }
+
+    static bool wanted(const XmlCompileJob& job) {
+        return job.result == NO_ERROR;
+    }
+
+    virtual bool run() {
+        if (mJob->cache != NULL && !mJob->target->hasData()) {
+            // the mapping is kept for parse() on a miss
+            size_t size;
+            const void* data = mJob->target->mapSourceFile(&size);
+            if (data != NULL) {
+                mJob->key = XmlCompileCache::key(data, size, mJob->options);
+                mJob->sourceSize = size;
+                mJob->cached = mJob->cache->read(mJob->key, size, &mJob->entry);
+                mJob->store = !mJob->cached;
+                if (mJob->cached) {
+                    mJob->target->unmapSourceFile();
+                    return true;
+                }
+            }
+        }
+
+        mJob->root = XMLNode::parse(mJob->target);
+        if (mJob->root == NULL) {
+            mJob->result = UNKNOWN_ERROR;
+        } else {
+            prepareXmlTree(mJob->root, mJob->options);
+        }
+        return true;
+    }
+
+    // bigger files first, so one large layout doesn't end up last
+    virtual size_t weight() const {
+        return mSourceSize;
+    }
+
+private:
+    XmlCompileJob* mJob;
+    size_t mSourceSize;
+};
+
+class FlattenXmlWorkUnit : public WorkQueue::WorkUnit {
+public:
+    FlattenXmlWorkUnit(XmlCompileJob* job) : mJob(job) { }
+
+    // cache hits are already done
+    static bool wanted(const XmlCompileJob& job) {
+        return job.result == NO_ERROR && job.root != NULL;
+    }
+
+    virtual bool run() {
+        mJob->result = flattenXmlTree(mJob->root, mJob->target, mJob->options);
+        mJob->root = NULL;
+        if (mJob->result == NO_ERROR && mJob->store) {
+            Vector<uint8_t>& compiled = mJob->entry.compiled;
+            compiled.clear();
+            compiled.appendArray((const uint8_t*) mJob->target->getData(),
+                    mJob->target->getSize());
+            mJob->cache->write(mJob->key, mJob->sourceSize, mJob->entry);
+        }
+        mJob->entry = XmlCompileCache::Entry();
+        return true;
+    }
+
+private:
+    XmlCompileJob* mJob;
+};
+
+/*
+ * Run one work unit per job the unit wants.  With one job there's no
+ * point in a thread; run them here, in order.
+ */
+template <typename Unit, typename Job>
+static void runBatchStage(size_t threads, Vector<Job>& jobs, size_t start, size_t end)
+{
+    if (threads <= 1) {
+        for (size_t i = start; i < end; i++) {
+            if (Unit::wanted(jobs[i])) {
+                Unit(&jobs.editItemAt(i)).run();
+            }
+        }
+        return;
+    }
+
+    WorkQueue wq(threads, false, WorkQueue::SCHEDULE_HEAVIEST_FIRST);
+    for (size_t i = start; i < end; i++) {
+        if (!Unit::wanted(jobs[i])) {
+            continue;
+        }
+        Unit* unit = new Unit(&jobs.editItemAt(i));
+        if (wq.schedule(unit, 0) != NO_ERROR) {
+            // can't happen before finish(); do it ourselves to be safe
+            delete unit;
+            Unit(&jobs.editItemAt(i)).run();
+        }
+    }
+    wq.finish();
+}
+
+/*
+ * The resolve step of a job the parse step found in the cache: use the
+ * stored output if the file's lookups still give the same answers,
+ * otherwise parse it after all and resolve it as usual.
+ */
+static status_t resolveCachedXml(const Bundle* bundle,
+                                 const sp<AaptAssets>& assets,
+                                 const String16& resourceName,
+                                 XmlCompileJob& job,
+                                 ResourceTable* table)
+{
+    status_t err = replayXmlTree(assets, job.target->getPrintableSource(), job.entry.attrs,
+            table, job.options);
+    if (err == NO_ERROR) {
+        const Vector<uint8_t>& compiled = job.entry.compiled;
+        job.target->clearData();
+        err = job.target->writeData(compiled.array(), compiled.size());
+        job.target->setCompressionMethod(ZipEntry::kCompressDeflated);
+        job.entry = XmlCompileCache::Entry();
+        job.cache->countHit();
+        return err;
+    }
+    if (err != NOT_ENOUGH_DATA) {
+        return err;
+    }
+
+    job.cached = false;
+    job.store = true;
+    job.root = XMLNode::parse(job.target);
+    if (job.root == NULL) {
+        return UNKNOWN_ERROR;
+    }
+    prepareXmlTree(job.root, job.options);
+    return resolveXmlTree(bundle, assets, resourceName, job.root, job.target, table,
+            job.options, &job.entry.attrs);
+}
+
+// Parsed trees are only kept for this many files at a time, which bounds
+// memory on modules with thousands of layouts.
+static const size_t kXmlBatchSize = 256;
+
+status_t compileXmlFiles(const Bundle* bundle,
+                         const sp<AaptAssets>& assets,
+                         const Vector<String16>& resourceNames,
+                         const Vector<sp<AaptFile> >& targets,
+                         ResourceTable* table,
+                         int options,
+                         Vector<status_t>* outResults)
+{
+    const size_t N = targets.size();
+    const size_t threads = bundle->getJobs();
+
+    XmlCompileCache* cache = NULL;
+    if (bundle->getCompiledXmlCacheDir() != NULL && N > 0) {
+        cache = new XmlCompileCache(String8(bundle->getCompiledXmlCacheDir()));
+    }
+
+    Vector<XmlCompileJob> jobs;
+    jobs.setCapacity(N);
+    for (size_t i = 0; i < N; i++) {
+        XmlCompileJob job;
+        job.target = targets[i];
+        job.result = NO_ERROR;
+        job.options = options;
+        job.cache = cache;
+        job.key = 0;
+        job.sourceSize = 0;
+        job.cached = false;
+        job.store = false;
+        jobs.add(job);
+    }
+
+    for (size_t start = 0; start < N; start += kXmlBatchSize) {
+        const size_t end = start + kXmlBatchSize < N ? start + kXmlBatchSize : N;
+
+        runBatchStage<ParseXmlWorkUnit>(threads, jobs, start, end);
+
+        for (size_t i = start; i < end; i++) {
+            XmlCompileJob& job = jobs.editItemAt(i);
+            if (job.result == NO_ERROR && job.cached) {
+                job.result = resolveCachedXml(bundle, assets, resourceNames[i], job, table);
+            } else if (job.result == NO_ERROR) {
+                job.result = resolveXmlTree(bundle, assets, resourceNames[i], job.root,
+                        job.target, table, options, job.store ? &job.entry.attrs : NULL);
+            }
+            if (job.result == NO_ERROR && job.store) {
+                // modifyForCompat() may have taken attributes out of the
+                // tree; what it does isn't recorded, so don't keep those.
+                const Vector<XmlCompileCache::Attr>& attrs = job.entry.attrs;
+                for (size_t ai = 0; ai < attrs.size() && job.store; ai++) {
+                    job.store = !table->isAttributeFromL(attrs[ai].nameResId);
+                }
+                cache->countMiss();
+            }
+            if (job.result != NO_ERROR) {
+                job.root = NULL;
+                job.store = false;
+            }
+        }
+
+        runBatchStage<FlattenXmlWorkUnit>(threads, jobs, start, end);
+    }
+
+    bool hasErrors = false;
+    outResults->clear();
+    for (size_t i = 0; i < N; i++) {
+        outResults->add(jobs[i].result);
+        hasErrors = hasErrors || jobs[i].result != NO_ERROR;
+    }
+
+    if (cache != NULL) {
+        if (bundle->getVerbose()) {
+            printf("Compiled XML cache: %d hit%s, %d miss%s\n",
+                    (int) cache->getHits(), cache->getHits() == 1 ? "" : "s",
+                    (int) cache->getMisses(), cache->getMisses() == 1 ? "" : "es");
+        }
+        delete cache;
+    }
+    return hasErrors ? UNKNOWN_ERROR : NO_ERROR;
+}
+
 #undef NOISY
 #define NOISY(x) //x
 
@@ -769,6 +1152,98 @@ status_t compileResourceFile(Bundle* bundle,
         return err;
     }
 
+    return compileResourceFile(bundle, assets, in, block, defParams, overwrite, outTable);
+}
+
+// One values file of a compileResourceFiles() batch.
+struct ValuesParseJob {
+    sp<AaptFile> file;
+    ResXMLTree* block;
+    status_t result;
+};
+
+class ParseValuesWorkUnit : public WorkQueue::WorkUnit {
+public:
+    ParseValuesWorkUnit(ValuesParseJob* job) : mJob(job), mSourceSize(0) {
+        struct stat st;
+        if (stat(job->file->getSourceFile().string(), &st) == 0) {
+            mSourceSize = st.st_size;
+        }
+    }
+
+    static bool wanted(const ValuesParseJob&) {
+        return true;
+    }
+
+    virtual bool run() {
+        mJob->block = new ResXMLTree();
+        mJob->result = parseXMLResource(mJob->file, mJob->block, false, true);
+        return true;
+    }
+
+    // the biggest translations first, so they don't end up last
+    virtual size_t weight() const {
+        return mSourceSize;
+    }
+
+private:
+    ValuesParseJob* mJob;
+    size_t mSourceSize;
+};
+
+status_t compileResourceFiles(Bundle* bundle,
+                              const sp<AaptAssets>& assets,
+                              const Vector<sp<AaptFile> >& files,
+                              const Vector<ResTable_config>& params,
+                              const Vector<bool>& overwrite,
+                              ResourceTable* outTable,
+                              Vector<status_t>* outResults)
+{
+    const size_t N = files.size();
+    const size_t threads = bundle->getJobs();
+
+    Vector<ValuesParseJob> jobs;
+    jobs.setCapacity(N);
+    for (size_t i = 0; i < N; i++) {
+        ValuesParseJob job;
+        job.file = files[i];
+        job.block = NULL;
+        job.result = NO_ERROR;
+        jobs.add(job);
+    }
+
+    bool hasErrors = false;
+    outResults->clear();
+    for (size_t start = 0; start < N; start += kXmlBatchSize) {
+        const size_t end = start + kXmlBatchSize < N ? start + kXmlBatchSize : N;
+
+        runBatchStage<ParseValuesWorkUnit>(threads, jobs, start, end);
+
+        for (size_t i = start; i < end; i++) {
+            ValuesParseJob& job = jobs.editItemAt(i);
+            if (job.result == NO_ERROR) {
+                job.result = compileResourceFile(bundle, assets, job.file, *job.block,
+                        params[i], overwrite[i], outTable);
+            }
+            delete job.block;
+            job.block = NULL;
+            outResults->add(job.result);
+            hasErrors = hasErrors || job.result != NO_ERROR;
+        }
+    }
+    return hasErrors ? UNKNOWN_ERROR : NO_ERROR;
+}
+
+status_t compileResourceFile(Bundle* bundle,
+                             const sp<AaptAssets>& assets,
+                             const sp<AaptFile>& in,
+                             ResXMLTree& block,
+                             const ResTable_config& defParams,
+                             const bool overwrite,
+                             ResourceTable* outTable)
+{
+    status_t err = NO_ERROR;
+
     // Top-level tag.
     const String16 resources16("resources");
 
@@ -1726,6 +2201,10 @@ ResourceTable::ResourceTable(Bundle* bundle, const String16& assetsPackage, Reso
     , mNumLocal(0)
     , mBundle(bundle)
 {
+    if (bundle->getAttrFallbackPackage() != NULL) {
+        mAttrFallbackPackage = StringAtoms::canonical(
+                String16(bundle->getAttrFallbackPackage()));
+    }
    
     
     ssize_t packageId = -1;
@@ -1911,10 +2390,9 @@ status_t ResourceTable::addPublic(const SourcePos& sourcePos,
                                   const String16& name,
                                   const uint32_t ident)
 {
-    uint32_t rid = mAssets->getIncludedResources()
-        .identifierForName(name.string(), name.size(),
-                           type.string(), type.size(),
-                           package.string(), package.size());
+    uint32_t rid = mAssets->identifierForName(name.string(), name.size(),
+                                              type.string(), type.size(),
+                                              package.string(), package.size());
     if (rid != 0) {
         sourcePos.error("Error declaring public resource %s/%s for included package %s\n",
                 String8(type).string(), String8(name).string(),
@@ -1940,10 +2418,9 @@ status_t ResourceTable::addEntry(const SourcePos& sourcePos,
                                  const int32_t format,
                                  const bool overwrite)
 {
-    uint32_t rid = mAssets->getIncludedResources()
-        .identifierForName(name.string(), name.size(),
-                           type.string(), type.size(),
-                           package.string(), package.size());
+    uint32_t rid = mAssets->identifierForName(name.string(), name.size(),
+                                              type.string(), type.size(),
+                                              package.string(), package.size());
     if (rid != 0) {
         sourcePos.error("Resource entry %s/%s is already defined in package %s.",
                 String8(type).string(), String8(name).string(), String8(package).string());
@@ -1975,10 +2452,9 @@ status_t ResourceTable::startBag(const SourcePos& sourcePos,
 
     // Check for adding entries in other packages...  for now we do
     // nothing.  We need to do the right thing here to support skinning.
-    uint32_t rid = mAssets->getIncludedResources()
-    .identifierForName(name.string(), name.size(),
-                       type.string(), type.size(),
-                       package.string(), package.size());
+    uint32_t rid = mAssets->identifierForName(name.string(), name.size(),
+                                              type.string(), type.size(),
+                                              package.string(), package.size());
     if (rid != 0) {
         sourcePos.error("Resource entry %s/%s is already defined in package %s.",
                 String8(type).string(), String8(name).string(), String8(package).string());
@@ -1991,7 +2467,7 @@ status_t ResourceTable::startBag(const SourcePos& sourcePos,
         if (p != NULL) {
             sp<Type> t = p->getTypes().valueFor(type);
             if (t != NULL) {
-                if (t->getCanAddEntries().indexOf(name) >= 0) {
+                if (t->getCanAddEntries().indexOfKey(name) >= 0) {
                     canAdd = true;
                 }
             }
@@ -2035,10 +2511,9 @@ status_t ResourceTable::addBag(const SourcePos& sourcePos,
 {
     // Check for adding entries in other packages...  for now we do
     // nothing.  We need to do the right thing here to support skinning.
-    uint32_t rid = mAssets->getIncludedResources()
-        .identifierForName(name.string(), name.size(),
-                           type.string(), type.size(),
-                           package.string(), package.size());
+    uint32_t rid = mAssets->identifierForName(name.string(), name.size(),
+                                              type.string(), type.size(),
+                                              package.string(), package.size());
     if (rid != 0) {
         return NO_ERROR;
     }
@@ -2072,10 +2547,9 @@ bool ResourceTable::hasBagOrEntry(const String16& package,
                                   const String16& name) const
 {
     // First look for this in the included resources...
-    uint32_t rid = mAssets->getIncludedResources()
-        .identifierForName(name.string(), name.size(),
-                           type.string(), type.size(),
-                           package.string(), package.size());
+    uint32_t rid = mAssets->identifierForName(name.string(), name.size(),
+                                              type.string(), type.size(),
+                                              package.string(), package.size());
     if (rid != 0) {
         return true;
     }
@@ -2098,10 +2572,9 @@ bool ResourceTable::hasBagOrEntry(const String16& package,
                                   const ResTable_config& config) const
 {
     // First look for this in the included resources...
-    uint32_t rid = mAssets->getIncludedResources()
-        .identifierForName(name.string(), name.size(),
-                           type.string(), type.size(),
-                           package.string(), package.size());
+    uint32_t rid = mAssets->identifierForName(name.string(), name.size(),
+                                              type.string(), type.size(),
+                                              package.string(), package.size());
     if (rid != 0) {
         return true;
     }
@@ -2223,16 +2696,18 @@ uint32_t ResourceTable::getResId(const String16& package,
                                  const String16& name,
                                  bool onlyPublic) const
 {
-    uint32_t id = ResourceIdCache::lookup(package, type, name, onlyPublic);
+    const atom_t packageAtom = StringAtoms::intern(package);
+    const atom_t typeAtom = StringAtoms::intern(type);
+    const atom_t nameAtom = StringAtoms::intern(name);
+    uint32_t id = ResourceIdCache::lookup(packageAtom, typeAtom, nameAtom, onlyPublic);
     if (id != 0) return id;     // cache hit
 
     // First look for this in the included resources...
     uint32_t specFlags = 0;
-    uint32_t rid = mAssets->getIncludedResources()
-        .identifierForName(name.string(), name.size(),
-                           type.string(), type.size(),
-                           package.string(), package.size(),
-                           &specFlags);
+    uint32_t rid = mAssets->identifierForName(name.string(), name.size(),
+                                              type.string(), type.size(),
+                                              package.string(), package.size(),
+                                              &specFlags);
     if (rid != 0) {
         if (onlyPublic) {
             if ((specFlags & ResTable_typeSpec::SPEC_PUBLIC) == 0) {
@@ -2241,7 +2716,7 @@ uint32_t ResourceTable::getResId(const String16& package,
             }
         }
         
-        return ResourceIdCache::store(package, type, name, onlyPublic, rid);
+        return ResourceIdCache::store(packageAtom, typeAtom, nameAtom, onlyPublic, rid);
     }
     sp<Package> p = mPackages.valueFor(package);
     if (p == NULL){
@@ -2264,10 +2739,35 @@ uint32_t ResourceTable::getResId(const String16& package,
         return 0;
     }
 
-    return ResourceIdCache::store(package, type, name, onlyPublic,
+    return ResourceIdCache::store(packageAtom, typeAtom, nameAtom, onlyPublic,
             getResId(p, t, ei));
 }
 
+bool ResourceTable::lookupXmlAttrId(const String16& ns, const String16& name,
+                                    uint32_t* outId) const
+{
+    ssize_t nsIdx = mXmlAttrIds.indexOfKey(ns);
+    if (nsIdx < 0) {
+        return false;
+    }
+    const StringHashMap<uint32_t>& ids = mXmlAttrIds.valueAt(nsIdx);
+    ssize_t idx = ids.indexOfKey(name);
+    if (idx < 0) {
+        return false;
+    }
+    *outId = ids.valueAt(idx);
+    return true;
+}
+
+void ResourceTable::storeXmlAttrId(const String16& ns, const String16& name, uint32_t id) const
+{
+    ssize_t nsIdx = mXmlAttrIds.indexOfKey(ns);
+    if (nsIdx < 0) {
+        nsIdx = mXmlAttrIds.add(ns, StringHashMap<uint32_t>());
+    }
+    mXmlAttrIds.editValueAt(nsIdx).add(name, id);
+}
+
 uint32_t ResourceTable::getResId(const String16& ref,
                                  const String16* defType,
                                  const String16* defPackage,
@@ -3859,7 +4359,7 @@ status_t ResourceTable::Type::addPublic(const SourcePos& sourcePos,
 
 void ResourceTable::Type::canAddEntry(const String16& name)
 {
-    mCanAddEntries.add(name);
+    mCanAddEntries.add(name, true);
 }
 
 sp<ResourceTable::Entry> ResourceTable::Type::getEntry(const String16& entry,
@@ -3872,14 +4372,17 @@ sp<ResourceTable::Entry> ResourceTable::Type::getEntry(const String16& entry,
     int pos = -1;
     sp<ConfigList> c = mConfigs.valueFor(entry);
     if (c == NULL) {
-        if (overlay && !autoAddOverlay && mCanAddEntries.indexOf(entry) < 0) {
+        if (overlay && !autoAddOverlay && mCanAddEntries.indexOfKey(entry) < 0) {
             sourcePos.error("Resource at %s appears in overlay but not"
                             " in the base package; use <add-resource> to add.\n",
                             String8(entry).string());
             return NULL;
         }
-        c = new ConfigList(entry, sourcePos);
-        mConfigs.add(entry, c);
+        // Share one buffer between the map key and the config list, entry
+        // and cache copies of the name.
+        const String16 name(StringAtoms::canonical(entry));
+        c = new ConfigList(name, sourcePos);
+        mConfigs.add(name, c);
         pos = (int)mOrderedConfigs.size();
         mOrderedConfigs.add(c);
         if (doSetIndex) {
@@ -3918,7 +4421,7 @@ sp<ResourceTable::Entry> ResourceTable::Type::getEntry(const String16& entry,
             NOISY(printf("New entry at %s:%d: NULL config\n",
                       sourcePos.file.string(), sourcePos.line));
         }
-        e = new Entry(entry, sourcePos);
+        e = new Entry(c->getName(), sourcePos);
         c->addEntry(cdesc, e);
         /*
         if (doSetIndex) {
@@ -3943,6 +4446,18 @@ sp<ResourceTable::Entry> ResourceTable::Type::getEntry(const String16& entry,
     return e;
 }
 
+/*
+ * Orders public definitions by name, which is the order they were checked
+ * in when mPublic was a KeyedVector; keeps error output unchanged.
+ */
+struct PublicNameLess {
+    PublicNameLess(const StringHashMap<ResourceTable::Public>& pub) : publics(pub) { }
+    bool operator()(size_t a, size_t b) const {
+        return publics.keyAt(a) < publics.keyAt(b);
+    }
+    const StringHashMap<ResourceTable::Public>& publics;
+};
+
 status_t ResourceTable::Type::applyPublicEntryOrder()
 {
     size_t N = mOrderedConfigs.size();
@@ -3955,45 +4470,45 @@ status_t ResourceTable::Type::applyPublicEntryOrder()
     }
 
     const size_t NP = mPublic.size();
+    Vector<size_t> publicOrder;
+    publicOrder.setCapacity(NP);
+    for (size_t j=0; j<NP; j++) {
+        publicOrder.add(j);
+    }
+    std::sort(publicOrder.editArray(), publicOrder.editArray() + NP, PublicNameLess(mPublic));
+
     //printf("Ordering %d configs from %d public defs\n", N, NP);
-    size_t j;
-    for (j=0; j<NP; j++) {
-        const String16& name = mPublic.keyAt(j);
-        const Public& p = mPublic.valueAt(j);
+    for (size_t j=0; j<NP; j++) {
+        const String16& name = mPublic.keyAt(publicOrder[j]);
+        const Public& p = mPublic.valueAt(publicOrder[j]);
         int32_t idx = Res_GETENTRY(p.ident);
         //printf("Looking for entry \"%s\"/\"%s\" (0x%08x) in %d...\n",
         //       String8(mName).string(), String8(name).string(), p.ident, N);
         bool found = false;
-        for (i=0; i<N; i++) {
-            sp<ConfigList> e = origOrder.itemAt(i);
-            //printf("#%d: \"%s\"\n", i, String8(e->getName()).string());
-            if (e->getName() == name) {
-                if (idx >= (int32_t)mOrderedConfigs.size()) {
-                    p.sourcePos.error("Public entry identifier 0x%x entry index "
-                            "is larger than available symbols (index %d, total symbols %d).\n",
-                            p.ident, idx, mOrderedConfigs.size());
-                    hasError = true;
-                } else if (mOrderedConfigs.itemAt(idx) == NULL) {
-                    e->setPublic(true);
-                    e->setPublicSourcePos(p.sourcePos);
-                    mOrderedConfigs.replaceAt(e, idx);
-                    origOrder.removeAt(i);
-                    N--;
-                    found = true;
-                    break;
-                } else {
-                    sp<ConfigList> oe = mOrderedConfigs.itemAt(idx);
-
-                    p.sourcePos.error("Multiple entry names declared for public entry"
-                            " identifier 0x%x in type %s (%s vs %s).\n"
-                            "%s:%d: Originally defined here.",
-                            idx+1, String8(mName).string(),
-                            String8(oe->getName()).string(),
-                            String8(name).string(),
-                            oe->getPublicSourcePos().file.string(),
-                            oe->getPublicSourcePos().line);
-                    hasError = true;
-                }
+        sp<ConfigList> e = mConfigs.valueFor(name);
+        if (e != NULL) {
+            if (idx >= (int32_t)mOrderedConfigs.size()) {
+                p.sourcePos.error("Public entry identifier 0x%x entry index "
+                        "is larger than available symbols (index %d, total symbols %d).\n",
+                        p.ident, idx, mOrderedConfigs.size());
+                hasError = true;
+            } else if (mOrderedConfigs.itemAt(idx) == NULL) {
+                e->setPublic(true);
+                e->setPublicSourcePos(p.sourcePos);
+                mOrderedConfigs.replaceAt(e, idx);
+                found = true;
+            } else {
+                sp<ConfigList> oe = mOrderedConfigs.itemAt(idx);
+
+                p.sourcePos.error("Multiple entry names declared for public entry"
+                        " identifier 0x%x in type %s (%s vs %s).\n"
+                        "%s:%d: Originally defined here.",
+                        idx+1, String8(mName).string(),
+                        String8(oe->getName()).string(),
+                        String8(name).string(),
+                        oe->getPublicSourcePos().file.string(),
+                        oe->getPublicSourcePos().line);
+                hasError = true;
             }
         }
 
@@ -4004,16 +4519,13 @@ status_t ResourceTable::Type::applyPublicEntryOrder()
         }
     }
 
-    //printf("Copying back in %d non-public configs, have %d\n", N, origOrder.size());
-    
-    if (N != origOrder.size()) {
-        printf("Internal error: remaining private symbol count mismatch\n");
-        N = origOrder.size();
-    }
-    
-    j = 0;
+    // Fill the gaps with everything that wasn't placed, in its original order.
+    size_t j = 0;
     for (i=0; i<N; i++) {
         sp<ConfigList> e = origOrder.itemAt(i);
+        if (e->getPublic()) {
+            continue;
+        }
         // There will always be enough room for the remaining entries.
         while (mOrderedConfigs.itemAt(j) != NULL) {
             j++;
@@ -4038,8 +4550,9 @@ sp<ResourceTable::Type> ResourceTable::Package::getType(const String16& type,
 {
     sp<Type> t = mTypes.valueFor(type);
     if (t == NULL) {
-        t = new Type(type, sourcePos);
-        mTypes.add(type, t);
+        const String16 name(StringAtoms::canonical(type));
+        t = new Type(name, sourcePos);
+        mTypes.add(name, t);
         mOrderedTypes.add(t);
         if (doSetIndex) {
             // For some reason the type's index is set to one plus the index
@@ -4080,7 +4593,7 @@ status_t ResourceTable::Package::setKeyStrings(const sp<AaptFile>& data)
 
 status_t ResourceTable::Package::setStrings(const sp<AaptFile>& data,
                                             ResStringPool* strings,
-                                            DefaultKeyedVector<String16, uint32_t>* mappings)
+                                            StringHashMap<uint32_t>* mappings)
 {
     if (data->getData() == NULL) {
         return UNKNOWN_ERROR;
@@ -4092,6 +4605,7 @@ status_t ResourceTable::Package::setStrings(const sp<AaptFile>& data,
     status_t err = strings->setTo(data->getData(), data->getSize());
     if (err == NO_ERROR) {
         const size_t N = strings->size();
+        mappings->setCapacity(N);
         for (size_t i=0; i<N; i++) {
             size_t len;
             mappings->add(String16(strings->stringAt(i, &len)), i);
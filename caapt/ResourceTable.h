@@ -11,6 +11,8 @@
 #include "StringPool.h"
 #include "SourcePos.h"
 #include "ResourceFilter.h"
+#include "StringAtoms.h"
+#include "StringHashMap.h"
 
 #include <map>
 #include <queue>
@@ -57,6 +59,28 @@ status_t compileXmlFile(const Bundle* bundle,
                         ResourceTable* table,
                         int options = XML_COMPILE_STANDARD_RESOURCE);
 
+/*
+ * Compile a batch of XML resource files, with the same result as calling
+ * compileXmlFile() on each in order.  Parsing and flattening run on up to
+ * bundle->getJobs() threads; the steps that read or change the table run
+ * on the calling thread, one file at a time in the order given, so ids
+ * and queued work items come out the same as a serial build.  Each
+ * file's status goes into "outResults"; returns UNKNOWN_ERROR if any
+ * file failed.
+ *
+ * With bundle->getCompiledXmlCacheDir() set, a file compiled before with
+ * the same content and options isn't parsed or flattened again: its
+ * recorded table lookups are redone, and if they all come out the same
+ * the stored output is used.  See XmlCompileCache.
+ */
+status_t compileXmlFiles(const Bundle* bundle,
+                         const sp<AaptAssets>& assets,
+                         const Vector<String16>& resourceNames,
+                         const Vector<sp<AaptFile> >& targets,
+                         ResourceTable* table,
+                         int options,
+                         Vector<status_t>* outResults);
+
 status_t compileResourceFile(Bundle* bundle,
                              const sp<AaptAssets>& assets,
                              const sp<AaptFile>& in,
@@ -64,6 +88,32 @@ status_t compileResourceFile(Bundle* bundle,
                              const bool overwrite,
                              ResourceTable* outTable);
 
+/*
+ * Same, for a file already parsed with parseXMLResource(..., false, true).
+ */
+status_t compileResourceFile(Bundle* bundle,
+                             const sp<AaptAssets>& assets,
+                             const sp<AaptFile>& in,
+                             ResXMLTree& block,
+                             const ResTable_config& defParams,
+                             const bool overwrite,
+                             ResourceTable* outTable);
+
+/*
+ * Compile a batch of values files, with the same result as calling
+ * compileResourceFile() on each in order.  Files are parsed on up to
+ * bundle->getJobs() threads; the parsed trees are then added to the table
+ * on the calling thread in the order given, so errors, overlay handling
+ * and ids come out as in a serial build.
+ */
+status_t compileResourceFiles(Bundle* bundle,
+                              const sp<AaptAssets>& assets,
+                              const Vector<sp<AaptFile> >& files,
+                              const Vector<ResTable_config>& params,
+                              const Vector<bool>& overwrite,
+                              ResourceTable* outTable,
+                              Vector<status_t>* outResults);
+
 struct AccessorCookie
 {
     SourcePos sourcePos;
@@ -245,6 +295,27 @@ public:
                       const char** outErrorMsg = NULL,
                       bool onlyPublic = true) const;
 
+    /*
+     * The package XMLNode::assignResourceIds() tries for an attribute the
+     * package of its namespace doesn't define (--attr-fallback-package);
+     * empty for none.
+     */
+    const String16& getAttrFallbackPackage() const { return mAttrFallbackPackage; }
+
+    /*
+     * What an XML attribute (namespace, name) resolved to, 0 included, so
+     * each distinct attribute is looked up once per build.  Only for
+     * assignResourceIds(), which runs in order after the IDs are assigned.
+     */
+    bool lookupXmlAttrId(const String16& ns, const String16& name, uint32_t* outId) const;
+    void storeXmlAttrId(const String16& ns, const String16& name, uint32_t id) const;
+
+    /*
+     * True for a public platform attribute added in L, which
+     * modifyForCompat() moves out of pre-L resources.
+     */
+    bool isAttributeFromL(uint32_t attrId);
+
     static bool isValidResourceName(const String16& s);
     
     bool stringToValue(Res_value* outValue, StringPool* pool,
@@ -502,20 +573,20 @@ public:
 
         const SortedVector<ConfigDescription>& getUniqueConfigs() const { return mUniqueConfigs; }
         
-        const DefaultKeyedVector<String16, sp<ConfigList> >& getConfigs() const { return mConfigs; }
+        const StringHashMap<sp<ConfigList> >& getConfigs() const { return mConfigs; }
         const Vector<sp<ConfigList> >& getOrderedConfigs() const { return mOrderedConfigs; }
 
-        const SortedVector<String16>& getCanAddEntries() const { return mCanAddEntries; }
+        const StringHashMap<bool>& getCanAddEntries() const { return mCanAddEntries; }
         
         const SourcePos& getPos() const { return mPos; }
     private:
         String16 mName;
         SourcePos* mFirstPublicSourcePos;
-        DefaultKeyedVector<String16, Public> mPublic;
+        StringHashMap<Public> mPublic;
         SortedVector<ConfigDescription> mUniqueConfigs;
-        DefaultKeyedVector<String16, sp<ConfigList> > mConfigs;
+        StringHashMap<sp<ConfigList> > mConfigs;
         Vector<sp<ConfigList> > mOrderedConfigs;
-        SortedVector<String16> mCanAddEntries;
+        StringHashMap<bool> mCanAddEntries;
         int32_t mPublicIndex;
         int32_t mIndex;
         SourcePos mPos;
@@ -545,24 +616,24 @@ public:
 
         status_t applyPublicTypeOrder();
 
-        const DefaultKeyedVector<String16, sp<Type> >& getTypes() const { return mTypes; }
+        const StringHashMap<sp<Type> >& getTypes() const { return mTypes; }
         const Vector<sp<Type> >& getOrderedTypes() const { return mOrderedTypes; }
 
     private:
         status_t setStrings(const sp<AaptFile>& data,
                             ResStringPool* strings,
-                            DefaultKeyedVector<String16, uint32_t>* mappings);
+                            StringHashMap<uint32_t>* mappings);
 
         const String16 mName;
         const size_t mPackageId;
-        DefaultKeyedVector<String16, sp<Type> > mTypes;
+        StringHashMap<sp<Type> > mTypes;
         Vector<sp<Type> > mOrderedTypes;
         sp<AaptFile> mTypeStringsData;
         sp<AaptFile> mKeyStringsData;
         ResStringPool mTypeStrings;
         ResStringPool mKeyStrings;
-        DefaultKeyedVector<String16, uint32_t> mTypeStringsMapping;
-        DefaultKeyedVector<String16, uint32_t> mKeyStringsMapping;
+        StringHashMap<uint32_t> mTypeStringsMapping;
+        StringHashMap<uint32_t> mKeyStringsMapping;
     };
 
 private:
@@ -589,18 +660,20 @@ private:
     const Item* getItem(uint32_t resID, uint32_t attrID) const;
     bool getItemValue(uint32_t resID, uint32_t attrID,
                       Res_value* outValue);
-    bool isAttributeFromL(uint32_t attrId);
 
 
     String16 mAssetsPackage;
     PackageType mPackageType;
     sp<AaptAssets> mAssets;
     uint32_t mTypeIdOffset;
-    DefaultKeyedVector<String16, sp<Package> > mPackages;
+    StringHashMap<sp<Package> > mPackages;
     Vector<sp<Package> > mOrderedPackages;
     size_t mNumLocal;
     SourcePos mCurrentXmlPos;
     Bundle* mBundle;
+    String16 mAttrFallbackPackage;
+    // What each XML attribute resolved to, by namespace and then name
+    mutable StringHashMap<StringHashMap<uint32_t> > mXmlAttrIds;
     
     // key = string resource name, value = set of locales in which that name is defined
     map<String16, map<String8, SourcePos> > mLocalizations;
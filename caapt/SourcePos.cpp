@@ -1,5 +1,7 @@
 #include "SourcePos.h"
 
+#include <utils/threads.h>
+
 #include <stdarg.h>
 #include <vector>
 
@@ -29,6 +31,9 @@ struct ErrorPos
     void print(FILE* to) const;
 };
 
+// XML files are parsed on several threads at once, so errors can come
+// from any of them.
+static Mutex g_errorsLock;
 static vector<ErrorPos> g_errors;
 
 ErrorPos::ErrorPos()
@@ -117,6 +122,7 @@ SourcePos::error(const char* fmt, ...) const
     va_start(ap, fmt);
     String8 msg = String8::formatV(fmt, ap);
     va_end(ap);
+    AutoMutex _l(g_errorsLock);
     g_errors.push_back(ErrorPos(this->file, this->line, msg, ErrorPos::ERROR));
 }
 
@@ -143,12 +149,14 @@ SourcePos::printf(const char* fmt, ...) const
 bool
 SourcePos::hasErrors()
 {
+    AutoMutex _l(g_errorsLock);
     return g_errors.size() > 0;
 }
 
 void
 SourcePos::printErrors(FILE* to)
 {
+    AutoMutex _l(g_errorsLock);
     vector<ErrorPos>::const_iterator it;
     for (it=g_errors.begin(); it!=g_errors.end(); it++) {
         it->print(to);
@@ -157,3 +165,10 @@ SourcePos::printErrors(FILE* to)
 
 
 
+
+void
+SourcePos::clearErrors()
+{
+    AutoMutex _l(g_errorsLock);
+    g_errors.clear();
+}
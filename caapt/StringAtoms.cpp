@@ -0,0 +1,171 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Process-wide table of interned strings.
+
+#include <utils/RWLock.h>
+#include <utils/String16.h>
+#include <utils/Vector.h>
+#include "StringAtoms.h"
+
+#include <string.h>
+
+namespace android {
+
+// Lookups only take the read lock; adding a string takes the write lock.
+static RWLock sLock;
+
+// sStrings[atom - 1] is the string for an atom, sHashes[atom - 1] its
+// hash.  sSlots is an open-addressing table of atoms (0 for an empty
+// slot), a power of two in size and kept under 3/4 full.
+static Vector<String16> sStrings;
+static Vector<uint32_t> sHashes;
+static Vector<atom_t> sSlots;
+
+// FNV-1a over the UTF-16 units; the same function as StringHashMap::hash.
+static inline uint32_t hashString(const char16_t* str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static inline bool equals(const String16& atom, const char16_t* str, size_t len) {
+    return atom.size() == len && memcmp(atom.string(), str, len * sizeof(char16_t)) == 0;
+}
+
+static inline bool equals8(const String16& atom, const char* str, size_t len) {
+    if (atom.size() != len) {
+        return false;
+    }
+    const char16_t* cp = atom.string();
+    for (size_t i = 0; i < len; i++) {
+        if (cp[i] != (unsigned char) str[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Caller holds a lock.
+static atom_t findLocked(uint32_t hash, const char16_t* str, size_t len) {
+    if (sSlots.isEmpty()) {
+        return 0;
+    }
+    const size_t mask = sSlots.size() - 1;
+    size_t slot = hash & mask;
+    atom_t atom;
+    while ((atom = sSlots[slot]) != 0) {
+        if (sHashes[atom - 1] == hash && equals(sStrings[atom - 1], str, len)) {
+            return atom;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return 0;
+}
+
+// Caller holds the write lock.
+static void insertSlot(atom_t atom) {
+    const size_t mask = sSlots.size() - 1;
+    size_t slot = sHashes[atom - 1] & mask;
+    while (sSlots[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+    sSlots.editItemAt(slot) = atom;
+}
+
+static atom_t internHashed(uint32_t hash, const char16_t* str, size_t len,
+        const String16* original) {
+    {
+        RWLock::AutoRLock _l(sLock);
+        atom_t atom = findLocked(hash, str, len);
+        if (atom != 0) {
+            return atom;
+        }
+    }
+
+    RWLock::AutoWLock _l(sLock);
+    // someone may have added it since we looked
+    atom_t atom = findLocked(hash, str, len);
+    if (atom != 0) {
+        return atom;
+    }
+
+    if ((sStrings.size() + 1) * 4 > sSlots.size() * 3) {
+        size_t numSlots = sSlots.isEmpty() ? 1024 : sSlots.size() * 2;
+        sSlots.clear();
+        sSlots.insertAt((atom_t) 0, 0, numSlots);
+        for (size_t i = 0; i < sStrings.size(); i++) {
+            insertSlot(i + 1);
+        }
+    }
+    sStrings.add(original != NULL ? *original : String16(str, len));
+    sHashes.add(hash);
+    atom = sStrings.size();
+    insertSlot(atom);
+    return atom;
+}
+
+atom_t StringAtoms::intern(const String16& str) {
+    return internHashed(hashString(str.string(), str.size()), str.string(), str.size(), &str);
+}
+
+atom_t StringAtoms::intern(const char16_t* str, size_t len) {
+    return internHashed(hashString(str, len), str, len, NULL);
+}
+
+atom_t StringAtoms::intern8(const char* str, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        if ((unsigned char) str[i] >= 0x80) {
+            return intern(String16(str, len));
+        }
+        hash ^= (unsigned char) str[i];
+        hash *= 16777619u;
+    }
+
+    {
+        RWLock::AutoRLock _l(sLock);
+        if (!sSlots.isEmpty()) {
+            const size_t mask = sSlots.size() - 1;
+            size_t slot = hash & mask;
+            atom_t atom;
+            while ((atom = sSlots[slot]) != 0) {
+                if (sHashes[atom - 1] == hash && equals8(sStrings[atom - 1], str, len)) {
+                    return atom;
+                }
+                slot = (slot + 1) & mask;
+            }
+        }
+    }
+
+    String16 str16(str, len);
+    return internHashed(hash, str16.string(), str16.size(), &str16);
+}
+
+atom_t StringAtoms::find(const String16& str) {
+    const uint32_t hash = hashString(str.string(), str.size());
+    RWLock::AutoRLock _l(sLock);
+    return findLocked(hash, str.string(), str.size());
+}
+
+String16 StringAtoms::string(atom_t atom) {
+    RWLock::AutoRLock _l(sLock);
+    if (atom == 0 || atom > sStrings.size()) {
+        return String16();
+    }
+    return sStrings[atom - 1];
+}
+
+String16 StringAtoms::canonical(const String16& str) {
+    return string(intern(str));
+}
+
+size_t StringAtoms::size() {
+    RWLock::AutoRLock _l(sLock);
+    return sStrings.size();
+}
+
+}
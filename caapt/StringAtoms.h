@@ -0,0 +1,60 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Process-wide table of interned strings.
+
+#ifndef STRING_ATOMS_H
+#define STRING_ATOMS_H
+
+#include <utils/String16.h>
+
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * Stable ID for an interned string.  Atoms are handed out from 1 in the
+ * order strings are first seen and are never freed; 0 means "no atom".
+ */
+typedef uint32_t atom_t;
+
+/*
+ * Package, type, element and attribute names are a small set of strings
+ * that get converted, copied and compared millions of times in a build.
+ * Interning a name once gives an integer that can be hashed and compared
+ * directly, and a canonical String16 whose buffer every copy shares, so
+ * the same name isn't allocated again and again.
+ *
+ * Only intern names: there is no way to remove a string.  The table
+ * grows for the life of the process on purpose, since ResourceIdCache
+ * and other process-wide caches keep atoms, and a freed atom would
+ * leave them pointing at the wrong name.  Its size is bounded by the
+ * distinct names the process sees; for the daemon, the names in the
+ * projects it builds.  Safe to use from several threads at once.
+ */
+class StringAtoms {
+public:
+    static atom_t intern(const String16& str);
+    static atom_t intern(const char16_t* str, size_t len);
+
+    /*
+     * Intern a UTF-8 string.  ASCII strings that are already in the
+     * table are found without converting them.
+     */
+    static atom_t intern8(const char* str, size_t len);
+
+    /* the atom for "str" if it has been interned, else 0 */
+    static atom_t find(const String16& str);
+
+    /* the canonical string for an atom, sharing its buffer */
+    static String16 string(atom_t atom);
+
+    /* shorthand for string(intern(str)) */
+    static String16 canonical(const String16& str);
+
+    static size_t size();
+};
+
+}
+
+#endif
@@ -0,0 +1,160 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// Hashed String16-keyed map that keeps its entries in insertion order.
+//
+
+#ifndef STRING_HASH_MAP_H
+#define STRING_HASH_MAP_H
+
+#include <utils/String16.h>
+#include <utils/Vector.h>
+
+#include <stdint.h>
+
+namespace android {
+
+/*
+ * Drop-in for the lookup side of DefaultKeyedVector<String16, VALUE>.
+ *
+ * A KeyedVector keeps its keys sorted, so every add() shifts (and
+ * copy-constructs) everything after the insertion point and building a
+ * table of N names costs O(N^2).  Here entries are appended to a vector
+ * and found through an open-addressing table of indices, so add() and
+ * valueFor() are O(1).  keyAt()/valueAt() walk the entries in the order
+ * they were added; callers that need name order must sort themselves.
+ *
+ * Keys are stored as String16 copies, which share the caller's buffer,
+ * together with their hash so a probe only compares strings on a hash
+ * match.  There is no removal.
+ */
+template <typename VALUE>
+class StringHashMap {
+public:
+    explicit StringHashMap(const VALUE& defValue = VALUE())
+        : mDefault(defValue) { }
+
+    inline size_t size() const { return mEntries.size(); }
+    inline bool isEmpty() const { return mEntries.isEmpty(); }
+
+    /* index of the key in insertion order, or NAME_NOT_FOUND */
+    ssize_t indexOfKey(const String16& key) const {
+        if (mEntries.isEmpty()) {
+            return NAME_NOT_FOUND;
+        }
+        const uint32_t hashcode = hash(key);
+        const size_t mask = mSlots.size() - 1;
+        size_t slot = hashcode & mask;
+        while (mSlots[slot] >= 0) {
+            const entry_t& e = mEntries[mSlots[slot]];
+            // interned keys (see StringAtoms) share a buffer
+            if (e.hashcode == hashcode
+                    && (e.key.string() == key.string() || e.key == key)) {
+                return mSlots[slot];
+            }
+            slot = (slot + 1) & mask;
+        }
+        return NAME_NOT_FOUND;
+    }
+
+    /* the value for "key", or the default value if it isn't present */
+    const VALUE& valueFor(const String16& key) const {
+        ssize_t idx = indexOfKey(key);
+        return idx >= 0 ? mEntries[idx].value : mDefault;
+    }
+
+    /* "key" must be present */
+    VALUE& editValueFor(const String16& key) {
+        return mEntries.editItemAt(indexOfKey(key)).value;
+    }
+
+    const String16& keyAt(size_t index) const { return mEntries[index].key; }
+    const VALUE& valueAt(size_t index) const { return mEntries[index].value; }
+    VALUE& editValueAt(size_t index) { return mEntries.editItemAt(index).value; }
+
+    /*
+     * Add a key, or replace the value of an existing one (as KeyedVector
+     * does).  Returns the key's index.
+     */
+    ssize_t add(const String16& key, const VALUE& value) {
+        ssize_t idx = indexOfKey(key);
+        if (idx >= 0) {
+            mEntries.editItemAt(idx).value = value;
+            return idx;
+        }
+        if ((mEntries.size() + 1) * 4 > mSlots.size() * 3) {
+            rehash(mSlots.isEmpty() ? 16 : mSlots.size() * 2);
+        }
+        entry_t e;
+        e.key = key;
+        e.value = value;
+        e.hashcode = hash(key);
+        idx = mEntries.add(e);
+        insertSlot(idx);
+        return idx;
+    }
+
+    /* reserve room for "size" keys, to skip the rehashes while filling */
+    void setCapacity(size_t size) {
+        mEntries.setCapacity(size);
+        size_t slots = 16;
+        while (slots * 3 < size * 4) {
+            slots *= 2;
+        }
+        if (slots > mSlots.size()) {
+            rehash(slots);
+        }
+    }
+
+    void clear() {
+        mEntries.clear();
+        mSlots.clear();
+    }
+
+    /* FNV-1a over the UTF-16 units */
+    static uint32_t hash(const String16& key) {
+        uint32_t hashcode = 2166136261u;
+        const char16_t* cp = key.string();
+        const char16_t* end = cp + key.size();
+        while (cp < end) {
+            hashcode ^= *cp++;
+            hashcode *= 16777619u;
+        }
+        return hashcode;
+    }
+
+private:
+    struct entry_t {
+        String16 key;
+        VALUE value;
+        uint32_t hashcode;
+    };
+
+    void insertSlot(size_t idx) {
+        const size_t mask = mSlots.size() - 1;
+        size_t slot = mEntries[idx].hashcode & mask;
+        while (mSlots[slot] >= 0) {
+            slot = (slot + 1) & mask;
+        }
+        mSlots.editItemAt(slot) = (int32_t) idx;
+    }
+
+    void rehash(size_t slots) {
+        mSlots.clear();
+        mSlots.insertAt((int32_t) -1, 0, slots);
+        const size_t N = mEntries.size();
+        for (size_t i = 0; i < N; i++) {
+            insertSlot(i);
+        }
+    }
+
+    Vector<entry_t> mEntries;
+    // indices into mEntries, -1 for an empty slot; a power of two in size
+    // and kept under 3/4 full
+    Vector<int32_t> mSlots;
+    VALUE mDefault;
+};
+
+} // namespace android
+
+#endif // STRING_HASH_MAP_H
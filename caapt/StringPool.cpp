@@ -6,11 +6,15 @@
 
 #include "StringPool.h"
 #include "ResourceTable.h"
+#include "StringAtoms.h"
 
 #include <utils/ByteOrder.h>
 #include <utils/SortedVector.h>
+#include <utils/Unicode.h>
 #include "qsort_r_compat.h"
 
+#include <algorithm>
+
 #if HAVE_PRINTF_ZD
 #  define ZD "%zd"
 #  define ZD_TYPE ssize_t
@@ -79,6 +83,31 @@ String8 StringPool::entry::makeConfigsString() const {
     return configStr;
 }
 
+static bool configLess(const ResTable_config& a, const ResTable_config& b) {
+    return a.compareLogical(b) < 0;
+}
+
+static bool configEqual(const ResTable_config& a, const ResTable_config& b) {
+    return a.compareLogical(b) == 0;
+}
+
+/*
+ * Put the configs add() collected into order and drop the repeats.  The
+ * sort is stable, so of several equal configs the first one added is the
+ * one kept, as when each was inserted in place.
+ */
+void StringPool::entry::sortConfigs() {
+    if (configsSorted) {
+        return;
+    }
+    ResTable_config* begin = configs.editArray();
+    ResTable_config* end = begin + configs.size();
+    std::stable_sort(begin, end, configLess);
+    end = std::unique(begin, end, configEqual);
+    configs.removeItemsAt(end - begin, configs.size() - (end - begin));
+    configsSorted = true;
+}
+
 int StringPool::entry::compare(const entry& o) const {
     // Strings with styles go first, to reduce the size of the styles array.
     // We don't care about the relative order of these strings.
@@ -150,22 +179,15 @@ ssize_t StringPool::add(const String16& value,
     }
 
     if (config != NULL) {
-        // Add this to the set of configs associated with the string.
+        // Add this to the set of configs associated with the string.  They
+        // are sorted all at once by sortByConfig(); until then, only skip
+        // the common case of the same string in the same config again.
         entry& ent = mEntries.editItemAt(eidx);
-        size_t addPos;
-        for (addPos=0; addPos<ent.configs.size(); addPos++) {
-            int cmp = ent.configs.itemAt(addPos).compareLogical(*config);
-            if (cmp >= 0) {
-                if (cmp > 0) {
-                    NOISY(printf("*** inserting config: %s\n", config->toString().string()));
-                    ent.configs.insertAt(*config, addPos);
-                }
-                break;
-            }
-        }
-        if (addPos >= ent.configs.size()) {
+        const size_t NC = ent.configs.size();
+        if (NC == 0 || ent.configs[NC-1].compareLogical(*config) != 0) {
             NOISY(printf("*** adding config: %s\n", config->toString().string()));
             ent.configs.add(*config);
+            ent.configsSorted = NC == 0;
         }
     }
 
@@ -216,8 +238,11 @@ status_t StringPool::addStyleSpan(size_t idx, const entry_style_span& span)
         mEntryStyleArray.add();
     }
 
+    // Span tags are a handful of names repeated over every styled string,
+    // so they're interned to share one buffer.
     entry_style& style = mEntryStyleArray.editItemAt(idx);
-    style.spans.add(span);
+    ssize_t spanIdx = style.spans.add(span);
+    style.spans.editItemAt(spanIdx).name = StringAtoms::canonical(span.name);
     mEntries.editItemAt(mEntryArray[idx]).hasStyles = true;
     return NO_ERROR;
 }
@@ -236,6 +261,11 @@ void StringPool::sortByConfig()
 
     const size_t N = mEntryArray.size();
 
+    const size_t NE = mEntries.size();
+    for (size_t i=0; i<NE; i++) {
+        mEntries.editItemAt(i).sortConfigs();
+    }
+
     // This is a vector that starts out with a 1:1 mapping to entries
     // in the array, which we will sort to come up with the desired order.
     // At that point it maps from the new position in the array to the
@@ -335,6 +365,7 @@ void StringPool::sortByConfig()
     mEntryArray = newEntryArray;
     mEntryStyleArray = newEntryStyleArray;
     mValues.clear();
+    mValues.setCapacity(mEntries.size());
     for (size_t i=0; i<mEntries.size(); i++) {
         const entry& ent = mEntries[i];
         mValues.add(ent.value, ent.indices[0]);
@@ -418,6 +449,12 @@ status_t StringPool::writeStringBlock(const sp<AaptFile>& pool)
 
     const size_t charSize = mUTF8 ? sizeof(uint8_t) : sizeof(char16_t);
 
+    // Lay out every string first, so the block is allocated once and each
+    // string is encoded straight into it rather than through a String8.
+    Vector<size_t> encSizes;
+    if (mUTF8) {
+        encSizes.setCapacity(STRINGS);
+    }
     size_t strPos = 0;
     for (i=0; i<STRINGS; i++) {
         entry& ent = mEntries.editItemAt(i);
@@ -425,12 +462,15 @@ status_t StringPool::writeStringBlock(const sp<AaptFile>& pool)
         const size_t lenSize = strSize > (size_t)(1<<((charSize*8)-1))-1 ?
             charSize*2 : charSize;
 
-        String8 encStr;
+        size_t encSize = 0;
+        if (mUTF8 && strSize > 0) {
+            // invalid UTF-16 is written as an empty string, as String8 does
+            const ssize_t len = utf16_to_utf8_length(ent.value.string(), strSize);
+            encSize = len > 0 ? len : 0;
+        }
         if (mUTF8) {
-            encStr = String8(ent.value);
+            encSizes.add(encSize);
         }
-
-        const size_t encSize = mUTF8 ? encStr.size() : 0;
         const size_t encLenSize = mUTF8 ?
             (encSize > (size_t)(1<<((charSize*8)-1))-1 ?
                 charSize*2 : charSize) : 0;
@@ -439,21 +479,36 @@ status_t StringPool::writeStringBlock(const sp<AaptFile>& pool)
 
         const size_t totalSize = lenSize + encLenSize +
             ((mUTF8 ? encSize : strSize)+1)*charSize;
+        strPos += totalSize;
+    }
 
-        void* dat = (void*)pool->editData(preSize + strPos + totalSize);
-        if (dat == NULL) {
-            fprintf(stderr, "ERROR: Out of memory for string pool\n");
-            return NO_MEMORY;
-        }
-        dat = (uint8_t*)dat + preSize + strPos;
+    uint8_t* strData = (uint8_t*)pool->editData(preSize + strPos);
+    if (strData == NULL) {
+        fprintf(stderr, "ERROR: Out of memory for string pool\n");
+        return NO_MEMORY;
+    }
+    strData += preSize;
+    // anything after an embedded NUL is left as zeros
+    memset(strData, 0, strPos);
+
+    for (i=0; i<STRINGS; i++) {
+        const entry& ent = mEntries[i];
+        const size_t strSize = (ent.value.size());
+        void* dat = strData + ent.offset;
         if (mUTF8) {
             uint8_t* strings = (uint8_t*)dat;
+            const size_t encSize = encSizes[i];
 
             ENCODE_LENGTH(strings, sizeof(uint8_t), strSize)
 
             ENCODE_LENGTH(strings, sizeof(uint8_t), encSize)
 
-            strncpy((char*)strings, encStr, encSize+1);
+            if (encSize > 0) {
+                utf16_to_utf8(ent.value.string(), strSize, (char*)strings);
+                // like strncpy(), stop at an embedded NUL
+                const size_t len = strnlen((const char*)strings, encSize);
+                memset(strings + len, 0, encSize + 1 - len);
+            }
         } else {
             uint16_t* strings = (uint16_t*)dat;
 
@@ -461,8 +516,6 @@ status_t StringPool::writeStringBlock(const sp<AaptFile>& pool)
 
             strcpy16_htod(strings, ent.value);
         }
-
-        strPos += totalSize;
     }
 
     // Pad ending string position up to a uint32_t boundary.
@@ -9,6 +9,7 @@
 
 #include "Main.h"
 #include "AaptAssets.h"
+#include "StringHashMap.h"
 
 #include <androidfw/ResourceTypes.h>
 #include <utils/String16.h>
@@ -39,18 +40,25 @@ class StringPool
 {
 public:
     struct entry {
-        entry() : offset(0) { }
-        entry(const String16& _value) : value(_value), offset(0), hasStyles(false) { }
+        entry() : offset(0), hasStyles(false), configsSorted(false) { }
+        entry(const String16& _value) : value(_value), offset(0), hasStyles(false),
+                configsSorted(true) { }
         entry(const entry& o) : value(o.value), offset(o.offset),
                 hasStyles(o.hasStyles), indices(o.indices),
-                configTypeName(o.configTypeName), configs(o.configs) { }
+                configTypeName(o.configTypeName), configs(o.configs),
+                configsSorted(o.configsSorted) { }
 
         String16 value;
         size_t offset;
         bool hasStyles;
         Vector<size_t> indices;
         String8 configTypeName;
+        // Sorted by ResTable_config::compareLogical() without duplicates,
+        // once sortConfigs() has run; add() only appends.
         Vector<ResTable_config> configs;
+        bool configsSorted;
+
+        void sortConfigs();
 
         String8 makeConfigsString() const;
 
@@ -165,7 +173,7 @@ private:
 
     // Unique set of all the strings added to the pool, mapped to
     // the first index of mEntryArray where the value was added.
-    DefaultKeyedVector<String16, ssize_t>   mValues;
+    StringHashMap<ssize_t>                  mValues;
     // This array maps from the original position a string was placed at
     // in mEntryArray to its new position after being sorted with sortByConfig().
     Vector<size_t>                          mOriginalPosToNewPos;
@@ -24,8 +24,8 @@ namespace android {
 
 // --- WorkQueue ---
 
-WorkQueue::WorkQueue(size_t maxThreads, bool canCallJava) :
-        mMaxThreads(maxThreads), mCanCallJava(canCallJava),
+WorkQueue::WorkQueue(size_t maxThreads, bool canCallJava, SchedulingMode mode) :
+        mMaxThreads(maxThreads), mCanCallJava(canCallJava), mMode(mode),
         mCanceled(false), mFinished(false), mIdleThreads(0) {
 }
 
@@ -60,7 +60,24 @@ status_t WorkQueue::schedule(WorkUnit* workUnit, size_t backlog) {
         }
     }
 
-    mWorkUnits.add(workUnit);
+    if (mMode == SCHEDULE_HEAVIEST_FIRST) {
+        // Keep the pending units sorted by descending weight; threads
+        // always take the head of the list.
+        const size_t weight = workUnit->weight();
+        size_t lo = 0;
+        size_t hi = mWorkUnits.size();
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (mWorkUnits.itemAt(mid)->weight() >= weight) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        mWorkUnits.insertAt(workUnit, lo);
+    } else {
+        mWorkUnits.add(workUnit);
+    }
     mWorkChangedCondition.broadcast();
     return OK;
 }
@@ -44,10 +44,24 @@ public:
          * If the result is 'false' then the work queue is canceled.
          */
         virtual bool run() = 0;
+
+        /*
+         * Relative cost of the work unit, used by SCHEDULE_HEAVIEST_FIRST.
+         */
+        virtual size_t weight() const { return 0; }
+    };
+
+    enum SchedulingMode {
+        /* Work units run in the order they were posted. */
+        SCHEDULE_FIFO,
+        /* Pending work units with the largest weight() run first, so that
+         * one expensive unit posted late doesn't become the tail. */
+        SCHEDULE_HEAVIEST_FIRST,
     };
 
     /* Creates a work queue with the specified maximum number of work threads. */
-    WorkQueue(size_t maxThreads, bool canCallJava = true);
+    WorkQueue(size_t maxThreads, bool canCallJava = true,
+            SchedulingMode mode = SCHEDULE_FIFO);
 
     /* Destroys the work queue.
      * Cancels pending work and waits for all remaining threads to complete.
@@ -102,6 +116,7 @@ private:
 
     const size_t mMaxThreads;
     const bool mCanCallJava;
+    const SchedulingMode mMode;
 
     Mutex mLock;
     Condition mWorkChangedCondition;
@@ -7,6 +7,7 @@
 #include "XMLNode.h"
 #include "ResourceTable.h"
 #include "pseudolocalize.h"
+#include "StringAtoms.h"
 
 #include <utils/ByteOrder.h>
 #include <errno.h>
@@ -48,6 +49,8 @@ static const String16 RESOURCES_PREFIX(RESOURCES_ROOT_NAMESPACE);
 static const String16 RESOURCES_PREFIX_AUTO_PACKAGE(RESOURCES_AUTO_PACKAGE_NAMESPACE);
 static const String16 RESOURCES_PRV_PREFIX(RESOURCES_ROOT_PRV_NAMESPACE);
 static const String16 RESOURCES_TOOLS_NAMESPACE("http://schemas.android.com/tools");
+static const String16 ATTR_TYPE("attr");
+static const String16 DEFAULT_ATTR_FALLBACK_PACKAGE(kDefaultAttrFallbackPackage);
 
 String16 getNamespaceResourcePackage(String16 appPackage, String16 namespaceUri, bool* outIsPublic)
 {
@@ -576,9 +579,11 @@ status_t parseXMLResource(const sp<AaptFile>& file, ResXMLTree* outTree,
 
 sp<XMLNode> XMLNode::parse(const sp<AaptFile>& file)
 {
-    char buf[16384];
-    int fd = open(file->getSourceFile().string(), O_RDONLY | O_BINARY);
-    if (fd < 0) {
+    // The whole file goes to expat in one XML_Parse() call, straight from
+    // the mapping.
+    size_t len;
+    const char* data = (const char*) file->mapSourceFile(&len);
+    if (data == NULL) {
         SourcePos(file->getSourceFile(), -1).error("Unable to open file for read: %s",
                 strerror(errno));
         return NULL;
@@ -594,29 +599,21 @@ sp<XMLNode> XMLNode::parse(const sp<AaptFile>& file)
     XML_SetCharacterDataHandler(parser, characterData);
     XML_SetCommentHandler(parser, commentData);
 
-    ssize_t len;
-    bool done;
-    do {
-        len = read(fd, buf, sizeof(buf));
-        done = len < (ssize_t)sizeof(buf);
-        if (len < 0) {
-            SourcePos(file->getSourceFile(), -1).error("Error reading file: %s\n", strerror(errno));
-            close(fd);
-            return NULL;
-        }
-        if (XML_Parse(parser, buf, len, done) == XML_STATUS_ERROR) {
-            SourcePos(file->getSourceFile(), (int)XML_GetCurrentLineNumber(parser)).error(
-                    "Error parsing XML: %s\n", XML_ErrorString(XML_GetErrorCode(parser)));
-            close(fd);
-            return NULL;
-        }
-    } while (!done);
+    if (XML_Parse(parser, data, (int) len, true) == XML_STATUS_ERROR) {
+        SourcePos(file->getSourceFile(), (int)XML_GetCurrentLineNumber(parser)).error(
+                "Error parsing XML: %s\n", XML_ErrorString(XML_GetErrorCode(parser)));
+        XML_ParserFree(parser);
+        file->unmapSourceFile();
+        return NULL;
+    }
 
     XML_ParserFree(parser);
+    // Nothing keeps pointers into the text, and one mapping per resource
+    // file adds up on large projects.
+    file->unmapSourceFile();
     if (state.root == NULL) {
         SourcePos(file->getSourceFile(), -1).error("No XML data generated when parsing");
     }
-    close(fd);
     return state.root;
 }
 
@@ -988,21 +985,101 @@ status_t XMLNode::parseValues(const sp<AaptAssets>& assets,
     return hasErrors ? UNKNOWN_ERROR : NO_ERROR;
 }
 
+/*
+ * The uncached part of XMLNode::resolveAttrId(): look "name" up in "pkg",
+ * then in the fallback package, and remember the answer, 0 included.
+ */
+static uint32_t findAttrId(const sp<AaptAssets>& assets, const ResourceTable* table,
+                           const String16& ns, const String16& name,
+                           const String16& pkg, bool nsIsPublic)
+{
+    const String16& attr(ATTR_TYPE);
+    uint32_t res = 0;
+    if (pkg.size() > 0) {
+        if (table != NULL) {
+            // An XML attribute name has no '@', '*', type or package
+            // part, so expanding it as a reference would only copy it.
+            res = table->getResId(pkg, attr, name, nsIsPublic);
+        }
+        else {
+            res = assets->identifierForName(name.string(), name.size(),
+                                            attr.string(), attr.size(),
+                                            pkg.string(), pkg.size());
+        }
+
+        // Without a table there's no --attr-fallback-package to go by.
+        const String16& fallback = table != NULL
+                ? table->getAttrFallbackPackage() : DEFAULT_ATTR_FALLBACK_PACKAGE;
+        if (res == 0 && fallback.size() > 0) {
+            String16 fallbackPkg(getNamespaceResourcePackage(fallback, ns, &nsIsPublic));
+            res = assets->identifierForName(name.string(), name.size(),
+                                            attr.string(), attr.size(),
+                                            fallbackPkg.string(), fallbackPkg.size());
+        }
+    }
+
+    if (table != NULL) {
+        table->storeXmlAttrId(ns, name, res);
+    }
+    return res;
+}
+
+// The outcome only depends on the namespace and the name, and a custom
+// attribute that misses in its package would otherwise miss there, and
+// in the fallback, for every use in every file.
+uint32_t XMLNode::resolveAttrId(const sp<AaptAssets>& assets,
+                               const ResourceTable* table,
+                               const String16& ns, const String16& name)
+{
+    uint32_t res = 0;
+    if (table != NULL && table->lookupXmlAttrId(ns, name, &res)) {
+        // resolved, or found missing, for an earlier element
+        return res;
+    }
+    bool nsIsPublic = true;
+    const String16 pkg(getNamespaceResourcePackage(String16(assets->getPackage()), ns,
+            &nsIsPublic));
+    return findAttrId(assets, table, ns, name, pkg, nsIsPublic);
+}
+
+uint32_t XMLNode::resolveAttrId(const sp<AaptAssets>& assets,
+                               const ResourceTable* table,
+                               const String16& ns, const String16& name,
+                               const String16& pkg, bool nsIsPublic)
+{
+    uint32_t res = 0;
+    if (table != NULL && table->lookupXmlAttrId(ns, name, &res)) {
+        return res;
+    }
+    return findAttrId(assets, table, ns, name, pkg, nsIsPublic);
+}
+
 status_t XMLNode::assignResourceIds(const sp<AaptAssets>& assets,
                                     const ResourceTable* table)
 {
     bool hasErrors = false;
     
     if (getType() == TYPE_ELEMENT) {
-        String16 attr("attr");
-        const char* errorMsg;
+        const String16 appPackage(assets->getPackage());
+        // Attributes of an element nearly always share one namespace, and
+        // parsed names are interned, so the package is only worked out
+        // when the namespace buffer changes.
+        const char16_t* lastNs = NULL;
+        String16 lastPkg;
+        bool lastIsPublic = true;
         const size_t N = mAttributes.size();
         for (size_t i=0; i<N; i++) {
             const attribute_entry& e = mAttributes.itemAt(i);
             if (e.ns.size() <= 0) continue;
-            bool nsIsPublic;
+            if (e.ns.string() != lastNs) {
+                lastIsPublic = true;
+                lastPkg = StringAtoms::canonical(
+                        getNamespaceResourcePackage(appPackage, e.ns, &lastIsPublic));
+                lastNs = e.ns.string();
+            }
+            bool nsIsPublic = lastIsPublic;
             
-            String16 pkg(getNamespaceResourcePackage(String16(assets->getPackage()), e.ns, &nsIsPublic));
+            const String16& pkg(lastPkg);
             NOISY(printf("*******Elem for elementName[%s], eName[%s]= eString[\"%s\"]: namespace(%s) %s ===> %s\n",
                          String8(getElementName()).string(),
                          String8(e.name).string(),
@@ -1014,25 +1091,7 @@ status_t XMLNode::assignResourceIds(const sp<AaptAssets>& assets,
             if (pkg.size() <= 0)
                 continue;
             
-            uint32_t res = 0;
-            if (table != NULL) {
-                res = table->getResId(e.name, &attr, &pkg, &errorMsg, nsIsPublic);
-            }
-            else {
-                res = assets->getIncludedResources().
-                identifierForName(e.name.string(), e.name.size(),
-                                  attr.string(), attr.size(),
-                                  pkg.string(), pkg.size());
-            }
-            
-            if(res == 0) {
-                String16 pkg(getNamespaceResourcePackage(String16("ctrip.android.view"), e.ns, &nsIsPublic));
-                res = assets->getIncludedResources().identifierForName(e.name.string(), e.name.size(),
-                                  attr.string(), attr.size(),
-                                  pkg.string(), pkg.size());
-                
-//                printf("find in ctrip.android.viewxxxx,pkg:[%s], name:[%s],attribute:[%s],resid=0x%08x\n", String8(pkg).string(), String8(e.name).string(), String8(attr).string(), res);
-            }
+            uint32_t res = resolveAttrId(assets, table, e.ns, e.name, pkg, nsIsPublic);
             
             if (res != 0) {
                 NOISY(printf("XML attribute name %s: resid=0x%08x\n",
@@ -1054,10 +1113,9 @@ status_t XMLNode::assignResourceIds(const sp<AaptAssets>& assets,
                     res = table->getResId(e.name, &attr, &pkg, &errorMsg, nsIsPublic);
                 }
                 else {
-                    res = assets->getIncludedResources().
-                    identifierForName(e.name.string(), e.name.size(),
-                                      attr.string(), attr.size(),
-                                      pkg.string(), pkg.size());
+                    res = assets->identifierForName(e.name.string(), e.name.size(),
+                                                    attr.string(), attr.size(),
+                                                    pkg.string(), pkg.size());
                 }
 
                 if (res != 0) {
@@ -1240,12 +1298,14 @@ static void splitName(const char* name, String16* outNs, String16* outName)
     while (*p != 0 && *p != 1) {
         p++;
     }
+    // Names repeat across every file, so they're interned instead of
+    // converted again each time they're seen.
     if (*p == 0) {
         *outNs = String16();
-        *outName = String16(name);
+        *outName = StringAtoms::string(StringAtoms::intern8(name, p-name));
     } else {
-        *outNs = String16(name, (p-name));
-        *outName = String16(p+1);
+        *outNs = StringAtoms::string(StringAtoms::intern8(name, p-name));
+        *outName = StringAtoms::string(StringAtoms::intern8(p+1, strlen(p+1)));
     }
 }
 
@@ -136,6 +136,20 @@ public:
     status_t assignResourceIds(const sp<AaptAssets>& assets,
                                const ResourceTable* table = NULL);
 
+    /*
+     * The resource ID assignResourceIds() gives an attribute named "name"
+     * in namespace "ns", or 0 if there's none.  Callers that already have
+     * what getNamespaceResourcePackage() says of "ns" pass it in as "pkg"
+     * and "nsIsPublic"; otherwise it's worked out on a cache miss.
+     */
+    static uint32_t resolveAttrId(const sp<AaptAssets>& assets,
+                                  const ResourceTable* table,
+                                  const String16& ns, const String16& name);
+    static uint32_t resolveAttrId(const sp<AaptAssets>& assets,
+                                  const ResourceTable* table,
+                                  const String16& ns, const String16& name,
+                                  const String16& pkg, bool nsIsPublic);
+
     status_t flatten(const sp<AaptFile>& dest, bool stripComments,
             bool stripRawValues) const;
 
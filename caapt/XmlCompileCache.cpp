@@ -0,0 +1,252 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// On-disk cache of compiled XML resource files, keyed by content.
+//
+
+#include "XmlCompileCache.h"
+#include "AaptUtil.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#ifdef HAVE_MS_C_RUNTIME
+#include <direct.h>
+#endif
+
+#include <vector>
+
+/*
+ * Each cache file is (little-endian uint32s unless noted):
+ *
+ *   header    magic, source size, attribute count, compiled size
+ *   attrs     { line, nameResId, dataType, data, nsLen, nameLen,
+ *               rawLen } followed by that many UTF-16 units of the
+ *             namespace, name and raw value
+ *   compiled  the flattened ResXMLTree
+ */
+static const unsigned char kMagic[4] = { 'a', 'X', 'C', '1' };
+enum {
+    kHeaderLen = 16,
+    kAttrLen = 28,
+};
+
+// Entries nobody has read for a month are deleted, going through the
+// directory at most once a day.
+static const time_t kMaxEntryAge = 30 * 24 * 60 * 60;
+static const time_t kPruneInterval = 24 * 60 * 60;
+
+static inline uint32_t readU4(const unsigned char* p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void writeU4(std::vector<unsigned char>* out, uint32_t val)
+{
+    out->push_back((unsigned char) val);
+    out->push_back((unsigned char) (val >> 8));
+    out->push_back((unsigned char) (val >> 16));
+    out->push_back((unsigned char) (val >> 24));
+}
+
+static void writeChars(std::vector<unsigned char>* out, const String16& str)
+{
+    const char16_t* s = str.string();
+    for (size_t i = 0; i < str.size(); i++) {
+        out->push_back((unsigned char) s[i]);
+        out->push_back((unsigned char) (s[i] >> 8));
+    }
+}
+
+/* read "len" UTF-16 units at *pos, or return false if they run past end */
+static bool readChars(const unsigned char* data, size_t size, size_t* pos, size_t len,
+        String16* out)
+{
+    if (len > (size - *pos) / 2) {
+        return false;
+    }
+    std::vector<char16_t> chars(len);
+    const unsigned char* p = data + *pos;
+    for (size_t i = 0; i < len; i++) {
+        chars[i] = (char16_t) (p[2*i] | (p[2*i+1] << 8));
+    }
+    out->setTo(len > 0 ? &chars[0] : NULL, len);
+    *pos += len * 2;
+    return true;
+}
+
+XmlCompileCache::XmlCompileCache(const String8& cacheDir)
+    : mCacheDir(cacheDir), mHits(0), mMisses(0), mTempCounter(0)
+{
+#ifdef HAVE_MS_C_RUNTIME
+    _mkdir(mCacheDir.string());
+#else
+    mkdir(mCacheDir.string(), S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
+#endif
+    AaptUtil::pruneCacheDir(mCacheDir, kMaxEntryAge, kPruneInterval);
+}
+
+/*
+ * 64-bit FNV-1a over the options and the content.  Everything else the
+ * output depends on comes from the table, and is checked by redoing the
+ * lookups.
+ */
+uint64_t XmlCompileCache::key(const void* source, size_t size, int options)
+{
+    unsigned char optionBytes[4];
+    for (int i = 0; i < 4; i++) {
+        optionBytes[i] = (unsigned char) (options >> (8 * i));
+    }
+    return AaptUtil::hashBytes(source, size, AaptUtil::hashBytes(optionBytes, 4));
+}
+
+bool XmlCompileCache::read(uint64_t key, size_t sourceSize, Entry* outEntry) const
+{
+    String8 path = entryPath(key, sourceSize);
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return false;
+    }
+
+    std::vector<unsigned char> buf;
+    bool ok = false;
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && st.st_size >= kHeaderLen) {
+        buf.resize(st.st_size);
+        ok = fread(&buf[0], 1, buf.size(), fp) == buf.size() && fgetc(fp) == EOF;
+    }
+    fclose(fp);
+    if (!ok) {
+        return false;
+    }
+
+    const unsigned char* data = &buf[0];
+    const size_t size = buf.size();
+    if (memcmp(data, kMagic, sizeof(kMagic)) != 0 || readU4(data + 4) != sourceSize) {
+        return false;
+    }
+    const size_t attrCount = readU4(data + 8);
+    const size_t compiledSize = readU4(data + 12);
+    if (attrCount > (size - kHeaderLen) / kAttrLen) {
+        return false;
+    }
+
+    outEntry->attrs.clear();
+    outEntry->attrs.setCapacity(attrCount);
+    size_t pos = kHeaderLen;
+    for (size_t i = 0; i < attrCount; i++) {
+        if (size - pos < kAttrLen) {
+            return false;
+        }
+        const unsigned char* p = data + pos;
+        Attr attr;
+        attr.line = (int32_t) readU4(p);
+        attr.nameResId = readU4(p + 4);
+        attr.dataType = (uint8_t) readU4(p + 8);
+        attr.data = readU4(p + 12);
+        const size_t nsLen = readU4(p + 16);
+        const size_t nameLen = readU4(p + 20);
+        const size_t rawLen = readU4(p + 24);
+        pos += kAttrLen;
+        if (!readChars(data, size, &pos, nsLen, &attr.ns)
+                || !readChars(data, size, &pos, nameLen, &attr.name)
+                || !readChars(data, size, &pos, rawLen, &attr.rawValue)) {
+            return false;
+        }
+        outEntry->attrs.add(attr);
+    }
+
+    // anything trailing means the entry isn't what we wrote
+    if (size - pos != compiledSize) {
+        return false;
+    }
+    outEntry->compiled.clear();
+    if (compiledSize > 0) {
+        outEntry->compiled.insertAt(0, 0, compiledSize);
+        memcpy(outEntry->compiled.editArray(), data + pos, compiledSize);
+    }
+    AaptUtil::touchCacheEntry(path);
+    return true;
+}
+
+void XmlCompileCache::write(uint64_t key, size_t sourceSize, const Entry& entry)
+{
+    std::vector<unsigned char> out;
+    out.insert(out.end(), kMagic, kMagic + sizeof(kMagic));
+    writeU4(&out, sourceSize);
+    writeU4(&out, entry.attrs.size());
+    writeU4(&out, entry.compiled.size());
+    for (size_t i = 0; i < entry.attrs.size(); i++) {
+        const Attr& attr = entry.attrs[i];
+        writeU4(&out, (uint32_t) attr.line);
+        writeU4(&out, attr.nameResId);
+        writeU4(&out, attr.dataType);
+        writeU4(&out, attr.data);
+        writeU4(&out, attr.ns.size());
+        writeU4(&out, attr.name.size());
+        writeU4(&out, attr.rawValue.size());
+        writeChars(&out, attr.ns);
+        writeChars(&out, attr.name);
+        writeChars(&out, attr.rawValue);
+    }
+
+    size_t counter;
+    {
+        AutoMutex _l(mLock);
+        counter = mTempCounter++;
+    }
+    String8 path = entryPath(key, sourceSize);
+    String8 tempPath(path);
+    tempPath.appendFormat(".%d.%lu.tmp", (int) getpid(), (unsigned long) counter);
+
+    FILE* fp = fopen(tempPath.string(), "wb");
+    if (fp == NULL) {
+        return;
+    }
+    const size_t len = entry.compiled.size();
+    bool ok = fwrite(&out[0], 1, out.size(), fp) == out.size()
+            && (len == 0 || fwrite(entry.compiled.array(), 1, len, fp) == len);
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tempPath.string(), path.string()) != 0) {
+        unlink(tempPath.string());
+    }
+}
+
+void XmlCompileCache::countHit()
+{
+    AutoMutex _l(mLock);
+    mHits++;
+}
+
+void XmlCompileCache::countMiss()
+{
+    AutoMutex _l(mLock);
+    mMisses++;
+}
+
+size_t XmlCompileCache::getHits() const
+{
+    AutoMutex _l(mLock);
+    return mHits;
+}
+
+size_t XmlCompileCache::getMisses() const
+{
+    AutoMutex _l(mLock);
+    return mMisses;
+}
+
+String8 XmlCompileCache::entryPath(uint64_t key, size_t sourceSize) const
+{
+    String8 name;
+    name.appendFormat("%08lx%08lx-%lu.xc",
+            (unsigned long) (key >> 32), (unsigned long) (key & 0xffffffffUL),
+            (unsigned long) sourceSize);
+
+    String8 path(mCacheDir);
+    path.appendPath(name);
+    return path;
+}
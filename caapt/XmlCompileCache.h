@@ -0,0 +1,87 @@
+//
+// Copyright 2015 The Android Open Source Project
+//
+// On-disk cache of compiled XML resource files, keyed by content.
+//
+
+#ifndef __XML_COMPILE_CACHE_H
+#define __XML_COMPILE_CACHE_H
+
+#include <utils/Errors.h>
+#include <utils/String16.h>
+#include <utils/String8.h>
+#include <utils/Vector.h>
+#include <utils/threads.h>
+
+#include <stdint.h>
+
+using namespace android;
+
+/*
+ * Most layouts, drawables and menus are unchanged from one build to the
+ * next, yet each is parsed, resolved against the table and flattened
+ * again.  This cache keeps, for each file it's given, the flattened
+ * ResXMLTree together with every lookup the resolve step made: the
+ * attribute name -> ID of each namespaced attribute, and the raw string
+ * and resulting Res_value of every attribute value.  A later build with
+ * the same content and compile options redoes just those lookups,
+ * in order; if every one gives the same answer, the file's other
+ * resources haven't changed in any way it can see and the stored bytes
+ * are its output.  Otherwise it is compiled as usual.
+ *
+ * Redoing the lookups, instead of trusting a hash of the whole table,
+ * means adding a string doesn't recompile every layout, and that @+id
+ * references still create their IDs in the same order.
+ *
+ * Entries are written to a temp file and renamed into place, so several
+ * threads or aapt processes can share one directory.  A damaged or
+ * mismatching entry is treated as a miss.  Reading an entry touches it,
+ * and entries that haven't been read for a month are pruned.
+ */
+class XmlCompileCache {
+public:
+    XmlCompileCache(const String8& cacheDir);
+
+    /* one attribute, as the resolve step saw it */
+    struct Attr {
+        String16 ns;
+        String16 name;
+        String16 rawValue;      // before parsing
+        int32_t line;           // of the element, for errors
+        uint32_t nameResId;
+        uint8_t dataType;
+        uint32_t data;          // not compared for TYPE_STRING
+    };
+
+    struct Entry {
+        Vector<Attr> attrs;
+        Vector<uint8_t> compiled;
+    };
+
+    /* the key of a source file's compiled form with these options */
+    static uint64_t key(const void* source, size_t size, int options);
+
+    /* fill "outEntry" from what's stored under "key"; false on a miss */
+    bool read(uint64_t key, size_t sourceSize, Entry* outEntry) const;
+
+    /* store an entry; failures only cost the next hit */
+    void write(uint64_t key, size_t sourceSize, const Entry& entry);
+
+    /* counters for verbose output */
+    void countHit();
+    void countMiss();
+    size_t getHits() const;
+    size_t getMisses() const;
+
+private:
+    String8 entryPath(uint64_t key, size_t sourceSize) const;
+
+    String8 mCacheDir;
+
+    mutable Mutex mLock;
+    size_t mHits;
+    size_t mMisses;
+    size_t mTempCounter;
+};
+
+#endif // __XML_COMPILE_CACHE_H
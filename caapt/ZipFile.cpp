@@ -32,6 +32,10 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <assert.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 using namespace android;
 
@@ -53,6 +57,12 @@ static status_t errnoToStatus(int err)
         return UNKNOWN_ERROR;
 }
 
+ZipFile::ZipFile(void)
+  : mZipFp(NULL), mReadOnly(false), mNeedCDRewrite(false),
+    mCompressionLevel(Z_BEST_COMPRESSION), mEntryIndexUsed(0)
+{
+}
+
 /*
  * Open a file and parse its guts.
  */
@@ -142,31 +152,100 @@ ZipEntry* ZipFile::getEntryByIndex(int idx) const
 
 /*
  * Find an entry by name.
+ *
+ * The same name can appear more than once (add(ZipFile*,...) doesn't
+ * check for duplicates); as before, the entry added last wins.
  */
 ZipEntry* ZipFile::getEntryByName(const char* fileName) const
 {
-    /*
-     * Do a stupid linear string-compare search.
-     *
-     * There are various ways to speed this up, especially since it's rare
-     * to intermingle changes to the archive with "get by name" calls.  We
-     * don't want to sort the mEntries vector itself, however, because
-     * it's used to recreate the Central Directory.
-     *
-     * (Hash table works, parallel list of pointers in sorted order is good.)
-     */
-    int idx;
+    size_t numSlots = mEntryIndex.size();
+    if (numSlots == 0)
+        return NULL;
+
+    size_t mask = numSlots - 1;
+    size_t slot = hashEntryName(fileName) & mask;
+    ZipEntry* pFound = NULL;
+    int foundIdx = -1;
+
+    while (true) {
+        int idx = mEntryIndex[slot];
+        if (idx < 0)
+            break;
 
-    for (idx = mEntries.size()-1; idx >= 0; idx--) {
         ZipEntry* pEntry = mEntries[idx];
-        if (!pEntry->getDeleted() &&
+        if (idx > foundIdx && !pEntry->getDeleted() &&
             strcmp(fileName, pEntry->getFileName()) == 0)
         {
-            return pEntry;
+            pFound = pEntry;
+            foundIdx = idx;
         }
+        slot = (slot + 1) & mask;
     }
 
-    return NULL;
+    return pFound;
+}
+
+/*
+ * FNV-1a over the file name.
+ */
+unsigned int ZipFile::hashEntryName(const char* fileName)
+{
+    unsigned int hash = 2166136261u;
+    const unsigned char* cp = (const unsigned char*) fileName;
+
+    while (*cp != '\0') {
+        hash ^= *cp++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Add mEntries[idx] to the name index, growing the table to keep the
+ * load factor under 3/4 so probe sequences stay short.
+ */
+void ZipFile::addEntryToIndex(int idx)
+{
+    if ((mEntryIndexUsed + 1) * 4 > mEntryIndex.size() * 3) {
+        // rebuild picks up every entry up to and including idx
+        rebuildEntryIndex((mEntryIndexUsed + 1) * 2);
+        return;
+    }
+
+    size_t mask = mEntryIndex.size() - 1;
+    size_t slot = hashEntryName(mEntries[idx]->getFileName()) & mask;
+    while (mEntryIndex[slot] >= 0)
+        slot = (slot + 1) & mask;
+    mEntryIndex.editItemAt(slot) = idx;
+    mEntryIndexUsed++;
+}
+
+/*
+ * Recreate the name index from scratch.  Needed after anything that
+ * changes positions in mEntries.
+ */
+void ZipFile::rebuildEntryIndex(size_t minSlots)
+{
+    size_t count = mEntries.size();
+    size_t numSlots = 16;
+
+    if (minSlots < count)
+        minSlots = count;
+    while (numSlots * 3 < minSlots * 4)
+        numSlots <<= 1;
+
+    mEntryIndex.clear();
+    mEntryIndex.insertAt(-1, 0, numSlots);
+    mEntryIndexUsed = 0;
+
+    size_t mask = numSlots - 1;
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = hashEntryName(mEntries[i]->getFileName()) & mask;
+        while (mEntryIndex[slot] >= 0)
+            slot = (slot + 1) & mask;
+        mEntryIndex.editItemAt(slot) = (int) i;
+        mEntryIndexUsed++;
+    }
 }
 
 /*
@@ -180,6 +259,8 @@ void ZipFile::discardEntries(void)
         delete mEntries[count];
 
     mEntries.clear();
+    mEntryIndex.clear();
+    mEntryIndexUsed = 0;
 }
 
 
@@ -317,6 +398,7 @@ status_t ZipFile::readCentralDir(void)
 
         mEntries.add(pEntry);
     }
+    rebuildEntryIndex();
 
 
     /*
@@ -357,7 +439,7 @@ bail:
  */
 status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
     const char* storageName, int sourceType, int compressionMethod,
-    ZipEntry** ppEntry)
+    ZipEntry** ppEntry, const Deflated* pDeflated)
 {
     ZipEntry* pEntry = NULL;
     status_t result = NO_ERROR;
@@ -414,7 +496,18 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
     if (sourceType == ZipEntry::kCompressStored) {
         if (compressionMethod == ZipEntry::kCompressDeflated) {
             bool failed = false;
-            result = compressFpToFp(mZipFp, inputFp, data, size, &crc);
+            if (pDeflated != NULL) {
+                /* deflateToBuffer() already did the work; just copy it in */
+                size_t len = pDeflated->data.size();
+                if (fwrite(pDeflated->data.array(), 1, len, mZipFp) != len) {
+                    ALOGD("fwrite %d bytes failed\n", (int) len);
+                    result = UNKNOWN_ERROR;
+                }
+                crc = pDeflated->crc;
+            } else {
+                result = compressFpToFp(mZipFp, inputFp, data, size,
+                            mCompressionLevel, &crc);
+            }
             if (result != NO_ERROR) {
                 ALOGD("compression failed, storing\n");
                 failed = true;
@@ -424,7 +517,8 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
                  * to be set through an API call, but I don't expect our
                  * criteria to change over time.
                  */
-                long src = inputFp ? ftell(inputFp) : size;
+                long src = pDeflated ? pDeflated->uncompressedLen :
+                           inputFp ? ftell(inputFp) : size;
                 long dst = ftell(mZipFp) - startPosn;
                 if (dst + (dst / 10) > src) {
                     ALOGD("insufficient compression (src=%ld dst=%ld), storing\n",
@@ -454,8 +548,11 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
             }
         }
 
-        // currently seeked to end of file
-        uncompressedLen = inputFp ? ftell(inputFp) : size;
+        // currently seeked to end of file (unless we had it pre-deflated)
+        if (pDeflated != NULL && compressionMethod == ZipEntry::kCompressDeflated)
+            uncompressedLen = pDeflated->uncompressedLen;
+        else
+            uncompressedLen = inputFp ? ftell(inputFp) : size;
     } else if (sourceType == ZipEntry::kCompressDeflated) {
         /* we should support uncompressed-from-compressed, but it's not
          * important right now */
@@ -517,7 +614,7 @@ status_t ZipFile::addCommon(const char* fileName, const void* data, size_t size,
     /*
      * Add pEntry to the list.
      */
-    mEntries.add(pEntry);
+    addEntryToIndex(mEntries.add(pEntry));
     if (ppEntry != NULL)
         *ppEntry = pEntry;
     pEntry = NULL;
@@ -583,25 +680,19 @@ status_t ZipFile::add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
     pEntry->mLFH.write(mZipFp);
 
     /*
-     * Copy the data over.
+     * Copy the data over, still compressed.
      *
      * If the "has data descriptor" flag is set, we want to copy the DD
      * fields as well.  This is a fixed-size area immediately following
      * the data.
      */
-    if (fseek(pSourceZip->mZipFp, pSourceEntry->getFileOffset(), SEEK_SET) != 0)
-    {
-        result = UNKNOWN_ERROR;
-        goto bail;
-    }
-
     off_t copyLen;
     copyLen = pSourceEntry->getCompressedLen();
     if ((pSourceEntry->mLFH.mGPBitFlag & ZipEntry::kUsesDataDescr) != 0)
         copyLen += ZipEntry::kDataDescriptorLen;
 
-    if (copyPartialFpToFp(mZipFp, pSourceZip->mZipFp, copyLen, NULL)
-        != NO_ERROR)
+    if (copyRangeToFp(mZipFp, pSourceZip->mZipFp,
+            pSourceEntry->getFileOffset(), copyLen) != NO_ERROR)
     {
         ALOGW("copy of '%s' failed\n", pEntry->mCDE.mFileName);
         result = UNKNOWN_ERROR;
@@ -625,7 +716,7 @@ status_t ZipFile::add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
     /*
      * Add pEntry to the list.
      */
-    mEntries.add(pEntry);
+    addEntryToIndex(mEntries.add(pEntry));
     if (ppEntry != NULL)
         *ppEntry = pEntry;
     pEntry = NULL;
@@ -734,6 +825,57 @@ status_t ZipFile::copyPartialFpToFp(FILE* dstFp, FILE* srcFp, long length,
     return NO_ERROR;
 }
 
+/*
+ * Copy "length" bytes starting at "srcOffset" in "srcFp" to the current
+ * position of "dstFp".
+ *
+ * Where the kernel can copy between two files (Linux sendfile), the data
+ * goes straight from one file to the other without passing through our
+ * buffers.  Otherwise, or if the kernel declines, this falls back to
+ * copyPartialFpToFp().
+ *
+ * On exit, "dstFp" will be seeked immediately past the data just
+ * written; the position of "srcFp" is undefined.
+ */
+status_t ZipFile::copyRangeToFp(FILE* dstFp, FILE* srcFp, off_t srcOffset,
+    long length)
+{
+#if defined(__linux__)
+    long dstStart = ftell(dstFp);
+    int dstFd = fileno(dstFp);
+
+    if (dstStart >= 0 && fflush(dstFp) == 0 &&
+        lseek(dstFd, dstStart, SEEK_SET) == dstStart)
+    {
+        off_t inOffset = srcOffset;
+        long remaining = length;
+
+        while (remaining > 0) {
+            ssize_t actual = sendfile(dstFd, fileno(srcFp), &inOffset, remaining);
+            if (actual < 0 && errno == EINTR)
+                continue;
+            if (actual <= 0)
+                break;
+            remaining -= actual;
+        }
+
+        /* resync stdio with where the fd ended up */
+        if (remaining == 0)
+            return fseek(dstFp, dstStart + length, SEEK_SET) == 0 ?
+                NO_ERROR : UNKNOWN_ERROR;
+
+        ALOGV("sendfile stopped with %ld bytes left, copying by hand\n",
+            remaining);
+        if (fseek(dstFp, dstStart, SEEK_SET) != 0)
+            return UNKNOWN_ERROR;
+    }
+#endif
+
+    if (fseek(srcFp, srcOffset, SEEK_SET) != 0)
+        return UNKNOWN_ERROR;
+    return copyPartialFpToFp(dstFp, srcFp, length, NULL);
+}
+
 /*
  * Compress all of the data in "srcFp" and write it to "dstFp".
  *
@@ -741,7 +883,46 @@ status_t ZipFile::copyPartialFpToFp(FILE* dstFp, FILE* srcFp, long length,
  * will be seeked immediately past the compressed data.
  */
 status_t ZipFile::compressFpToFp(FILE* dstFp, FILE* srcFp,
-    const void* data, size_t size, unsigned long* pCRC32)
+    const void* data, size_t size, int level, unsigned long* pCRC32)
+{
+    return compressCommon(dstFp, NULL, srcFp, data, size, level, pCRC32);
+}
+
+/*
+ * Compress a file, or a block of data, into memory.
+ *
+ * Safe to call from any thread: the only state involved is the source
+ * and "pDeflated".
+ */
+status_t ZipFile::deflateToBuffer(const char* fileName, const void* data,
+    size_t size, int level, Deflated* pDeflated)
+{
+    FILE* inputFp = NULL;
+    status_t result;
+
+    pDeflated->data.clear();
+    if (!data) {
+        inputFp = fopen(fileName, FILE_OPEN_RO);
+        if (inputFp == NULL)
+            return errnoToStatus(errno);
+    }
+
+    result = compressCommon(NULL, &pDeflated->data, inputFp, data, size,
+                level, &pDeflated->crc);
+    pDeflated->uncompressedLen = inputFp ? ftell(inputFp) : size;
+
+    if (inputFp != NULL)
+        fclose(inputFp);
+    return result;
+}
+
+/*
+ * Shared body of compressFpToFp() and deflateToBuffer().  Output goes to
+ * "dstFp", or is appended to "pDstBuf" when that's non-NULL.
+ */
+status_t ZipFile::compressCommon(FILE* dstFp, Vector<unsigned char>* pDstBuf,
+    FILE* srcFp, const void* data, size_t size, int level,
+    unsigned long* pCRC32)
 {
     status_t result = NO_ERROR;
     const size_t kBufSize = 32768;
@@ -775,7 +956,7 @@ status_t ZipFile::compressFpToFp(FILE* dstFp, FILE* srcFp,
     zstream.avail_out = kBufSize;
     zstream.data_type = Z_UNKNOWN;
 
-    zerr = deflateInit2(&zstream, Z_BEST_COMPRESSION,
+    zerr = deflateInit2(&zstream, level,
         Z_DEFLATED, -MAX_WBITS, DEF_MEM_LEVEL, Z_DEFAULT_STRATEGY);
     if (zerr != Z_OK) {
         result = UNKNOWN_ERROR;
@@ -841,7 +1022,12 @@ status_t ZipFile::compressFpToFp(FILE* dstFp, FILE* srcFp,
             (zerr == Z_STREAM_END && zstream.avail_out != (uInt) kBufSize))
         {
             ALOGV("+++ writing %d bytes\n", (int) (zstream.next_out - outBuf));
-            if (fwrite(outBuf, 1, zstream.next_out - outBuf, dstFp) !=
+            if (pDstBuf != NULL) {
+                if (pDstBuf->appendArray(outBuf, zstream.next_out - outBuf) < 0) {
+                    result = NO_MEMORY;
+                    goto z_bail;
+                }
+            } else if (fwrite(outBuf, 1, zstream.next_out - outBuf, dstFp) !=
                 (size_t)(zstream.next_out - outBuf))
             {
                 ALOGD("write %d failed in deflate\n",
@@ -882,7 +1068,10 @@ status_t ZipFile::remove(ZipEntry* pEntry)
      * not some stray ZipEntry from a different file.
      */
 
-    /* mark entry as deleted, and mark archive as dirty */
+    /*
+     * Mark entry as deleted, and mark archive as dirty.  The entry stays
+     * in the name index (getEntryByName skips it) until crunchArchive().
+     */
     pEntry->setDeleted();
     mNeedCDRewrite = true;
     return NO_ERROR;
@@ -1020,6 +1209,7 @@ status_t ZipFile::crunchArchive(void)
             if (result != NO_ERROR) {
                 /* this is why you use a temp file */
                 ALOGE("error during crunch - archive is toast\n");
+                rebuildEntryIndex();
                 return result;
             }
 
@@ -1040,6 +1230,10 @@ status_t ZipFile::crunchArchive(void)
     assert(mEOCD.mNumEntries == mEOCD.mTotalNumEntries);
     assert(mEOCD.mNumEntries == count);
 
+    /* indices past the first deleted entry have moved */
+    if (delCount > 0)
+        rebuildEntryIndex();
+
     return result;
 }
 
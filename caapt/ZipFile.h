@@ -43,9 +43,7 @@ namespace android {
  */
 class ZipFile {
 public:
-    ZipFile(void)
-      : mZipFp(NULL), mReadOnly(false), mNeedCDRewrite(false)
-      {}
+    ZipFile(void);
     ~ZipFile(void) {
         if (!mReadOnly)
             flush();
@@ -65,6 +63,13 @@ public:
     };
     status_t open(const char* zipFileName, int flags);
 
+    /*
+     * zlib level (0-9) used when add() deflates.  Defaults to the best,
+     * slowest compression.
+     */
+    void setCompressionLevel(int level) { mCompressionLevel = level; }
+    int getCompressionLevel(void) const { return mCompressionLevel; }
+
     /*
      * Add a file to the end of the archive.  Specify whether you want the
      * library to try to store it compressed.
@@ -116,11 +121,52 @@ public:
                          compressionMethod, ppEntry);
     }
 
+    /*
+     * Data deflated ahead of time by deflateToBuffer().
+     */
+    struct Deflated {
+        Deflated(void) : uncompressedLen(0), crc(0) {}
+
+        Vector<unsigned char> data;     // raw deflate stream
+        long            uncompressedLen;
+        unsigned long   crc;            // CRC-32 of the uncompressed data
+    };
+
+    /*
+     * Deflate a file, or "data" if it's non-NULL, into memory exactly as
+     * add() would have written it.  This doesn't touch any archive, so it
+     * can run on several threads at once.
+     */
+    static status_t deflateToBuffer(const char* fileName, const void* data,
+        size_t size, int level, Deflated* pDeflated);
+
+    /*
+     * Like add(), but with the data already run through deflateToBuffer().
+     * The source is still used for the mod time, and is stored as-is if
+     * the deflated form turns out not to be worth it.
+     */
+    status_t addDeflated(const char* fileName, const char* storageName,
+        const Deflated& deflated, ZipEntry** ppEntry)
+    {
+        return addCommon(fileName, NULL, 0, storageName,
+                         ZipEntry::kCompressStored,
+                         ZipEntry::kCompressDeflated, ppEntry, &deflated);
+    }
+    status_t addDeflated(const void* data, size_t size, const char* storageName,
+        const Deflated& deflated, ZipEntry** ppEntry)
+    {
+        return addCommon(NULL, data, size, storageName,
+                         ZipEntry::kCompressStored,
+                         ZipEntry::kCompressDeflated, ppEntry, &deflated);
+    }
+
     /*
      * Add an entry by copying it from another zip file.  If "padding" is
      * nonzero, the specified number of bytes will be added to the "extra"
      * field in the header.
      *
+     * The data is copied as-is, without being inflated or recompressed.
+     *
      * If "ppEntry" is non-NULL, a pointer to the new entry will be returned.
      */
     status_t add(const ZipFile* pSourceZip, const ZipEntry* pSourceEntry,
@@ -220,10 +266,15 @@ private:
     /* clean up mEntries */
     void discardEntries(void);
 
+    /* name index over mEntries, used by getEntryByName */
+    static unsigned int hashEntryName(const char* fileName);
+    void addEntryToIndex(int idx);
+    void rebuildEntryIndex(size_t minSlots = 0);
+
     /* common handler for all "add" functions */
     status_t addCommon(const char* fileName, const void* data, size_t size,
         const char* storageName, int sourceType, int compressionMethod,
-        ZipEntry** ppEntry);
+        ZipEntry** ppEntry, const Deflated* pDeflated = NULL);
 
     /* copy all of "srcFp" into "dstFp" */
     status_t copyFpToFp(FILE* dstFp, FILE* srcFp, unsigned long* pCRC32);
@@ -233,11 +284,18 @@ private:
     /* copy some of "srcFp" into "dstFp" */
     status_t copyPartialFpToFp(FILE* dstFp, FILE* srcFp, long length,
         unsigned long* pCRC32);
+    /* copy a range of "srcFp" into "dstFp", in the kernel when possible */
+    status_t copyRangeToFp(FILE* dstFp, FILE* srcFp, off_t srcOffset,
+        long length);
     /* like memmove(), but on parts of a single file */
     status_t filemove(FILE* fp, off_t dest, off_t src, size_t n);
     /* compress all of "srcFp" into "dstFp", using Deflate */
-    status_t compressFpToFp(FILE* dstFp, FILE* srcFp,
-        const void* data, size_t size, unsigned long* pCRC32);
+    static status_t compressFpToFp(FILE* dstFp, FILE* srcFp,
+        const void* data, size_t size, int level, unsigned long* pCRC32);
+    /* compress into "dstFp", or append to "pDstBuf" if it's non-NULL */
+    static status_t compressCommon(FILE* dstFp, Vector<unsigned char>* pDstBuf,
+        FILE* srcFp, const void* data, size_t size, int level,
+        unsigned long* pCRC32);
 
     /* get modification date from a file descriptor */
     time_t getModTime(int fd);
@@ -257,12 +315,24 @@ private:
     /* set this when we trash the central dir */
     bool            mNeedCDRewrite;
 
+    /* zlib level for entries we deflate */
+    int             mCompressionLevel;
+
     /*
      * One ZipEntry per entry in the zip file.  I'm using pointers instead
      * of objects because it's easier than making operator= work for the
      * classes and sub-classes.
      */
     Vector<ZipEntry*>   mEntries;
+
+    /*
+     * Open-addressing hash of file name -> index into mEntries.  Slots
+     * hold -1 when empty.  Entries pending deletion stay in the index
+     * until crunchArchive() shifts them out, so the table must be
+     * rebuilt whenever mEntries is reordered.
+     */
+    Vector<int>         mEntryIndex;
+    size_t              mEntryIndexUsed;
 };
 
 }; // namespace android
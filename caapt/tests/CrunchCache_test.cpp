@@ -1,97 +1,175 @@
 //
 // Copyright 2011 The Android Open Source Project
 //
+#include <utils/KeyedVector.h>
 #include <utils/String8.h>
-#include <iostream>
-#include <errno.h>
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "CrunchCache.h"
 #include "FileFinder.h"
 #include "MockFileFinder.h"
 #include "CacheUpdater.h"
 #include "MockCacheUpdater.h"
+#include "TestHelper.h"
 
 using namespace android;
-using std::cout;
-using std::endl;
-
-void expectEqual(int got, int expected, const char* desc) {
-    cout << "Checking " << desc << ": ";
-    cout << "Got " << got << ", expected " << expected << "...";
-    cout << ( (got == expected) ? "PASSED" : "FAILED") << endl;
-    errno += ((got == expected) ? 0 : 1);
-}
 
-int main() {
+class CrunchCacheTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mSource = testTempPath("crunch", "res");
+        mDest = testTempPath("crunch", "cache");
+        mkdir(mSource.string(), 0755);
+        mkdir(mDest.string(), 0755);
+    }
+
+    virtual void TearDown() {
+        unlink(mSource.appendPathCopy("hello.png").string());
+        unlink(mDest.appendPathCopy(CrunchCache::kManifestName).string());
+        rmdir(mSource.string());
+        rmdir(mDest.string());
+    }
+
+    /*
+     * Runs one crunch over the files in "sources" and "dests", given as
+     * names relative to the source and cache roots, with the mod-times the
+     * file finder should report for them.  The manifest is on disk, so it
+     * carries over from one call to the next.
+     */
+    size_t crunch(const KeyedVector<String8,time_t>& sources,
+                  const KeyedVector<String8,time_t>& dests,
+                  MockCacheUpdater* cu, bool forceOverwrite = false) {
+        KeyedVector<String8, KeyedVector<String8,time_t> > data;
+        data.add(mSource, underRoot(mSource, sources));
+        data.add(mDest, underRoot(mDest, dests));
+        MockFileFinder ff(data);
+        CrunchCache cc(mSource, mDest, &ff);
+        return cc.crunch(cu, forceOverwrite);
+    }
+
+    bool writeSource(const char* name, const char* content) {
+        FILE* fp = fopen(mSource.appendPathCopy(name).string(), "wb");
+        if (fp == NULL) {
+            return false;
+        }
+        fputs(content, fp);
+        return fclose(fp) == 0;
+    }
+
+    String8 mSource;
+    String8 mDest;
+
+private:
+    static KeyedVector<String8,time_t> underRoot(const String8& root,
+            const KeyedVector<String8,time_t>& files) {
+        KeyedVector<String8,time_t> rooted;
+        for (size_t i = 0; i < files.size(); i++) {
+            rooted.add(root.appendPathCopy(files.keyAt(i)), files.valueAt(i));
+        }
+        return rooted;
+    }
+};
+
+TEST_F(CrunchCacheTest, CrunchesNewerAndMissingFiles) {
+    KeyedVector<String8,time_t> sources;
+    // This shouldn't be updated
+    sources.add(String8("drawable/hello.png"), 3);
+    // This should be updated
+    sources.add(String8("drawable/world.png"), 5);
+    // This has no cached copy yet
+    sources.add(String8("drawable-cool/hello.png"), 3);
+
+    KeyedVector<String8,time_t> dests;
+    dests.add(String8("drawable/hello.png"), 3);
+    dests.add(String8("drawable/world.png"), 3);
+    // This should be deleted
+    dests.add(String8("drawable/dead.png"), 3);
+
+    MockCacheUpdater cu;
+    EXPECT_EQ(2U, crunch(sources, dests, &cu));
+    EXPECT_EQ(1, cu.deleteCount);
+    EXPECT_EQ(2, cu.processCount);
+
+    MockCacheUpdater forced;
+    EXPECT_EQ(3U, crunch(sources, dests, &forced, true));
+    EXPECT_EQ(3, forced.processCount);
+}
 
-    errno = 0;
+/*
+ * A source that only looks newer, as after a fresh checkout, isn't
+ * crunched again while its content matches the manifest.
+ */
+TEST_F(CrunchCacheTest, SkipsSourcesWithUnchangedContent) {
+    ASSERT_TRUE(writeSource("hello.png", "unchanged"));
+
+    KeyedVector<String8,time_t> sources;
+    KeyedVector<String8,time_t> dests;
+    sources.add(String8("hello.png"), 100);
+    MockCacheUpdater first;
+    EXPECT_EQ(1U, crunch(sources, dests, &first));
+
+    sources.replaceValueFor(String8("hello.png"), 200);
+    dests.add(String8("hello.png"), 150);
+    MockCacheUpdater second;
+    EXPECT_EQ(0U, crunch(sources, dests, &second));
+    EXPECT_EQ(0, second.processCount);
+
+    ASSERT_TRUE(writeSource("hello.png", "changed"));
+    sources.replaceValueFor(String8("hello.png"), 300);
+    MockCacheUpdater third;
+    EXPECT_EQ(1U, crunch(sources, dests, &third));
+    EXPECT_EQ(1, third.processCount);
+}
 
-    String8 source("res");
-    String8 dest("res2");
+/*
+ * Once a newer source has been hashed and found unchanged, the next run
+ * takes its mod-time on trust: with the file gone, a rehash would fail and
+ * force a crunch.
+ */
+TEST_F(CrunchCacheTest, RemembersHashedSourcesByModTime) {
+    ASSERT_TRUE(writeSource("hello.png", "unchanged"));
+
+    KeyedVector<String8,time_t> sources;
+    KeyedVector<String8,time_t> dests;
+    sources.add(String8("hello.png"), 100);
+    MockCacheUpdater first;
+    EXPECT_EQ(1U, crunch(sources, dests, &first));
+
+    sources.replaceValueFor(String8("hello.png"), 200);
+    dests.add(String8("hello.png"), 150);
+    MockCacheUpdater second;
+    EXPECT_EQ(0U, crunch(sources, dests, &second));
+
+    unlink(mSource.appendPathCopy("hello.png").string());
+    MockCacheUpdater third;
+    EXPECT_EQ(0U, crunch(sources, dests, &third));
+
+    sources.replaceValueFor(String8("hello.png"), 300);
+    MockCacheUpdater fourth;
+    EXPECT_EQ(1U, crunch(sources, dests, &fourth));
+}
 
-    // Create data for MockFileFinder to feed to the cache
-    KeyedVector<String8, time_t> sourceData;
-    // This shouldn't be updated
-    sourceData.add(String8("res/drawable/hello.png"),3);
-    // This should be updated
-    sourceData.add(String8("res/drawable/world.png"),5);
-    // This should cause make directory to be called
-    sourceData.add(String8("res/drawable-cool/hello.png"),3);
-
-    KeyedVector<String8, time_t> destData;
-    destData.add(String8("res2/drawable/hello.png"),3);
-    destData.add(String8("res2/drawable/world.png"),3);
-    // this should call delete
-    destData.add(String8("res2/drawable/dead.png"),3);
-
-    // Package up data and create mock file finder
-    KeyedVector<String8, KeyedVector<String8,time_t> > data;
-    data.add(source,sourceData);
-    data.add(dest,destData);
-    FileFinder* ff = new MockFileFinder(data);
-    CrunchCache cc(source,dest,ff);
-
-    MockCacheUpdater* mcu = new MockCacheUpdater();
-    CacheUpdater* cu(mcu);
-
-    cout << "Running Crunch...";
-    int result = cc.crunch(cu);
-    cout << ((result > 0) ? "PASSED" : "FAILED") << endl;
-    errno += ((result > 0) ? 0 : 1);
-
-    const int EXPECTED_RESULT = 2;
-    expectEqual(result, EXPECTED_RESULT, "number of files touched");
-
-    cout << "Checking calls to deleteFile and processImage:" << endl;
-    const int EXPECTED_DELETES = 1;
-    const int EXPECTED_PROCESSED = 2;
-    // Deletes
-    expectEqual(mcu->deleteCount, EXPECTED_DELETES, "deleteFile");
-    // processImage
-    expectEqual(mcu->processCount, EXPECTED_PROCESSED, "processImage");
-
-    const int EXPECTED_OVERWRITES = 3;
-    result = cc.crunch(cu, true);
-    expectEqual(result, EXPECTED_OVERWRITES, "number of files touched with overwrite");
-    \
-
-    if (errno == 0)
-        cout << "ALL TESTS PASSED!" << endl;
-    else
-        cout << errno << " TESTS FAILED" << endl;
-
-    delete ff;
-    delete cu;
-
-    // TESTS BELOW WILL GO AWAY SOON
-
-    String8 source2("ApiDemos/res");
-    String8 dest2("ApiDemos/res2");
-
-    FileFinder* sff = new SystemFileFinder();
-    CacheUpdater* scu = new SystemCacheUpdater();
-
-    CrunchCache scc(source2,dest2,sff);
-
-    scc.crunch(scu);
-}
\ No newline at end of file
+/*
+ * A source modified in the second it was hashed could change again
+ * without its mod-time moving, so it's hashed again next time.
+ */
+TEST_F(CrunchCacheTest, DoesNotTrustModTimesFromTheCurrentSecond) {
+    ASSERT_TRUE(writeSource("hello.png", "unchanged"));
+
+    const time_t future = time(NULL) + 60;
+    KeyedVector<String8,time_t> sources;
+    KeyedVector<String8,time_t> dests;
+    sources.add(String8("hello.png"), future);
+    MockCacheUpdater first;
+    EXPECT_EQ(1U, crunch(sources, dests, &first));
+
+    unlink(mSource.appendPathCopy("hello.png").string());
+    dests.add(String8("hello.png"), future - 1);
+    MockCacheUpdater second;
+    EXPECT_EQ(1U, crunch(sources, dests, &second));
+}
@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+#include <gtest/gtest.h>
+
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "AaptAssets.h"
+#include "AaptUtil.h"
+#include "Bundle.h"
+#include "Images.h"
+#include "TestHelper.h"
+
+using android::String8;
+using android::Vector;
+
+TEST(ImagesTest, ScanRowMatchesScalar) {
+    unsigned char row[4 * 67];
+    unsigned int seed = 1;
+
+    for (int iter = 0; iter < 20000; iter++) {
+        int width = iter % 67;
+        int kind = (iter / 67) % 3;
+        for (int i = 0; i < width; i++) {
+            seed = seed * 1103515245 + 12345;
+            unsigned char* px = row + i * 4;
+            unsigned char v = seed >> 16;
+            if (kind == 0) {
+                // gray and opaque
+                px[0] = px[1] = px[2] = v;
+                px[3] = 0xff;
+            } else if (kind == 1) {
+                // nearly gray, now and then not opaque
+                px[0] = px[2] = v;
+                px[1] = v + ((seed >> 8) % 3) - 1;
+                px[3] = ((seed >> 4) % 61 == 0) ? 0xfe : 0xff;
+            } else {
+                px[0] = seed >> 24;
+                px[1] = seed >> 16;
+                px[2] = seed >> 8;
+                px[3] = seed;
+            }
+        }
+
+        int fastDev = iter % 3;
+        int slowDev = fastDev;
+        bool fastOpaque = true;
+        bool slowOpaque = true;
+        scanRgbaRow(row, width, &fastDev, &fastOpaque);
+        scanRgbaRowScalar(row, width, &slowDev, &slowOpaque);
+        ASSERT_EQ(slowDev, fastDev) << "width " << width;
+        ASSERT_EQ(slowOpaque, fastOpaque) << "width " << width;
+    }
+}
+
+/*
+ * One of a few synthetic RGBA images, each aimed at a different color type
+ * or palette edge.  "seed" is an LCG so the pixels are the same everywhere.
+ */
+enum {
+    kOpaqueGray,        // GRAY
+    kGrayFewAlphas,     // gray + alpha, few combinations: PALETTE
+    kGrayManyAlphas,    // GRAY_ALPHA
+    kFewColorsAlpha,    // PALETTE with tRNS, in runs
+    kFewColorsOpaque,   // PALETTE without tRNS
+    k256Colors,         // exactly a full palette
+    k257Colors,         // one color too many, found on the last row
+    kOpaqueRgb,         // RGB
+    kRgba,              // RGBA, with a fully saturated pixel early on
+    kPngKindCount
+};
+
+static const int kPngWidth = 64;
+static const int kPngHeight = 32;
+
+static void fillPixel(int kind, int x, int y, unsigned int* seed, unsigned char* px) {
+    *seed = *seed * 1103515245 + 12345;
+    const unsigned int r = *seed >> 8;
+    const int i = y * kPngWidth + x;
+    switch (kind) {
+    case kOpaqueGray:
+        px[0] = px[1] = px[2] = (unsigned char) (x * 4 + y);
+        px[3] = 0xff;
+        break;
+    case kGrayFewAlphas:
+        px[0] = px[1] = px[2] = (unsigned char) ((r % 4) * 60);
+        px[3] = (unsigned char) (((r >> 4) % 3) * 120);
+        break;
+    case kGrayManyAlphas:
+        px[0] = px[1] = px[2] = (unsigned char) r;
+        px[3] = (unsigned char) (r >> 8);
+        break;
+    case kFewColorsAlpha: {
+        // runs of 5 pixels, 40 colors
+        unsigned int c = ((i / 5) * 2654435761U) % 40;
+        px[0] = (unsigned char) (c * 6);
+        px[1] = (unsigned char) (255 - c * 5);
+        px[2] = (unsigned char) (c * 37);
+        px[3] = (unsigned char) (c % 3 == 0 ? 0x80 : 0xff);
+        break;
+    }
+    case kFewColorsOpaque: {
+        unsigned int c = r % 200;
+        px[0] = (unsigned char) c;
+        px[1] = (unsigned char) (c * 7);
+        px[2] = (unsigned char) (c * 13);
+        px[3] = 0xff;
+        break;
+    }
+    case k256Colors:
+    case k257Colors: {
+        unsigned int c = i % 256;
+        if (kind == k257Colors && i == kPngWidth * kPngHeight - 1) {
+            c = 256;
+        }
+        px[0] = (unsigned char) c;
+        px[1] = (unsigned char) (c >> 8);
+        px[2] = (unsigned char) (255 - c);
+        px[3] = 0xff;
+        break;
+    }
+    case kOpaqueRgb:
+        px[0] = (unsigned char) r;
+        px[1] = (unsigned char) (r >> 8);
+        px[2] = (unsigned char) (r >> 16);
+        px[3] = 0xff;
+        break;
+    default:
+        px[0] = (unsigned char) (i == 3 ? 0xff : r);
+        px[1] = (unsigned char) (i == 3 ? 0x00 : r >> 8);
+        px[2] = (unsigned char) (r >> 16);
+        px[3] = (unsigned char) (r >> 4);
+        break;
+    }
+}
+
+static bool writeRgbaPng(const String8& path, int kind) {
+    FILE* fp = fopen(path.string(), "wb");
+    if (fp == NULL) {
+        return false;
+    }
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    unsigned char row[kPngWidth * 4];
+    unsigned int seed = 1;
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(fp);
+        return false;
+    }
+    png_init_io(png, fp);
+    png_set_IHDR(png, info, kPngWidth, kPngHeight, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+            PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (int y = 0; y < kPngHeight; y++) {
+        for (int x = 0; x < kPngWidth; x++) {
+            fillPixel(kind, x, y, &seed, row + x * 4);
+        }
+        png_write_row(png, row);
+    }
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    return fclose(fp) == 0;
+}
+
+/*
+ * AaptUtil::hashBytes() over what the color analysis decided for a
+ * crunched PNG: its color type, palette and transparency, then the pixel
+ * rows as stored.  0 if it can't be read.
+ */
+static uint64_t analysisDigest(const String8& path) {
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return 0;
+    }
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png_create_info_struct(png);
+    png_bytep row = NULL;
+    uint64_t hash = AaptUtil::kHashSeed;
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, NULL);
+        free(row);
+        fclose(fp);
+        return 0;
+    }
+    png_init_io(png, fp);
+    png_read_info(png, info);
+
+    const unsigned char colorType = png_get_color_type(png, info);
+    hash = AaptUtil::hashBytes(&colorType, 1, hash);
+    if (colorType == PNG_COLOR_TYPE_PALETTE) {
+        png_colorp palette;
+        int count = 0;
+        png_get_PLTE(png, info, &palette, &count);
+        hash = AaptUtil::hashBytes(palette, 3 * count, hash);
+        png_bytep alpha;
+        int alphaCount = 0;
+        if (png_get_tRNS(png, info, &alpha, &alphaCount, NULL) != 0) {
+            hash = AaptUtil::hashBytes(alpha, alphaCount, hash);
+        }
+    }
+    const png_uint_32 height = png_get_image_height(png, info);
+    const size_t rowBytes = png_get_rowbytes(png, info);
+    row = (png_bytep) malloc(rowBytes);
+    for (png_uint_32 y = 0; y < height; y++) {
+        png_read_row(png, row, NULL);
+        hash = AaptUtil::hashBytes(row, rowBytes, hash);
+    }
+    png_destroy_read_struct(&png, &info, NULL);
+    free(row);
+    fclose(fp);
+    return hash;
+}
+
+/*
+ * The color type, palette and pixel rows chosen for each image are those
+ * of the one-pixel-at-a-time analysis the scan and palette lookup
+ * replaced; the digests were taken from that code.
+ */
+TEST(ImagesTest, AnalysisMatchesBaseline) {
+    static const uint64_t kBaseline[kPngKindCount] = {
+        0x13b877120af2845fULL,  // kOpaqueGray
+        0xdbe0185d4c6176f8ULL,  // kGrayFewAlphas
+        0x68506c7891889f2bULL,  // kGrayManyAlphas
+        0xfc4ac8d6f8f71709ULL,  // kFewColorsAlpha
+        0xa475beecdacb087eULL,  // kFewColorsOpaque
+        0x7523d1b4acdb2a92ULL,  // k256Colors
+        0xf2dbcacf64fefb14ULL,  // k257Colors
+        0xfac31310f1aadfdfULL,  // kOpaqueRgb
+        0x2b29802f4c6ab24dULL,  // kRgba
+    };
+
+    Bundle bundle;
+    String8 source = testTempPath("images", "source.png");
+    String8 dest = testTempPath("images", "crunched.png");
+    for (int kind = 0; kind < kPngKindCount; kind++) {
+        ASSERT_TRUE(writeRgbaPng(source, kind));
+        ASSERT_EQ(android::NO_ERROR, preProcessImageToCache(&bundle, source, dest));
+        EXPECT_EQ(kBaseline[kind], analysisDigest(dest)) << "kind " << kind;
+    }
+    unlink(source.string());
+    unlink(dest.string());
+}
+
+/* "source" as a drawable, the way preProcessImage() is given it */
+static sp<AaptFile> drawableFile(const String8& source) {
+    sp<AaptFile> file = new AaptFile(source, AaptGroupEntry(), String8("drawable"));
+    sp<AaptGroup> group = new AaptGroup(String8("icon.png"), String8("drawable/icon.png"));
+    group->addFile(file);
+    return file;
+}
+
+/*
+ * A remembered "keep the original" result is only reused under the
+ * --png-passthrough mode it was made with.
+ */
+TEST(ImagesTest, RememberedImageKeepsPassthroughMode) {
+    String8 top = String8(__FILE__).getPathDir().getPathDir().getPathDir();
+    Vector<String8> pngs;
+    findDrawablePngs(top.appendPathCopy("sample/res"), &pngs);
+    size_t i = 0;
+    while (i < pngs.size() && pngs[i].getBasePath().getPathExtension() == ".9") {
+        i++;
+    }
+    ASSERT_LT(i, pngs.size());
+
+    // crunching aapt's own output again can't make it any smaller
+    Bundle bundle;
+    String8 crunched = testTempPath("images", "crunched.png");
+    ASSERT_EQ(android::NO_ERROR, preProcessImageToCache(&bundle, pngs[i], crunched));
+
+    setKeepCrunchedImages(true);
+    bundle.setPngPassthrough(PNG_PASSTHROUGH_LARGER);
+    sp<AaptFile> kept = drawableFile(crunched);
+    ASSERT_EQ(android::NO_ERROR, preProcessImage(&bundle, NULL, kept, NULL));
+    EXPECT_FALSE(kept->hasData());
+
+    bundle.setPngPassthrough(PNG_PASSTHROUGH_NEVER);
+    sp<AaptFile> recrunched = drawableFile(crunched);
+    ASSERT_EQ(android::NO_ERROR, preProcessImage(&bundle, NULL, recrunched, NULL));
+    EXPECT_TRUE(recrunched->hasData());
+
+    setKeepCrunchedImages(false);
+    unlink(crunched.string());
+}
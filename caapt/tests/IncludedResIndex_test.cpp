@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/ResourceTypes.h>
+#include <utils/String8.h>
+#include <utils/String16.h>
+#include <gtest/gtest.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "AaptAssets.h"
+#include "Bundle.h"
+#include "IncludedResIndex.h"
+#include "ResourceTable.h"
+#include "TestHelper.h"
+
+using android::ResTable;
+using android::ResTable_typeSpec;
+using android::String16;
+using android::String8;
+
+static const char* kPackage = "com.example.base";
+
+static String16 entryName(int i, int count) {
+    return String16(scrambledName("str_", i, count));
+}
+
+/* the number of files in "dir" whose names end in "ext" */
+static size_t countFiles(const String8& dir, const char* ext) {
+    DIR* d = opendir(dir.string());
+    if (d == NULL) {
+        return 0;
+    }
+    size_t count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] != '.' && String8(entry->d_name).getPathExtension() == ext) {
+            count++;
+        }
+    }
+    closedir(d);
+    return count;
+}
+
+TEST(IncludedResIndexTest, MatchesResTable) {
+    const int count = 3000;
+    sp<AaptFile> arsc = buildStringTable(kPackage, count, 100);
+    ASSERT_TRUE(arsc != NULL);
+    ResTable res;
+    ASSERT_EQ(NO_ERROR, res.add(arsc->getData(), arsc->getSize()));
+
+    String8 path = testTempPath("residx", "match.rid");
+    ASSERT_EQ(NO_ERROR, IncludedResIndex::write(path.string(), arsc->getData(), arsc->getSize()));
+    sp<IncludedResIndex> index = new IncludedResIndex();
+    ASSERT_EQ(NO_ERROR, index->add(path.string()));
+
+    const String16 package(kPackage);
+    const String16 type("string");
+    uint32_t id = 0;
+    EXPECT_TRUE(index->hasPackage(package.string(), package.size(), &id));
+    EXPECT_EQ(0x7fu, id);
+    EXPECT_FALSE(index->hasPackage(type.string(), type.size()));
+
+    for (int i = 0; i < count; i++) {
+        String16 name = entryName(i, count);
+        uint32_t expectedFlags = 0;
+        uint32_t flags = 0;
+        uint32_t expected = res.identifierForName(name.string(), name.size(),
+                type.string(), type.size(), package.string(), package.size(), &expectedFlags);
+        ASSERT_NE(0u, expected);
+        EXPECT_EQ(expected, index->identifierForName(name.string(), name.size(),
+                type.string(), type.size(), package.string(), package.size(), &flags));
+        EXPECT_EQ(expectedFlags, flags);
+        EXPECT_EQ(i < 100, (flags & ResTable_typeSpec::SPEC_PUBLIC) != 0);
+    }
+
+    const String16 missing("str_missing");
+    const String16 otherType("drawable");
+    EXPECT_EQ(0u, index->identifierForName(missing.string(), missing.size(),
+            type.string(), type.size(), package.string(), package.size()));
+    String16 name = entryName(0, count);
+    EXPECT_EQ(0u, index->identifierForName(name.string(), name.size(),
+            otherType.string(), otherType.size(), package.string(), package.size()));
+
+    unlink(path.string());
+}
+
+TEST(IncludedResIndexTest, FallsBackToPrivateAttrs) {
+    Bundle bundle;
+    sp<AaptAssets> assets = new AaptAssets();
+    const String16 package(kPackage);
+    const String16 attr("attr");
+    const String16 attrPrivate("^attr-private");
+    const SourcePos pos(String8("attrs.xml"), 1);
+
+    ResourceTable table(&bundle, package, ResourceTable::App);
+    ASSERT_EQ(NO_ERROR, table.addIncludedResources(&bundle, assets));
+    ASSERT_EQ(NO_ERROR, table.addEntry(pos, package, attr, String16("shown"), String16("")));
+    ASSERT_EQ(NO_ERROR, table.addEntry(pos, package, attrPrivate, String16("hidden"),
+            String16("")));
+    ASSERT_EQ(NO_ERROR, table.assignResourceIds());
+    sp<AaptFile> arsc = table.flatten(&bundle, new MatchAllFilter(), true);
+    ASSERT_TRUE(arsc != NULL);
+    ResTable res;
+    ASSERT_EQ(NO_ERROR, res.add(arsc->getData(), arsc->getSize()));
+
+    String8 path = testTempPath("residx", "private.rid");
+    ASSERT_EQ(NO_ERROR, IncludedResIndex::write(path.string(), arsc->getData(), arsc->getSize()));
+    sp<IncludedResIndex> index = new IncludedResIndex();
+    ASSERT_EQ(NO_ERROR, index->add(path.string()));
+
+    const char* names[] = { "shown", "hidden", "absent" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        const String16 name(names[i]);
+        uint32_t expectedFlags = 0;
+        uint32_t flags = 0;
+        EXPECT_EQ(res.identifierForName(name.string(), name.size(), attr.string(), attr.size(),
+                        package.string(), package.size(), &expectedFlags),
+                index->identifierForName(name.string(), name.size(), attr.string(), attr.size(),
+                        package.string(), package.size(), &flags)) << names[i];
+        EXPECT_EQ(expectedFlags, flags) << names[i];
+    }
+    const String16 hidden("hidden");
+    EXPECT_NE(0u, index->identifierForName(hidden.string(), hidden.size(),
+            attr.string(), attr.size(), package.string(), package.size()));
+
+    unlink(path.string());
+}
+
+TEST(IncludedResIndexTest, RejectsDamagedFiles) {
+    sp<AaptFile> arsc = buildStringTable(kPackage, 100, 0);
+    ASSERT_TRUE(arsc != NULL);
+    String8 path = testTempPath("residx", "damaged.rid");
+    ASSERT_EQ(NO_ERROR, IncludedResIndex::write(path.string(), arsc->getData(), arsc->getSize()));
+    ASSERT_EQ(0, truncate(path.string(), 64));
+
+    sp<IncludedResIndex> index = new IncludedResIndex();
+    EXPECT_NE(NO_ERROR, index->add(path.string()));
+    EXPECT_NE(NO_ERROR, IncludedResIndex::write(path.string(), "not a table", 11));
+
+    unlink(path.string());
+}
+
+TEST(IncludedResIndexTest, LoadsFromCacheByContent) {
+    sp<AaptFile> arsc = buildStringTable(kPackage, 500, 10);
+    ASSERT_TRUE(arsc != NULL);
+
+    // an -I directory holding resources.arsc
+    String8 includeDir = testTempPath("residx", "include");
+    mkdir(includeDir.string(), S_IRWXU);
+    String8 arscPath(includeDir);
+    arscPath.appendPath("resources.arsc");
+    FILE* fp = fopen(arscPath.string(), "wb");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(arsc->getSize(), fwrite(arsc->getData(), 1, arsc->getSize(), fp));
+    fclose(fp);
+
+    String8 cacheDir = testTempPath("residx", "cache");
+    Vector<String8> paths;
+    paths.add(includeDir);
+    sp<IncludedResIndex> built = IncludedResIndex::load(paths, cacheDir, false);
+    ASSERT_TRUE(built != NULL);
+    ASSERT_EQ(1u, countFiles(cacheDir, ".rid"));
+
+    // the second run maps what the first one stored
+    sp<IncludedResIndex> cached = IncludedResIndex::load(paths, cacheDir, false);
+    ASSERT_TRUE(cached != NULL);
+    EXPECT_EQ(1u, countFiles(cacheDir, ".rid"));
+
+    const String16 package(kPackage);
+    const String16 type("string");
+    String16 name = entryName(42, 500);
+    EXPECT_NE(0u, cached->identifierForName(name.string(), name.size(),
+            type.string(), type.size(), package.string(), package.size()));
+    EXPECT_EQ(built->identifierForName(name.string(), name.size(),
+                    type.string(), type.size(), package.string(), package.size()),
+            cached->identifierForName(name.string(), name.size(),
+                    type.string(), type.size(), package.string(), package.size()));
+
+    // once the source is older than the run, its hash is remembered by
+    // path, size and time...
+    struct utimbuf past;
+    past.actime = past.modtime = time(NULL) - 60;
+    ASSERT_EQ(0, utime(arscPath.string(), &past));
+    ASSERT_TRUE(IncludedResIndex::load(paths, cacheDir, false) != NULL);
+    ASSERT_EQ(1u, countFiles(cacheDir, ".src"));
+
+    // ...and believed while those match: a wrong remembered hash names a
+    // new index
+    DIR* memoDir = opendir(cacheDir.string());
+    ASSERT_TRUE(memoDir != NULL);
+    struct dirent* memo;
+    while ((memo = readdir(memoDir)) != NULL) {
+        String8 memoPath(cacheDir);
+        memoPath.appendPath(memo->d_name);
+        if (memoPath.getPathExtension() == ".src") {
+            fp = fopen(memoPath.string(), "w");
+            ASSERT_TRUE(fp != NULL);
+            fprintf(fp, "%lld %lu %llx\n%s\n", (long long) past.modtime,
+                    (unsigned long) arsc->getSize(), 0x1234ULL, arscPath.string());
+            fclose(fp);
+        }
+    }
+    closedir(memoDir);
+    ASSERT_TRUE(IncludedResIndex::load(paths, cacheDir, false) != NULL);
+    EXPECT_EQ(2u, countFiles(cacheDir, ".rid"));
+
+    // a new modification time means hashing the content again, which
+    // finds the first index
+    past.actime = past.modtime = time(NULL) - 30;
+    ASSERT_EQ(0, utime(arscPath.string(), &past));
+    ASSERT_TRUE(IncludedResIndex::load(paths, cacheDir, false) != NULL);
+    EXPECT_EQ(2u, countFiles(cacheDir, ".rid"));
+
+    // a different table is a different entry
+    sp<AaptFile> other = buildStringTable(kPackage, 600, 0);
+    ASSERT_TRUE(other != NULL);
+    fp = fopen(arscPath.string(), "wb");
+    ASSERT_TRUE(fp != NULL);
+    ASSERT_EQ(other->getSize(), fwrite(other->getData(), 1, other->getSize(), fp));
+    fclose(fp);
+    ASSERT_TRUE(IncludedResIndex::load(paths, cacheDir, false) != NULL);
+    EXPECT_EQ(3u, countFiles(cacheDir, ".rid"));
+
+    DIR* d = opendir(cacheDir.string());
+    struct dirent* entry;
+    while (d != NULL && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            String8 file(cacheDir);
+            file.appendPath(entry->d_name);
+            unlink(file.string());
+        }
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    rmdir(cacheDir.string());
+    unlink(arscPath.string());
+    rmdir(includeDir.string());
+}
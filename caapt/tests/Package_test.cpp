@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <utils/Vector.h>
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <set>
+#include <string>
+
+#include "AaptAssets.h"
+#include "Bundle.h"
+#include "Main.h"
+#include "OutputSet.h"
+#include "ZipEntry.h"
+#include "ZipFile.h"
+#include "TestHelper.h"
+
+using android::String8;
+using android::Vector;
+using android::ZipEntry;
+using android::ZipFile;
+
+class AssetSet : public OutputSet {
+public:
+    const std::set<OutputEntry>& getEntries() const { return mEntries; }
+
+    void add(const char* path, const sp<AaptFile>& file) {
+        mEntries.insert(OutputEntry(String8(path), file));
+    }
+
+private:
+    std::set<OutputEntry> mEntries;
+};
+
+/*
+ * Every part of an archive that a serial and a parallel run must agree
+ * on: each entry's name, method, sizes, CRC, offset and stored bytes, and
+ * the archive's length.  Entry times are left out, since those of
+ * generated files come from the clock.  Empty if it can't be read.
+ */
+static std::string archiveLayout(const String8& path) {
+    std::string layout;
+    ZipFile zip;
+    if (zip.open(path.string(), ZipFile::kOpenReadOnly) != android::NO_ERROR) {
+        return layout;
+    }
+    FILE* fp = fopen(path.string(), "rb");
+    if (fp == NULL) {
+        return layout;
+    }
+    for (int i = 0; i < zip.getNumEntries(); i++) {
+        const ZipEntry* entry = zip.getEntryByIndex(i);
+        String8 header;
+        header.appendFormat("%s %d %ld %ld %08lx %ld\n", entry->getFileName(),
+                entry->getCompressionMethod(), (long) entry->getUncompressedLen(),
+                (long) entry->getCompressedLen(), entry->getCRC32(),
+                (long) entry->getLFHOffset());
+        layout.append(header.string());
+
+        std::string data(entry->getCompressedLen(), '\0');
+        if (fseek(fp, entry->getFileOffset(), SEEK_SET) != 0
+                || fread(&data[0], 1, data.size(), fp) != data.size()) {
+            fclose(fp);
+            return std::string();
+        }
+        layout.append(data);
+    }
+    fseek(fp, 0, SEEK_END);
+    String8 length;
+    length.appendFormat("%ld\n", ftell(fp));
+    layout.append(length.string());
+    fclose(fp);
+    return layout;
+}
+
+class PackageTest : public ::testing::Test {
+protected:
+    virtual void SetUp() {
+        mSourceDir = testTempPath("package", "src");
+        mkdir(mSourceDir.string(), 0755);
+    }
+
+    virtual void TearDown() {
+        for (size_t i = 0; i < mCreated.size(); i++) {
+            unlink(mCreated[i].string());
+        }
+        rmdir(mSourceDir.string());
+    }
+
+    /* A source file named "name" whose text varies with "seed". */
+    String8 writeSource(const char* name, int seed, int lines) {
+        String8 path = mSourceDir.appendPathCopy(name);
+        FILE* fp = fopen(path.string(), "w");
+        if (fp != NULL) {
+            for (int i = 0; i < lines; i++) {
+                fprintf(fp, "line %d of %s, %s\n", i, name,
+                        scrambledName("v", i * seed + 1, 997).string());
+            }
+            fclose(fp);
+        }
+        addCreated(path);
+        return path;
+    }
+
+    /*
+     * Some fifty assets: text read from disk, which is deflated, a PNG
+     * that's stored, a generated file in each method and an .EXCLUDE file
+     * that's left out.  "generation" changes the generated files and every
+     * seventh text file.
+     */
+    sp<OutputSet> buildAssets(int generation) {
+        sp<AssetSet> set = new AssetSet();
+        for (int i = 0; i < 48; i++) {
+            String8 name;
+            name.appendFormat("text%d.txt", i);
+            const int seed = (i % 7 == 0) ? i + generation : i;
+            String8 path = writeSource(name.string(), seed + 1, 20 + (i * 37) % 400);
+            String8 storage("assets/");
+            storage.append(name);
+            set->add(storage.string(), new AaptFile(path, AaptGroupEntry(), String8()));
+        }
+        set->add("res/drawable/icon.png", new AaptFile(writeSource("icon.png", 3, 50),
+                AaptGroupEntry(), String8()));
+        set->add("assets/notes.txt.EXCLUDE", new AaptFile(
+                writeSource("notes.txt.EXCLUDE", 5, 50), AaptGroupEntry(), String8()));
+
+        static const int kMethods[] = { ZipEntry::kCompressDeflated, ZipEntry::kCompressStored };
+        for (size_t i = 0; i < sizeof(kMethods) / sizeof(kMethods[0]); i++) {
+            String8 text;
+            for (int line = 0; line < 300; line++) {
+                text.appendFormat("<item name=\"%s\" generation=\"%d\" />\n",
+                        scrambledName("item_", line, 300).string(), generation);
+            }
+            String8 storage;
+            storage.appendFormat("res/xml/generated%d.xml", (int) i);
+            sp<AaptFile> file = new AaptFile(storage, AaptGroupEntry(), String8("xml"));
+            file->writeData(text.string(), text.length());
+            file->setCompressionMethod(kMethods[i]);
+            set->add(storage.string(), file);
+        }
+        return set;
+    }
+
+    status_t package(const String8& apk, const sp<OutputSet>& assets, size_t jobs,
+                     bool update) {
+        Bundle bundle;
+        bundle.setCompressionMethod(ZipEntry::kCompressDeflated);
+        bundle.setJobs(jobs);
+        bundle.setUpdate(update);
+        addCreated(apk);
+        return writeAPK(&bundle, apk, assets);
+    }
+
+    bool copyFile(const String8& from, const String8& to) {
+        std::string data;
+        FILE* in = fopen(from.string(), "rb");
+        if (in == NULL) {
+            return false;
+        }
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+            data.append(buf, n);
+        }
+        fclose(in);
+        FILE* out = fopen(to.string(), "wb");
+        if (out == NULL) {
+            return false;
+        }
+        addCreated(to);
+        fwrite(data.data(), 1, data.size(), out);
+        return fclose(out) == 0;
+    }
+
+    void addCreated(const String8& path) {
+        for (size_t i = 0; i < mCreated.size(); i++) {
+            if (mCreated[i] == path) {
+                return;
+            }
+        }
+        mCreated.add(path);
+    }
+
+    String8 mSourceDir;
+    Vector<String8> mCreated;
+};
+
+TEST_F(PackageTest, ParallelMatchesSerial) {
+    sp<OutputSet> assets = buildAssets(0);
+    String8 serial = testTempPath("package", "serial.apk");
+    String8 parallel = testTempPath("package", "parallel.apk");
+    unlink(serial.string());
+    unlink(parallel.string());
+    ASSERT_EQ(android::NO_ERROR, package(serial, assets, 1, false));
+    ASSERT_EQ(android::NO_ERROR, package(parallel, assets, 4, false));
+
+    const std::string layout = archiveLayout(serial);
+    ASSERT_FALSE(layout.empty());
+    EXPECT_TRUE(layout == archiveLayout(parallel));
+
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(parallel.string(), ZipFile::kOpenReadOnly));
+    EXPECT_EQ(51, zip.getNumEntries());
+    EXPECT_TRUE(zip.getEntryByName("assets/notes.txt.EXCLUDE") == NULL);
+    ZipEntry* png = zip.getEntryByName("res/drawable/icon.png");
+    ASSERT_TRUE(png != NULL);
+    EXPECT_EQ(ZipEntry::kCompressStored, png->getCompressionMethod());
+    ZipEntry* text = zip.getEntryByName("assets/text47.txt");
+    ASSERT_TRUE(text != NULL);
+    EXPECT_EQ(ZipEntry::kCompressDeflated, text->getCompressionMethod());
+}
+
+/*
+ * -u stays serial, but the same archive must come out of it whatever
+ * --jobs says.
+ */
+TEST_F(PackageTest, UpdateMatchesSerial) {
+    String8 base = testTempPath("package", "base.apk");
+    unlink(base.string());
+    ASSERT_EQ(android::NO_ERROR, package(base, buildAssets(0), 1, false));
+
+    // the changed sources must look newer than the entries they replace
+    sp<OutputSet> assets = buildAssets(1);
+    const time_t later = time(NULL) + 10;
+    for (int i = 0; i < 48; i += 7) {
+        String8 name;
+        name.appendFormat("text%d.txt", i);
+        struct utimbuf times;
+        times.actime = later;
+        times.modtime = later;
+        ASSERT_EQ(0, utime(mSourceDir.appendPathCopy(name).string(), &times));
+    }
+
+    String8 serial = testTempPath("package", "serial.apk");
+    String8 parallel = testTempPath("package", "parallel.apk");
+    ASSERT_TRUE(copyFile(base, serial));
+    ASSERT_TRUE(copyFile(base, parallel));
+    ASSERT_EQ(android::NO_ERROR, package(serial, assets, 1, true));
+    ASSERT_EQ(android::NO_ERROR, package(parallel, assets, 4, true));
+
+    const std::string layout = archiveLayout(serial);
+    ASSERT_FALSE(layout.empty());
+    EXPECT_TRUE(layout == archiveLayout(parallel));
+    EXPECT_FALSE(layout == archiveLayout(base));
+}
@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Timings, not correctness checks.  These build into aapt_perf_tests,
+// apart from the unit tests; run it by hand and read the numbers from
+// the --gtest_output XML.
+//
+
+#include <androidfw/ResourceTypes.h>
+#include <utils/String8.h>
+#include <utils/String16.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "AaptAssets.h"
+#include "Bundle.h"
+#include "Images.h"
+#include "IncludedResIndex.h"
+#include "RMerge.h"
+#include "RSymbolIndex.h"
+#include "ResourceTable.h"
+#include "StringPool.h"
+#include "ZipFile.h"
+#include "TestHelper.h"
+
+using android::ResTable;
+using android::String16;
+using android::String8;
+using android::Vector;
+using android::ZipEntry;
+using android::ZipFile;
+
+static const char* kPackage = "com.example.bench";
+
+static int usSince(nsecs_t start) {
+    return (int) ((systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1000);
+}
+
+/*
+ * Writing an archive of N small entries, so regressions back to quadratic
+ * behavior show up.
+ */
+TEST(AaptPerf, ZipWriteTimeByEntryCount) {
+    static const int kCounts[] = { 1000, 4000, 16000, 32000 };
+
+    for (size_t c = 0; c < sizeof(kCounts) / sizeof(kCounts[0]); c++) {
+        String8 path = testTempPath("perf", "entries.zip");
+        ZipFile zip;
+        ASSERT_EQ(android::NO_ERROR, zip.open(path.string(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < kCounts[c]; i++) {
+            String8 name;
+            name.appendFormat("assets/dir%d/file%d.bin", i % 97, i);
+            ASSERT_EQ(android::NO_ERROR, zip.add(name.string(), name.length(),
+                    name.string(), ZipEntry::kCompressStored, NULL));
+        }
+        ASSERT_EQ(android::NO_ERROR, zip.flush());
+
+        String8 key;
+        key.appendFormat("us_for_%d_entries", kCounts[c]);
+        RecordProperty(key.string(), usSince(start));
+        unlink(path.string());
+    }
+}
+
+/*
+ * Build a jar of roughly "totalSize" bytes of compressible .class data.
+ * Written at level 1 so setting it up doesn't dominate the run.
+ */
+static void makeJar(const String8& path, size_t totalSize) {
+    const size_t kEntrySize = 128 * 1024;
+    unsigned char* data = new unsigned char[kEntrySize];
+    unsigned int seed = 1;
+
+    ZipFile jar;
+    jar.setCompressionLevel(1);
+    ASSERT_EQ(android::NO_ERROR, jar.open(path.string(),
+            ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+    for (size_t i = 0; i * kEntrySize < totalSize; i++) {
+        // a small alphabet keeps it compressible but not trivially so
+        for (size_t j = 0; j < kEntrySize; j++) {
+            seed = seed * 1103515245 + 12345;
+            data[j] = "abcdefghijklmnop"[(seed >> 16) & 0xf];
+        }
+        String8 name;
+        name.appendFormat("com/example/Class%d.class", (int) i);
+        ASSERT_EQ(android::NO_ERROR, jar.add(data, kEntrySize, name.string(),
+                ZipEntry::kCompressDeflated, NULL));
+    }
+    ASSERT_EQ(android::NO_ERROR, jar.flush());
+    delete[] data;
+}
+
+/*
+ * Copying every entry of a 50 MB jar by inflating and recompressing it
+ * (what processJarFile used to do) and by raw copy.  Writes 150 MB of
+ * temp files.
+ */
+TEST(AaptPerf, JarCopyRawVersusRecompress) {
+    String8 jarPath = testTempPath("perf", "classes.jar");
+    makeJar(jarPath, 50 * 1024 * 1024);
+
+    ZipFile jar;
+    ASSERT_EQ(android::NO_ERROR, jar.open(jarPath.string(), ZipFile::kOpenReadOnly));
+
+    for (int raw = 0; raw < 2; raw++) {
+        String8 outPath = testTempPath("perf", raw ? "raw.zip" : "recompress.zip");
+        ZipFile out;
+        ASSERT_EQ(android::NO_ERROR, out.open(outPath.string(),
+                ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < jar.getNumEntries(); i++) {
+            ZipEntry* entry = jar.getEntryByIndex(i);
+            if (raw) {
+                ASSERT_EQ(android::NO_ERROR, out.add(&jar, entry, 0, NULL));
+            } else {
+                void* data = jar.uncompress(entry);
+                ASSERT_TRUE(data != NULL);
+                ASSERT_EQ(android::NO_ERROR, out.add(data, entry->getUncompressedLen(),
+                        entry->getFileName(), entry->getCompressionMethod(), NULL));
+                free(data);
+            }
+        }
+        ASSERT_EQ(android::NO_ERROR, out.flush());
+        int elapsed = usSince(start);
+
+        for (int i = 0; i < jar.getNumEntries(); i++) {
+            ZipEntry* entry = jar.getEntryByIndex(i);
+            ZipEntry* copy = out.getEntryByName(entry->getFileName());
+            ASSERT_TRUE(copy != NULL);
+            EXPECT_EQ(entry->getCRC32(), copy->getCRC32());
+            EXPECT_EQ(entry->getUncompressedLen(), copy->getUncompressedLen());
+        }
+
+        RecordProperty(raw ? "us_raw_copy" : "us_recompress", elapsed);
+        unlink(outPath.string());
+    }
+
+    unlink(jarPath.string());
+}
+
+/*
+ * Crunching each drawable in the sample and bundle projects, color
+ * analysis included.
+ */
+TEST(AaptPerf, CrunchTimePerDrawable) {
+    // tests/ -> caapt/ -> top of the tree
+    String8 top = String8(__FILE__).getPathDir().getPathDir().getPathDir();
+    Vector<String8> pngs;
+    findDrawablePngs(top.appendPathCopy("sample/res"), &pngs);
+    findDrawablePngs(top.appendPathCopy("bundle/res"), &pngs);
+
+    Bundle bundle;
+    String8 dest = testTempPath("perf", "crunched.png");
+    for (size_t i = 0; i < pngs.size(); i++) {
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        ASSERT_EQ(android::NO_ERROR, preProcessImageToCache(&bundle, pngs[i], dest));
+        RecordProperty(pngs[i].string(), usSince(start));
+    }
+    unlink(dest.string());
+}
+
+/*
+ * Filling a table with 100k string entries, declaring some of them
+ * public and assigning resource IDs.
+ */
+TEST(AaptPerf, BuildTableTime) {
+    const int count = 100000;
+    const int publicCount = 2000;
+
+    Bundle bundle;
+    sp<AaptAssets> assets = new AaptAssets();
+    const String16 package(kPackage);
+    const String16 stringType("string");
+    const SourcePos pos(String8("values.xml"), 1);
+
+    ResourceTable table(&bundle, package, ResourceTable::App);
+    ASSERT_EQ(NO_ERROR, table.addIncludedResources(&bundle, assets));
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < count; i++) {
+        ASSERT_EQ(NO_ERROR, table.addEntry(pos, package, stringType,
+                String16(scrambledName("str_", i, count)), String16("value")));
+    }
+    RecordProperty("us_to_add", usSince(start));
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < publicCount; i++) {
+        ASSERT_EQ(NO_ERROR, table.addPublic(pos, package, stringType,
+                String16(scrambledName("str_", count - 1 - i, count)), 0x7f020000 + i));
+    }
+    for (int i = 0; i < count; i++) {
+        ASSERT_TRUE(table.hasBagOrEntry(package, stringType,
+                String16(scrambledName("str_", i, count))));
+    }
+    RecordProperty("us_to_look_up", usSince(start));
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    ASSERT_EQ(NO_ERROR, table.assignResourceIds());
+    RecordProperty("us_to_assign_ids", usSince(start));
+}
+
+/*
+ * Filling and writing a pool the size of a large app's global value pool.
+ */
+TEST(AaptPerf, StringPoolBuildTimeByStringCount) {
+    static const int kCounts[] = { 10000, 100000, 300000 };
+
+    for (size_t c = 0; c < sizeof(kCounts) / sizeof(kCounts[0]); c++) {
+        StringPool pool(true);
+        nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < kCounts[c]; i++) {
+            pool.add(String16(scrambledName("string value number ", i, kCounts[c])), true);
+        }
+        String8 key;
+        key.appendFormat("us_to_add_%d", kCounts[c]);
+        RecordProperty(key.string(), usSince(start));
+
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        sp<AaptFile> block = pool.createStringBlock();
+        ASSERT_TRUE(block != NULL);
+        key = String8();
+        key.appendFormat("us_to_write_%d", kCounts[c]);
+        RecordProperty(key.string(), usSince(start));
+    }
+}
+
+/*
+ * Resolving every name of a large package through the ResTable and
+ * through the index.
+ */
+TEST(AaptPerf, IncludedResIndexLookupTime) {
+    const int count = 50000;
+    sp<AaptFile> arsc = buildStringTable(kPackage, count, 0);
+    ASSERT_TRUE(arsc != NULL);
+    String8 path = testTempPath("perf", "lookup.rid");
+    ASSERT_EQ(NO_ERROR, IncludedResIndex::write(path.string(), arsc->getData(), arsc->getSize()));
+
+    const String16 package(kPackage);
+    const String16 type("string");
+    Vector<String16> names;
+    for (int i = 0; i < count; i++) {
+        names.add(String16(scrambledName("str_", i, count)));
+    }
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    ResTable res;
+    ASSERT_EQ(NO_ERROR, res.add(arsc->getData(), arsc->getSize()));
+    for (int i = 0; i < count; i++) {
+        ASSERT_NE(0u, res.identifierForName(names[i].string(), names[i].size(),
+                type.string(), type.size(), package.string(), package.size()));
+    }
+    RecordProperty("us_through_restable", usSince(start));
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    sp<IncludedResIndex> index = new IncludedResIndex();
+    ASSERT_EQ(NO_ERROR, index->add(path.string()));
+    for (int i = 0; i < count; i++) {
+        ASSERT_NE(0u, index->identifierForName(names[i].string(), names[i].size(),
+                type.string(), type.size(), package.string(), package.size()));
+    }
+    RecordProperty("us_through_index", usSince(start));
+
+    unlink(path.string());
+}
+
+/*
+ * Getting at the public symbols of a 100k-field R from R.java and from
+ * the index.
+ */
+TEST(AaptPerf, RSymbolIndexLoadTime) {
+    const int count = 100000;
+    RClassSpec r;
+    r.name = "R";
+    RClassSpec id;
+    id.name = "id";
+    for (int i = 0; i < count; i++) {
+        RFieldSpec field;
+        field.name = scrambledName("res_", i, 100003).string();
+        field.value = 0x7f0a0000 + i;
+        id.fields.push_back(field);
+    }
+    r.inner.push_back(id);
+
+    String8 indexPath = testTempPath("perf", "load.idx");
+    ASSERT_EQ(NO_ERROR, RSymbolIndex::write(indexPath.string(), r));
+
+    String8 javaPath = testTempPath("perf", "load.java");
+    FILE* fp = fopen(javaPath.string(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp, "package com.example;\n\npublic final class R {\n"
+            "    public static final class id {\n");
+    for (int i = 0; i < count; i++) {
+        fprintf(fp, "        /** Identifier %d. */\n"
+                "        public static final int %s=0x%08x;\n",
+                i, id.fields[i].name.c_str(), id.fields[i].value);
+    }
+    fprintf(fp, "    }\n}\n");
+    fclose(fp);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    RClassSpec parsed;
+    ASSERT_EQ(1, read_r_file_classes(javaPath.string(), &parsed));
+    RecordProperty("us_to_parse_r_java", usSince(start));
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    RSymbolIndex index;
+    ASSERT_EQ(NO_ERROR, index.open(indexPath.string()));
+    RSymbolIndex::Field field;
+    std::string name = id.fields[count / 2].name;
+    ASSERT_TRUE(index.findField(0, name.c_str(), name.size(), &field));
+    RecordProperty("us_to_open_and_search_index", usSince(start));
+
+    unlink(indexPath.string());
+    unlink(javaPath.string());
+}
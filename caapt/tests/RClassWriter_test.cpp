@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "RClassWriter.h"
+#include "RMerge.h"
+#include "ZipFile.h"
+#include "TestHelper.h"
+
+using android::String8;
+using android::ZipEntry;
+using android::ZipFile;
+
+static RFieldSpec intField(const char* name, int32_t value, bool isFinal = true) {
+    RFieldSpec field;
+    field.name = name;
+    field.value = value;
+    field.isFinal = isFinal;
+    return field;
+}
+
+static RClassSpec sampleR(bool nonConstantId) {
+    RClassSpec r;
+    r.name = "R";
+
+    RClassSpec attr;
+    attr.name = "attr";
+    attr.fields.push_back(intField("colorAccent", 0x7f010000, !nonConstantId));
+    attr.fields.push_back(intField("textSize", 0x7f010001, !nonConstantId));
+    r.inner.push_back(attr);
+
+    RClassSpec styleable;
+    styleable.name = "styleable";
+    RFieldSpec array;
+    array.name = "Widget";
+    array.kind = RFieldSpec::kIntArray;
+    array.values.push_back(0x7f010000);
+    array.values.push_back(0x7f010001);
+    styleable.fields.push_back(array);
+    styleable.fields.push_back(intField("Widget_colorAccent", 0, !nonConstantId));
+    styleable.fields.push_back(intField("Widget_textSize", 1, !nonConstantId));
+    r.inner.push_back(styleable);
+    return r;
+}
+
+static bool contains(const std::vector<unsigned char>& data, const std::string& str) {
+    return std::search(data.begin(), data.end(), str.begin(), str.end()) != data.end();
+}
+
+static uint32_t readU4(const std::vector<unsigned char>& data, size_t offset) {
+    return (data[offset] << 24) | (data[offset + 1] << 16)
+            | (data[offset + 2] << 8) | data[offset + 3];
+}
+
+TEST(RClassWriterTest, CompilesOuterAndInnerClasses) {
+    std::vector<RClassWriter::ClassFile> files;
+    ASSERT_EQ(NO_ERROR, RClassWriter::compile("com.example.app", sampleR(false), &files));
+    ASSERT_EQ(3u, files.size());
+    EXPECT_EQ("com/example/app/R.class", files[0].entryName);
+    EXPECT_EQ("com/example/app/R$attr.class", files[1].entryName);
+    EXPECT_EQ("com/example/app/R$styleable.class", files[2].entryName);
+
+    for (size_t i = 0; i < files.size(); i++) {
+        ASSERT_GT(files[i].data.size(), 10u);
+        EXPECT_EQ(0xcafebabeu, readU4(files[i].data, 0));
+        EXPECT_EQ(50u, readU4(files[i].data, 4));  // minor 0, major 50
+        EXPECT_TRUE(contains(files[i].data, "InnerClasses"));
+    }
+
+    // constants carry their value; only the styleable array needs <clinit>
+    EXPECT_TRUE(contains(files[1].data, "ConstantValue"));
+    EXPECT_FALSE(contains(files[1].data, "<clinit>"));
+    EXPECT_TRUE(contains(files[2].data, "<clinit>"));
+}
+
+TEST(RClassWriterTest, NonConstantIdsAreAssignedInClinit) {
+    std::vector<RClassWriter::ClassFile> files;
+    ASSERT_EQ(NO_ERROR, RClassWriter::compile("com.example.app", sampleR(true), &files));
+    ASSERT_EQ(3u, files.size());
+    EXPECT_FALSE(contains(files[1].data, "ConstantValue"));
+    EXPECT_TRUE(contains(files[1].data, "<clinit>"));
+}
+
+TEST(RClassWriterTest, SplitsLongInitializers) {
+    RClassSpec r;
+    r.name = "R";
+    RClassSpec styleable;
+    styleable.name = "styleable";
+    RFieldSpec array;
+    array.name = "Huge";
+    array.kind = RFieldSpec::kIntArray;
+    for (int i = 0; i < 20000; i++) {
+        array.values.push_back(0x7f010000 + i);
+    }
+    styleable.fields.push_back(array);
+    r.inner.push_back(styleable);
+
+    std::vector<RClassWriter::ClassFile> files;
+    ASSERT_EQ(NO_ERROR, RClassWriter::compile("com.example.app", r, &files));
+    ASSERT_EQ(2u, files.size());
+    EXPECT_TRUE(contains(files[1].data, "clinit$0"));
+    EXPECT_TRUE(contains(files[1].data, "clinit$1"));
+}
+
+TEST(RClassWriterTest, RejectsDuplicateFields) {
+    RClassSpec r = sampleR(false);
+    r.inner[0].fields.push_back(intField("colorAccent", 0x7f010002));
+    std::vector<RClassWriter::ClassFile> files;
+    EXPECT_NE(NO_ERROR, RClassWriter::compile("com.example.app", r, &files));
+}
+
+TEST(RClassWriterTest, RejectsMoreFieldsThanAClassHolds) {
+    RClassSpec r;
+    r.name = "R";
+    RClassSpec id;
+    id.name = "id";
+    for (int i = 0; i < 65536; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "id_%d", i);
+        id.fields.push_back(intField(name, 0x7f080000 + i));
+    }
+    r.inner.push_back(id);
+    std::vector<RClassWriter::ClassFile> files;
+    EXPECT_NE(NO_ERROR, RClassWriter::compile("com.example.app", r, &files));
+}
+
+TEST(RClassWriterTest, WriteJarReplacesEntries) {
+    String8 path = testTempPath("rclass", "jar.jar");
+    unlink(path.string());
+
+    ASSERT_EQ(NO_ERROR, RClassWriter::writeJar(path.string(), "com.example.app", sampleR(false)));
+    ASSERT_EQ(NO_ERROR, RClassWriter::writeJar(path.string(), "com.example.app", sampleR(true)));
+    ASSERT_EQ(NO_ERROR, RClassWriter::writeJar(path.string(), "com.example.lib", sampleR(false)));
+
+    ZipFile zip;
+    ASSERT_EQ(NO_ERROR, zip.open(path.string(), ZipFile::kOpenReadOnly));
+    EXPECT_EQ(6, zip.getNumEntries());
+    EXPECT_TRUE(zip.getEntryByName("com/example/app/R$attr.class") != NULL);
+    EXPECT_TRUE(zip.getEntryByName("com/example/lib/R$styleable.class") != NULL);
+
+    unlink(path.string());
+}
+
+TEST(RClassWriterTest, MergesPublicRClasses) {
+    String8 path = testTempPath("rclass", "public.java");
+    FILE* fp = fopen(path.string(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp,
+            "package com.example.base;\n"
+            "\n"
+            "public final class R {\n"
+            "    public static final class attr {\n"
+            "        /** <p>Must be a color value. */\n"
+            "        public static final int baseColor=0x7f010000;\n"
+            "    }\n"
+            "    public static final class string {\n"
+            "        public static final int app_name=0x7f050000;\n"
+            "    }\n"
+            "    public static final class styleable {\n"
+            "        public static final int[] Base = {\n"
+            "            0x7f010000\n"
+            "        };\n"
+            "        public static final int Base_baseColor = 0;\n"
+            "    };\n"
+            "}\n");
+    fclose(fp);
+
+    RClassSpec publicR;
+    ASSERT_EQ(1, read_r_file_classes(path.string(), &publicR));
+    unlink(path.string());
+    ASSERT_EQ(3u, publicR.inner.size());
+    ASSERT_EQ(2u, publicR.inner[2].fields.size());
+    EXPECT_EQ(RFieldSpec::kIntArray, publicR.inner[2].fields[0].kind);
+    ASSERT_EQ(1u, publicR.inner[2].fields[0].values.size());
+    EXPECT_EQ(0x7f010000, publicR.inner[2].fields[0].values[0]);
+
+    RClassSpec projectR = sampleR(false);
+    RClassSpec drawable;
+    drawable.name = "drawable";
+    drawable.fields.push_back(intField("icon", 0x7f020000));
+    projectR.inner.push_back(drawable);
+    EXPECT_EQ(4u, merge_r_classes(publicR, &projectR));
+
+    // public classes first, in their order, with the project's fields
+    // after; classes only the project has come last
+    ASSERT_EQ(4u, projectR.inner.size());
+    EXPECT_EQ("attr", projectR.inner[0].name);
+    ASSERT_EQ(3u, projectR.inner[0].fields.size());
+    EXPECT_EQ("baseColor", projectR.inner[0].fields[0].name);
+    EXPECT_EQ(0x7f010000, projectR.inner[0].fields[0].value);
+    EXPECT_EQ("colorAccent", projectR.inner[0].fields[1].name);
+    EXPECT_EQ("string", projectR.inner[1].name);
+    EXPECT_EQ("styleable", projectR.inner[2].name);
+    EXPECT_EQ(5u, projectR.inner[2].fields.size());
+    EXPECT_EQ("drawable", projectR.inner[3].name);
+
+    std::vector<RClassWriter::ClassFile> files;
+    EXPECT_EQ(NO_ERROR, RClassWriter::compile("com.example.app", projectR, &files));
+    EXPECT_EQ(5u, files.size());
+}
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <gtest/gtest.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "RMerge.h"
+#include "TestHelper.h"
+
+using android::String8;
+
+static const char* kPublicR =
+        "/* AUTO-GENERATED FILE.  DO NOT MODIFY. */\n"
+        "package com.example.base;\n"
+        "\n"
+        "public final class R {\n"
+        "    public static final class attr {\n"
+        "        /** <p>Must be a color value.\n"
+        "         */\n"
+        "        public static final int tint=0x7f010000;\n"
+        "    }\n"
+        "    public static final class string {\n"
+        "        public static final int app_name=0x7f050000;\n"
+        "        public static final int cancel=0x7f050001;\n"
+        "    }\n"
+        "}\n";
+
+static const char* kProjectR =
+        "/* AUTO-GENERATED FILE.  DO NOT MODIFY. */\n"
+        "package com.example.module;\n"
+        "\n"
+        "public final class R {\n"
+        "    public static final class layout {\n"
+        "        /** the module's only screen */\n"
+        "        public static final int main=0x7f030000;\n"
+        "    }\n"
+        "    public static final class string {\n"
+        "        // module strings follow the base ones\n"
+        "        public static final int title=0x7f050002;\n"
+        "    }\n"
+        "    public static final class styleable {\n"
+        "        public static final int[] Widget = {\n"
+        "            0x7f010000\n"
+        "        };\n"
+        "    }\n"
+        "}\n";
+
+static bool writeFile(const String8& path, const std::string& text) {
+    FILE* fp = fopen(path.string(), "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fwrite(text.data(), 1, text.size(), fp);
+    return fclose(fp) == 0;
+}
+
+static std::string readFile(const String8& path) {
+    std::string text;
+    FILE* fp = fopen(path.string(), "r");
+    if (fp == NULL) {
+        return text;
+    }
+    char buf[1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        text.append(buf, n);
+    }
+    fclose(fp);
+    return text;
+}
+
+/*
+ * The public classes come first in their own order, each followed by the
+ * project's fields of the same class; classes only the project has come
+ * last.  The project's comments are kept, the public javadoc isn't.
+ */
+TEST(RMergeTest, MergesPublicClassesFirst) {
+    String8 publicPath = testTempPath("rmerge", "public.java");
+    String8 projectPath = testTempPath("rmerge", "project.java");
+    ASSERT_TRUE(writeFile(publicPath, kPublicR));
+    ASSERT_TRUE(writeFile(projectPath, kProjectR));
+
+    ASSERT_EQ(1, merge_r_file(publicPath.string(), projectPath.string()));
+    EXPECT_EQ(std::string(
+            "package com.example.module;\n"
+            "public final class R {\n"
+            "\n"
+            "public static final class attr {\n"
+            "        \n"
+            "        public static final int tint=0x7f010000;\n"
+            "        }\n"
+            "public static final class string {\n"
+            "        public static final int app_name=0x7f050000;\n"
+            "        public static final int cancel=0x7f050001;\n"
+            "    \n"
+            "        // module strings follow the base ones\n"
+            "        public static final int title=0x7f050002;\n"
+            "        }\n"
+            "public static final class layout {\n"
+            "        /** the module's only screen */\n"
+            "        public static final int main=0x7f030000;\n"
+            "        }\n"
+            "public static final class styleable {\n"
+            "        public static final int[] Widget = {\n"
+            "            0x7f010000\n"
+            "        };\n"
+            "        }\n"
+            "}"), readFile(projectPath));
+
+    unlink(publicPath.string());
+    unlink(projectPath.string());
+}
+
+TEST(RMergeTest, MergedFieldsKeepTheirOrder) {
+    String8 publicPath = testTempPath("rmerge", "public.java");
+    String8 projectPath = testTempPath("rmerge", "project.java");
+    ASSERT_TRUE(writeFile(publicPath, kPublicR));
+    ASSERT_TRUE(writeFile(projectPath, kProjectR));
+    ASSERT_EQ(1, merge_r_file(publicPath.string(), projectPath.string()));
+
+    RClassSpec merged;
+    ASSERT_EQ(1, read_r_file_classes(projectPath.string(), &merged));
+    ASSERT_EQ(4u, merged.inner.size());
+    EXPECT_EQ("attr", merged.inner[0].name);
+    EXPECT_EQ("string", merged.inner[1].name);
+    EXPECT_EQ("layout", merged.inner[2].name);
+    EXPECT_EQ("styleable", merged.inner[3].name);
+
+    const RClassSpec& strings = merged.inner[1];
+    ASSERT_EQ(3u, strings.fields.size());
+    EXPECT_EQ("app_name", strings.fields[0].name);
+    EXPECT_EQ("cancel", strings.fields[1].name);
+    EXPECT_EQ("title", strings.fields[2].name);
+    EXPECT_EQ(0x7f050002, strings.fields[2].value);
+
+    ASSERT_EQ(1u, merged.inner[3].fields.size());
+    EXPECT_EQ(RFieldSpec::kIntArray, merged.inner[3].fields[0].kind);
+
+    unlink(publicPath.string());
+    unlink(projectPath.string());
+}
+
+TEST(RMergeTest, FailsWhenInputIsMissing) {
+    String8 publicPath = testTempPath("rmerge", "public.java");
+    String8 projectPath = testTempPath("rmerge", "missing.java");
+    ASSERT_TRUE(writeFile(publicPath, kPublicR));
+    unlink(projectPath.string());
+
+    EXPECT_EQ(-1, merge_r_file(NULL, projectPath.string()));
+    EXPECT_EQ(-2, merge_r_file(publicPath.string(), projectPath.string()));
+
+    unlink(publicPath.string());
+}
+
+/*
+ * A file size limit makes the write fail even for root, who could
+ * write to a read-only file.
+ */
+TEST(RMergeTest, FailsWhenOutputCannotBeWritten) {
+    String8 publicPath = testTempPath("rmerge", "public.java");
+    String8 projectPath = testTempPath("rmerge", "project.java");
+    ASSERT_TRUE(writeFile(publicPath, kPublicR));
+    ASSERT_TRUE(writeFile(projectPath, kProjectR));
+
+    struct rlimit saved;
+    ASSERT_EQ(0, getrlimit(RLIMIT_FSIZE, &saved));
+    struct rlimit small = saved;
+    small.rlim_cur = 16;
+    void (*savedHandler)(int) = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(0, setrlimit(RLIMIT_FSIZE, &small));
+
+    const int result = merge_r_file(publicPath.string(), projectPath.string());
+
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, savedHandler);
+    EXPECT_EQ(-5, result);
+
+    unlink(publicPath.string());
+    unlink(projectPath.string());
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "RMerge.h"
+#include "RSymbolIndex.h"
+#include "TestHelper.h"
+
+using android::String8;
+
+static std::string fieldName(int i) {
+    return scrambledName("res_", i, 100003).string();
+}
+
+/* an R class with "count" ids, a styleable and a string constant */
+static RClassSpec sampleR(int count) {
+    RClassSpec r;
+    r.name = "R";
+
+    RClassSpec id;
+    id.name = "id";
+    for (int i = 0; i < count; i++) {
+        RFieldSpec field;
+        field.name = fieldName(i);
+        field.value = 0x7f0a0000 + i;
+        id.fields.push_back(field);
+    }
+    r.inner.push_back(id);
+
+    RClassSpec styleable;
+    styleable.name = "styleable";
+    RFieldSpec array;
+    array.name = "Widget";
+    array.kind = RFieldSpec::kIntArray;
+    array.values.push_back(0x7f010000);
+    array.values.push_back(0x7f010001);
+    styleable.fields.push_back(array);
+    RFieldSpec index;
+    index.name = "Widget_size";
+    index.value = 1;
+    index.isFinal = false;
+    styleable.fields.push_back(index);
+    r.inner.push_back(styleable);
+
+    RClassSpec string;
+    string.name = "string";
+    RFieldSpec str;
+    str.name = "version";
+    str.kind = RFieldSpec::kString;
+    str.stringValue = "1.0";
+    string.fields.push_back(str);
+    r.inner.push_back(string);
+    return r;
+}
+
+TEST(RSymbolIndexTest, WriteOpenAndFind) {
+    const int count = 1000;
+    String8 path = testTempPath("rsymidx", "find.idx");
+    ASSERT_EQ(NO_ERROR, RSymbolIndex::write(path.string(), sampleR(count)));
+    EXPECT_TRUE(RSymbolIndex::isIndexFile(path.string()));
+
+    RSymbolIndex index;
+    ASSERT_EQ(NO_ERROR, index.open(path.string()));
+    ASSERT_EQ(3u, index.getClassCount());
+    ASSERT_EQ(0, index.indexOfClass("id"));
+    ASSERT_EQ(1, index.indexOfClass("styleable"));
+    EXPECT_EQ(-1, index.indexOfClass("drawable"));
+
+    RSymbolIndex::Field field;
+    for (int i = 0; i < count; i++) {
+        std::string name = fieldName(i);
+        ASSERT_TRUE(index.findField(0, name.c_str(), name.size(), &field)) << name;
+        EXPECT_EQ(RFieldSpec::kInt, field.kind);
+        EXPECT_TRUE(field.isFinal);
+        EXPECT_EQ(0x7f0a0000 + i, field.value);
+    }
+    EXPECT_FALSE(index.findField(0, "res_", 4, &field));
+    EXPECT_FALSE(index.findField(0, "zzz", 3, &field));
+
+    ASSERT_TRUE(index.findField(1, "Widget", 6, &field));
+    EXPECT_EQ(RFieldSpec::kIntArray, field.kind);
+    ASSERT_EQ(2u, field.count);
+    EXPECT_EQ(0x7f010001, index.getArrayValue(field, 1));
+    ASSERT_TRUE(index.findField(1, "Widget_size", 11, &field));
+    EXPECT_FALSE(field.isFinal);
+
+    ASSERT_TRUE(index.findField(2, "version", 7, &field));
+    EXPECT_EQ(RFieldSpec::kString, field.kind);
+    EXPECT_EQ(std::string("1.0"), std::string(field.string, field.count));
+
+    unlink(path.string());
+}
+
+TEST(RSymbolIndexTest, RejectsDamagedFiles) {
+    String8 path = testTempPath("rsymidx", "damaged.idx");
+    ASSERT_EQ(NO_ERROR, RSymbolIndex::write(path.string(), sampleR(100)));
+    ASSERT_EQ(0, truncate(path.string(), 64));
+
+    RSymbolIndex index;
+    EXPECT_NE(NO_ERROR, index.open(path.string()));
+
+    FILE* fp = fopen(path.string(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fputs("package com.example;\n", fp);
+    fclose(fp);
+    EXPECT_FALSE(RSymbolIndex::isIndexFile(path.string()));
+    EXPECT_NE(NO_ERROR, index.open(path.string()));
+
+    unlink(path.string());
+}
+
+TEST(RSymbolIndexTest, PublicRFromIndex) {
+    String8 indexPath = testTempPath("rsymidx", "public.idx");
+    ASSERT_EQ(NO_ERROR, RSymbolIndex::write(indexPath.string(), sampleR(10)));
+
+    // --output-r-jar: the index expands to the same classes
+    RClassSpec publicR;
+    ASSERT_EQ(1, read_r_file_classes(indexPath.string(), &publicR));
+    ASSERT_EQ(3u, publicR.inner.size());
+    EXPECT_EQ("id", publicR.inner[0].name);
+    EXPECT_EQ(10u, publicR.inner[0].fields.size());
+    EXPECT_EQ(2u, publicR.inner[1].fields.size());
+
+    // R.java merge: the index's classes come first, as text
+    String8 projectPath = testTempPath("rsymidx", "project.java");
+    FILE* fp = fopen(projectPath.string(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fprintf(fp,
+            "package com.example.module;\n"
+            "\n"
+            "public final class R {\n"
+            "    public static final class id {\n"
+            "        public static final int module_id=0x7f0a1000;\n"
+            "    }\n"
+            "    public static final class layout {\n"
+            "        public static final int main=0x7f030000;\n"
+            "    }\n"
+            "}\n");
+    fclose(fp);
+    ASSERT_EQ(1, merge_r_file(indexPath.string(), projectPath.string()));
+
+    RClassSpec merged;
+    ASSERT_EQ(1, read_r_file_classes(projectPath.string(), &merged));
+    ASSERT_EQ(4u, merged.inner.size());
+    EXPECT_EQ("id", merged.inner[0].name);
+    EXPECT_EQ(11u, merged.inner[0].fields.size());
+    EXPECT_EQ("module_id", merged.inner[0].fields[10].name);
+    EXPECT_EQ("styleable", merged.inner[1].name);
+    ASSERT_EQ(2u, merged.inner[1].fields[0].values.size());
+    EXPECT_EQ("string", merged.inner[2].name);
+    EXPECT_EQ("1.0", merged.inner[2].fields[0].stringValue);
+    EXPECT_EQ("layout", merged.inner[3].name);
+
+    unlink(indexPath.string());
+    unlink(projectPath.string());
+}
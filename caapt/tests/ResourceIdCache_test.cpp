@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/SortedVector.h>
+#include <utils/String16.h>
+#include <gtest/gtest.h>
+
+#include "ResourceIdCache.h"
+#include "TestHelper.h"
+
+using android::ResourceIdCache;
+using android::SortedVector;
+using android::String16;
+
+TEST(ResourceIdCacheTest, RetainKeepsOnlyIncludedPackages) {
+    ResourceIdCache::clear();
+    const String16 android("android");
+    const String16 app("com.example.base");
+    const String16 stringType("string");
+    ResourceIdCache::store(android, stringType, String16("ok"), false, 0x0104000a);
+    ResourceIdCache::store(app, stringType, String16("title"), false, 0x7f050000);
+    // a feature split built under the base package's name, at its own ID
+    ResourceIdCache::store(app, stringType, String16("feature"), false, 0x80050000);
+    ResourceIdCache::store(String16("com.example.other"), stringType, String16("x"), false,
+            0x7f050001);
+
+    SortedVector<String16> packages;
+    packages.add(android);
+    packages.add(app);
+    SortedVector<uint32_t> packageIds;
+    packageIds.add(0x01);
+    packageIds.add(0x7f);
+    ResourceIdCache::retainPackages(packages, packageIds);
+
+    EXPECT_EQ(0x0104000au, ResourceIdCache::lookup(android, stringType, String16("ok"), false));
+    EXPECT_EQ(0x7f050000u, ResourceIdCache::lookup(app, stringType, String16("title"), false));
+    EXPECT_EQ(0u, ResourceIdCache::lookup(app, stringType, String16("feature"), false));
+    EXPECT_EQ(0u, ResourceIdCache::lookup(String16("com.example.other"), stringType,
+            String16("x"), false));
+    ResourceIdCache::clear();
+}
+
+TEST(ResourceIdCacheTest, KeepsEveryEntryAsItGrows) {
+    ResourceIdCache::clear();
+    const String16 app("com.example.base");
+    const String16 stringType("string");
+    // far past the 2048 entries the old cache was capped at
+    const int count = 20000;
+    for (int i = 0; i < count; i++) {
+        ResourceIdCache::store(app, stringType, String16(scrambledName("str_", i, count)),
+                false, 0x7f050000 + i);
+    }
+    for (int i = 0; i < count; i++) {
+        ASSERT_EQ((uint32_t) (0x7f050000 + i), ResourceIdCache::lookup(app, stringType,
+                String16(scrambledName("str_", i, count)), false)) << i;
+    }
+
+    // public and non-public lookups of a name are separate entries
+    const String16 first(scrambledName("str_", 0, count));
+    EXPECT_EQ(0u, ResourceIdCache::lookup(app, stringType, first, true));
+    ResourceIdCache::store(app, stringType, first, true, 0x7f060000);
+    EXPECT_EQ(0x7f060000u, ResourceIdCache::lookup(app, stringType, first, true));
+    EXPECT_EQ(0x7f050000u, ResourceIdCache::lookup(app, stringType, first, false));
+
+    // storing a name again replaces its ID
+    ResourceIdCache::store(app, stringType, first, false, 0x7f070000);
+    EXPECT_EQ(0x7f070000u, ResourceIdCache::lookup(app, stringType, first, false));
+
+    ResourceIdCache::clear();
+    EXPECT_EQ(0u, ResourceIdCache::lookup(app, stringType, first, false));
+}
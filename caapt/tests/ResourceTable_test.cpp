@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <utils/String16.h>
+#include <gtest/gtest.h>
+
+#include "AaptAssets.h"
+#include "Bundle.h"
+#include "ResourceTable.h"
+#include "StringHashMap.h"
+#include "TestHelper.h"
+
+using android::String16;
+using android::String8;
+using android::StringHashMap;
+
+static const char* kPackage = "com.example.bench";
+
+static String16 entryName(int i, int count) {
+    return String16(scrambledName("str_", i, count));
+}
+
+TEST(StringHashMapTest, LookupAndInsertionOrder) {
+    StringHashMap<int> map(-1);
+    const int count = 5000;
+    for (int i = 0; i < count; i++) {
+        EXPECT_EQ(i, map.add(entryName(i, count), i));
+    }
+    ASSERT_EQ((size_t) count, map.size());
+
+    for (int i = 0; i < count; i++) {
+        String16 name = entryName(i, count);
+        EXPECT_EQ(i, map.indexOfKey(name));
+        EXPECT_EQ(i, map.valueFor(name));
+        EXPECT_TRUE(map.keyAt(i) == name);
+    }
+    EXPECT_EQ(-1, map.valueFor(String16("missing")));
+    EXPECT_LT(map.indexOfKey(String16("missing")), 0);
+
+    // adding a key again replaces its value in place
+    String16 again = entryName(17, count);
+    EXPECT_EQ(17, map.add(again, 1000));
+    EXPECT_EQ(1000, map.valueFor(again));
+    EXPECT_EQ((size_t) count, map.size());
+}
+
+TEST(ResourceTableTest, PublicIdsComeFirst) {
+    const int count = 500;
+    const int publicCount = 20;
+
+    Bundle bundle;
+    sp<AaptAssets> assets = new AaptAssets();
+    const String16 package(kPackage);
+    const String16 stringType("string");
+    const SourcePos pos(String8("values.xml"), 1);
+
+    ResourceTable table(&bundle, package, ResourceTable::App);
+    ASSERT_EQ(NO_ERROR, table.addIncludedResources(&bundle, assets));
+    for (int i = 0; i < count; i++) {
+        ASSERT_EQ(NO_ERROR, table.addEntry(pos, package, stringType,
+                entryName(i, count), String16("value")));
+    }
+    // the last names added get the first public IDs
+    for (int i = 0; i < publicCount; i++) {
+        ASSERT_EQ(NO_ERROR, table.addPublic(pos, package, stringType,
+                entryName(count - 1 - i, count), 0x7f020000 + i));
+    }
+    ASSERT_EQ(NO_ERROR, table.assignResourceIds());
+
+    for (int i = 0; i < publicCount; i++) {
+        EXPECT_EQ((uint32_t) (0x7f020000 + i),
+                table.getResId(package, stringType, entryName(count - 1 - i, count), false));
+    }
+    // everything else fills the gaps after them, in the order it was added
+    for (int i = 0; i < count - publicCount; i++) {
+        EXPECT_EQ((uint32_t) (0x7f020000 + publicCount + i),
+                table.getResId(package, stringType, entryName(i, count), false)) << i;
+    }
+}
+
+TEST(ResourceTableTest, XmlAttrIdCache) {
+    Bundle bundle;
+    EXPECT_TRUE(ResourceTable(&bundle, String16(kPackage), ResourceTable::App)
+            .getAttrFallbackPackage() == String16(kDefaultAttrFallbackPackage));
+
+    bundle.setAttrFallbackPackage("com.example.widgets");
+    ResourceTable table(&bundle, String16(kPackage), ResourceTable::App);
+    EXPECT_TRUE(table.getAttrFallbackPackage() == String16("com.example.widgets"));
+
+    const String16 ns("http://schemas.android.com/apk/res-auto");
+    const String16 custom("cornerRadius");
+    const String16 missing("noSuchAttr");
+    uint32_t id = 1;
+    EXPECT_FALSE(table.lookupXmlAttrId(ns, custom, &id));
+
+    // a miss is remembered as well as a hit
+    table.storeXmlAttrId(ns, custom, 0x7f010005);
+    table.storeXmlAttrId(ns, missing, 0);
+    ASSERT_TRUE(table.lookupXmlAttrId(ns, custom, &id));
+    EXPECT_EQ(0x7f010005u, id);
+    ASSERT_TRUE(table.lookupXmlAttrId(ns, missing, &id));
+    EXPECT_EQ(0u, id);
+
+    // keyed on the strings, not their buffers, and per namespace
+    ASSERT_TRUE(table.lookupXmlAttrId(String16("http://schemas.android.com/apk/res-auto"),
+            String16("cornerRadius"), &id));
+    EXPECT_EQ(0x7f010005u, id);
+    EXPECT_FALSE(table.lookupXmlAttrId(String16("http://schemas.android.com/apk/res/android"),
+            custom, &id));
+
+    // ...and still found after the table has grown
+    for (int i = 0; i < 1000; i++) {
+        table.storeXmlAttrId(ns, String16(scrambledName("attr_", i, 1000)), 0x7f010100 + i);
+    }
+    for (int i = 0; i < 1000; i++) {
+        ASSERT_TRUE(table.lookupXmlAttrId(ns, String16(scrambledName("attr_", i, 1000)), &id));
+        EXPECT_EQ((uint32_t) (0x7f010100 + i), id);
+    }
+    ASSERT_TRUE(table.lookupXmlAttrId(ns, custom, &id));
+    EXPECT_EQ(0x7f010005u, id);
+
+    bundle.setAttrFallbackPackage("");
+    EXPECT_EQ(0u, ResourceTable(&bundle, String16(kPackage), ResourceTable::App)
+            .getAttrFallbackPackage().size());
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <utils/String16.h>
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include "StringAtoms.h"
+#include "TestHelper.h"
+
+using android::String16;
+using android::String8;
+using android::StringAtoms;
+using android::atom_t;
+
+TEST(StringAtomsTest, InternIsStable) {
+    const size_t count = 5000;
+    atom_t atoms[count];
+    for (size_t i = 0; i < count; i++) {
+        String8 name;
+        name.appendFormat("atoms_test_name_%d", (int) i);
+        EXPECT_EQ(0u, StringAtoms::find(String16(name)));
+        atoms[i] = StringAtoms::intern(String16(name));
+        EXPECT_NE(0u, atoms[i]);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        String8 name;
+        name.appendFormat("atoms_test_name_%d", (int) i);
+        const String16 name16(name);
+        EXPECT_EQ(atoms[i], StringAtoms::intern(name16));
+        EXPECT_EQ(atoms[i], StringAtoms::intern(name16.string(), name16.size()));
+        EXPECT_EQ(atoms[i], StringAtoms::intern8(name.string(), name.length()));
+        EXPECT_EQ(atoms[i], StringAtoms::find(name16));
+        EXPECT_TRUE(StringAtoms::string(atoms[i]) == name16);
+    }
+
+    // copies of the canonical string share its buffer
+    EXPECT_EQ(StringAtoms::string(atoms[3]).string(),
+            StringAtoms::canonical(String16("atoms_test_name_3")).string());
+    EXPECT_EQ(0u, StringAtoms::string(0).size());
+}
+
+TEST(StringAtomsTest, Intern8MatchesUtf16) {
+    // "caf\xc3\xa9" is "café"; the first is only a prefix of it
+    const char* names[] = { "caf", "caf\xc3\xa9", "atoms_\xe2\x82\xac" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        atom_t atom = StringAtoms::intern8(names[i], strlen(names[i]));
+        EXPECT_EQ(atom, StringAtoms::intern(String16(names[i])));
+        EXPECT_TRUE(StringAtoms::string(atom) == String16(names[i]));
+    }
+    EXPECT_NE(StringAtoms::intern8("caf", 3), StringAtoms::intern8("caf\xc3\xa9", 5));
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/ResourceTypes.h>
+#include <utils/String8.h>
+#include <utils/String16.h>
+#include <gtest/gtest.h>
+
+#include "AaptConfig.h"
+#include "StringPool.h"
+#include "TestHelper.h"
+
+using android::ResStringPool;
+using android::String16;
+using android::String8;
+
+static String16 poolString(int i) {
+    String8 str;
+    // mix in some non-ASCII so the UTF-8 lengths differ from UTF-16
+    str.appendFormat("value %d \xc3\xa9\xe2\x82\xac", i % 997);
+    return String16(str);
+}
+
+static void checkRoundTrip(bool utf8) {
+    StringPool pool(utf8);
+    ConfigDescription land, port;
+    ASSERT_TRUE(AaptConfig::parse(String8("land"), &land));
+    ASSERT_TRUE(AaptConfig::parse(String8("port"), &port));
+
+    const int count = 5000;
+    Vector<ssize_t> positions;
+    for (int i = 0; i < count; i++) {
+        const ResTable_config& config = (i % 3) ? land : port;
+        String8 typeName("string");
+        positions.add(pool.add(poolString(i), true, &typeName, &config));
+    }
+    // duplicates are merged
+    EXPECT_EQ(positions[0], positions[997]);
+    EXPECT_EQ(positions[0], pool.offsetForString(poolString(0)));
+    EXPECT_LT(pool.offsetForString(String16("not in the pool")), 0);
+
+    pool.sortByConfig();
+    sp<AaptFile> block = pool.createStringBlock();
+    ASSERT_TRUE(block != NULL);
+
+    ResStringPool parsed;
+    ASSERT_EQ(NO_ERROR, parsed.setTo(block->getData(), block->getSize()));
+    EXPECT_EQ(utf8, parsed.isUTF8());
+    for (int i = 0; i < count; i++) {
+        size_t pos = pool.mapOriginalPosToNewPos(positions[i]);
+        size_t len;
+        const char16_t* str = parsed.stringAt(pos, &len);
+        ASSERT_TRUE(str != NULL);
+        EXPECT_TRUE(String16(str, len) == poolString(i)) << i;
+    }
+}
+
+TEST(StringPoolTest, RoundTripUtf16) {
+    checkRoundTrip(false);
+}
+
+TEST(StringPoolTest, RoundTripUtf8) {
+    checkRoundTrip(true);
+}
@@ -18,6 +18,18 @@
 #define __TEST_HELPER_H
 
 #include <utils/String8.h>
+#include <utils/String16.h>
+#include <utils/Vector.h>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AaptAssets.h"
+#include "Bundle.h"
+#include "ResourceFilter.h"
+#include "ResourceTable.h"
 
 namespace android {
 
@@ -30,4 +42,104 @@ inline std::ostream& operator<<(std::ostream& stream, const String8& str) {
 
 }
 
+/**
+ * A path in $TMPDIR (or /tmp) for this test process, named
+ * "aapt_<suite>_test_<pid>_<tag>".
+ */
+inline android::String8 testTempPath(const char* suite, const char* tag) {
+    const char* tmp = getenv("TMPDIR");
+    android::String8 path(tmp != NULL && tmp[0] != '\0' ? tmp : "/tmp");
+    android::String8 name;
+    name.appendFormat("aapt_%s_test_%d_%s", suite, (int) getpid(), tag);
+    path.appendPath(name);
+    return path;
+}
+
+/**
+ * Name "i" of "count" with the numbers scrambled, so a sorted container
+ * would insert into the middle most of the time, the way names come out
+ * of real values/ files.
+ */
+inline android::String8 scrambledName(const char* prefix, int i, int count) {
+    android::String8 name;
+    name.appendFormat("%s%d", prefix, (int) ((i * 7919LL) % count));
+    return name;
+}
+
+/**
+ * Adds the .png files in the drawable and mipmap directories of "resDir"
+ * to "pngs".
+ */
+inline void findDrawablePngs(const android::String8& resDir,
+                             android::Vector<android::String8>* pngs) {
+    DIR* res = opendir(resDir.string());
+    if (res == NULL) {
+        return;
+    }
+    struct dirent* typeEntry;
+    while ((typeEntry = readdir(res)) != NULL) {
+        if (strncmp(typeEntry->d_name, "drawable", 8) != 0
+                && strncmp(typeEntry->d_name, "mipmap", 6) != 0) {
+            continue;
+        }
+        android::String8 typeDir(resDir);
+        typeDir.appendPath(typeEntry->d_name);
+        DIR* dir = opendir(typeDir.string());
+        if (dir == NULL) {
+            continue;
+        }
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            android::String8 path(typeDir);
+            path.appendPath(entry->d_name);
+            if (path.getPathExtension() == ".png") {
+                pngs->add(path);
+            }
+        }
+        closedir(dir);
+    }
+    closedir(res);
+}
+
+class MatchAllFilter : public ResourceFilter {
+public:
+    bool match(const android::ResTable_config&) const { return true; }
+};
+
+/**
+ * A flattened table for "package" of "count" strings named
+ * scrambledName("str_", i, count), the first "publicCount" of them
+ * public from 0x7f020000.  NULL if any step fails.
+ */
+inline sp<AaptFile> buildStringTable(const char* package, int count, int publicCount) {
+    Bundle bundle;
+    sp<AaptAssets> assets = new AaptAssets();
+    const android::String16 package16(package);
+    const android::String16 stringType("string");
+    const SourcePos pos(android::String8("values.xml"), 1);
+
+    ResourceTable table(&bundle, package16, ResourceTable::App);
+    if (table.addIncludedResources(&bundle, assets) != android::NO_ERROR) {
+        return NULL;
+    }
+    for (int i = 0; i < count; i++) {
+        if (table.addEntry(pos, package16, stringType,
+                android::String16(scrambledName("str_", i, count)),
+                android::String16("value")) != android::NO_ERROR) {
+            return NULL;
+        }
+    }
+    for (int i = 0; i < publicCount; i++) {
+        if (table.addPublic(pos, package16, stringType,
+                android::String16(scrambledName("str_", i, count)),
+                0x7f020000 + i) != android::NO_ERROR) {
+            return NULL;
+        }
+    }
+    if (table.assignResourceIds() != android::NO_ERROR) {
+        return NULL;
+    }
+    return table.flatten(&bundle, new MatchAllFilter(), true);
+}
+
 #endif
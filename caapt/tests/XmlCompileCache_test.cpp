@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2015 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <androidfw/ResourceTypes.h>
+#include <utils/String8.h>
+#include <utils/String16.h>
+#include <gtest/gtest.h>
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "AaptAssets.h"
+#include "Bundle.h"
+#include "ResourceTable.h"
+#include "XmlCompileCache.h"
+#include "TestHelper.h"
+
+using android::ResXMLTree;
+using android::Res_value;
+using android::String16;
+using android::String8;
+
+static const char* kPackage = "com.example.layouts";
+
+static const char* kLayout =
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+        "<LinearLayout label=\"@string/hello\" note=\"plain text\">\n"
+        "    <View tag=\"@string/hello\" />\n"
+        "</LinearLayout>\n";
+
+static void writeFile(const String8& path, const char* text) {
+    FILE* fp = fopen(path.string(), "w");
+    ASSERT_TRUE(fp != NULL);
+    fputs(text, fp);
+    fclose(fp);
+}
+
+static void removeDir(const String8& dir) {
+    DIR* d = opendir(dir.string());
+    struct dirent* entry;
+    while (d != NULL && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            String8 file(dir);
+            file.appendPath(entry->d_name);
+            unlink(file.string());
+        }
+    }
+    if (d != NULL) {
+        closedir(d);
+    }
+    rmdir(dir.string());
+}
+
+/*
+ * Compile "source" as layout/main.xml against a table holding
+ * @string/hello, after @string/first if "shifted".
+ */
+static sp<AaptFile> compileLayout(Bundle* bundle, const String8& source, bool shifted,
+        uint32_t* outHelloId) {
+    sp<AaptAssets> assets = new AaptAssets();
+    assets->setPackage(String8(kPackage));
+    const String16 package(kPackage);
+    const String16 stringType("string");
+    const SourcePos pos(String8("values.xml"), 1);
+
+    ResourceTable table(bundle, package, ResourceTable::App);
+    if (table.addIncludedResources(bundle, assets) != NO_ERROR) {
+        return NULL;
+    }
+    if (shifted && table.addEntry(pos, package, stringType, String16("first"),
+            String16("First")) != NO_ERROR) {
+        return NULL;
+    }
+    if (table.addEntry(pos, package, stringType, String16("hello"),
+            String16("Hello")) != NO_ERROR) {
+        return NULL;
+    }
+    if (table.assignResourceIds() != NO_ERROR) {
+        return NULL;
+    }
+    // not getResId(), whose process-wide cache would remember an earlier table
+    *outHelloId = table.getCustomResource(package, stringType, String16("hello"));
+
+    sp<AaptFile> file = new AaptFile(source, AaptGroupEntry(), String8("layout"));
+    Vector<String16> names;
+    names.add(String16("main"));
+    Vector<sp<AaptFile> > files;
+    files.add(file);
+    Vector<status_t> results;
+    if (compileXmlFiles(bundle, assets, names, files, &table,
+            XML_COMPILE_STANDARD_RESOURCE, &results) != NO_ERROR) {
+        return NULL;
+    }
+    return file;
+}
+
+/* the value of the root element's attribute "name" */
+static Res_value rootAttr(const sp<AaptFile>& file, const char* name) {
+    Res_value value;
+    memset(&value, 0, sizeof(value));
+    ResXMLTree tree;
+    if (tree.setTo(file->getData(), file->getSize(), true) != NO_ERROR) {
+        return value;
+    }
+    ResXMLTree::event_code_t code;
+    while ((code = tree.next()) != ResXMLTree::END_DOCUMENT
+            && code != ResXMLTree::BAD_DOCUMENT) {
+        if (code == ResXMLTree::START_TAG) {
+            ssize_t index = tree.indexOfAttribute(NULL, name);
+            if (index >= 0) {
+                tree.getAttributeValue(index, &value);
+            }
+            break;
+        }
+    }
+    return value;
+}
+
+static bool sameData(const sp<AaptFile>& a, const sp<AaptFile>& b) {
+    return a->getSize() == b->getSize()
+            && memcmp(a->getData(), b->getData(), a->getSize()) == 0;
+}
+
+TEST(XmlCompileCacheTest, WriteAndRead) {
+    String8 cacheDir = testTempPath("xmlcache", "roundtrip");
+    XmlCompileCache cache(cacheDir);
+
+    XmlCompileCache::Entry entry;
+    XmlCompileCache::Attr attr;
+    attr.ns = String16("http://schemas.android.com/apk/res/android");
+    attr.name = String16("text");
+    attr.rawValue = String16("@string/hello");
+    attr.line = 7;
+    attr.nameResId = 0x0101014f;
+    attr.dataType = Res_value::TYPE_REFERENCE;
+    attr.data = 0x7f050000;
+    entry.attrs.add(attr);
+    const uint8_t compiled[] = { 3, 0, 8, 0, 42, 0, 0, 0 };
+    entry.compiled.appendArray(compiled, sizeof(compiled));
+
+    const uint64_t key = XmlCompileCache::key("<a/>", 4, XML_COMPILE_STANDARD_RESOURCE);
+    EXPECT_NE(key, XmlCompileCache::key("<a/>", 4, XML_COMPILE_UTF8));
+    cache.write(key, 4, entry);
+
+    XmlCompileCache::Entry read;
+    ASSERT_TRUE(cache.read(key, 4, &read));
+    ASSERT_EQ(1u, read.attrs.size());
+    EXPECT_TRUE(read.attrs[0].ns == attr.ns);
+    EXPECT_TRUE(read.attrs[0].name == attr.name);
+    EXPECT_TRUE(read.attrs[0].rawValue == attr.rawValue);
+    EXPECT_EQ(7, read.attrs[0].line);
+    EXPECT_EQ(0x0101014fu, read.attrs[0].nameResId);
+    EXPECT_EQ(Res_value::TYPE_REFERENCE, read.attrs[0].dataType);
+    EXPECT_EQ(0x7f050000u, read.attrs[0].data);
+    ASSERT_EQ(sizeof(compiled), read.compiled.size());
+    EXPECT_EQ(0, memcmp(compiled, read.compiled.array(), sizeof(compiled)));
+
+    // a different source size is a different entry
+    EXPECT_FALSE(cache.read(key, 5, &read));
+
+    // a damaged entry is a miss
+    DIR* d = opendir(cacheDir.string());
+    ASSERT_TRUE(d != NULL);
+    struct dirent* file;
+    while ((file = readdir(d)) != NULL) {
+        if (file->d_name[0] != '.') {
+            String8 path(cacheDir);
+            path.appendPath(file->d_name);
+            ASSERT_EQ(0, truncate(path.string(), 40));
+        }
+    }
+    closedir(d);
+    EXPECT_FALSE(cache.read(key, 4, &read));
+
+    removeDir(cacheDir);
+}
+
+TEST(XmlCompileCacheTest, ReusesOnlyWhileLookupsMatch) {
+    String8 cacheDir = testTempPath("xmlcache", "compile");
+    String8 source = testTempPath("xmlcache", "main.xml");
+    writeFile(source, kLayout);
+
+    Bundle bundle;
+    bundle.setCompiledXmlCacheDir(cacheDir.string());
+
+    uint32_t helloId = 0;
+    sp<AaptFile> first = compileLayout(&bundle, source, false, &helloId);
+    ASSERT_TRUE(first != NULL);
+    Res_value label = rootAttr(first, "label");
+    EXPECT_EQ(Res_value::TYPE_REFERENCE, label.dataType);
+    EXPECT_EQ(helloId, label.data);
+
+    // the compile recorded each attribute's lookup, in document order
+    const uint64_t key = XmlCompileCache::key(kLayout, strlen(kLayout),
+            XML_COMPILE_STANDARD_RESOURCE);
+    XmlCompileCache cache(cacheDir);
+    XmlCompileCache::Entry entry;
+    ASSERT_TRUE(cache.read(key, strlen(kLayout), &entry));
+    ASSERT_EQ(3u, entry.attrs.size());
+    EXPECT_TRUE(entry.attrs[0].rawValue == String16("@string/hello"));
+    EXPECT_EQ(helloId, entry.attrs[0].data);
+    EXPECT_EQ(Res_value::TYPE_STRING, entry.attrs[1].dataType);
+    EXPECT_EQ(3, entry.attrs[2].line);
+
+    // mark the stored output, so a reuse of it can be told apart
+    const uint8_t marker[4] = { 0, 0, 0, 0 };
+    XmlCompileCache::Entry marked(entry);
+    marked.compiled.appendArray(marker, sizeof(marker));
+    cache.write(key, strlen(kLayout), marked);
+
+    uint32_t sameId = 0;
+    sp<AaptFile> reused = compileLayout(&bundle, source, false, &sameId);
+    ASSERT_TRUE(reused != NULL);
+    EXPECT_EQ(helloId, sameId);
+    EXPECT_EQ(first->getSize() + sizeof(marker), reused->getSize());
+
+    // @string/hello moves: the file is compiled again, with the new ID
+    uint32_t shiftedId = 0;
+    sp<AaptFile> shifted = compileLayout(&bundle, source, true, &shiftedId);
+    ASSERT_TRUE(shifted != NULL);
+    ASSERT_NE(helloId, shiftedId);
+    EXPECT_EQ(shiftedId, rootAttr(shifted, "label").data);
+    EXPECT_EQ(first->getSize(), shifted->getSize());
+
+    // ...and that is what's stored now
+    ASSERT_TRUE(cache.read(key, strlen(kLayout), &entry));
+    EXPECT_EQ(shiftedId, entry.attrs[0].data);
+    sp<AaptFile> again = compileLayout(&bundle, source, true, &shiftedId);
+    ASSERT_TRUE(again != NULL);
+    EXPECT_TRUE(sameData(shifted, again));
+
+    // no cache, same output
+    bundle.setCompiledXmlCacheDir(NULL);
+    sp<AaptFile> uncached = compileLayout(&bundle, source, true, &shiftedId);
+    ASSERT_TRUE(uncached != NULL);
+    EXPECT_TRUE(sameData(shifted, uncached));
+
+    unlink(source.string());
+    removeDir(cacheDir);
+}
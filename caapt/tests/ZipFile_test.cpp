@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utils/String8.h>
+#include <gtest/gtest.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AaptUtil.h"
+#include "Bundle.h"
+#include "ZipFile.h"
+#include "TestHelper.h"
+
+using android::String8;
+using android::ZipEntry;
+using android::ZipFile;
+
+static String8 entryName(int i) {
+    String8 name;
+    name.appendFormat("assets/dir%d/file%d.bin", i % 97, i);
+    return name;
+}
+
+TEST(ZipFileTest, LookupAfterAddRemoveAndCrunch) {
+    String8 path = testTempPath("zipfile", "lookup.zip");
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(path.string(),
+            ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+
+    const int count = 200;
+    for (int i = 0; i < count; i++) {
+        String8 name = entryName(i);
+        ASSERT_EQ(android::NO_ERROR, zip.add(name.string(), name.length(),
+                name.string(), ZipEntry::kCompressStored, NULL));
+    }
+
+    // adding the same name again is rejected
+    String8 dup = entryName(7);
+    EXPECT_EQ(android::ALREADY_EXISTS, zip.add(dup.string(), dup.length(),
+            dup.string(), ZipEntry::kCompressStored, NULL));
+
+    for (int i = 0; i < count; i++) {
+        ZipEntry* pEntry = zip.getEntryByName(entryName(i).string());
+        ASSERT_TRUE(pEntry != NULL);
+        EXPECT_STREQ(entryName(i).string(), pEntry->getFileName());
+    }
+    EXPECT_TRUE(zip.getEntryByName("assets/missing.bin") == NULL);
+
+    // remove every third entry; they must vanish before and after crunching
+    for (int i = 0; i < count; i += 3) {
+        ASSERT_EQ(android::NO_ERROR,
+                zip.remove(zip.getEntryByName(entryName(i).string())));
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < count; i++) {
+            ZipEntry* pEntry = zip.getEntryByName(entryName(i).string());
+            if (i % 3 == 0) {
+                EXPECT_TRUE(pEntry == NULL) << entryName(i);
+            } else {
+                ASSERT_TRUE(pEntry != NULL) << entryName(i);
+                EXPECT_STREQ(entryName(i).string(), pEntry->getFileName());
+            }
+        }
+        ASSERT_EQ(android::NO_ERROR, zip.flush());
+    }
+
+    unlink(path.string());
+}
+
+TEST(ZipFileTest, CompressionLevelArgument) {
+    int level = -1;
+    EXPECT_TRUE(AaptUtil::parseCompressionLevel("0", &level));
+    EXPECT_EQ(0, level);
+    EXPECT_TRUE(AaptUtil::parseCompressionLevel("9", &level));
+    EXPECT_EQ(9, level);
+
+    level = 5;
+    EXPECT_FALSE(AaptUtil::parseCompressionLevel("", &level));
+    EXPECT_FALSE(AaptUtil::parseCompressionLevel("10", &level));
+    EXPECT_FALSE(AaptUtil::parseCompressionLevel("-1", &level));
+    EXPECT_FALSE(AaptUtil::parseCompressionLevel("3x", &level));
+    EXPECT_FALSE(AaptUtil::parseCompressionLevel("fast", &level));
+    EXPECT_EQ(5, level);
+
+    Bundle bundle;
+    EXPECT_EQ((int) kDefaultCompressionLevel, bundle.getCompressionLevel());
+    ZipFile zip;
+    EXPECT_EQ((int) kDefaultCompressionLevel, zip.getCompressionLevel());
+}
+
+TEST(ZipFileTest, CompressionLevelAppliesToEntries) {
+    String8 text;
+    for (int i = 0; i < 4000; i++) {
+        text.appendFormat("<string name=\"%s\">value number %d</string>\n",
+                scrambledName("str_", i, 4000).string(), i);
+    }
+
+    String8 path = testTempPath("zipfile", "levels.zip");
+    ZipFile zip;
+    ASSERT_EQ(android::NO_ERROR, zip.open(path.string(),
+            ZipFile::kOpenReadWrite | ZipFile::kOpenCreate | ZipFile::kOpenTruncate));
+    static const int kLevels[] = { 0, 1, 9 };
+    for (size_t i = 0; i < sizeof(kLevels) / sizeof(kLevels[0]); i++) {
+        String8 name;
+        name.appendFormat("res/values/level%d.xml", kLevels[i]);
+        zip.setCompressionLevel(kLevels[i]);
+        ASSERT_EQ(android::NO_ERROR, zip.add(text.string(), text.length(), name.string(),
+                ZipEntry::kCompressDeflated, NULL));
+    }
+    ASSERT_EQ(android::NO_ERROR, zip.flush());
+
+    // level 0 doesn't shrink anything, so the entry is stored instead
+    ZipEntry* stored = zip.getEntryByName("res/values/level0.xml");
+    ZipEntry* fast = zip.getEntryByName("res/values/level1.xml");
+    ZipEntry* best = zip.getEntryByName("res/values/level9.xml");
+    ASSERT_TRUE(stored != NULL && fast != NULL && best != NULL);
+    EXPECT_EQ(ZipEntry::kCompressStored, stored->getCompressionMethod());
+    EXPECT_EQ(ZipEntry::kCompressDeflated, fast->getCompressionMethod());
+    EXPECT_EQ(ZipEntry::kCompressDeflated, best->getCompressionMethod());
+    EXPECT_LT(best->getCompressedLen(), fast->getCompressedLen());
+
+    ZipEntry* entries[] = { stored, fast, best };
+    for (size_t i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+        void* data = zip.uncompress(entries[i]);
+        ASSERT_TRUE(data != NULL);
+        EXPECT_EQ(0, memcmp(text.string(), data, text.length()));
+        free(data);
+    }
+
+    unlink(path.string());
+}